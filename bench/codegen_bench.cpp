@@ -0,0 +1,100 @@
+// Benchmark: thông lượng parse + sinh mã ROP trên chương trình 100k câu lệnh.
+//
+// Build (từ thư mục gốc repo):
+//   g++ -std=c++17 -O2 -Isrc bench/codegen_bench.cpp src/Lexer.cpp src/StringInterner.cpp src/Parser.cpp
+//       src/ROPGenerator.cpp src/GadgetImage.cpp src/GadgetEffect.cpp src/InstructionSelector.cpp
+//       src/RegisterAllocator.cpp src/Optimizer.cpp src/ChainOptimizer.cpp src/SuperoptTable.cpp
+//       src/MappedFile.cpp -o codegen_bench
+// Chạy: ./codegen_bench [file_gadget] [số_câu_lệnh] [bảng_superopt] > /dev/null
+// (bảng superopt mặc định: file gadget đổi đuôi thành .superopt, nếu có)
+// (kết quả đo được in ra stderr để tách khỏi log DEBUG)
+#include "Lexer.h"
+#include "Parser.h"
+#include "Optimizer.h"
+#include "ROPGenerator.h"
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+namespace {
+
+std::string makeSource(size_t statements, size_t variables) {
+    std::string src;
+    src.reserve(statements * 40);
+    for (size_t v = 0; v < variables; ++v) {
+        src += "VAR v" + std::to_string(v) + ";\n";
+    }
+    for (size_t i = variables; i < statements; ++i) {
+        std::string a = "v" + std::to_string(i % variables);
+        std::string b = "v" + std::to_string((i * 7) % variables);
+        switch (i % 3) {
+            case 0: src += a + " = " + b + " + (" + a + " - 3) + 12;\n"; break;
+            case 1: src += "MEM[" + a + " + 2] = MEM[" + b + "] + 1;\n"; break;
+            default: src += "PRINT_CHAR(" + std::to_string(i % 4 + 1) + ", " + b + ", 65);\n"; break;
+        }
+    }
+    return src;
+}
+
+double secondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    std::string gadget_file = argc > 1 ? argv[1] : "data/nx_u8_gadget.txt";
+    size_t statements = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 100000;
+
+    std::string superopt_file = argc > 3 ? argv[3] : gadget_file.substr(0, gadget_file.rfind('.')) + ".superopt";
+
+    GadgetDB db;
+    RomHandle rom = db.loadFromFile(gadget_file);
+    if (std::ifstream(superopt_file).good()) {
+        db.loadSuperoptTable(rom, superopt_file);
+    }
+    std::string source = makeSource(statements, 1000);
+
+    auto start = std::chrono::steady_clock::now();
+    Lexer lexer(std::string_view{source});
+    Parser parser(lexer);
+    AstArena arena;
+    parser.parse(arena);
+    double parse_seconds = secondsSince(start);
+
+    start = std::chrono::steady_clock::now();
+    AstOptimizer optimizer(parser.getSymbolTable());
+    optimizer.run(arena);
+    double optimize_seconds = secondsSince(start);
+
+    start = std::chrono::steady_clock::now();
+    ROPGenerator generator(db, optimizer.symbols());
+    generator.setScratchBase(optimizer.scratchEnd());
+    std::vector<uint8_t> payload;
+    generator.emitPayload(arena, payload);
+    double codegen_seconds = secondsSince(start);
+
+    std::cerr << "Câu lệnh: " << statements << ", node AST: " << arena.size()
+              << ", payload: " << payload.size() << " byte (" << generator.sourceMap().size()
+              << " đoạn trong bảng nguồn)\n"
+              << "Parse:   " << parse_seconds * 1000.0 << " ms ("
+              << static_cast<double>(statements) / parse_seconds / 1e6 << " M câu lệnh/s)\n"
+              << "Tối ưu:  " << optimize_seconds * 1000.0 << " ms (gấp " << optimizer.stats().folded_nodes
+              << " node, lan truyền " << optimizer.stats().propagated_reads << " lần đọc, bỏ "
+              << optimizer.stats().dead_stores << " lệnh gán chết và " << optimizer.stats().freed_variables
+              << " biến, dùng lại "
+              << optimizer.stats().reused_expressions << " biểu thức qua " << optimizer.stats().temporaries << " ô tạm)\n"
+              << "Sinh mã: " << codegen_seconds * 1000.0 << " ms ("
+              << static_cast<double>(statements) / codegen_seconds / 1e6 << " M câu lệnh/s)\n"
+              << "Ghi gộp: " << generator.bulkStoreStats().statements << " câu lệnh ("
+              << generator.bulkStoreStats().wide_stores << " qr0, " << generator.bulkStoreStats().fills << " memset, "
+              << generator.bulkStoreStats().copies << " memcpy)\n"
+              << "Peephole: -" << generator.peepholeStats().bytes_saved << " byte sau "
+              << generator.peepholeStats().passes << " lượt\n"
+              << "Ô đệm:   -" << generator.fillerStats().bytes_reclaimed << " byte ("
+              << generator.fillerStats().slots_reused << " ô, bỏ " << generator.fillerStats().gadgets_removed
+              << " gadget pop)\n";
+    return 0;
+}
@@ -0,0 +1,72 @@
+// Micro-benchmark: số token/giây của Lexer::getNextToken() so với Lexer::nextSlice().
+//
+// Build (từ thư mục gốc repo):
+//   g++ -std=c++17 -O2 -Isrc bench/lexer_bench.cpp src/Lexer.cpp src/StringInterner.cpp src/MappedFile.cpp -o lexer_bench
+// Chạy: ./lexer_bench [số_câu_lệnh] [file.fxl]
+#include "Lexer.h"
+#include "MappedFile.h"
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <string>
+
+namespace {
+
+// Sinh một chương trình FxLaux tổng hợp (giống các file sinh tự động cỡ lớn)
+std::string makeSource(size_t statements) {
+    std::string src;
+    src.reserve(statements * 32);
+    for (size_t i = 0; i < statements; ++i) {
+        std::string name = "var_" + std::to_string(i % 1000);
+        switch (i % 4) {
+            case 0: src += "VAR " + name + ";\n"; break;
+            case 1: src += name + " = " + name + " + 12345 - counter;\n"; break;
+            case 2: src += "PRINT_CHAR(1, " + std::to_string(i % 16) + ", 65);\n"; break;
+            default: src += "MEM_WRITE(8192, MEM_READ(8194));\n"; break;
+        }
+    }
+    return src;
+}
+
+template <typename Fn>
+void run(const char* label, std::string_view source, Fn&& lex_all) {
+    auto start = std::chrono::steady_clock::now();
+    size_t tokens = lex_all(source);
+    auto end = std::chrono::steady_clock::now();
+    double seconds = std::chrono::duration<double>(end - start).count();
+    std::cout << label << ": " << tokens << " token trong " << seconds * 1000.0 << " ms ("
+              << static_cast<double>(tokens) / seconds / 1e6 << " Mtoken/s)" << std::endl;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    size_t statements = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 1000000;
+
+    std::string generated;
+    std::unique_ptr<MappedFile> mapped;
+    std::string_view source;
+    if (argc > 2) {
+        mapped = std::make_unique<MappedFile>(argv[2]);
+        source = mapped->view();
+    } else {
+        generated = makeSource(statements);
+        source = generated;
+    }
+
+    run("getNextToken (Token + std::string)", source, [](std::string_view src) {
+        Lexer lexer{std::string(src)};
+        size_t count = 0;
+        while (lexer.getNextToken().type != TokenType::END_OF_FILE) ++count;
+        return count;
+    });
+
+    run("nextSlice (string_view, không cấp phát)", source, [](std::string_view src) {
+        Lexer lexer(src);
+        size_t count = 0;
+        while (lexer.nextSlice().type != TokenType::END_OF_FILE) ++count;
+        return count;
+    });
+    return 0;
+}
@@ -0,0 +1,593 @@
+#include "ChainOptimizer.h"
+#include "GadgetEffect.h"
+#include "ROPGenerator.h"
+#include <algorithm>
+#include <stdexcept>
+#include <unordered_map>
+
+namespace {
+
+using GF = GadgetFunction;
+
+// Một luật viết tay: dãy gadget liên tiếp -> dãy ngắn hơn.
+// words[k]: word pop thứ k của phần thay thế lấy từ word pop thứ words[k] của mẫu
+// (đánh số liên tục qua mọi gadget của mẫu), -1 = đệm.
+struct RuleSpec {
+    const char* name;
+    std::array<GF, 3> pattern;
+    std::array<GF, 2> replacement;
+    std::array<int8_t, 12> words;
+};
+
+// Bảng luật. Mỗi luật được kiểm tra lúc dựng ChainOptimizer: phần thay thế
+// không được ghi/đọc thanh ghi hay bộ nhớ nào ngoài những gì mẫu đã làm và
+// phải ngắn hơn mẫu (nên vòng lặp tới điểm bất động luôn dừng).
+constexpr RuleSpec kPeepholeRules[] = {
+    // Hai pop nửa thanh ghi -> một pop rộng (12 byte -> 8 byte)
+    {"pop er0 + pop er2 -> pop xr0", {GF::POP_ER0, GF::POP_ER2}, {GF::POP_XR0}, {0, 1}},
+    {"pop er2 + pop er0 -> pop xr0", {GF::POP_ER2, GF::POP_ER0}, {GF::POP_XR0}, {1, 0}},
+    {"pop er4 + pop er6 -> pop xr4", {GF::POP_ER4, GF::POP_ER6}, {GF::POP_XR4}, {0, 1}},
+    {"pop er6 + pop er4 -> pop xr4", {GF::POP_ER6, GF::POP_ER4}, {GF::POP_XR4}, {1, 0}},
+    {"pop er8 + pop er10 -> pop xr8", {GF::POP_ER8, GF::POP_ER10}, {GF::POP_XR8}, {0, 1}},
+    {"pop er10 + pop er8 -> pop xr8", {GF::POP_ER10, GF::POP_ER8}, {GF::POP_XR8}, {1, 0}},
+    {"pop er12 + pop er14 -> pop xr12", {GF::POP_ER12, GF::POP_ER14}, {GF::POP_XR12}, {0, 1}},
+    {"pop er14 + pop er12 -> pop xr12", {GF::POP_ER14, GF::POP_ER12}, {GF::POP_XR12}, {1, 0}},
+    {"pop xr0 + pop xr4 -> pop qr0", {GF::POP_XR0, GF::POP_XR4}, {GF::POP_QR0}, {0, 1, 2, 3}},
+    {"pop xr4 + pop xr0 -> pop qr0", {GF::POP_XR4, GF::POP_XR0}, {GF::POP_QR0}, {2, 3, 0, 1}},
+    {"pop xr8 + pop xr12 -> pop qr8", {GF::POP_XR8, GF::POP_XR12}, {GF::POP_QR8}, {0, 1, 2, 3}},
+    {"pop xr12 + pop xr8 -> pop qr8", {GF::POP_XR12, GF::POP_XR8}, {GF::POP_QR8}, {2, 3, 0, 1}},
+
+    // Nạp một hằng rồi chép sang cặp bên cạnh: pop cả hai nửa của xr0 cùng giá trị
+    {"pop er2 + er0 = er2 -> pop xr0", {GF::POP_ER2, GF::MOV_ER0_ER2_RET}, {GF::POP_XR0}, {0, 0}},
+    {"pop er0 + er2 = er0 -> pop xr0", {GF::POP_ER0, GF::MOV_ER2_ER0_ER0_ER2_POP_ER8_RET}, {GF::POP_XR0}, {0, 0}},
+
+    // Chép qua lại: lần chép thứ hai không đổi gì
+    {"er8 = er0 + er0 = er8", {GF::MOV_ER8_ER0_RET, GF::MOV_ER0_ER8_RET}, {GF::MOV_ER8_ER0_RET}, {}},
+    {"er0 = er8 + er8 = er0", {GF::MOV_ER0_ER8_RET, GF::MOV_ER8_ER0_RET}, {GF::MOV_ER0_ER8_RET}, {}},
+    {"er2 = er0 + er0 = er2", {GF::MOV_ER2_ER0_ER0_ER2_POP_ER8_RET, GF::MOV_ER0_ER2_RET},
+     {GF::MOV_ER2_ER0_ER0_ER2_POP_ER8_RET}, {0}},
+    {"er0 = er2 + er2 = er0", {GF::MOV_ER0_ER2_RET, GF::MOV_ER2_ER0_ER0_ER2_POP_ER8_RET}, {GF::MOV_ER0_ER2_RET}, {}},
+};
+
+size_t lengthOf(const GF* funcs, size_t max) {
+    size_t n = 0;
+    while (n < max && funcs[n] != GF::UNKNOWN_GADGET) ++n;
+    return n;
+}
+
+// Gadget chỉ gồm các pop (không đọc gì, không chạm bộ nhớ)
+bool isPurePop(GF func) {
+    const GadgetEffectTable& table = GadgetEffectTable::instance();
+    const GadgetEffect& e = table.effect(func);
+    if (e.op_count == 0 || e.opaque) return false;
+    return std::all_of(table.opsBegin(func), table.opsEnd(func),
+                       [](const EffectOp& op) { return op.kind == EffectOpKind::Pop; });
+}
+
+constexpr size_t kMaxSlots = 16;
+constexpr size_t kPairCount = 8; // er0, er2, ..., er14
+
+// Thanh ghi mà một op chạm tới (đọc hoặc ghi); op không mô hình hóa được thì coi như chạm mọi thứ
+RegMask touches(const EffectOp& op) {
+    switch (op.kind) {
+        case EffectOpKind::Call:
+        case EffectOpKind::Opaque:
+        case EffectOpKind::Break:
+            return ~RegMask{0};
+        default:
+            return op.dst.mask() | op.src.mask();
+    }
+}
+
+// pairs[w] = n/2 nếu word pop thứ w của func nạp đúng cặp ERn và các op phía sau trong
+// gadget không đụng tới ERn nữa (giá trị pop còn sống khi gadget trả về), ngược lại -1
+size_t popSlotPairs(GF func, std::array<int8_t, kMaxSlots>& pairs) {
+    const GadgetEffectTable& table = GadgetEffectTable::instance();
+    size_t count = 0;
+    for (const EffectOp* op = table.opsBegin(func); op != table.opsEnd(func); ++op) {
+        if (op->kind != EffectOpKind::Pop) continue;
+        unsigned int words = op->dst.width <= 2 ? 1 : op->dst.width / 2;
+        for (unsigned int i = 0; i < words && count < kMaxSlots; ++i) {
+            unsigned int base = op->dst.base + 2 * i;
+            int8_t pair = -1;
+            if (op->dst.width >= 2 && base < 16 && base % 2 == 0) {
+                pair = static_cast<int8_t>(base / 2);
+                for (const EffectOp* later = op + 1; later != table.opsEnd(func); ++later) {
+                    if (touches(*later) & reg::er(base)) {
+                        pair = -1;
+                        break;
+                    }
+                }
+            }
+            pairs[count++] = pair;
+        }
+    }
+    return count;
+}
+
+} // namespace
+
+uint32_t chainBytes(const std::vector<ChainEntry>& chain) {
+    uint32_t bytes = 0;
+    for (const ChainEntry& e : chain) {
+        bytes += e.kind == ChainEntry::Kind::Gadget ? 4 : e.kind == ChainEntry::Kind::Label ? 0 : 2;
+    }
+    return bytes;
+}
+
+// --- ChainOptimizer Implementation ---
+ChainOptimizer::ChainOptimizer(const GadgetDB& db, RomHandle rom, const ByteConstraints& constraints) {
+    for (const RuleSpec& spec : kPeepholeRules) {
+        Rule rule;
+        rule.pattern_len = static_cast<uint8_t>(lengthOf(spec.pattern.data(), kMaxPattern));
+        rule.replacement_len = static_cast<uint8_t>(lengthOf(spec.replacement.data(), kMaxReplacement));
+        std::copy_n(spec.pattern.begin(), kMaxPattern, rule.pattern.begin());
+        std::copy_n(spec.replacement.begin(), kMaxReplacement, rule.replacement.begin());
+        std::copy_n(spec.words.begin(), kMaxWords, rule.words.begin());
+        addRule(rule, spec.name, db, rom, constraints);
+    }
+
+    // Pop bị ghi đè: một gadget chỉ gồm pop, ngay sau đó là gadget nạp lại (bằng pop)
+    // mọi thanh ghi đó mà không đọc chúng trước -> bỏ gadget đầu
+    for (size_t f = 1; f < kGadgetFunctionCount; ++f) {
+        GF first = static_cast<GF>(f);
+        if (!isPurePop(first)) continue;
+        const GadgetEffect& dead = gadgetEffect(first);
+        for (size_t g = 1; g < kGadgetFunctionCount; ++g) {
+            GF second = static_cast<GF>(g);
+            const GadgetEffect& next = gadgetEffect(second);
+            if (next.opaque || next.calls || next.pivots) continue;
+            if ((dead.writes & ~next.pop_writes) != 0 || (next.reads & dead.writes) != 0) continue;
+            Rule rule;
+            rule.pattern_len = 2;
+            rule.pattern = {first, second, GF::UNKNOWN_GADGET};
+            rule.replacement_len = 1;
+            rule.replacement = {second, GF::UNKNOWN_GADGET};
+            for (size_t w = 0; w < gadgetPopWords(second); ++w) {
+                rule.words[w] = static_cast<int8_t>(dead.pop_words + w);
+            }
+            addRule(rule, "pop bị ghi đè: " + std::string(gadgetSpelling(first)) + " ; " +
+                              std::string(gadgetSpelling(second)),
+                    db, rom, constraints);
+        }
+    }
+
+    // Cùng gadget đầu: thử luật tiết kiệm nhiều nhất trước
+    for (std::vector<uint16_t>& list : by_first) {
+        std::stable_sort(list.begin(), list.end(),
+                         [this](uint16_t a, uint16_t b) { return rules[a].bytes_saved > rules[b].bytes_saved; });
+    }
+}
+
+void ChainOptimizer::addRule(const Rule& rule, std::string name, const GadgetDB& db, RomHandle rom,
+                             const ByteConstraints& constraints) {
+    GadgetEffect from, to; // Tác động gộp của mẫu và của phần thay thế
+    size_t pattern_words = 0, replacement_words = 0;
+    auto accumulate = [](GadgetEffect& sum, GF func) {
+        const GadgetEffect& e = gadgetEffect(func);
+        sum.reads |= e.reads & ~sum.writes;
+        sum.writes |= e.writes;
+        sum.loads += e.loads;
+        sum.stores += e.stores;
+        sum.calls |= e.calls;
+        sum.pivots |= e.pivots;
+        sum.opaque |= e.opaque;
+    };
+    for (size_t i = 0; i < rule.pattern_len; ++i) {
+        accumulate(from, rule.pattern[i]);
+        pattern_words += gadgetPopWords(rule.pattern[i]);
+    }
+    for (size_t i = 0; i < rule.replacement_len; ++i) {
+        accumulate(to, rule.replacement[i]);
+        replacement_words += gadgetPopWords(rule.replacement[i]);
+    }
+
+    const char* problem = nullptr;
+    if (rule.pattern_len == 0 || rule.replacement_len > rule.pattern_len) {
+        problem = "mẫu rỗng hoặc phần thay thế dài hơn mẫu";
+    } else if (pattern_words > kMaxWords || replacement_words > kMaxWords) {
+        problem = "quá nhiều word pop";
+    } else if ((to.writes & ~from.writes) != 0 || (to.reads & ~from.reads) != 0) {
+        problem = "phần thay thế chạm thanh ghi mà mẫu không chạm";
+    } else if (to.loads > from.loads || to.stores > from.stores || (to.calls && !from.calls) ||
+               (to.pivots && !from.pivots) || to.opaque) {
+        problem = "phần thay thế có tác động bộ nhớ/điều khiển mà mẫu không có";
+    }
+    for (size_t w = 0; !problem && w < replacement_words; ++w) {
+        if (rule.words[w] >= static_cast<int8_t>(pattern_words)) {
+            problem = "word pop tham chiếu ra ngoài mẫu";
+        }
+    }
+    int32_t saved = 4 * (rule.pattern_len - rule.replacement_len) +
+                    2 * (static_cast<int32_t>(pattern_words) - static_cast<int32_t>(replacement_words));
+    if (!problem && saved <= 0) {
+        problem = "phần thay thế không ngắn hơn mẫu";
+    }
+    if (problem) {
+        throw std::logic_error("Lỗi: Luật peephole '" + name + "' không hợp lệ: " + problem + ".");
+    }
+
+    for (size_t i = 0; i < rule.replacement_len; ++i) {
+        if (!db.isAvailable(rom, rule.replacement[i]) || !db.selectCandidate(rom, rule.replacement[i], constraints)) {
+            return; // ROM không có gadget thay thế: luật tắt
+        }
+    }
+
+    Rule enabled = rule;
+    enabled.bytes_saved = static_cast<uint32_t>(saved);
+    by_first[static_cast<size_t>(rule.pattern[0])].push_back(static_cast<uint16_t>(rules.size()));
+    rules.push_back(enabled);
+    counters.rules.push_back(PeepholeRuleStats{std::move(name), 0, 0});
+}
+
+size_t ChainOptimizer::match(const Rule& rule, const std::vector<ChainEntry>& chain, size_t at,
+                             std::array<ChainEntry, kMaxWords>& words) const {
+    size_t pos = at, count = 0;
+    for (size_t i = 0; i < rule.pattern_len; ++i) {
+        if (pos >= chain.size() || chain[pos].kind != ChainEntry::Kind::Gadget || chain[pos].func != rule.pattern[i]) {
+            return 0;
+        }
+        size_t pops = gadgetPopWords(rule.pattern[i]);
+        if (pos + 1 + pops > chain.size()) return 0;
+        for (size_t w = 0; w < pops; ++w) {
+            const ChainEntry& e = chain[pos + 1 + w];
+            // Chuỗi lệch hoặc đích nhảy nằm giữa mẫu: không đụng vào
+            if (e.kind == ChainEntry::Kind::Gadget || e.kind == ChainEntry::Kind::Label) return 0;
+            words[count++] = e;
+        }
+        pos += 1 + pops;
+    }
+    return pos;
+}
+
+bool ChainOptimizer::pass(std::vector<ChainEntry>& chain) {
+    bool changed = false;
+    std::array<ChainEntry, kMaxWords> words;
+    scratch.clear();
+    scratch.reserve(chain.size());
+
+    size_t i = 0;
+    while (i < chain.size()) {
+        const ChainEntry& e = chain[i];
+        size_t end = 0;
+        if (e.kind == ChainEntry::Kind::Gadget) {
+            for (uint16_t index : by_first[static_cast<size_t>(e.func)]) {
+                const Rule& rule = rules[index];
+                end = match(rule, chain, i, words);
+                if (end == 0) continue;
+
+                size_t w = 0;
+                for (size_t r = 0; r < rule.replacement_len; ++r) {
+                    scratch.push_back(ChainEntry::gadget(rule.replacement[r], e.statement));
+                    for (size_t k = 0; k < gadgetPopWords(rule.replacement[r]); ++k, ++w) {
+                        scratch.push_back(rule.words[w] < 0 ? ChainEntry::pad(e.statement) : words[rule.words[w]]);
+                    }
+                }
+                counters.rules[index].hits++;
+                counters.rules[index].bytes_saved += rule.bytes_saved;
+                counters.bytes_saved += rule.bytes_saved;
+                changed = true;
+                break;
+            }
+        }
+        if (end != 0) {
+            i = end;
+        } else {
+            scratch.push_back(e);
+            ++i;
+        }
+    }
+    chain.swap(scratch);
+    return changed;
+}
+
+void ChainOptimizer::run(std::vector<ChainEntry>& chain) {
+    bool changed;
+    do {
+        changed = pass(chain);
+        counters.passes++;
+    } while (changed);
+}
+
+// --- Tận dụng ô pop đệm ---
+void reuseFillerSlots(std::vector<ChainEntry>& chain, FillerStats& stats) {
+    std::vector<ChainEntry> out;
+    out.reserve(chain.size());
+    std::array<int32_t, kPairCount> open; // Vị trí (trong out) của ô đệm còn mở cho từng cặp, -1 = không có
+    open.fill(-1);
+    std::array<int8_t, kMaxSlots> pairs;
+
+    size_t i = 0;
+    while (i < chain.size()) {
+        const ChainEntry& e = chain[i];
+        if (e.kind != ChainEntry::Kind::Gadget) {
+            if (e.kind == ChainEntry::Kind::Label) open.fill(-1);
+            out.push_back(e);
+            ++i;
+            continue;
+        }
+        size_t words = gadgetPopWords(e.func);
+        bool aligned = i + 1 + words <= chain.size() && words == popSlotPairs(e.func, pairs);
+        for (size_t w = 0; aligned && w < words; ++w) {
+            aligned = chain[i + 1 + w].kind != ChainEntry::Kind::Gadget && chain[i + 1 + w].kind != ChainEntry::Kind::Label;
+        }
+        if (!aligned) {
+            // Chuỗi lệch hoặc gadget lạ: không đụng vào, đóng mọi ô
+            open.fill(-1);
+            out.push_back(e);
+            ++i;
+            continue;
+        }
+
+        // Gadget chỉ gồm pop: bỏ được nếu mọi word dữ liệu có ô đệm mở cùng cặp
+        // (word đệm thì không cần chỗ: thanh ghi giữ giá trị cũ cũng được)
+        if (words > 0 && isPurePop(e.func)) {
+            std::array<int32_t, kPairCount> target = open;
+            bool fits = true;
+            for (size_t w = 0; fits && w < words; ++w) {
+                if (chain[i + 1 + w].kind == ChainEntry::Kind::Pad) continue;
+                fits = pairs[w] >= 0 && target[pairs[w]] >= 0;
+                if (fits) target[pairs[w]] = -1;
+            }
+            if (fits) {
+                for (size_t w = 0; w < words; ++w) {
+                    const ChainEntry& word = chain[i + 1 + w];
+                    if (word.kind == ChainEntry::Kind::Pad) continue;
+                    out[open[pairs[w]]] = word;
+                    open[pairs[w]] = -1;
+                    stats.slots_reused++;
+                }
+                stats.gadgets_removed++;
+                stats.bytes_reclaimed += static_cast<uint32_t>(4 + 2 * words);
+                i += 1 + words;
+                continue;
+            }
+        }
+
+        const GadgetEffect& effect = gadgetEffect(e.func);
+        if (effect.calls || effect.pivots || effect.opaque) {
+            open.fill(-1);
+        } else {
+            for (size_t k = 0; k < kPairCount; ++k) {
+                if ((effect.reads | effect.writes) & reg::er(2 * k)) open[k] = -1;
+            }
+        }
+        out.push_back(e);
+        for (size_t w = 0; w < words; ++w) {
+            const ChainEntry& word = chain[i + 1 + w];
+            if (word.kind == ChainEntry::Kind::Pad && pairs[w] >= 0) {
+                open[pairs[w]] = static_cast<int32_t>(out.size());
+            }
+            out.push_back(word);
+        }
+        i += 1 + words;
+    }
+    chain.swap(out);
+}
+
+// --- Chương trình con trong chuỗi ---
+bool subroutinesAvailable(const GadgetDB& db, RomHandle rom, const ByteConstraints& constraints,
+                          GadgetFunction* missing) {
+    for (GF func : {GF::POP_ER14, GF::POP_ER8, GF::LOAD_SP_FROM_ER8_POP_ER8, GF::SP_ER14_POP_ER14_RT}) {
+        if (!db.selectCandidate(rom, func, constraints)) {
+            if (missing) *missing = func;
+            return false;
+        }
+    }
+    return true;
+}
+
+void appendCall(std::vector<ChainEntry>& chain, uint32_t entry, uint32_t& next_label, uint32_t stmt) {
+    uint32_t guard = next_label++;
+    uint32_t ret = next_label++;
+    chain.push_back(ChainEntry::label(guard, stmt));
+    chain.push_back(ChainEntry::gadget(GF::POP_ER14, stmt));
+    chain.push_back(ChainEntry::labelAddress(ret, -2, stmt));
+    chain.push_back(ChainEntry::gadget(GF::POP_ER8, stmt));
+    chain.push_back(ChainEntry::labelAddress(ret, -2, stmt));
+    chain.push_back(ChainEntry::gadget(GF::LOAD_SP_FROM_ER8_POP_ER8, stmt));
+    chain.push_back(ChainEntry::labelAddress(entry, -2, stmt));
+    chain.push_back(ChainEntry::label(ret, stmt));
+}
+
+void appendReturn(std::vector<ChainEntry>& chain, uint32_t stmt) {
+    chain.push_back(ChainEntry::gadget(GF::SP_ER14_POP_ER14_RT, stmt));
+    chain.push_back(ChainEntry::pad(stmt)); // Không được đọc: "pop er14" đọc word tại SP mới
+}
+
+// --- Tách đoạn chuỗi lặp lại thành chương trình con ---
+namespace {
+
+constexpr size_t kMaxOutlineUnits = 16;   // Số gadget tối đa của một đoạn
+constexpr uint32_t kMaxOutlineRounds = 32; // Số thân tối đa
+
+// Một gadget cùng các word pop của nó (hoặc một entry lẻ: nhãn, chuỗi lệch)
+struct OutlineUnit {
+    uint32_t begin = 0; // Chỉ số entry đầu trong chuỗi
+    uint32_t size = 1;  // Số entry
+    uint32_t bytes = 0;
+    uint64_t hash = 0;
+    bool barrier = true; // Không được nằm trong đoạn tách ra
+};
+
+std::vector<OutlineUnit> splitUnits(const std::vector<ChainEntry>& chain, size_t end) {
+    std::vector<OutlineUnit> units;
+    size_t i = 0;
+    while (i < end) {
+        OutlineUnit unit;
+        unit.begin = static_cast<uint32_t>(i);
+        const ChainEntry& e = chain[i];
+        if (e.kind != ChainEntry::Kind::Gadget) {
+            unit.bytes = e.kind == ChainEntry::Kind::Label ? 0 : 2;
+            units.push_back(unit);
+            ++i;
+            continue;
+        }
+        size_t words = gadgetPopWords(e.func);
+        bool aligned = i + 1 + words <= end;
+        for (size_t w = 0; aligned && w < words; ++w) {
+            aligned = chain[i + 1 + w].kind != ChainEntry::Kind::Gadget && chain[i + 1 + w].kind != ChainEntry::Kind::Label;
+        }
+        if (!aligned) {
+            unit.bytes = 4;
+            units.push_back(unit);
+            ++i;
+            continue;
+        }
+        const GadgetEffect& effect = gadgetEffect(e.func);
+        unit.size = static_cast<uint32_t>(1 + words);
+        unit.bytes = static_cast<uint32_t>(4 + 2 * words);
+        unit.barrier = effect.pivots || effect.calls || effect.opaque || e.func == GF::BRK ||
+                       ((effect.reads | effect.writes) & reg::er(14)) != 0;
+        // FNV-1a trên gadget và các word (loại + giá trị)
+        uint64_t h = 1469598103934665603ull;
+        auto mix = [&h](uint64_t v) { h = (h ^ v) * 1099511628211ull; };
+        mix(static_cast<uint64_t>(e.func));
+        for (size_t w = 0; w < words; ++w) {
+            const ChainEntry& word = chain[i + 1 + w];
+            // Word nhãn/khối chỉ biết địa chỉ sau cùng: không so được, không chép đi được
+            if (word.kind != ChainEntry::Kind::Data && word.kind != ChainEntry::Kind::Pad) unit.barrier = true;
+            mix(static_cast<uint64_t>(word.kind) << 16 | word.value);
+        }
+        unit.hash = h;
+        units.push_back(unit);
+        i += 1 + words;
+    }
+    return units;
+}
+
+bool sameUnits(const std::vector<ChainEntry>& chain, const std::vector<OutlineUnit>& units, size_t a, size_t b,
+               size_t length) {
+    for (size_t k = 0; k < length; ++k) {
+        const OutlineUnit& x = units[a + k];
+        const OutlineUnit& y = units[b + k];
+        if (x.hash != y.hash || x.size != y.size) return false;
+        for (uint32_t j = 0; j < x.size; ++j) {
+            const ChainEntry& p = chain[x.begin + j];
+            const ChainEntry& q = chain[y.begin + j];
+            if (p.kind != q.kind || p.func != q.func || p.value != q.value) return false;
+        }
+    }
+    return true;
+}
+
+// Thanh ghi mà đoạn [first, first + length) ghi; false nếu đoạn đọc er8 trước khi ghi
+// (lệnh gọi để lại rác trong er8 khi vào thân)
+bool fragmentEntryValid(const std::vector<ChainEntry>& chain, const std::vector<OutlineUnit>& units, size_t first,
+                        size_t length, RegMask& written) {
+    written = 0;
+    for (size_t k = first; k < first + length; ++k) {
+        const GadgetEffect& effect = gadgetEffect(chain[units[k].begin].func);
+        if (effect.reads & ~written & reg::er(8)) return false;
+        written |= effect.writes;
+    }
+    return true;
+}
+
+// Sau khi gọi, er14 và phần er8 mà đoạn không ghi chứa rác: phần chạy tiếp từ unit `from`
+// phải ghi chúng trước khi đọc
+bool continuationSafe(const std::vector<ChainEntry>& chain, const std::vector<OutlineUnit>& units, size_t from,
+                      RegMask written) {
+    RegMask clobbered = (reg::er(8) & ~written) | reg::er(14);
+    for (size_t k = from; k < units.size(); ++k) {
+        const ChainEntry& e = chain[units[k].begin];
+        if (e.kind == ChainEntry::Kind::Label) continue; // Chạy thẳng qua nhãn
+        if (e.kind != ChainEntry::Kind::Gadget) return false;
+        const GadgetEffect& effect = gadgetEffect(e.func);
+        if (effect.opaque || (effect.reads & clobbered)) return false;
+        clobbered &= ~effect.writes;
+        if (clobbered == 0 || effect.pivots || e.func == GF::BRK) return true;
+    }
+    return true; // Hết phần chính: BRK
+}
+
+} // namespace
+
+void outlineRepeatedFragments(std::vector<ChainEntry>& chain, const GadgetDB& db, RomHandle rom,
+                              const ByteConstraints& constraints, uint32_t& next_label, OutlineStats& stats) {
+    if (!subroutinesAvailable(db, rom, constraints)) return;
+    std::vector<ChainEntry> bodies; // Đặt sau phần chính khi xong
+
+    for (uint32_t round = 0; round < kMaxOutlineRounds; ++round) {
+        size_t end = 0;
+        while (end < chain.size() && !(chain[end].kind == ChainEntry::Kind::Gadget && chain[end].func == GF::BRK)) ++end;
+        std::vector<OutlineUnit> units = splitUnits(chain, end);
+
+        // Ứng viên tốt nhất: độ dài (số unit) và các chỗ gọi (unit đầu), không chồng nhau
+        int64_t best_saved = 0;
+        size_t best_length = 0;
+        std::vector<uint32_t> best_sites;
+        std::unordered_map<uint64_t, std::vector<uint32_t>> buckets;
+        std::vector<uint32_t> group, rest, sites;
+        for (size_t length = 1; length <= kMaxOutlineUnits && length <= units.size(); ++length) {
+            buckets.clear();
+            for (size_t first = 0; first + length <= units.size(); ++first) {
+                uint64_t h = length;
+                bool usable = true;
+                for (size_t k = first; usable && k < first + length; ++k) {
+                    usable = !units[k].barrier;
+                    h = (h ^ units[k].hash) * 1099511628211ull;
+                }
+                if (usable) buckets[h].push_back(static_cast<uint32_t>(first));
+            }
+            for (auto& [hash, starts] : buckets) {
+                // Tách theo so khớp chính xác (mã băm có thể trùng)
+                while (starts.size() >= 2) {
+                    group.clear();
+                    rest.clear();
+                    for (uint32_t s : starts) {
+                        (group.empty() || sameUnits(chain, units, group[0], s, length) ? group : rest).push_back(s);
+                    }
+                    starts.swap(rest);
+                    RegMask written;
+                    if (group.size() < 2 || !fragmentEntryValid(chain, units, group[0], length, written)) continue;
+                    int64_t bytes = 0;
+                    for (size_t k = group[0]; k < group[0] + length; ++k) bytes += units[k].bytes;
+                    sites.clear();
+                    size_t free_from = 0;
+                    for (uint32_t s : group) { // Tăng dần
+                        if (s >= free_from && continuationSafe(chain, units, s + length, written)) {
+                            sites.push_back(s);
+                            free_from = s + length;
+                        }
+                    }
+                    int64_t n = static_cast<int64_t>(sites.size());
+                    int64_t saved = n * bytes - (bytes + kReturnSequenceBytes) - n * kCallSequenceBytes;
+                    if (n >= 2 && saved > best_saved) {
+                        best_saved = saved;
+                        best_length = length;
+                        best_sites = sites;
+                    }
+                }
+            }
+        }
+        if (best_saved <= 0) break;
+
+        // Thân: nhãn entry, bản sao của lần xuất hiện đầu, trở về
+        uint32_t entry = next_label++;
+        const OutlineUnit& head = units[best_sites[0]];
+        const OutlineUnit& tail = units[best_sites[0] + best_length - 1];
+        bodies.push_back(ChainEntry::label(entry, chain[head.begin].statement));
+        bodies.insert(bodies.end(), chain.begin() + head.begin, chain.begin() + tail.begin + tail.size);
+        appendReturn(bodies, chain[tail.begin].statement);
+
+        std::vector<ChainEntry> out;
+        out.reserve(chain.size());
+        size_t copied = 0;
+        for (uint32_t site : best_sites) {
+            size_t from = units[site].begin;
+            size_t to = units[site + best_length - 1].begin + units[site + best_length - 1].size;
+            out.insert(out.end(), chain.begin() + static_cast<std::ptrdiff_t>(copied),
+                       chain.begin() + static_cast<std::ptrdiff_t>(from));
+            appendCall(out, entry, next_label, chain[from].statement);
+            copied = to;
+        }
+        out.insert(out.end(), chain.begin() + static_cast<std::ptrdiff_t>(copied), chain.end());
+        chain.swap(out);
+
+        stats.subroutines++;
+        stats.call_sites += static_cast<uint32_t>(best_sites.size());
+        stats.bytes_saved += static_cast<uint32_t>(best_saved);
+    }
+    chain.insert(chain.end(), bodies.begin(), bodies.end());
+}
@@ -0,0 +1,186 @@
+#ifndef CHAIN_OPTIMIZER_H
+#define CHAIN_OPTIMIZER_H
+
+#include "GadgetFunction.h"
+#include <array>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+class GadgetDB;
+struct ByteConstraints;
+using RomHandle = uint32_t;
+
+// --- Chuỗi ROP dạng ký hiệu ---
+// ROPGenerator gom chuỗi ở dạng này (gadget còn là GadgetFunction, chưa phải địa
+// chỉ) để các pass sau còn sửa được; chỉ lúc xuất cuối cùng mới tra địa chỉ ROM.
+// Mỗi gadget được theo sau bởi đúng gadgetPopWords(func) entry Data/Pad.
+// Các pass giữ nhãn câu lệnh: entry thay thế mang nhãn của gadget đầu mẫu.
+// Label đánh dấu đích nhảy của vòng lặp (và chỗ cần khôi phục sau lời gọi hàm
+// ROM): không chiếm byte nào, các pass không được dời gadget hay word qua nó.
+struct ChainEntry {
+    enum class Kind : uint8_t {
+        Gadget, // Địa chỉ gadget (4 byte trong payload)
+        Data,   // Word dữ liệu được một pop đọc
+        Pad,    // Word đệm cho pop không mang dữ liệu: giá trị tùy ý
+        BlockAddress, // Word dữ liệu = địa chỉ khi chạy của khối dữ liệu thứ `value` (điền sau cùng)
+        Label,        // Nhãn số `value` (0 byte)
+        LabelAddress, // Word dữ liệu = địa chỉ khi chạy của nhãn `value` + offset (điền sau cùng)
+        ChainWord,    // Word dữ liệu = word của chính payload tại nhãn `value` + offset (điền sau cùng)
+    };
+    static constexpr uint32_t kNoStatement = 0xFFFFFFFF;
+
+    Kind kind = Kind::Pad;
+    GadgetFunction func = GadgetFunction::UNKNOWN_GADGET;
+    uint16_t value = 0;
+    uint32_t statement = kNoStatement; // NodeId của câu lệnh sinh ra entry (cho bảng nguồn)
+    int16_t offset = 0;                // Byte, tính từ nhãn (LabelAddress, ChainWord)
+
+    static ChainEntry gadget(GadgetFunction f, uint32_t stmt = kNoStatement) {
+        return ChainEntry{Kind::Gadget, f, 0, stmt};
+    }
+    static ChainEntry data(uint32_t v, uint32_t stmt = kNoStatement) {
+        return ChainEntry{Kind::Data, GadgetFunction::UNKNOWN_GADGET, static_cast<uint16_t>(v), stmt};
+    }
+    static ChainEntry blockAddress(uint32_t block, uint32_t stmt = kNoStatement) {
+        return ChainEntry{Kind::BlockAddress, GadgetFunction::UNKNOWN_GADGET, static_cast<uint16_t>(block), stmt};
+    }
+    static ChainEntry pad(uint32_t stmt = kNoStatement) {
+        return ChainEntry{Kind::Pad, GadgetFunction::UNKNOWN_GADGET, 0, stmt};
+    }
+    static ChainEntry label(uint32_t id, uint32_t stmt = kNoStatement) {
+        return ChainEntry{Kind::Label, GadgetFunction::UNKNOWN_GADGET, static_cast<uint16_t>(id), stmt};
+    }
+    static ChainEntry labelAddress(uint32_t id, int offset, uint32_t stmt = kNoStatement) {
+        return ChainEntry{Kind::LabelAddress, GadgetFunction::UNKNOWN_GADGET, static_cast<uint16_t>(id), stmt,
+                          static_cast<int16_t>(offset)};
+    }
+    static ChainEntry chainWord(uint32_t id, int offset, uint32_t stmt = kNoStatement) {
+        return ChainEntry{Kind::ChainWord, GadgetFunction::UNKNOWN_GADGET, static_cast<uint16_t>(id), stmt,
+                          static_cast<int16_t>(offset)};
+    }
+};
+
+// Số byte của một chuỗi ký hiệu trong payload (gadget 4 byte, word 2 byte, nhãn 0 byte)
+uint32_t chainBytes(const std::vector<ChainEntry>& chain);
+
+// --- Tối ưu lỗ khóa (peephole) trên chuỗi ký hiệu ---
+// Một cửa sổ trượt tìm các dãy gadget liên tiếp khớp mẫu trong bảng luật và
+// thay bằng dãy ngắn hơn có cùng tác động lên thanh ghi. Bảng luật là dữ liệu
+// (kPeepholeRules trong ChainOptimizer.cpp) cộng với các luật "pop bị ghi đè"
+// suy ra từ mô hình tác động (GadgetEffect). Luật chỉ được bật khi ROM có các
+// gadget thay thế (thỏa ràng buộc byte). Lặp tới khi không còn luật nào khớp.
+
+struct PeepholeRuleStats {
+    std::string name;
+    uint32_t hits = 0;
+    uint32_t bytes_saved = 0;
+};
+
+struct PeepholeStats {
+    std::vector<PeepholeRuleStats> rules; // Theo thứ tự luật được bật
+    uint32_t passes = 0;
+    uint32_t bytes_saved = 0;
+};
+
+class ChainOptimizer {
+public:
+    ChainOptimizer(const GadgetDB& db, RomHandle rom, const ByteConstraints& constraints);
+
+    // Chạy các luật tới điểm bất động (sửa `chain` tại chỗ); cộng dồn vào stats()
+    void run(std::vector<ChainEntry>& chain);
+
+    const PeepholeStats& stats() const { return counters; }
+    size_t activeRuleCount() const { return rules.size(); }
+
+private:
+    static constexpr size_t kMaxPattern = 3;
+    static constexpr size_t kMaxReplacement = 2;
+    static constexpr size_t kMaxWords = 12; // Tổng word pop của mẫu / của phần thay thế
+
+    struct Rule {
+        uint8_t pattern_len = 0;
+        std::array<GadgetFunction, kMaxPattern> pattern{};
+        uint8_t replacement_len = 0;
+        std::array<GadgetFunction, kMaxReplacement> replacement{};
+        // Với mỗi word pop của phần thay thế: chỉ số word pop trong mẫu, -1 = đệm
+        std::array<int8_t, kMaxWords> words{};
+        uint32_t bytes_saved = 0;
+    };
+
+    std::vector<Rule> rules;
+    // Luật theo gadget đầu tiên của mẫu (chỉ số = GadgetFunction)
+    std::array<std::vector<uint16_t>, kGadgetFunctionCount> by_first;
+    std::vector<ChainEntry> scratch; // Bộ đệm cho một lượt quét
+    PeepholeStats counters;
+
+    // Kiểm tra luật (tác động, số word) rồi bật nếu ROM có đủ gadget thay thế
+    void addRule(const Rule& rule, std::string name, const GadgetDB& db, RomHandle rom,
+                 const ByteConstraints& constraints);
+    // Khớp luật tại vị trí `at`; trả về vị trí ngay sau mẫu, hoặc 0 nếu không khớp
+    size_t match(const Rule& rule, const std::vector<ChainEntry>& chain, size_t at,
+                 std::array<ChainEntry, kMaxWords>& words) const;
+    // Một lượt quét từ đầu tới cuối; trả về true nếu có thay đổi
+    bool pass(std::vector<ChainEntry>& chain);
+};
+
+// --- Tận dụng ô pop đệm ---
+// Nhiều gadget pop thêm thanh ghi như tác dụng phụ (ví dụ "er0 = er6,pop er8,
+// pop xr4"); các word đó vẫn chiếm chỗ trong chuỗi dù chỉ là đệm. Pass này đi
+// dọc chuỗi, nhớ các ô đệm còn "mở" (thanh ghi mà ô đó nạp chưa bị đọc/ghi lại
+// từ lúc pop) và khi gặp một gadget chỉ gồm pop mà mọi word của nó rơi được vào
+// các ô mở cùng thanh ghi, đưa giá trị vào các ô đó rồi bỏ hẳn gadget.
+
+struct FillerStats {
+    uint32_t slots_reused = 0;    // Số ô đệm được dùng để mang dữ liệu
+    uint32_t gadgets_removed = 0; // Số gadget pop bị bỏ
+    uint32_t bytes_reclaimed = 0;
+};
+
+// Sửa `chain` tại chỗ; cộng dồn vào `stats`. Không cần ROM: chỉ bỏ gadget, không thêm.
+// Nhãn đóng mọi ô: đích nhảy tới có thể đến từ chỗ khác trong chuỗi.
+void reuseFillerSlots(std::vector<ChainEntry>& chain, FillerStats& stats);
+
+// --- Chương trình con trong chuỗi ---
+// Lệnh gọi (18 byte) đặt địa chỉ trở về vào er14 rồi nhảy như vòng lặp:
+//   [nhãn chặn] pop er14 = ret - 2; pop er8 = ret - 2; sp=[er8],pop er8 (word đệm = entry - 2); ret:
+// Word đệm của lệnh nhảy vừa là đích (đọc qua [er8]) vừa là word mà "pop er14" của phần
+// trở về đọc lại. Thân bắt đầu bằng nhãn entry (đích có offset -2, như placeLabel của
+// ROPGenerator) và kết thúc bằng "sp = er14,pop er14,rt" + word đệm (6 byte): SP về ret.
+// Như mọi gadget kết thúc bằng rt khác, giả định LR trỏ tới một pop pc.
+// Lời gọi phá er8 và er14; thân không được đổi er14 nếu không tự cất lại.
+// Nhãn chặn trước pop er14 ngăn reuseFillerSlots kéo địa chỉ trở về lên một ô đệm phía
+// trước (er14 sẽ phải sống qua đoạn giữa).
+constexpr uint32_t kCallSequenceBytes = 18;
+constexpr uint32_t kReturnSequenceBytes = 6;
+
+// ROM có đủ gadget (thỏa ràng buộc byte) cho lệnh gọi và trở về? Nếu không, `missing` là gadget thiếu
+bool subroutinesAvailable(const GadgetDB& db, RomHandle rom, const ByteConstraints& constraints,
+                          GadgetFunction* missing = nullptr);
+// Nối một lệnh gọi tới nhãn `entry`; dùng 2 nhãn mới từ `next_label`
+void appendCall(std::vector<ChainEntry>& chain, uint32_t entry, uint32_t& next_label,
+                uint32_t stmt = ChainEntry::kNoStatement);
+void appendReturn(std::vector<ChainEntry>& chain, uint32_t stmt = ChainEntry::kNoStatement);
+
+// --- Tách đoạn chuỗi lặp lại thành chương trình con ---
+// Băm mọi đoạn 1..16 gadget liên tiếp (mỗi gadget kèm các word pop của nó) trong phần
+// chính của chuỗi (trước BRK đầu tiên), so khớp chính xác các đoạn cùng mã băm, rồi
+// thay đoạn có lợi nhất bằng lệnh gọi tới một bản duy nhất đặt ở cuối chuỗi; lặp lại.
+// Chỉ tách khi n lần xuất hiện có n * S > S + kReturnSequenceBytes + n * kCallSequenceBytes.
+// Đoạn không chứa nhãn, word nhãn/khối, gadget đổi SP, gọi hàm ROM hay chạm er14, không
+// đọc er8 trước khi ghi; phần chạy tiếp sau mỗi chỗ gọi không được đọc er14 (hay er8 nếu
+// đoạn không ghi nó) trước khi ghi. Đích nhảy không giả định gì về thanh ghi (trừ thân
+// chương trình con, mà er14 được đặt ngay sau nhãn chặn), nên việc quét dừng ở gadget đổi SP.
+// Phải chạy sau các pass khác và trước khi đặt khối dữ liệu; `next_label` là nhãn kế tiếp còn trống.
+
+struct OutlineStats {
+    uint32_t subroutines = 0; // Số thân được tách ra
+    uint32_t call_sites = 0;  // Số đoạn được thay bằng lệnh gọi
+    uint32_t bytes_saved = 0;
+};
+
+// Sửa `chain` tại chỗ; cộng dồn vào `stats`. Không làm gì nếu ROM thiếu gadget gọi/trở về.
+void outlineRepeatedFragments(std::vector<ChainEntry>& chain, const GadgetDB& db, RomHandle rom,
+                              const ByteConstraints& constraints, uint32_t& next_label, OutlineStats& stats);
+
+#endif // CHAIN_OPTIMIZER_H
@@ -0,0 +1,419 @@
+#include "GadgetEffect.h"
+#include <array>
+#include <cctype>
+#include <stdexcept>
+
+namespace {
+
+constexpr std::array<std::string_view, 12> kRomCalls = {
+    "memcpy", "strcpy", "strcat", "memset", "delay", "line_print",
+    "printline", "hex_byte", "smart_strcpy", "zero_KO", "line_draw", "render.ddd4",
+};
+
+std::string_view trim(std::string_view s) {
+    while (!s.empty() && isspace(static_cast<unsigned char>(s.front()))) s.remove_prefix(1);
+    while (!s.empty() && isspace(static_cast<unsigned char>(s.back()))) s.remove_suffix(1);
+    return s;
+}
+
+bool startsWith(std::string_view s, std::string_view prefix) {
+    return s.substr(0, prefix.size()) == prefix;
+}
+
+[[noreturn]] void fail(std::string_view spelling, std::string_view what) {
+    throw std::runtime_error("Lỗi: Không hiểu mô tả gadget '" + std::string(spelling) + "': " + std::string(what));
+}
+
+// "er0" -> {0, 2}, "qr8" -> {8, 8}, "ea" -> {EA, 2}; width 0 nếu không phải thanh ghi
+RegOperand parseReg(std::string_view s) {
+    RegOperand op;
+    s = trim(s);
+    if (s == "ea") return RegOperand{reg::kEA, 2};
+    if (s == "sp") return RegOperand{reg::kSP, 2};
+    uint8_t width = 0;
+    if (startsWith(s, "er")) { width = 2; s.remove_prefix(2); }
+    else if (startsWith(s, "xr")) { width = 4; s.remove_prefix(2); }
+    else if (startsWith(s, "qr")) { width = 8; s.remove_prefix(2); }
+    else if (startsWith(s, "r")) { width = 1; s.remove_prefix(1); }
+    else return op;
+    if (s.empty() || s.size() > 2) return op;
+    unsigned n = 0;
+    for (char c : s) {
+        if (!isdigit(static_cast<unsigned char>(c))) return op;
+        n = n * 10 + static_cast<unsigned>(c - '0');
+    }
+    if (n > 15 || n % width != 0 || n + width > 16) return op;
+    op.base = static_cast<uint8_t>(n);
+    op.width = width;
+    return op;
+}
+
+// Số thập phân hoặc hex kiểu "D002H"; trả về false nếu không phải số
+bool parseImm(std::string_view s, int32_t& value) {
+    s = trim(s);
+    if (s.empty()) return false;
+    bool hex = s.back() == 'H' || s.back() == 'h';
+    if (hex) s.remove_suffix(1);
+    if (s.empty()) return false;
+    int32_t v = 0;
+    for (char c : s) {
+        int digit;
+        if (isdigit(static_cast<unsigned char>(c))) digit = c - '0';
+        else if (hex && isxdigit(static_cast<unsigned char>(c))) digit = tolower(static_cast<unsigned char>(c)) - 'a' + 10;
+        else return false;
+        v = v * (hex ? 16 : 10) + digit;
+    }
+    value = v;
+    return true;
+}
+
+// "[er2]" -> thanh ghi địa chỉ er2; width 0 nếu không phải dạng [reg]
+RegOperand parseMemRef(std::string_view s) {
+    s = trim(s);
+    if (s.size() < 3 || s.front() != '[' || s.back() != ']') return RegOperand{};
+    return parseReg(s.substr(1, s.size() - 2));
+}
+
+CompareCond parseCond(std::string_view s) {
+    if (s == "gt") return CompareCond::Gt;
+    if (s == "eq") return CompareCond::Eq;
+    if (s == "le") return CompareCond::Le;
+    if (s == "lt") return CompareCond::Lt;
+    return CompareCond::None;
+}
+
+// Tách theo dấu phẩy; "or r0,r1" là một mệnh đề có dấu phẩy bên trong
+std::vector<std::string_view> splitClauses(std::string_view spelling) {
+    std::vector<std::string_view> parts;
+    size_t start = 0;
+    while (start <= spelling.size()) {
+        size_t comma = spelling.find(',', start);
+        if (comma == std::string_view::npos) comma = spelling.size();
+        parts.push_back(trim(spelling.substr(start, comma - start)));
+        start = comma + 1;
+    }
+    std::vector<std::string_view> clauses;
+    for (size_t i = 0; i < parts.size(); ++i) {
+        if (startsWith(parts[i], "or ") && i + 1 < parts.size()) {
+            // Ghép lại "or a" + "b" thành một mệnh đề (hai lát cắt liền nhau trong spelling)
+            const char* begin = parts[i].data();
+            const char* end = parts[i + 1].data() + parts[i + 1].size();
+            clauses.push_back(std::string_view(begin, static_cast<size_t>(end - begin)));
+            ++i;
+        } else {
+            clauses.push_back(parts[i]);
+        }
+    }
+    return clauses;
+}
+
+class EffectBuilder {
+public:
+    EffectBuilder(std::string_view spelling, std::vector<EffectOp>& ops) : spelling(spelling), ops(ops) {
+        effect.first_op = static_cast<uint16_t>(ops.size());
+    }
+
+    GadgetEffect finish() {
+        effect.op_count = static_cast<uint16_t>(ops.size() - effect.first_op);
+        return effect;
+    }
+
+    void clause(std::string_view c) {
+        if (c.empty()) fail(spelling, "mệnh đề rỗng");
+        // rt quay về qua LR, mà chuỗi giả định luôn trỏ tới một pop pc: giống hệt gadget kết thúc
+        // bằng pop pc, nên không có tác động nào cần ghi lại
+        if (c == "rt" || c == "RT") return;
+        if (c == "DI") { emit(EffectOp{EffectOpKind::DisableInt}); return; }
+        if (c == "nop") return;
+        if (c == "break") { emit(EffectOp{EffectOpKind::Break}); return; }
+        if (c == "setlr") {
+            emit(EffectOp{EffectOpKind::SetLR});
+            write(reg::LR);
+            return;
+        }
+        if (startsWith(c, "BL ")) { call(trim(c.substr(3))); return; }
+        if (startsWith(c, "B ") || startsWith(c, "calc_checksum") || c == "pr_checksum") {
+            EffectOp op{EffectOpKind::Opaque};
+            emit(op);
+            effect.opaque = true;
+            effect.calls = true;
+            write(0xFFFFFFFFu & ~reg::SP);
+            return;
+        }
+        if (startsWith(c, "pop ")) { pop(c.substr(4)); return; }
+        if (startsWith(c, "lea ")) {
+            EffectOp op{EffectOpKind::Lea};
+            if (!parseImm(c.substr(4), op.imm)) fail(spelling, "toán hạng lea");
+            op.dst = RegOperand{reg::kEA, 2};
+            emit(op);
+            write(reg::EA);
+            effect.const_writes |= reg::EA;
+            return;
+        }
+        if (startsWith(c, "or ")) {
+            std::string_view args = c.substr(3);
+            size_t comma = args.find(',');
+            if (comma == std::string_view::npos) fail(spelling, "or cần hai toán hạng");
+            binary(EffectOpKind::Or, args.substr(0, comma), args.substr(comma + 1));
+            return;
+        }
+        if (c.find('|') != std::string_view::npos) {
+            // "r0 = 0 |r0 = 1": r0 nhận 0 hoặc 1 tùy kết quả so sánh trước đó
+            std::string_view lhs = trim(c.substr(0, c.find('=')));
+            EffectOp op{EffectOpKind::SetFlag};
+            op.dst = reg(lhs);
+            read(reg::PSW);
+            emit(op);
+            write(op.dst.mask());
+            return;
+        }
+        size_t underscore = c.find('_');
+        size_t minus = c.find(" - ");
+        if (underscore != std::string_view::npos && minus != std::string_view::npos) {
+            compare(trim(c.substr(0, minus)), trim(c.substr(minus + 3, underscore - minus - 3)), c.substr(underscore + 1));
+            return;
+        }
+        if (c.find("<<") != std::string_view::npos || c.find(">>") != std::string_view::npos) {
+            bool left = c.find("<<") != std::string_view::npos;
+            size_t at = c.find(left ? "<<" : ">>");
+            EffectOp op{left ? EffectOpKind::Shl : EffectOpKind::Shr};
+            op.dst = reg(c.substr(0, at));
+            if (!parseImm(c.substr(at + 2), op.imm)) fail(spelling, "số bit dịch");
+            read(op.dst.mask());
+            emit(op);
+            write(op.dst.mask() | reg::PSW);
+            return;
+        }
+        static constexpr std::array<std::pair<std::string_view, EffectOpKind>, 4> kCompound = {{
+            {"+=", EffectOpKind::Add}, {"-=", EffectOpKind::Sub}, {"*=", EffectOpKind::Mul}, {"/=", EffectOpKind::Div},
+        }};
+        for (const auto& [token, kind] : kCompound) {
+            size_t at = c.find(token);
+            if (at != std::string_view::npos) {
+                compound(kind, trim(c.substr(0, at)), trim(c.substr(at + 2)));
+                return;
+            }
+        }
+        if (c.find('=') != std::string_view::npos) {
+            assignChain(c);
+            return;
+        }
+        fail(spelling, c);
+    }
+
+private:
+    std::string_view spelling;
+    std::vector<EffectOp>& ops;
+    GadgetEffect effect;
+    RegMask written = 0; // Thanh ghi đã bị ghi trong gadget (để tính reads "lộ ra ngoài")
+
+    RegOperand reg(std::string_view s) {
+        RegOperand r = parseReg(s);
+        if (r.width == 0) fail(spelling, "thanh ghi '" + std::string(trim(s)) + "'");
+        return r;
+    }
+
+    void read(RegMask mask) { effect.reads |= mask & ~written; }
+    void write(RegMask mask) {
+        written |= mask;
+        effect.writes |= mask;
+    }
+    void emit(const EffectOp& op) { ops.push_back(op); }
+
+    bool afterCompare() const {
+        return ops.size() > effect.first_op && ops.back().kind == EffectOpKind::Compare;
+    }
+
+    void call(std::string_view name) {
+        EffectOp op{EffectOpKind::Call};
+        op.imm = -1;
+        for (size_t i = 0; i < kRomCalls.size(); ++i) {
+            if (kRomCalls[i] == name) op.imm = static_cast<int32_t>(i);
+        }
+        if (op.imm < 0) fail(spelling, "hàm ROM không biết '" + std::string(name) + "'");
+        read(reg::bytes(0, 8)); // Đối số truyền qua ER0–ER6
+        emit(op);
+        effect.calls = true;
+        effect.loads++;
+        effect.stores++;
+        write(reg::kCallClobbers);
+    }
+
+    void pop(std::string_view operand) {
+        EffectOp op{EffectOpKind::Pop};
+        op.dst = reg(operand);
+        emit(op);
+        write(op.dst.mask());
+        effect.pop_writes |= op.dst.mask();
+        effect.pop_words += static_cast<uint8_t>(op.dst.width <= 2 ? 1 : op.dst.width / 2);
+    }
+
+    void compare(std::string_view lhs, std::string_view rhs, std::string_view cond) {
+        EffectOp op{EffectOpKind::Compare};
+        op.cond = parseCond(cond);
+        if (op.cond == CompareCond::None) fail(spelling, "điều kiện so sánh");
+        op.dst = reg(lhs);
+        if (!parseImm(rhs, op.imm)) {
+            op.src = reg(rhs);
+        }
+        read(op.dst.mask() | op.src.mask());
+        emit(op);
+        write(reg::PSW);
+    }
+
+    void binary(EffectOpKind kind, std::string_view lhs, std::string_view rhs) {
+        EffectOp op{kind};
+        op.dst = reg(lhs);
+        if (!parseImm(rhs, op.imm)) {
+            op.src = reg(rhs);
+        }
+        read(op.dst.mask() | op.src.mask());
+        emit(op);
+        write(op.dst.mask() | reg::PSW);
+        if (kind == EffectOpKind::Div) write(op.src.mask()); // DIV ERn, Rm: phần dư vào Rm
+    }
+
+    void compound(EffectOpKind kind, std::string_view lhs, std::string_view rhs) {
+        RegOperand mem = parseMemRef(lhs);
+        if (mem.width == 0) {
+            binary(kind, lhs, rhs);
+            return;
+        }
+        // [reg] += src / imm
+        if (kind != EffectOpKind::Add && kind != EffectOpKind::Sub) fail(spelling, "phép toán bộ nhớ");
+        EffectOp op{EffectOpKind::StoreAdd};
+        op.dst = mem;
+        if (parseImm(rhs, op.imm)) {
+            op.mem_width = 1; // [ea]+=1 / [ea]-=1: tăng/giảm một byte
+        } else {
+            op.src = reg(rhs);
+            op.mem_width = op.src.width;
+        }
+        if (kind == EffectOpKind::Sub) op.imm = -op.imm;
+        read(op.dst.mask() | op.src.mask());
+        emit(op);
+        effect.loads++;
+        effect.stores++;
+        write(reg::PSW);
+    }
+
+    // "a = b", "a = b = 0" (gán từ phải sang trái)
+    void assignChain(std::string_view c) {
+        std::vector<std::string_view> parts;
+        size_t start = 0;
+        while (true) {
+            size_t eq = c.find('=', start);
+            parts.push_back(trim(c.substr(start, eq == std::string_view::npos ? std::string_view::npos : eq - start)));
+            if (eq == std::string_view::npos) break;
+            start = eq + 1;
+        }
+        bool conditional = afterCompare();
+        for (size_t i = parts.size() - 1; i-- > 0;) {
+            assign(parts[i], parts[i + 1], conditional);
+        }
+    }
+
+    void assign(std::string_view lhs, std::string_view rhs, bool conditional) {
+        RegOperand dst_mem = parseMemRef(lhs);
+        RegOperand src_mem = parseMemRef(rhs);
+
+        if (dst_mem.width != 0) { // [addr] = src
+            EffectOp op{EffectOpKind::Store};
+            op.dst = dst_mem;
+            op.src = reg(rhs);
+            op.mem_width = op.src.width;
+            read(op.dst.mask() | op.src.mask());
+            emit(op);
+            effect.stores++;
+            return;
+        }
+
+        RegOperand dst = reg(lhs);
+        if (src_mem.width != 0) { // dst = [addr]
+            EffectOp op{dst.base == reg::kSP ? EffectOpKind::LoadSP : EffectOpKind::Load};
+            op.dst = dst;
+            op.src = src_mem;
+            op.mem_width = dst.width;
+            read(src_mem.mask());
+            emit(op);
+            effect.loads++;
+            if (op.kind == EffectOpKind::LoadSP) effect.pivots = true;
+            write(dst.mask());
+            return;
+        }
+
+        EffectOp op{EffectOpKind::Move};
+        op.dst = dst;
+        if (parseImm(rhs, op.imm)) {
+            op.kind = conditional ? EffectOpKind::CondLoadImm : EffectOpKind::LoadImm;
+            if (conditional) read(dst.mask() | reg::PSW); // Có thể giữ nguyên giá trị cũ
+            else effect.const_writes |= dst.mask();
+        } else {
+            op.src = reg(rhs);
+            if (dst.base == reg::kSP) {
+                op.kind = EffectOpKind::SetSP;
+                effect.pivots = true;
+            } else if (op.src.base == reg::kSP) {
+                op.kind = EffectOpKind::GetSP;
+            } else if (conditional) {
+                op.kind = EffectOpKind::CondMove;
+                read(dst.mask() | reg::PSW);
+            }
+            read(op.src.mask());
+            effect.const_writes &= ~dst.mask();
+        }
+        emit(op);
+        write(dst.mask());
+    }
+};
+
+} // namespace
+
+GadgetEffect parseGadgetEffect(std::string_view spelling, std::vector<EffectOp>& ops) {
+    EffectBuilder builder(spelling, ops);
+    for (std::string_view clause : splitClauses(spelling)) {
+        builder.clause(clause);
+    }
+    return builder.finish();
+}
+
+GadgetEffectTable::GadgetEffectTable() : effects(kGadgetFunctionCount) {
+    ops.reserve(kGadgetFunctionCount * 3);
+    for (size_t i = 1; i < kGadgetFunctionCount; ++i) {
+        GadgetFunction func = static_cast<GadgetFunction>(i);
+        effects[i] = parseGadgetEffect(gadgetSpelling(func), ops);
+        // Đếm pop lúc biên dịch (GadgetFunction.h) và mô hình đầy đủ phải khớp nhau
+        if (effects[i].pop_words != gadgetPopWords(func)) {
+            throw std::logic_error("Lỗi: Số word pop của gadget '" + std::string(gadgetSpelling(func)) + "' không nhất quán.");
+        }
+    }
+}
+
+const GadgetEffectTable& GadgetEffectTable::instance() {
+    static const GadgetEffectTable table;
+    return table;
+}
+
+std::string_view romCallName(int32_t index) {
+    if (index < 0 || static_cast<size_t>(index) >= kRomCalls.size()) return std::string_view();
+    return kRomCalls[static_cast<size_t>(index)];
+}
+
+std::string describeRegs(RegMask mask) {
+    std::string out;
+    auto append = [&out](const std::string& name) {
+        if (!out.empty()) out += ' ';
+        out += name;
+    };
+    for (unsigned n = 0; n < 16;) {
+        if (n % 8 == 0 && (mask & reg::qr(n)) == reg::qr(n)) { append("qr" + std::to_string(n)); n += 8; }
+        else if (n % 4 == 0 && (mask & reg::xr(n)) == reg::xr(n)) { append("xr" + std::to_string(n)); n += 4; }
+        else if (n % 2 == 0 && (mask & reg::er(n)) == reg::er(n)) { append("er" + std::to_string(n)); n += 2; }
+        else { if (mask & reg::r(n)) append("r" + std::to_string(n)); n += 1; }
+    }
+    if (mask & reg::EA) append("ea");
+    if (mask & reg::SP) append("sp");
+    if (mask & reg::PSW) append("psw");
+    if (mask & reg::LR) append("lr");
+    return out;
+}
@@ -0,0 +1,140 @@
+#ifndef GADGET_EFFECT_H
+#define GADGET_EFFECT_H
+
+#include "GadgetFunction.h"
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// --- Mô hình tác động của gadget ---
+// Cách viết của mỗi gadget (ví dụ "[er2]=er0,r2 = 0,pop er4,rt") là một ngôn ngữ
+// nhỏ: các mệnh đề cách nhau bởi dấu phẩy, thực hiện tuần tự. Bộ parse ở đây
+// biến nó thành danh sách EffectOp (đủ để giả lập) và một bản tóm tắt
+// GadgetEffect (thanh ghi đọc/ghi, truy cập bộ nhớ, số word bị pop, ...)
+// mà bộ sinh mã dùng để chọn gadget theo chi phí.
+
+// Tập thanh ghi: bit 0..15 là r0..r15, cộng thêm EA, SP, PSW, LR
+using RegMask = uint32_t;
+
+namespace reg {
+constexpr uint8_t kEA = 16;
+constexpr uint8_t kSP = 17;
+constexpr uint8_t kPSW = 18;
+constexpr uint8_t kLR = 19;
+
+constexpr RegMask bytes(unsigned first, unsigned count) {
+    return ((count >= 32 ? 0xFFFFFFFFu : ((1u << count) - 1u)) << first);
+}
+constexpr RegMask r(unsigned n) { return bytes(n, 1); }
+constexpr RegMask er(unsigned n) { return bytes(n, 2); }
+constexpr RegMask xr(unsigned n) { return bytes(n, 4); }
+constexpr RegMask qr(unsigned n) { return bytes(n, 8); }
+constexpr RegMask EA = 1u << kEA;
+constexpr RegMask SP = 1u << kSP;
+constexpr RegMask PSW = 1u << kPSW;
+constexpr RegMask LR = 1u << kLR;
+// Thanh ghi mà một lệnh BL tới hàm ROM có thể phá (giả định theo ABI nX-U8: ER0–ER6)
+constexpr RegMask kCallClobbers = bytes(0, 8) | PSW | LR;
+} // namespace reg
+
+// Toán hạng thanh ghi: byte đầu tiên (0..15, hoặc reg::kEA / reg::kSP) + độ rộng (byte)
+struct RegOperand {
+    uint8_t base = 0;
+    uint8_t width = 0; // 1 = rN, 2 = erN/ea/sp, 4 = xrN, 8 = qrN; 0 = không dùng
+
+    RegMask mask() const {
+        if (width == 0) return 0;
+        if (base == reg::kEA) return reg::EA;
+        if (base == reg::kSP) return reg::SP;
+        return reg::bytes(base, width);
+    }
+};
+
+enum class EffectOpKind : uint8_t {
+    Pop,        // dst = word(s) tiếp theo trên stack
+    Move,       // dst = src
+    LoadImm,    // dst = imm
+    Add,        // dst += src (hoặc imm nếu src.width == 0)
+    Sub,        // dst -= src / imm
+    Mul,        // dst *= src
+    Div,        // dst /= src (phần dư vào src)
+    Or,         // dst |= src
+    Shl,        // dst <<= imm
+    Shr,        // dst >>= imm
+    Load,       // dst = [src]
+    Store,      // [dst] = src
+    StoreAdd,   // [dst] += src / imm (độ rộng: width của op)
+    Compare,    // PSW = so sánh dst với src / imm theo điều kiện cond
+    SetFlag,    // dst = (điều kiện của Compare trước đó) ? 1 : 0
+    CondLoadImm,// nếu điều kiện đúng: dst = imm
+    CondMove,   // nếu điều kiện đúng: dst = src
+    SetSP,      // SP = src
+    GetSP,      // dst = SP
+    LoadSP,     // SP = [src]
+    Lea,        // EA = imm
+    SetLR,      // LR = (địa chỉ pop pc kế tiếp)
+    Call,       // BL tới hàm ROM (imm = chỉ số trong romCallName())
+    Opaque,     // Không mô hình hóa được (B LEAVE, checksum, ...)
+    DisableInt, // DI
+    Break,      // BRK
+};
+
+enum class CompareCond : uint8_t { None, Gt, Eq, Le, Lt };
+
+struct EffectOp {
+    EffectOpKind kind;
+    CompareCond cond = CompareCond::None;
+    RegOperand dst{};
+    RegOperand src{};
+    int32_t imm = 0;
+    uint8_t mem_width = 0; // Độ rộng truy cập bộ nhớ (byte) cho Load/Store/StoreAdd
+};
+
+// Bản tóm tắt gọn của một gadget
+struct GadgetEffect {
+    RegMask reads = 0;       // Thanh ghi được đọc trước khi bị ghi (giá trị vào có ý nghĩa)
+    RegMask writes = 0;      // Thanh ghi bị ghi (kể cả bởi pop và lời gọi BL)
+    RegMask pop_writes = 0;  // Thanh ghi được nạp từ stack (các ô pop có thể mang dữ liệu)
+    RegMask const_writes = 0;// Thanh ghi bị gán hằng số
+    uint8_t pop_words = 0;   // Số word stack mà các pop tiêu thụ
+    uint8_t loads = 0;       // Số lần đọc bộ nhớ
+    uint8_t stores = 0;      // Số lần ghi bộ nhớ
+    bool pivots = false;     // Thay đổi SP (sp = ..., sp=[..])
+    bool calls = false;      // Gọi hàm ROM (BL), có thể ghi đè vùng stack phía dưới SP
+    bool opaque = false;     // Có phần không mô hình hóa được, không dùng cho chọn lệnh tự động
+    uint16_t first_op = 0;   // Vị trí các EffectOp trong bảng
+    uint16_t op_count = 0;
+};
+
+// Parse một cách viết thành các op (nối vào `ops`) và bản tóm tắt.
+// Ném std::runtime_error nếu cách viết không hợp lệ.
+GadgetEffect parseGadgetEffect(std::string_view spelling, std::vector<EffectOp>& ops);
+
+// Bảng tác động của mọi GadgetFunction, dựng một lần (lần dùng đầu tiên) từ GadgetTable.def.
+// Các EffectOp của mọi gadget nằm liên tiếp trong một mảng duy nhất.
+class GadgetEffectTable {
+public:
+    static const GadgetEffectTable& instance();
+
+    const GadgetEffect& effect(GadgetFunction func) const { return effects[static_cast<size_t>(func)]; }
+    const EffectOp* opsBegin(GadgetFunction func) const { return ops.data() + effect(func).first_op; }
+    const EffectOp* opsEnd(GadgetFunction func) const { return opsBegin(func) + effect(func).op_count; }
+
+private:
+    GadgetEffectTable();
+    std::vector<GadgetEffect> effects; // Chỉ số = GadgetFunction
+    std::vector<EffectOp> ops;
+};
+
+inline const GadgetEffect& gadgetEffect(GadgetFunction func) {
+    return GadgetEffectTable::instance().effect(func);
+}
+
+// Tên hàm ROM của một op Call ("memcpy", "memset", ...); rỗng nếu không biết
+std::string_view romCallName(int32_t index);
+
+// Mô tả ngắn gọn một tập thanh ghi (ví dụ: "er0 r2 ea"), dùng cho log/DEBUG
+std::string describeRegs(RegMask mask);
+
+#endif // GADGET_EFFECT_H
@@ -0,0 +1,227 @@
+#include "GadgetEmulator.h"
+
+namespace {
+
+uint8_t initialByte(uint32_t seed, uint16_t address) {
+    uint32_t x = seed ^ (address * 0x9E3779B1u);
+    x ^= x >> 15;
+    x *= 0x85EBCA77u;
+    x ^= x >> 13;
+    return static_cast<uint8_t>(x);
+}
+
+uint64_t widthMask(unsigned int bytes) {
+    return bytes >= 8 ? ~0ull : (1ull << (8 * bytes)) - 1;
+}
+
+bool compare(CompareCond cond, uint64_t a, uint64_t b) {
+    switch (cond) {
+        case CompareCond::Gt: return a > b;
+        case CompareCond::Eq: return a == b;
+        case CompareCond::Le: return a <= b;
+        case CompareCond::Lt: return a < b;
+        default: return false;
+    }
+}
+
+uint16_t loadWord(const MachineState& s, uint16_t address) {
+    return static_cast<uint16_t>(s.load(address) | (s.load(static_cast<uint16_t>(address + 1)) << 8));
+}
+
+// BL tới hàm ROM: er0 = đích, er2 = nguồn (memcpy) hoặc r2 = byte điền (memset), số byte là
+// word tại SP. Hàm đẩy LR và thanh ghi vào stack nên 8 byte ngay dưới SP bị ghi đè, và trả về
+// với ER0–ER6 không còn giá trị xác định (reg::kCallClobbers).
+bool callRom(int32_t index, MachineState& s) {
+    std::string_view name = romCallName(index);
+    if (name != "memset" && name != "memcpy") return false;
+    uint16_t dest = static_cast<uint16_t>(s.get(RegOperand{0, 2}));
+    uint16_t source = static_cast<uint16_t>(s.get(RegOperand{2, 2}));
+    uint16_t length = loadWord(s, s.sp);
+    for (uint16_t a = static_cast<uint16_t>(s.sp - 8); a != s.sp; ++a) {
+        s.store(a, initialByte(~s.memory_seed, a));
+    }
+    for (uint16_t i = 0; i < length; ++i) {
+        uint8_t byte = name == "memset" ? static_cast<uint8_t>(source) : s.load(static_cast<uint16_t>(source + i));
+        s.store(static_cast<uint16_t>(dest + i), byte);
+    }
+    for (uint8_t i = 0; i < 8; ++i) {
+        s.r[i] = initialByte(~s.memory_seed, i);
+    }
+    return true;
+}
+
+} // namespace
+
+uint64_t MachineState::get(const RegOperand& op) const {
+    if (op.base == reg::kEA) return ea;
+    if (op.base == reg::kSP) return sp;
+    uint64_t v = 0;
+    for (unsigned int i = 0; i < op.width; ++i) {
+        v |= static_cast<uint64_t>(r[op.base + i]) << (8 * i);
+    }
+    return v;
+}
+
+void MachineState::set(const RegOperand& op, uint64_t value) {
+    if (op.base == reg::kEA) {
+        ea = static_cast<uint16_t>(value);
+        return;
+    }
+    if (op.base == reg::kSP) {
+        sp = static_cast<uint16_t>(value);
+        return;
+    }
+    for (unsigned int i = 0; i < op.width; ++i) {
+        r[op.base + i] = static_cast<uint8_t>(value >> (8 * i));
+    }
+}
+
+uint8_t MachineState::load(uint16_t address) const {
+    if (ram) return ram[address];
+    for (size_t i = write_count; i-- > 0;) {
+        if (writes[i].address == address) return writes[i].value;
+    }
+    return initialByte(memory_seed, address);
+}
+
+bool MachineState::store(uint16_t address, uint8_t value) {
+    if (ram) {
+        ram[address] = value;
+        return true;
+    }
+    for (size_t i = 0; i < write_count; ++i) {
+        if (writes[i].address == address) {
+            writes[i].value = value;
+            return true;
+        }
+    }
+    if (write_count == kMaxWrites) return false;
+    writes[write_count++] = MemoryWrite{address, value};
+    return true;
+}
+
+bool isEmulatable(GadgetFunction func) {
+    const GadgetEffectTable& table = GadgetEffectTable::instance();
+    const GadgetEffect& e = table.effect(func);
+    if (func == GadgetFunction::UNKNOWN_GADGET || e.opaque || e.calls || e.pivots) return false;
+    for (const EffectOp* op = table.opsBegin(func); op != table.opsEnd(func); ++op) {
+        switch (op->kind) {
+            case EffectOpKind::SetSP:
+            case EffectOpKind::GetSP:
+            case EffectOpKind::LoadSP:
+            case EffectOpKind::Call:
+            case EffectOpKind::Opaque:
+            case EffectOpKind::Break:
+                return false;
+            default:
+                break;
+        }
+    }
+    return true;
+}
+
+bool emulateGadget(GadgetFunction func, MachineState& s, const uint16_t* words) {
+    const GadgetEffectTable& table = GadgetEffectTable::instance();
+    size_t word = 0;
+    for (const EffectOp* op = table.opsBegin(func); op != table.opsEnd(func); ++op) {
+        uint64_t mask = widthMask(op->dst.width);
+        uint64_t operand = op->src.width != 0 ? s.get(op->src) : static_cast<uint64_t>(static_cast<int64_t>(op->imm));
+        switch (op->kind) {
+            case EffectOpKind::Pop: {
+                uint64_t v = 0;
+                unsigned int count = op->dst.width <= 2 ? 1 : op->dst.width / 2;
+                for (unsigned int i = 0; i < count; ++i) {
+                    if (words) {
+                        v |= static_cast<uint64_t>(words[word++]) << (16 * i);
+                    } else {
+                        v |= static_cast<uint64_t>(loadWord(s, s.sp)) << (16 * i);
+                        s.sp = static_cast<uint16_t>(s.sp + 2);
+                    }
+                }
+                s.set(op->dst, v);
+                break;
+            }
+            case EffectOpKind::Move:
+            case EffectOpKind::LoadImm:
+                s.set(op->dst, operand);
+                break;
+            case EffectOpKind::Add: s.set(op->dst, (s.get(op->dst) + operand) & mask); break;
+            case EffectOpKind::Sub: s.set(op->dst, (s.get(op->dst) - operand) & mask); break;
+            case EffectOpKind::Or: s.set(op->dst, s.get(op->dst) | operand); break;
+            case EffectOpKind::Shl: s.set(op->dst, (s.get(op->dst) << op->imm) & mask); break;
+            case EffectOpKind::Shr: s.set(op->dst, s.get(op->dst) >> op->imm); break;
+            case EffectOpKind::Mul: {
+                // MUL ERn, Rm: ERn = Rn * Rm (8 x 8 -> 16 bit)
+                uint64_t low = s.get(op->dst) & 0xFF;
+                s.set(op->dst, (low * (operand & 0xFF)) & mask);
+                break;
+            }
+            case EffectOpKind::Div: {
+                // DIV ERn, Rm: ERn = ERn / Rm, Rm = phần dư; chia cho 0 cho thương 0xFFFF
+                uint64_t dividend = s.get(op->dst);
+                uint64_t divisor = operand & widthMask(op->src.width);
+                if (divisor == 0) {
+                    s.set(op->dst, mask);
+                } else {
+                    s.set(op->dst, dividend / divisor);
+                    if (op->src.width != 0) s.set(op->src, dividend % divisor);
+                }
+                break;
+            }
+            case EffectOpKind::Load: {
+                uint16_t address = static_cast<uint16_t>(s.get(op->src));
+                uint64_t v = 0;
+                for (unsigned int i = 0; i < op->mem_width; ++i) {
+                    v |= static_cast<uint64_t>(s.load(static_cast<uint16_t>(address + i))) << (8 * i);
+                }
+                s.set(op->dst, v);
+                break;
+            }
+            case EffectOpKind::Store:
+            case EffectOpKind::StoreAdd: {
+                uint16_t address = static_cast<uint16_t>(s.get(op->dst));
+                uint64_t v = op->kind == EffectOpKind::Store ? s.get(op->src) : 0;
+                if (op->kind == EffectOpKind::StoreAdd) {
+                    uint64_t old = 0;
+                    for (unsigned int i = 0; i < op->mem_width; ++i) {
+                        old |= static_cast<uint64_t>(s.load(static_cast<uint16_t>(address + i))) << (8 * i);
+                    }
+                    v = old + operand;
+                }
+                for (unsigned int i = 0; i < op->mem_width; ++i) {
+                    if (!s.store(static_cast<uint16_t>(address + i), static_cast<uint8_t>(v >> (8 * i)))) return false;
+                }
+                break;
+            }
+            case EffectOpKind::Compare: {
+                uint64_t rhs = op->src.width != 0 ? operand : static_cast<uint64_t>(op->imm);
+                s.flag = compare(op->cond, s.get(op->dst), rhs & mask);
+                break;
+            }
+            case EffectOpKind::SetFlag: s.set(op->dst, s.flag ? 1 : 0); break;
+            case EffectOpKind::CondLoadImm:
+            case EffectOpKind::CondMove:
+                if (s.flag) s.set(op->dst, operand);
+                break;
+            case EffectOpKind::Lea: s.ea = static_cast<uint16_t>(op->imm); break;
+            case EffectOpKind::SetSP:
+            case EffectOpKind::GetSP:
+                if (words) return false; // SP chỉ có nghĩa khi stack nằm trong ram
+                s.set(op->dst, operand);
+                break;
+            case EffectOpKind::LoadSP:
+                if (words) return false;
+                s.sp = loadWord(s, static_cast<uint16_t>(operand));
+                break;
+            case EffectOpKind::Call:
+                if (words || !callRom(op->imm, s)) return false;
+                break;
+            case EffectOpKind::SetLR:
+            case EffectOpKind::DisableInt:
+                break; // Không ảnh hưởng thanh ghi dữ liệu / bộ nhớ
+            default:
+                return false; // Opaque, Break
+        }
+    }
+    return true;
+}
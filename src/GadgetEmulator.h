@@ -0,0 +1,55 @@
+#ifndef GADGET_EMULATOR_H
+#define GADGET_EMULATOR_H
+
+#include "GadgetEffect.h"
+#include <array>
+#include <cstdint>
+
+// --- Giả lập gadget trên mô hình tác động ---
+// Chạy các EffectOp của một gadget trên trạng thái máy rút gọn: 16 thanh ghi
+// byte, EA, một cờ so sánh và bộ nhớ "ảo" (nội dung ban đầu suy từ seed, các
+// byte đã ghi được nhớ lại). Đủ để kiểm chứng bằng thử ngẫu nhiên rằng hai dãy
+// gadget có cùng tác động (xem tools/superopt.cpp). Khi đó gadget đổi SP, gọi
+// hàm ROM hay có phần không mô hình hóa được thì không giả lập.
+//
+// Khi người gọi cấp RAM đầy đủ (MachineState::ram) và đặt payload vào đó, có thể chạy
+// cả chuỗi: các pop đọc word tại SP (words == nullptr), các gadget đổi SP (nhảy) chạy được,
+// và lời gọi hàm ROM qua BL (memset, memcpy) được mô hình hóa, kể cả việc hàm đó ghi đè
+// vùng stack ngay dưới SP.
+
+struct MemoryWrite {
+    uint16_t address;
+    uint8_t value;
+};
+
+struct MachineState {
+    static constexpr size_t kMaxWrites = 16;
+
+    std::array<uint8_t, 16> r{};
+    uint16_t ea = 0;
+    bool flag = false;          // Kết quả của Compare gần nhất
+    uint32_t memory_seed = 0;   // Nội dung ban đầu của bộ nhớ
+    uint8_t write_count = 0;
+    std::array<MemoryWrite, kMaxWrites> writes{};
+    // 64 KB do người gọi cấp: đọc/ghi thẳng vào đây (không dùng seed và writes)
+    uint8_t* ram = nullptr;
+    uint16_t sp = 0;            // Chỉ dùng khi stack nằm trong ram (words == nullptr)
+
+    uint64_t get(const RegOperand& op) const;
+    void set(const RegOperand& op, uint64_t value);
+
+    uint8_t load(uint16_t address) const;
+    // Trả về false nếu đã hết chỗ ghi nhớ
+    bool store(uint16_t address, uint8_t value);
+};
+
+// Chạy `func` trên `state`; words: các word mà pop của gadget đọc, theo thứ tự, hoặc nullptr
+// để đọc từ stack trong state.ram (khi đó các op đổi/đọc SP và BL tới memset/memcpy
+// cũng giả lập được).
+// Trả về false nếu gadget có op không giả lập được (state khi đó không còn ý nghĩa).
+bool emulateGadget(GadgetFunction func, MachineState& state, const uint16_t* words);
+
+// Gadget có giả lập được với words cho trước không (không phụ thuộc trạng thái)
+bool isEmulatable(GadgetFunction func);
+
+#endif // GADGET_EMULATOR_H
@@ -0,0 +1,90 @@
+#ifndef GADGET_FUNCTION_H
+#define GADGET_FUNCTION_H
+
+#include "PerfectHash.h"
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+// --- Định nghĩa các loại Gadget ---
+// Sinh từ GadgetTable.def: enum, cách viết chuẩn và bảng tra ngược đều cùng một
+// nguồn, nên không thể có enum thiếu cách viết hoặc cách viết trỏ tới enum không tồn tại.
+enum class GadgetFunction : uint16_t {
+    UNKNOWN_GADGET,
+#define GADGET(name, spelling) name,
+#include "GadgetTable.def"
+#undef GADGET
+};
+
+namespace gadget_table {
+
+// Cách viết theo thứ tự khai báo; chỉ số i ứng với GadgetFunction(i + 1)
+constexpr std::array kSpellings = {
+#define GADGET(name, spelling) std::string_view(spelling),
+#include "GadgetTable.def"
+#undef GADGET
+};
+
+constexpr std::size_t kCount = kSpellings.size();
+
+constexpr auto kLookupTable = perfect_hash::build(kSpellings);
+static_assert(kLookupTable.ok, "GadgetTable.def: cách viết gadget bị trùng, không dựng được perfect hash");
+
+} // namespace gadget_table
+
+// Số giá trị enum (kể cả UNKNOWN_GADGET), dùng để đánh chỉ số mảng dày
+constexpr std::size_t kGadgetFunctionCount = gadget_table::kCount + 1;
+
+constexpr std::string_view gadgetSpelling(GadgetFunction func) {
+    std::size_t index = static_cast<std::size_t>(func);
+    if (index == 0 || index > gadget_table::kCount) return std::string_view();
+    return gadget_table::kSpellings[index - 1];
+}
+
+// Tra cách viết trong file -> enum: một lần perfect hash + một lần so sánh.
+// Trả về UNKNOWN_GADGET nếu không có trong bảng.
+constexpr GadgetFunction lookupGadget(std::string_view spelling) {
+    std::uint16_t idx = gadget_table::kLookupTable.candidate(spelling);
+    if (idx != perfect_hash::kEmptySlot && gadget_table::kSpellings[idx] == spelling) {
+        return static_cast<GadgetFunction>(idx + 1);
+    }
+    return GadgetFunction::UNKNOWN_GADGET;
+}
+
+// Số word 16-bit trên stack mà các lệnh "pop" trong cách viết tiêu thụ
+// (không tính việc lấy địa chỉ trả về). nX-U8 giữ SP chẵn nên pop rN cũng tốn 1 word.
+constexpr uint8_t stackWordsPopped(std::string_view spelling) {
+    uint8_t words = 0;
+    for (std::size_t pos = spelling.find("pop "); pos != std::string_view::npos; pos = spelling.find("pop ", pos + 4)) {
+        std::string_view reg = spelling.substr(pos + 4);
+        if (reg.substr(0, 2) == "qr") words += 4;
+        else if (reg.substr(0, 2) == "xr") words += 2;
+        else words += 1; // er*, r*, ea
+    }
+    return words;
+}
+
+namespace gadget_table {
+
+constexpr std::array<uint8_t, kCount> makePopWords() {
+    std::array<uint8_t, kCount> words{};
+    for (std::size_t i = 0; i < kCount; ++i) words[i] = stackWordsPopped(kSpellings[i]);
+    return words;
+}
+
+constexpr std::array<uint8_t, kCount> kPopWords = makePopWords();
+
+} // namespace gadget_table
+
+constexpr uint8_t gadgetPopWords(GadgetFunction func) {
+    std::size_t index = static_cast<std::size_t>(func);
+    if (index == 0 || index > gadget_table::kCount) return 0;
+    return gadget_table::kPopWords[index - 1];
+}
+
+static_assert(lookupGadget("pop er0") == GadgetFunction::POP_ER0, "Bảng gadget không nhất quán");
+static_assert(gadgetSpelling(GadgetFunction::BRK) == "break", "Bảng gadget không nhất quán");
+static_assert(gadgetPopWords(GadgetFunction::STORE_ER12_ER14_POP_XR4_POP_QR8) == 6, "Đếm pop sai");
+
+#endif // GADGET_FUNCTION_H
@@ -0,0 +1,124 @@
+#include "GadgetImage.h"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+namespace gadget_image {
+
+uint32_t checksum(const uint8_t* data, size_t size) {
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < size; ++i) {
+        h ^= data[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+} // namespace gadget_image
+
+namespace {
+
+bool hostIsLittleEndian() {
+    const uint16_t probe = 1;
+    unsigned char first;
+    std::memcpy(&first, &probe, 1);
+    return first == 1;
+}
+
+} // namespace
+
+GadgetImage::GadgetImage(const std::string& filepath) : file(filepath) {
+    using namespace gadget_image;
+    if (!hostIsLittleEndian()) {
+        throw std::runtime_error("Lỗi: Ảnh gadget chỉ hỗ trợ máy little-endian.");
+    }
+    if (file.size() < sizeof(ImageHeader)) {
+        throw std::runtime_error("Lỗi: File ảnh gadget quá ngắn: " + filepath);
+    }
+
+    ImageHeader header;
+    std::memcpy(&header, file.data(), sizeof(header));
+    if (header.magic != kMagic) {
+        throw std::runtime_error("Lỗi: File không phải ảnh gadget (sai magic): " + filepath);
+    }
+    if (header.version != kVersion || header.header_size != sizeof(ImageHeader)) {
+        throw std::runtime_error("Lỗi: Phiên bản ảnh gadget không được hỗ trợ: " + std::to_string(header.version) +
+                                 " (cần chạy lại gadgetc)");
+    }
+
+    size_t body_size = static_cast<size_t>(header.entry_count) * sizeof(ImageEntry) + header.string_table_size;
+    if (file.size() != sizeof(ImageHeader) + body_size) {
+        throw std::runtime_error("Lỗi: Kích thước ảnh gadget không khớp header: " + filepath);
+    }
+    const uint8_t* body = reinterpret_cast<const uint8_t*>(file.data()) + sizeof(ImageHeader);
+    if (checksum(body, body_size) != header.checksum) {
+        throw std::runtime_error("Lỗi: Checksum ảnh gadget không khớp: " + filepath);
+    }
+
+    entries = reinterpret_cast<const ImageEntry*>(body);
+    entry_count = header.entry_count;
+    strings = reinterpret_cast<const char*>(body) + entry_count * sizeof(ImageEntry);
+    for (size_t i = 0; i < entry_count; ++i) {
+        if (static_cast<size_t>(entries[i].name_offset) + entries[i].name_length > header.string_table_size) {
+            throw std::runtime_error("Lỗi: Mục ảnh gadget trỏ ra ngoài bảng chuỗi: " + filepath);
+        }
+    }
+}
+
+bool GadgetImage::find(uint16_t function, unsigned int& address) const {
+    const gadget_image::ImageEntry* end = entries + entry_count;
+    const gadget_image::ImageEntry* it = std::lower_bound(entries, end, function,
+        [](const gadget_image::ImageEntry& e, uint16_t f) { return e.function < f; });
+    if (it == end || it->function != function) {
+        return false;
+    }
+    address = it->address;
+    return true;
+}
+
+void GadgetImage::write(const std::string& filepath, std::vector<Record> records) {
+    using namespace gadget_image;
+    if (!hostIsLittleEndian()) {
+        throw std::runtime_error("Lỗi: Ảnh gadget chỉ hỗ trợ máy little-endian.");
+    }
+    std::stable_sort(records.begin(), records.end(),
+                     [](const Record& a, const Record& b) { return a.function < b.function; });
+
+    std::vector<ImageEntry> table;
+    std::string string_table;
+    table.reserve(records.size());
+    for (const Record& r : records) {
+        ImageEntry e{};
+        e.function = r.function;
+        e.address = r.address;
+        e.name_offset = static_cast<uint32_t>(string_table.size());
+        e.name_length = static_cast<uint32_t>(r.name.size());
+        string_table += r.name;
+        table.push_back(e);
+    }
+
+    std::vector<uint8_t> body(table.size() * sizeof(ImageEntry) + string_table.size());
+    if (!table.empty()) {
+        std::memcpy(body.data(), table.data(), table.size() * sizeof(ImageEntry));
+    }
+    std::memcpy(body.data() + table.size() * sizeof(ImageEntry), string_table.data(), string_table.size());
+
+    ImageHeader header{};
+    header.magic = kMagic;
+    header.version = kVersion;
+    header.header_size = sizeof(ImageHeader);
+    header.entry_count = static_cast<uint32_t>(table.size());
+    header.string_table_size = static_cast<uint32_t>(string_table.size());
+    header.checksum = checksum(body.data(), body.size());
+
+    std::ofstream out(filepath, std::ios::binary | std::ios::trunc);
+    if (!out.is_open()) {
+        throw std::runtime_error("Không thể ghi file ảnh gadget: " + filepath);
+    }
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.write(reinterpret_cast<const char*>(body.data()), static_cast<std::streamsize>(body.size()));
+    if (!out) {
+        throw std::runtime_error("Lỗi khi ghi file ảnh gadget: " + filepath);
+    }
+}
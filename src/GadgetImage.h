@@ -0,0 +1,80 @@
+#ifndef GADGET_IMAGE_H
+#define GADGET_IMAGE_H
+
+#include "MappedFile.h"
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// --- Ảnh nhị phân của database gadget ---
+// Được tạo bởi công cụ gadgetc từ file văn bản (data/nx_u8_gadget.txt) và nạp
+// bằng mmap: không cần parse gì khi khởi động. Bố cục (little-endian):
+//
+//   ImageHeader                       (24 byte)
+//   ImageEntry[entry_count]           (16 byte mỗi mục, sắp xếp theo function)
+//   bảng chuỗi                        (string_table_size byte, không có '\0')
+//
+// checksum = FNV-1a 32-bit trên toàn bộ phần sau header.
+namespace gadget_image {
+
+constexpr uint32_t kMagic = 0x44475846; // "FXGD"
+constexpr uint16_t kVersion = 1;
+
+struct ImageHeader {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t header_size;
+    uint32_t entry_count;
+    uint32_t string_table_size;
+    uint32_t checksum;
+    uint32_t reserved;
+};
+
+struct ImageEntry {
+    uint16_t function;    // Giá trị của GadgetFunction
+    uint16_t reserved;
+    uint32_t address;     // Địa chỉ gadget
+    uint32_t name_offset; // Vị trí cách viết gốc trong bảng chuỗi
+    uint32_t name_length;
+};
+
+static_assert(sizeof(ImageHeader) == 24, "ImageHeader phải đúng 24 byte");
+static_assert(sizeof(ImageEntry) == 16, "ImageEntry phải đúng 16 byte");
+
+uint32_t checksum(const uint8_t* data, size_t size);
+
+} // namespace gadget_image
+
+class GadgetImage {
+public:
+    // Một mục dùng khi ghi ảnh
+    struct Record {
+        uint16_t function;
+        uint32_t address;
+        std::string name;
+    };
+
+    // Ánh xạ và kiểm tra ảnh (magic, phiên bản, kích thước, checksum); lỗi thì ném runtime_error
+    explicit GadgetImage(const std::string& filepath);
+
+    // Ghi ảnh ra file; records được sắp xếp theo function trước khi ghi
+    static void write(const std::string& filepath, std::vector<Record> records);
+
+    size_t size() const { return entry_count; }
+    const gadget_image::ImageEntry& entry(size_t index) const { return entries[index]; }
+    std::string_view name(size_t index) const {
+        return std::string_view(strings + entries[index].name_offset, entries[index].name_length);
+    }
+
+    // Tìm kiếm nhị phân trên bảng đã sắp xếp; trả về false nếu không có
+    bool find(uint16_t function, unsigned int& address) const;
+
+private:
+    MappedFile file;
+    const gadget_image::ImageEntry* entries = nullptr;
+    const char* strings = nullptr;
+    size_t entry_count = 0;
+};
+
+#endif // GADGET_IMAGE_H
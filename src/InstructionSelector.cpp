@@ -0,0 +1,1496 @@
+#include "InstructionSelector.h"
+#include "ROPGenerator.h"
+#include <algorithm>
+#include <functional>
+#include <iterator>
+#include <stdexcept>
+
+namespace {
+
+using NT = Nonterminal;
+using GF = GadgetFunction;
+
+constexpr int8_t kNoImm = -1;
+constexpr int8_t kSelfImm = 2;  // Ô pop nhận giá trị của chính node Const
+constexpr int8_t kFixedImm = 3; // Ô pop nhận hằng cố định `fixed` của bước
+
+constexpr size_t kMaxRuleSteps = 24;
+constexpr size_t kMaxMacroGadgets = 3; // Độ dài tối đa một bước của phép nhân với hằng
+
+// Ghi 8 byte hằng: pop ea (địa chỉ); pop qr0 (4 word); [ea]=qr0
+constexpr GF kWideStoreSteps[] = {GF::POP_EA, GF::POP_QR0, GF::STORE_EA_QR0};
+
+// Đưa ER0 về 0/1 (er2 phải bằng 0): r0 = (er0 > 0), r1 = 0
+constexpr GF kBooleanSteps[] = {GF::CMP_ER0_ER2_GT_R0_ZERO_OR_ONE_RET, GF::MOV_R1_ZERO_RET};
+// Rẽ nhánh theo ER0 = 0/1: er2 = er0 và pop er8 (địa chỉ bảng nhảy), er0 = bảng + 2 * er0,
+// er8 = er0, sp=[er8]
+constexpr GF kBranchSteps[] = {GF::MOV_ER2_ER0_ER0_ER2_POP_ER8_RET, GF::ADD_ER0_ER2_RET, GF::ADD_ER0_ER8_RET,
+                               GF::MOV_ER8_ER0_RET, GF::LOAD_SP_FROM_ER8_POP_ER8};
+// Nhảy không điều kiện: pop er8 (địa chỉ một word chứa đích), sp=[er8]
+constexpr GF kJumpSteps[] = {GF::POP_ER8, GF::LOAD_SP_FROM_ER8_POP_ER8};
+
+// Một gadget trong mẫu; các word pop của nó là đệm 0, trừ các word trong imm_words khi imm >= 0
+struct RuleStep {
+    GF func;
+    int8_t imm = kNoImm;     // Toán hạng Imm (0/1), kSelfImm hoặc kFixedImm
+    uint8_t imm_words = 1;   // Bit w: word pop thứ w nhận giá trị của toán hạng
+    uint16_t fixed = 0;      // Giá trị cho kFixedImm
+};
+
+} // namespace
+
+struct InstructionSelector::Rule {
+    IrOp op;
+    NT result;
+    std::array<NT, 2> operands;
+    int32_t imm_value;  // Giá trị bắt buộc của hằng (Const, hoặc hằng của MulConst/DivConst; -1: bất kỳ)
+    uint8_t step_count;
+    std::array<RuleStep, kMaxRuleSteps> steps;
+};
+
+namespace {
+
+using Rule = InstructionSelector::Rule;
+
+constexpr Rule leaf(NT result, GF pop) {
+    return Rule{IrOp::Const, result, {NT::None, NT::None}, -1, 1, {{{pop, kSelfImm}, {}}}};
+}
+constexpr Rule rule(IrOp op, NT result, NT a, NT b, GF func, int32_t imm_value = -1) {
+    return Rule{op, result, {a, b}, imm_value, 1, {{{func}, {}}}};
+}
+constexpr Rule chain(NT to, NT from, GF func) {
+    return Rule{IrOp::Chain, to, {from, NT::None}, -1, 1, {{{func}, {}}}};
+}
+
+// Bảng luật. Thêm gadget mới vào GadgetTable.def rồi thêm luật ở đây là đủ:
+// chi phí và thanh ghi bị phá được suy ra từ mô hình tác động (GadgetEffect).
+constexpr Rule kRules[] = {
+    // Hằng số
+    leaf(NT::ER0, GF::POP_ER0),
+    leaf(NT::ER2, GF::POP_ER2),
+    leaf(NT::ER4, GF::POP_ER4),
+    leaf(NT::ER8, GF::POP_ER8),
+    leaf(NT::ER12, GF::POP_ER12),
+    rule(IrOp::Const, NT::ER0, NT::None, NT::None, GF::MOV_ER0_ONE_RET, 1),
+
+    // Đọc word
+    rule(IrOp::Load, NT::ER0, NT::ER0, NT::None, GF::LOAD_ER0_FROM_ER0_POP_XR8_RET),
+    rule(IrOp::Load, NT::ER0, NT::ER2, NT::None, GF::LOAD_ER0_FROM_ER2_R2_NINE_RET),
+    rule(IrOp::Load, NT::ER8, NT::ER0, NT::None, GF::LOAD_ER8_FROM_ER0_RET),
+    rule(IrOp::Load, NT::ER4, NT::ER8, NT::None, GF::LOAD_ER4_FROM_ER8_POP_ER8_RET),
+
+    // Số học
+    rule(IrOp::Add, NT::ER0, NT::ER0, NT::ER2, GF::ADD_ER0_ER2_RET),
+    rule(IrOp::Add, NT::ER0, NT::ER0, NT::ER4, GF::ADD_ER0_ER4_RET),
+    rule(IrOp::Add, NT::ER0, NT::ER0, NT::ER8, GF::ADD_ER0_ER8_RET),
+    rule(IrOp::Add, NT::ER2, NT::ER2, NT::ER8, GF::ADD_ER2_ER8_RET),
+    rule(IrOp::Add, NT::ER4, NT::ER4, NT::ER0, GF::ADD_ER4_ER0_R8_RET),
+    rule(IrOp::Add, NT::ER0, NT::ER0, NT::Imm, GF::ADD_ER0_ONE_RET, 1),
+    rule(IrOp::Sub, NT::ER0, NT::ER0, NT::ER2, GF::SUB_ER0_ER2_RET),
+    rule(IrOp::Sub, NT::ER0, NT::ER0, NT::ER12, GF::SUB_ER0_ER12_POP_ER8_POP_ER12_RET),
+    rule(IrOp::Shl4, NT::ER0, NT::ER0, NT::None, GF::SLL_ER0_4_RET),
+    // MUL/DIV tổng quát (toán hạng không phải hằng): er0 = r0 * r2 + er4 nên er4 phải là 0
+    Rule{IrOp::Mul, NT::ER0, {NT::ER0, NT::ER2}, -1, 2,
+         {{{GF::POP_ER4, kFixedImm, 1, 0}, {GF::MUL_ER0_R2_ER2_ER0_ADD_ER0_ER4_RET}}}},
+    rule(IrOp::Div, NT::ER0, NT::ER0, NT::ER2, GF::DIV_ER0_R2_RET),
+
+    // So sánh không dấu: r0 = (kid0 > kid1), r1 = 0
+    Rule{IrOp::Greater, NT::ER0, {NT::ER0, NT::ER2}, -1, 2,
+         {{{GF::CMP_ER0_ER2_GT_R0_ZERO_OR_ONE_RET}, {GF::MOV_R1_ZERO_RET}}}},
+    Rule{IrOp::Greater, NT::ER0, {NT::ER2, NT::ER0}, -1, 2,
+         {{{GF::CMP_ER2_ER0_GT_R0_ZERO_OR_ONE_RET}, {GF::MOV_R1_ZERO_RET}}}},
+
+    // Ghi word
+    rule(IrOp::Store, NT::Stmt, NT::ER2, NT::ER0, GF::STORE_ER2_ER0_R2_ZERO_POP_ER4_RET),
+    rule(IrOp::Store, NT::Stmt, NT::ER0, NT::ER2, GF::STORE_ER0_ER2_RET),
+    rule(IrOp::Store, NT::Stmt, NT::ER4, NT::ER0, GF::STORE_ER4_ER0_POP_ER0_RET),
+    rule(IrOp::Store, NT::Stmt, NT::ER8, NT::ER2, GF::STORE_ER8_ER2_POP_XR8),
+
+    // Ghi byte
+    rule(IrOp::StoreByte, NT::Stmt, NT::ER0, NT::ER2, GF::STORE_ER0_R2_RET),
+    rule(IrOp::StoreByte, NT::Stmt, NT::ER0, NT::ER2, GF::STORE_ER0_R2),
+    rule(IrOp::StoreByte, NT::Stmt, NT::ER2, NT::ER0, GF::STORE_ER2_R0_R2_ZERO),
+    // r2 = r0 rồi pop địa chỉ hằng thẳng vào er0: không cần nạp địa chỉ riêng
+    Rule{IrOp::StoreByte, NT::Stmt, {NT::Imm, NT::ER0}, -1, 2,
+         {{{GF::MOV_R2_R0_POP_ER0, 0}, {GF::STORE_ER0_R2_RET}}}},
+
+    // Chuyển giữa các thanh ghi
+    chain(NT::ER2, NT::ER0, GF::MOV_ER2_ER0_ER0_ER2_POP_ER8_RET),
+    chain(NT::ER2, NT::ER0, GF::MOV_ER2_ER0_R0_R4_R1_ZERO_POP_XR4_RET),
+    chain(NT::ER0, NT::ER2, GF::MOV_ER0_ER2_RET),
+    chain(NT::ER8, NT::ER0, GF::MOV_ER8_ER0_RET),
+    chain(NT::ER0, NT::ER8, GF::MOV_ER0_ER8_RET),
+    chain(NT::ER0, NT::ER4, GF::MOV_ER0_ER4_POP_ER4),
+    chain(NT::ER0, NT::ER12, GF::MOV_ER0_ER12_POP_ER12_RET),
+};
+
+// Nonterminal của cặp ERn; None nếu bộ chọn không dùng cặp này
+constexpr NT pairNt(unsigned int n) {
+    switch (n) {
+        case 0: return NT::ER0;
+        case 2: return NT::ER2;
+        case 4: return NT::ER4;
+        case 8: return NT::ER8;
+        case 12: return NT::ER12;
+        default: return NT::None;
+    }
+}
+
+// Một dòng của bảng superopt -> luật. Trả về false nếu bộ chọn không dùng được dòng này.
+bool ruleFromSuperopt(const SuperoptEntry& entry, Rule& r) {
+    NT dst = pairNt(entry.dst);
+    NT src = pairNt(entry.src);
+    int8_t imm = kNoImm;
+    switch (entry.goal) {
+        case SuperoptGoal::LoadConst:
+            r = Rule{IrOp::Const, dst, {NT::None, NT::None}, -1, 0, {}};
+            imm = kSelfImm;
+            break;
+        case SuperoptGoal::Copy:
+            r = Rule{IrOp::Chain, dst, {src, NT::None}, -1, 0, {}};
+            if (src == NT::None) return false;
+            break;
+        case SuperoptGoal::AddConst:
+            r = Rule{IrOp::Add, dst, {dst, NT::Imm}, -1, 0, {}};
+            imm = 1;
+            break;
+        case SuperoptGoal::StoreAbs:
+            r = Rule{IrOp::Store, NT::Stmt, {NT::Imm, src}, -1, 0, {}};
+            imm = 0;
+            if (src == NT::None) return false;
+            break;
+        default:
+            return false;
+    }
+    if (r.result == NT::None || entry.gadgets.size() > r.steps.size()) return false;
+
+    unsigned int first_word = 0;
+    for (GF func : entry.gadgets) {
+        RuleStep& step = r.steps[r.step_count++];
+        step.func = func;
+        step.imm_words = static_cast<uint8_t>((entry.param_words >> first_word) & ((1u << gadgetPopWords(func)) - 1));
+        step.imm = step.imm_words != 0 ? imm : kNoImm;
+        first_word += gadgetPopWords(func);
+    }
+    return true;
+}
+
+constexpr RegMask maskOf(NT nt) {
+    switch (nt) {
+        case NT::ER0: return reg::er(0);
+        case NT::ER2: return reg::er(2);
+        case NT::ER4: return reg::er(4);
+        case NT::ER8: return reg::er(8);
+        case NT::ER12: return reg::er(12);
+        default: return 0;
+    }
+}
+
+// Chỉ số n của cặp ERn ứng với một nonterminal thanh ghi
+constexpr unsigned int pairOf(NT nt) {
+    switch (nt) {
+        case NT::ER2: return 2;
+        case NT::ER4: return 4;
+        case NT::ER8: return 8;
+        case NT::ER12: return 12;
+        default: return 0;
+    }
+}
+
+constexpr NT kRegisterNts[] = {NT::ER0, NT::ER2, NT::ER4, NT::ER8, NT::ER12};
+
+constexpr bool isCommutative(IrOp op) { return op == IrOp::Add || op == IrOp::Mul; }
+
+constexpr bool isComparisonOp(TokenType op) {
+    return op == TokenType::LESS || op == TokenType::GREATER || op == TokenType::LESS_EQUAL ||
+           op == TokenType::GREATER_EQUAL || op == TokenType::EQUAL || op == TokenType::NOT_EQUAL;
+}
+
+// Node mang hằng trong value mà luật có thể đòi đúng giá trị (Rule::imm_value)
+constexpr bool hasConstantValue(IrOp op) {
+    return op == IrOp::Const || op == IrOp::MulConst || op == IrOp::DivConst;
+}
+
+constexpr size_t arity(IrOp op) {
+    switch (op) {
+        case IrOp::Const:
+        case IrOp::InER0:
+            return 0;
+        case IrOp::Load:
+        case IrOp::Shl4:
+        case IrOp::MulConst:
+        case IrOp::DivConst:
+        case IrOp::Chain:
+            return 1;
+        default:
+            return 2;
+    }
+}
+
+// Ước lượng số chu kỳ của một gadget từ các EffectOp của nó (kể cả pop pc/rt cuối)
+uint32_t estimateCycles(GF func) {
+    const GadgetEffectTable& table = GadgetEffectTable::instance();
+    uint32_t cycles = 3;
+    for (const EffectOp* op = table.opsBegin(func); op != table.opsEnd(func); ++op) {
+        switch (op->kind) {
+            case EffectOpKind::Pop: cycles += op->dst.width <= 2 ? 2 : op->dst.width; break;
+            case EffectOpKind::Load:
+            case EffectOpKind::Store: cycles += 1 + (op->mem_width + 1) / 2; break;
+            case EffectOpKind::StoreAdd: cycles += 4; break;
+            case EffectOpKind::Mul: cycles += 9; break;
+            case EffectOpKind::Div: cycles += 17; break;
+            case EffectOpKind::Call: cycles += 200; break;
+            case EffectOpKind::Opaque: cycles += 1000; break;
+            default: cycles += 1; break;
+        }
+    }
+    return cycles;
+}
+
+// --- Mô hình tuyến tính cho phép nhân với hằng ---
+// Mỗi cặp ER0..ER14 giữ y * Y + x * X (mod 2^16), với Y là giá trị của ER0 khi
+// bắt đầu một "bước" và X là số bị nhân (giữ nguyên trong một cặp cố định),
+// hoặc một giá trị không biết. Gadget chỉ gồm pop/chép/cộng/trừ/dịch trái giữa
+// các cặp biến đổi các hệ số này tuyến tính; pop của gadget chỉ gồm pop nạp hằng 0.
+struct Factor {
+    int32_t y = -1; // -1: không biết
+    int32_t x = 0;
+
+    bool known() const { return y >= 0; }
+    bool operator==(const Factor& o) const { return y == o.y && x == o.x; }
+};
+using FactorState = std::array<Factor, 8>;
+
+constexpr Factor kUnknownFactor{};
+
+// Chỉ số cặp (n/2) nếu toán hạng là đúng một cặp ERn, ngược lại -1
+int pairIndex(const RegOperand& op) {
+    return op.width == 2 && op.base < 16 && op.base % 2 == 0 ? op.base / 2 : -1;
+}
+
+void forgetPairs(FactorState& s, const RegOperand& op) {
+    if (op.base >= 16) return; // EA, SP: không phải cặp dữ liệu
+    for (unsigned int b = op.base; b < op.base + op.width && b < 16; ++b) {
+        s[b / 2] = kUnknownFactor;
+    }
+}
+
+bool isLinearGadget(GF func) {
+    const GadgetEffectTable& table = GadgetEffectTable::instance();
+    const GadgetEffect& e = table.effect(func);
+    if (e.op_count == 0 || e.opaque || e.calls || e.pivots || e.loads || e.stores) return false;
+    for (const EffectOp* op = table.opsBegin(func); op != table.opsEnd(func); ++op) {
+        switch (op->kind) {
+            case EffectOpKind::Pop:
+            case EffectOpKind::LoadImm:
+            case EffectOpKind::SetLR:
+            case EffectOpKind::Move:
+            case EffectOpKind::Add:
+            case EffectOpKind::Sub:
+            case EffectOpKind::Shl:
+                break;
+            default:
+                return false;
+        }
+    }
+    return true;
+}
+
+// Gadget chỉ gồm pop: mọi word pop của nó được cho mang hằng 0
+bool popsOnly(GF func) {
+    const GadgetEffect& e = gadgetEffect(func);
+    return e.op_count > 0 && e.writes == e.pop_writes;
+}
+
+void applyLinear(GF func, FactorState& s) {
+    const GadgetEffectTable& table = GadgetEffectTable::instance();
+    bool zero_pops = popsOnly(func);
+    for (const EffectOp* op = table.opsBegin(func); op != table.opsEnd(func); ++op) {
+        int dst = pairIndex(op->dst);
+        int src = pairIndex(op->src);
+        switch (op->kind) {
+            case EffectOpKind::Pop:
+                if (dst >= 0 || (op->dst.width > 2 && op->dst.base % 2 == 0)) {
+                    for (unsigned int b = op->dst.base; b < op->dst.base + op->dst.width && b < 16; b += 2) {
+                        s[b / 2] = zero_pops ? Factor{0, 0} : kUnknownFactor;
+                    }
+                } else {
+                    forgetPairs(s, op->dst);
+                }
+                break;
+            case EffectOpKind::LoadImm:
+                if (dst >= 0 && op->imm == 0) s[dst] = Factor{0, 0};
+                else forgetPairs(s, op->dst);
+                break;
+            case EffectOpKind::Move:
+                if (op->dst.base == op->src.base && op->dst.width == op->src.width) break; // r8 = r8
+                if (dst >= 0 && src >= 0) s[dst] = s[src];
+                else forgetPairs(s, op->dst);
+                break;
+            case EffectOpKind::Add:
+            case EffectOpKind::Sub:
+                if (dst < 0) {
+                    forgetPairs(s, op->dst);
+                } else if (op->src.width == 0) {
+                    if (op->imm != 0) s[dst] = kUnknownFactor; // Cộng hằng: không còn tuyến tính
+                } else if (src < 0 || !s[dst].known() || !s[src].known()) {
+                    s[dst] = kUnknownFactor;
+                } else {
+                    int32_t sign = op->kind == EffectOpKind::Add ? 1 : -1;
+                    s[dst] = Factor{(s[dst].y + sign * s[src].y) & 0xFFFF, (s[dst].x + sign * s[src].x) & 0xFFFF};
+                }
+                break;
+            case EffectOpKind::Shl:
+                if (dst >= 0 && s[dst].known()) {
+                    s[dst] = Factor{(s[dst].y << op->imm) & 0xFFFF, (s[dst].x << op->imm) & 0xFFFF};
+                } else {
+                    forgetPairs(s, op->dst);
+                }
+                break;
+            default:
+                break; // SetLR
+        }
+    }
+}
+
+} // namespace
+
+InstructionSelector::InstructionSelector(const GadgetDB& db, RomHandle rom, const ByteConstraints& constraints,
+                                         const SymbolTable& symbols, unsigned int scratch_base)
+    : gadget_db(db), rom(rom), byte_constraints(constraints), symbol_table(symbols), scratch_base(scratch_base) {
+    rules.assign(std::begin(kRules), std::end(kRules));
+    for (const SuperoptEntry& entry : gadget_db.model(rom).superopt) {
+        Rule r;
+        if (ruleFromSuperopt(entry, r)) rules.push_back(r);
+    }
+    if (rules.size() >= kNoRule) {
+        throw std::logic_error("Lỗi: Quá nhiều luật chọn gadget.");
+    }
+
+    for (size_t i = 0; i < rules.size(); ++i) {
+        activateRule(i);
+    }
+
+    // Các node ảo cho spill: gán nhãn một lần, địa chỉ ô tạm được điền lúc phát
+    labelNode(addNode(IrOp::InER0));
+    labelNode(addNode(IrOp::Const));
+    labelNode(addNode(IrOp::Store, kSlotStoreAddress, kValueInER0));
+    for (size_t keep = 0; keep < static_cast<size_t>(NT::Stmt); ++keep) {
+        RegMask avoid = maskOf(static_cast<NT>(keep));
+        uint32_t address = addNode(IrOp::Const);
+        labelNode(address, avoid);
+        labelNode(addNode(IrOp::Load, address), avoid);
+    }
+}
+
+InstructionSelector::~InstructionSelector() = default;
+
+bool InstructionSelector::activateRule(size_t index) {
+    const Rule& r = rules[index];
+    ActiveRule active{static_cast<uint16_t>(index), SelectionCost{}, 0};
+    for (size_t s = 0; s < r.step_count; ++s) {
+        GF func = r.steps[s].func;
+        const GadgetCandidate* candidate = gadget_db.isAvailable(rom, func)
+            ? gadget_db.selectCandidate(rom, func, byte_constraints)
+            : nullptr;
+        if (!candidate) {
+            return false;
+        }
+        active.cost = active.cost + SelectionCost{candidate->chainBytes(), estimateCycles(func)};
+        active.clobbers |= gadget_db.effect(func).writes;
+    }
+    active_rules.push_back(active);
+    return true;
+}
+
+bool InstructionSelector::ensureConstantRules(IrOp op, uint32_t value) {
+    uint32_t key = (static_cast<uint32_t>(op) << 16) | value;
+    auto it = constant_rules.find(key);
+    if (it != constant_rules.end()) return it->second;
+
+    std::vector<Rule> candidates;
+    if (op == IrOp::MulConst) {
+        Rule r;
+        if (planMultiply(value, r)) candidates.push_back(r);
+    } else {
+        // x / (16^k * m): dịch phải k lần 4 bit (qr0 >> 4 kéo bit từ er2 vào nên er2 phải
+        // là 0 trước đó; sau tối đa 3 lần dịch phần đó vẫn là 0), rồi DIV cho m < 256.
+        // Thử mọi k hợp lệ; bộ chọn so chi phí (và thanh ghi bị phá) giữa các cách.
+        for (uint32_t k = 0, divisor = value; k <= 3; ++k, divisor /= 16) {
+            if (divisor < 256) {
+                Rule r{IrOp::DivConst, NT::ER0, {NT::ER0, NT::None}, static_cast<int32_t>(value), 0, {}};
+                if (k > 0) {
+                    r.steps[r.step_count++] = RuleStep{GF::POP_ER2, kFixedImm, 1, 0};
+                    for (uint32_t i = 0; i < k; ++i) r.steps[r.step_count++] = RuleStep{GF::SRL_QR0_4_RET};
+                }
+                if (divisor != 1) {
+                    r.steps[r.step_count++] = RuleStep{GF::POP_ER2, kFixedImm, 1, static_cast<uint16_t>(divisor)};
+                    r.steps[r.step_count++] = RuleStep{GF::DIV_ER0_R2_RET};
+                }
+                candidates.push_back(r);
+            }
+            if (divisor % 16 != 0 || divisor == 0) break;
+        }
+    }
+
+    bool enabled = false;
+    for (const Rule& r : candidates) {
+        if (rules.size() >= kNoRule) {
+            throw std::logic_error("Lỗi: Quá nhiều luật chọn gadget.");
+        }
+        rules.push_back(r);
+        if (activateRule(rules.size() - 1)) {
+            enabled = true;
+        } else {
+            rules.pop_back();
+        }
+    }
+    constant_rules.emplace(key, enabled);
+    return enabled;
+}
+
+// --- Nhân với hằng bằng dịch/cộng/trừ ---
+// Bước (macro): dãy <= kMaxMacroGadgets gadget tuyến tính biến ER0 = v * X thành
+// (alpha * v + beta) * X, với X nằm yên trong cặp `keep` (keep = -1: không cần X,
+// beta = 0). Bước chuẩn bị chép X từ ER0 sang cặp keep. Mọi bước được tìm một
+// lần trên mô hình tuyến tính. Vì mọi phép nhân đều bắt đầu từ v = 1, một lượt
+// Dijkstra trên 2^16 giá trị của v cho mỗi keep cho ngay dãy rẻ nhất tới mọi hằng;
+// phép nhân với hằng sau đó chỉ còn là lần ngược bảng.
+class MultiplyPlanner {
+public:
+    using CostFn = std::function<SelectionCost(GF)>;
+
+    MultiplyPlanner(const std::vector<GF>& linear, CostFn cost);
+
+    // Dãy gadget cho ER0 *= factor (mod 2^16); false nếu không tìm được
+    bool plan(uint32_t factor, std::vector<GF>& gadgets);
+
+private:
+    static constexpr size_t kKeeps = 9;       // keep = -1, 1..7 (chỉ số = keep + 1)
+    static constexpr size_t kValues = 0x10000;
+    static constexpr uint16_t kNone = 0xFFFF;
+
+    struct Macro {
+        int8_t keep = -1;
+        bool setup = false;
+        uint16_t alpha = 1;
+        uint16_t beta = 0;
+        SelectionCost cost{};
+        uint8_t length = 0;
+        std::array<GF, kMaxMacroGadgets> gadgets{};
+    };
+    // Đường rẻ nhất từ v = 1 tới mọi v, với X nằm trong một cặp keep
+    struct Table {
+        std::vector<SelectionCost> cost;
+        std::vector<uint16_t> via;  // Bước cuối (chỉ số trong `macros`); kNone: chưa tới / v = 1
+        std::vector<uint16_t> from; // v trước bước cuối
+    };
+
+    std::vector<Macro> macros;
+    std::array<uint16_t, kKeeps> setup;       // Bước chuẩn bị rẻ nhất cho mỗi keep
+    std::array<Table, kKeeps> tables;
+    bool tables_ready = false;
+
+    void addMacro(const Macro& macro);
+    void buildTable(size_t keep);
+};
+
+MultiplyPlanner::MultiplyPlanner(const std::vector<GF>& linear, CostFn cost) {
+    setup.fill(kNone);
+    // Duyệt mọi dãy <= kMaxMacroGadgets gadget từ `start`. Bước chuẩn bị: ER0 = X lúc đầu
+    // (y = 1), cần cả ER0 và cặp keep bằng X lúc cuối.
+    Macro current;
+    std::function<void(const FactorState&, size_t)> walk = [&](const FactorState& state, size_t depth) {
+        if (depth > 0) {
+            const Factor& er0 = state[0];
+            int8_t keep = current.keep;
+            bool valid = current.setup ? er0 == Factor{1, 0} && state[keep] == Factor{1, 0}
+                                       : er0.known() && (keep < 0 ? er0.x == 0 : state[keep] == Factor{0, 1});
+            if (valid) {
+                Macro found = current;
+                found.alpha = static_cast<uint16_t>(current.setup ? 1 : er0.y);
+                found.beta = static_cast<uint16_t>(current.setup ? 0 : er0.x);
+                addMacro(found);
+            }
+        }
+        if (depth == kMaxMacroGadgets) return;
+        for (GF func : linear) {
+            FactorState next = state;
+            applyLinear(func, next);
+            if (next == state || !next[0].known()) continue;
+            SelectionCost saved = current.cost;
+            current.gadgets[depth] = func;
+            current.length = static_cast<uint8_t>(depth + 1);
+            current.cost = current.cost + cost(func);
+            walk(next, depth + 1);
+            current.cost = saved;
+        }
+    };
+
+    for (int8_t keep = -1; keep < 8; ++keep) {
+        if (keep == 0) continue;
+        FactorState start;
+        start.fill(kUnknownFactor);
+        start[0] = Factor{1, 0};
+        if (keep > 0) {
+            current = Macro{keep, true};
+            walk(start, 0);
+            start[keep] = Factor{0, 1};
+        }
+        current = Macro{keep, false};
+        walk(start, 0);
+    }
+}
+
+void MultiplyPlanner::addMacro(const Macro& macro) {
+    // Bước đồng nhất (alpha = 1, beta = 0) không bao giờ có ích
+    if (!macro.setup && macro.alpha == 1 && macro.beta == 0) return;
+    for (Macro& m : macros) {
+        if (m.keep == macro.keep && m.setup == macro.setup && m.alpha == macro.alpha && m.beta == macro.beta) {
+            if (macro.cost < m.cost) m = macro;
+            return;
+        }
+    }
+    macros.push_back(macro);
+}
+
+void MultiplyPlanner::buildTable(size_t k) {
+    Table& table = tables[k];
+    table.cost.assign(kValues, SelectionCost{UINT32_MAX, UINT32_MAX});
+    table.via.assign(kValues, kNone);
+    table.from.assign(kValues, kNone);
+
+    std::vector<uint16_t> steps;
+    for (size_t m = 0; m < macros.size(); ++m) {
+        if (static_cast<size_t>(macros[m].keep + 1) == k && !macros[m].setup) steps.push_back(static_cast<uint16_t>(m));
+    }
+
+    using Entry = std::pair<SelectionCost, uint16_t>;
+    auto later = [](const Entry& a, const Entry& b) { return b.first < a.first; };
+    std::vector<Entry> heap{{SelectionCost{}, 1}};
+    table.cost[1] = SelectionCost{};
+    while (!heap.empty()) {
+        std::pop_heap(heap.begin(), heap.end(), later);
+        Entry top = heap.back();
+        heap.pop_back();
+        uint16_t v = top.second;
+        if (table.cost[v] < top.first) continue; // Đã có đường rẻ hơn
+        for (uint16_t m : steps) {
+            const Macro& macro = macros[m];
+            uint16_t next = static_cast<uint16_t>(macro.alpha * v + macro.beta);
+            SelectionCost cost = top.first + macro.cost;
+            if (!(cost < table.cost[next])) continue;
+            table.cost[next] = cost;
+            table.via[next] = m;
+            table.from[next] = v;
+            heap.push_back({cost, next});
+            std::push_heap(heap.begin(), heap.end(), later);
+        }
+    }
+}
+
+bool MultiplyPlanner::plan(uint32_t factor, std::vector<GF>& gadgets) {
+    if (!tables_ready) {
+        for (size_t m = 0; m < macros.size(); ++m) {
+            size_t k = static_cast<size_t>(macros[m].keep + 1);
+            if (macros[m].setup && (setup[k] == kNone || macros[m].cost < macros[setup[k]].cost)) {
+                setup[k] = static_cast<uint16_t>(m);
+            }
+        }
+        for (size_t k = 0; k < kKeeps; ++k) {
+            // Keep không có bước nào dùng X thì không hơn keep = -1
+            bool uses_x = false;
+            for (const Macro& m : macros) {
+                uses_x |= static_cast<size_t>(m.keep + 1) == k && !m.setup && m.beta != 0;
+            }
+            if (k == 0 || (setup[k] != kNone && uses_x)) buildTable(k);
+        }
+        tables_ready = true;
+    }
+
+    uint16_t target = static_cast<uint16_t>(factor);
+    size_t best = kKeeps;
+    SelectionCost best_cost{UINT32_MAX, UINT32_MAX};
+    for (size_t k = 0; k < kKeeps; ++k) {
+        const Table& table = tables[k];
+        if (table.cost.empty() || table.cost[target].bytes == UINT32_MAX) continue;
+        SelectionCost cost = k > 0 ? macros[setup[k]].cost + table.cost[target] : table.cost[target];
+        if (cost < best_cost) {
+            best = k;
+            best_cost = cost;
+        }
+    }
+    if (best == kKeeps) return false;
+
+    std::vector<uint16_t> path;
+    for (uint16_t v = target; tables[best].via[v] != kNone; v = tables[best].from[v]) {
+        path.push_back(tables[best].via[v]);
+    }
+    if (best > 0) path.push_back(setup[best]);
+    gadgets.clear();
+    for (auto it = path.rbegin(); it != path.rend(); ++it) {
+        const Macro& macro = macros[*it];
+        gadgets.insert(gadgets.end(), macro.gadgets.begin(), macro.gadgets.begin() + macro.length);
+    }
+    return true;
+}
+
+bool InstructionSelector::planMultiply(uint32_t factor, Rule& out) {
+    if (!multiply_planner) {
+        std::vector<GF> linear;
+        for (size_t f = 1; f < kGadgetFunctionCount; ++f) {
+            GF func = static_cast<GF>(f);
+            if (isLinearGadget(func) && gadget_db.isAvailable(rom, func) &&
+                gadget_db.selectCandidate(rom, func, byte_constraints)) {
+                linear.push_back(func);
+            }
+        }
+        multiply_planner = std::make_unique<MultiplyPlanner>(linear, [this](GF func) {
+            return SelectionCost{gadget_db.selectCandidate(rom, func, byte_constraints)->chainBytes(), estimateCycles(func)};
+        });
+    }
+    std::vector<GF> gadgets;
+    if (!multiply_planner->plan(factor, gadgets) || gadgets.size() > kMaxRuleSteps) {
+        return false;
+    }
+    out = Rule{IrOp::MulConst, NT::ER0, {NT::ER0, NT::None}, static_cast<int32_t>(factor), 0, {}};
+    for (GF func : gadgets) {
+        // Pop của gadget chỉ gồm pop mang đúng hằng 0 như mô hình tuyến tính đã giả định
+        out.steps[out.step_count++] = popsOnly(func) ? RuleStep{func, kFixedImm, 0xFF, 0} : RuleStep{func};
+    }
+    return true;
+}
+
+uint32_t InstructionSelector::addNode(IrOp op, uint32_t kid0, uint32_t kid1, uint32_t value) {
+    // Gấp hằng ngay khi hạ xuống IR (ví dụ địa chỉ VRAM của PRINT_CHAR với dòng/cột là hằng)
+    bool unary = op == IrOp::Shl4 || op == IrOp::MulConst || op == IrOp::DivConst;
+    bool binary = op == IrOp::Add || op == IrOp::Sub || op == IrOp::Mul || op == IrOp::Greater;
+    if (ir.size() >= kFirstTreeNode && (binary || unary) &&
+        ir[kid0].op == IrOp::Const && (unary || ir[kid1].op == IrOp::Const) && !(op == IrOp::DivConst && value == 0)) {
+        uint32_t a = ir[kid0].value;
+        switch (op) {
+            case IrOp::Add: value = a + ir[kid1].value; break;
+            case IrOp::Sub: value = a - ir[kid1].value; break;
+            case IrOp::Mul: value = (a & 0xFF) * (ir[kid1].value & 0xFF); break;
+            case IrOp::Greater: value = a > ir[kid1].value ? 1 : 0; break;
+            case IrOp::Shl4: value = a << 4; break;
+            case IrOp::MulConst: value = a * value; break;
+            default: value = a / value; break; // DivConst
+        }
+        op = IrOp::Const;
+        kid0 = kid1 = 0;
+    }
+    ir.push_back(IrNode{op, {kid0, kid1}, value & 0xFFFF});
+    labels.emplace_back();
+    return static_cast<uint32_t>(ir.size() - 1);
+}
+
+void InstructionSelector::beginTree() {
+    ir.resize(kFirstTreeNode);
+    labels.resize(kFirstTreeNode);
+    prelude.clear();
+    temp_slots = 0;
+}
+
+uint32_t InstructionSelector::cloneTree(uint32_t node) {
+    IrNode n = ir[node];
+    size_t kids = arity(n.op);
+    uint32_t kid0 = kids > 0 ? cloneTree(n.kids[0]) : 0;
+    uint32_t kid1 = kids > 1 ? cloneTree(n.kids[1]) : 0;
+    return addNode(n.op, kid0, kid1, n.value);
+}
+
+void InstructionSelector::storeTemp(uint32_t address, uint32_t value) {
+    prelude.push_back(addNode(IrOp::Store, addNode(IrOp::Const, 0, 0, address), value));
+}
+
+uint32_t InstructionSelector::loadTemp(uint32_t address) {
+    return addNode(IrOp::Load, addNode(IrOp::Const, 0, 0, address));
+}
+
+uint32_t InstructionSelector::reusable(uint32_t node) {
+    const IrNode& n = ir[node];
+    if (n.op == IrOp::Const || (n.op == IrOp::Load && ir[n.kids[0]].op == IrOp::Const)) return node;
+    uint32_t temp = newTemp();
+    storeTemp(temp, node);
+    return loadTemp(temp);
+}
+
+void InstructionSelector::requireConstantRules(IrOp op, uint32_t value, int line) {
+    if (!ensureConstantRules(op, value)) {
+        throw std::runtime_error("Lỗi: Không tìm được dãy gadget cho phép " +
+                                 std::string(op == IrOp::MulConst ? "nhân với " : "chia cho ") +
+                                 std::to_string(value) + " (dòng " + std::to_string(line) + ").");
+    }
+}
+
+uint32_t InstructionSelector::multiplyConst(uint32_t node, uint32_t factor, int line) {
+    if (factor == 1) return node;
+    if (ir[node].op != IrOp::Const) requireConstantRules(IrOp::MulConst, factor, line);
+    return addNode(IrOp::MulConst, node, 0, factor);
+}
+
+uint32_t InstructionSelector::shiftRight(uint32_t node, unsigned int bits, int line) {
+    if (bits == 0) return node;
+    if (ir[node].op != IrOp::Const) requireConstantRules(IrOp::DivConst, 1u << bits, line);
+    return addNode(IrOp::DivConst, node, 0, 1u << bits);
+}
+
+uint32_t InstructionSelector::highByteOperand(uint32_t node) {
+    // MUL chỉ đọc byte thấp: word tại địa chỉ + 1 có byte thấp là byte cao của word tại địa chỉ
+    const IrNode& n = ir[node];
+    if (n.op == IrOp::Const) return addNode(IrOp::Const, 0, 0, n.value >> 8);
+    return loadTemp((ir[n.kids[0]].value + 1) & 0xFFFF);
+}
+
+uint32_t InstructionSelector::shiftLeft8(uint32_t node) {
+    return addNode(IrOp::Shl4, addNode(IrOp::Shl4, node));
+}
+
+uint32_t InstructionSelector::pick(uint32_t flag, uint32_t table, int line) {
+    return addNode(IrOp::Load, addNode(IrOp::Add, multiplyConst(flag, 2, line), addNode(IrOp::Const, 0, 0, table)));
+}
+
+uint32_t InstructionSelector::lowerMultiply(uint32_t left, uint32_t right) {
+    // a * b = al * bl + ((ah * bl + al * bh) << 8) (mod 2^16); MUL chỉ đọc byte thấp.
+    // Kết quả so sánh (0/1) không có byte cao nên bỏ được số hạng tương ứng.
+    if (ir[left].op == IrOp::Greater) std::swap(left, right);
+    if (ir[left].op == IrOp::Greater) return addNode(IrOp::Mul, left, right);
+    bool right_byte = ir[right].op == IrOp::Greater;
+    left = reusable(left);
+    right = reusable(right);
+    uint32_t cross = addNode(IrOp::Mul, highByteOperand(left), cloneTree(right));
+    if (!right_byte) cross = addNode(IrOp::Add, cross, addNode(IrOp::Mul, cloneTree(left), highByteOperand(right)));
+    uint32_t low = addNode(IrOp::Mul, left, right);
+    return addNode(IrOp::Add, low, shiftLeft8(cross));
+}
+
+uint32_t InstructionSelector::lowerDivide(uint32_t dividend, uint32_t divisor, int line) {
+    // y < 256: lệnh DIV. y >= 256: thương < 256, trừ dần 8 bước (R >> b >= y thì R -= y << b).
+    // Chọn nhánh không cần nhân: đọc bảng hai word trong ô tạm tại địa chỉ + 2 * cờ.
+    uint32_t rest = newTemp(), zero = newTemp(), y = newTemp();   // bảng {R, 0} và {0, y}
+    uint32_t quotient = newTemp(), small_quotient = newTemp();   // bảng {thương trừ dần, thương DIV}
+    uint32_t bit = newTemp();
+    uint32_t one = addNode(IrOp::Const, 0, 0, 1);
+    auto small = [&] { return addNode(IrOp::Greater, addNode(IrOp::Const, 0, 0, 256), loadTemp(y)); };
+    storeTemp(y, divisor);
+    storeTemp(rest, dividend);
+    storeTemp(zero, addNode(IrOp::Const));
+    storeTemp(small_quotient, addNode(IrOp::Div, loadTemp(rest), loadTemp(y)));
+    storeTemp(rest, pick(small(), rest, line)); // y < 256: R = 0, vòng trừ dần cho thương 0
+    for (unsigned int b = 8; b-- > 0;) {
+        uint32_t fits = addNode(IrOp::Greater, shiftRight(loadTemp(rest), b, line),
+                                addNode(IrOp::Sub, loadTemp(y), cloneTree(one)));
+        storeTemp(bit, fits);
+        if (b != 0) {
+            uint32_t subtrahend = multiplyConst(pick(loadTemp(bit), zero, line), 1u << b, line);
+            storeTemp(rest, addNode(IrOp::Sub, loadTemp(rest), subtrahend));
+        }
+        storeTemp(quotient, b == 7 ? loadTemp(bit) : addNode(IrOp::Add, multiplyConst(loadTemp(quotient), 2, line), loadTemp(bit)));
+    }
+    return pick(small(), quotient, line);
+}
+
+uint32_t InstructionSelector::divideByConstant(uint32_t dividend, uint32_t divisor, int line) {
+    // Ước lượng q0 = (x >> s) / d' với d' = (d >> s) + 1 < 256: d' * 2^s > d nên q0 <= x / d.
+    // Sau đó cộng 1 cho mỗi bội k * d mà phần dư x - q0 * d còn đạt tới; số lần cần cộng
+    // (sai số lớn nhất của ước lượng) tính trước bằng cách thử mọi x, và chọn s cho sai số nhỏ nhất.
+    if (divisor == 0) return addNode(IrOp::Const, 0, 0, 0xFFFF);
+    unsigned int best_shift = 0, best_error = UINT32_MAX;
+    for (unsigned int shift = 0; shift < 16 && (divisor >> shift) != 0; ++shift) {
+        uint32_t estimate = (divisor >> shift) + 1;
+        if (estimate > 255 || (shift != 0 && !ensureConstantRules(IrOp::DivConst, 1u << shift)) ||
+            !ensureConstantRules(IrOp::DivConst, estimate)) {
+            continue;
+        }
+        unsigned int error = 0;
+        for (uint32_t x = 0; x <= 0xFFFF; ++x) error = std::max(error, x / divisor - (x >> shift) / estimate);
+        if (error < best_error) best_shift = shift, best_error = error;
+    }
+    if (best_error == UINT32_MAX) requireConstantRules(IrOp::DivConst, divisor, line);
+    unsigned int steps = std::min<uint32_t>(best_error, 0xFFFF / divisor);
+
+    uint32_t x = reusable(dividend);
+    uint32_t estimate = addNode(IrOp::DivConst, shiftRight(cloneTree(x), best_shift, line), 0, (divisor >> best_shift) + 1);
+    if (steps == 0) return estimate;
+    estimate = reusable(estimate);
+    uint32_t remainder = addNode(IrOp::Sub, cloneTree(x), multiplyConst(cloneTree(estimate), divisor, line));
+    if (steps > 1) remainder = reusable(remainder);
+    uint32_t result = estimate;
+    for (uint32_t k = 1; k <= steps; ++k) {
+        uint32_t reached = addNode(IrOp::Greater, cloneTree(remainder), addNode(IrOp::Const, 0, 0, k * divisor - 1));
+        result = addNode(IrOp::Add, result, reached);
+    }
+    return result;
+}
+
+uint32_t InstructionSelector::lowerExpression(const AstArena& ast, NodeId node) {
+    const NodeSlots& s = ast.at(node);
+    switch (ast.type(node)) {
+        case NodeType::IntegerLiteral:
+            return addNode(IrOp::Const, 0, 0, s.a);
+        case NodeType::Identifier: {
+            const SymbolInfo* sym = symbol_table.get_symbol(s.a);
+            if (!sym) {
+                throw std::runtime_error("Lỗi: Biến #" + std::to_string(s.a) + " chưa khai báo.");
+            }
+            return addNode(IrOp::Load, addNode(IrOp::Const, 0, 0, sym->address));
+        }
+        case NodeType::MemRead:
+            return addNode(IrOp::Load, lowerExpression(ast, s.a));
+        case NodeType::BinaryOp: {
+            TokenType op = static_cast<TokenType>(s.c);
+            uint32_t left = lowerExpression(ast, s.a);
+            uint32_t right = lowerExpression(ast, s.b);
+            switch (op) {
+                case TokenType::PLUS: return addNode(IrOp::Add, left, right);
+                case TokenType::MINUS: return addNode(IrOp::Sub, left, right);
+                case TokenType::MULTIPLY:
+                case TokenType::DIVIDE: {
+                    bool multiply = op == TokenType::MULTIPLY;
+                    // Một vế là hằng: hạ bằng luật tổng hợp riêng cho hằng đó
+                    uint32_t constant = ir[right].op == IrOp::Const ? right
+                                      : multiply && ir[left].op == IrOp::Const ? left : 0;
+                    int line = ast.lines[node];
+                    if (constant == 0) {
+                        return multiply ? lowerMultiply(left, right) : lowerDivide(left, right, line);
+                    }
+                    IrOp const_op = multiply ? IrOp::MulConst : IrOp::DivConst;
+                    uint32_t factor = ir[constant].value;
+                    uint32_t other = constant == right ? left : right;
+                    bool folds = ir[other].op == IrOp::Const && !(const_op == IrOp::DivConst && factor == 0);
+                    if (!folds && !multiply && !ensureConstantRules(const_op, factor)) {
+                        return divideByConstant(left, factor, line); // Số chia không phủ được bằng dịch + DIV
+                    }
+                    if (!folds) requireConstantRules(const_op, factor, line);
+                    return addNode(const_op, other, 0, factor);
+                }
+                case TokenType::LESS:
+                case TokenType::GREATER:
+                case TokenType::LESS_EQUAL:
+                case TokenType::GREATER_EQUAL:
+                case TokenType::EQUAL:
+                case TokenType::NOT_EQUAL: {
+                    bool negated = false;
+                    uint32_t flag = lowerComparison(op, left, right, negated);
+                    return negated ? addNode(IrOp::Sub, addNode(IrOp::Const, 0, 0, 1), flag) : flag;
+                }
+                default:
+                    throw std::runtime_error("Lỗi: Toán tử '" + tokenTypeToString(op) + "' chưa được hỗ trợ trong ROP generation.");
+            }
+        }
+        default:
+            throw std::runtime_error("Lỗi: Loại node không hợp lệ trong biểu thức.");
+    }
+}
+
+uint32_t InstructionSelector::lowerComparison(TokenType op, uint32_t left, uint32_t right, bool& negated) {
+    // Chỉ có CMP "lớn hơn" cho kết quả 0/1: các phép còn lại là phủ định hoặc đổi vế của nó.
+    // a != b khi và chỉ khi a - b > 0 (không dấu).
+    negated = op == TokenType::LESS_EQUAL || op == TokenType::GREATER_EQUAL || op == TokenType::EQUAL;
+    switch (op) {
+        case TokenType::GREATER:
+        case TokenType::LESS_EQUAL:
+            return addNode(IrOp::Greater, left, right);
+        case TokenType::LESS:
+        case TokenType::GREATER_EQUAL:
+            return addNode(IrOp::Greater, right, left);
+        default: // EQUAL, NOT_EQUAL
+            return addNode(IrOp::Greater, addNode(IrOp::Sub, left, right), addNode(IrOp::Const, 0, 0, 0));
+    }
+}
+
+uint32_t InstructionSelector::lowerCondition(const AstArena& ast, NodeId node, bool& negated) {
+    const NodeSlots& s = ast.at(node);
+    TokenType op = static_cast<TokenType>(s.c);
+    if (ast.type(node) == NodeType::BinaryOp && isComparisonOp(op)) {
+        uint32_t left = lowerExpression(ast, s.a);
+        uint32_t right = lowerExpression(ast, s.b);
+        return lowerComparison(op, left, right, negated);
+    }
+    negated = false;
+    return addNode(IrOp::Greater, lowerExpression(ast, node), addNode(IrOp::Const, 0, 0, 0));
+}
+
+bool InstructionSelector::negatedCondition(const AstArena& ast, NodeId expr) {
+    TokenType op = static_cast<TokenType>(ast.at(expr).c);
+    return ast.type(expr) == NodeType::BinaryOp &&
+           (op == TokenType::LESS_EQUAL || op == TokenType::GREATER_EQUAL || op == TokenType::EQUAL);
+}
+
+uint32_t InstructionSelector::lowerStatement(const AstArena& ast, NodeId node) {
+    const NodeSlots& s = ast.at(node);
+    switch (ast.type(node)) {
+        case NodeType::Assignment: {
+            const SymbolInfo* sym = symbol_table.get_symbol(s.a);
+            if (!sym) {
+                throw std::runtime_error("Lỗi: Biến #" + std::to_string(s.a) + " chưa khai báo.");
+            }
+            uint32_t value = lowerExpression(ast, s.b);
+            return addNode(IrOp::Store, addNode(IrOp::Const, 0, 0, sym->address), value);
+        }
+        case NodeType::MemWrite: {
+            uint32_t address = lowerExpression(ast, s.a);
+            uint32_t value = lowerExpression(ast, s.b);
+            return addNode(IrOp::Store, address, value);
+        }
+        case NodeType::PrintChar: {
+            // Địa chỉ VRAM = (dòng - 1) * 0x10 + cột; ghi byte thấp của mã ký tự
+            uint32_t line = lowerExpression(ast, s.a);
+            uint32_t row = addNode(IrOp::Shl4, addNode(IrOp::Sub, line, addNode(IrOp::Const, 0, 0, 1)));
+            uint32_t address = addNode(IrOp::Add, row, lowerExpression(ast, s.b));
+            uint32_t value = lowerExpression(ast, s.c);
+            return addNode(IrOp::StoreByte, address, value);
+        }
+        default:
+            throw std::runtime_error("Lỗi: Loại node không được hỗ trợ trong ROP generation.");
+    }
+}
+
+SelectionCost InstructionSelector::selectStatement(const AstArena& ast, NodeId stmt, std::vector<ChainStep>& sink,
+                                                   uint32_t position) {
+    beginTree();
+    uint32_t root = lowerStatement(ast, stmt);
+    return selectTree(root, NT::Stmt, sink, position, "câu lệnh tại dòng " + std::to_string(ast.lines[stmt]));
+}
+
+SelectionCost InstructionSelector::selectValue(const AstArena& ast, NodeId expr, std::vector<ChainStep>& sink,
+                                               uint32_t position) {
+    beginTree();
+    uint32_t root = lowerExpression(ast, expr);
+    return selectTree(root, NT::ER0, sink, position, "biểu thức tại dòng " + std::to_string(ast.lines[expr]));
+}
+
+SelectionCost InstructionSelector::selectLoadWord(uint32_t address, std::vector<ChainStep>& sink, uint32_t position) {
+    beginTree();
+    uint32_t root = addNode(IrOp::Load, addNode(IrOp::Const, 0, 0, address & 0xFFFF));
+    return selectTree(root, NT::ER0, sink, position, "biến đếm của vòng lặp");
+}
+
+SelectionCost InstructionSelector::selectStoreWord(uint32_t address, const AstArena& ast, NodeId expr,
+                                                   std::vector<ChainStep>& sink, uint32_t position) {
+    beginTree();
+    uint32_t value = lowerExpression(ast, expr);
+    uint32_t root = addNode(IrOp::Store, addNode(IrOp::Const, 0, 0, address & 0xFFFF), value);
+    return selectTree(root, NT::Stmt, sink, position, "biểu thức tại dòng " + std::to_string(ast.lines[expr]));
+}
+
+SelectionCost InstructionSelector::selectCopyWord(uint32_t dst, uint32_t src, std::vector<ChainStep>& sink,
+                                                  uint32_t position) {
+    beginTree();
+    uint32_t load = addNode(IrOp::Load, addNode(IrOp::Const, 0, 0, src & 0xFFFF));
+    uint32_t root = addNode(IrOp::Store, addNode(IrOp::Const, 0, 0, dst & 0xFFFF), load);
+    return selectTree(root, NT::Stmt, sink, position, "nhánh của lệnh IF");
+}
+
+SelectionCost InstructionSelector::selectDecrementWord(uint32_t address, std::vector<ChainStep>& sink,
+                                                       uint32_t position) {
+    beginTree();
+    uint32_t load = addNode(IrOp::Load, addNode(IrOp::Const, 0, 0, address & 0xFFFF));
+    uint32_t value = addNode(IrOp::Sub, load, addNode(IrOp::Const, 0, 0, 1));
+    uint32_t root = addNode(IrOp::Store, addNode(IrOp::Const, 0, 0, address & 0xFFFF), value);
+    return selectTree(root, NT::Stmt, sink, position, "biến đếm của vòng lặp");
+}
+
+SelectionCost InstructionSelector::selectTree(uint32_t root, Nonterminal nt, std::vector<ChainStep>& sink,
+                                              uint32_t position, const std::string& what) {
+    // Các cây phụ (ghi ô tạm) trước, cây chính sau cùng. Gán nhãn lại trước mỗi cây vì
+    // thanh ghi đã đổi sau cây trước.
+    SelectionCost total;
+    std::vector<uint32_t> roots = std::move(prelude);
+    prelude.clear();
+    roots.push_back(root);
+    for (size_t i = 0; i < roots.size(); ++i) {
+        Nonterminal want = i + 1 < roots.size() ? NT::Stmt : nt;
+        // Thanh ghi đang giữ giá trị còn được đọc sau câu lệnh này: tránh phá nếu cùng số byte
+        live_mask = liveness ? liveness->liveRegisters(registers, position) : 0;
+
+        // Node được thêm theo thứ tự hậu tố nên con luôn được gán nhãn trước cha
+        for (uint32_t n = kFirstTreeNode; n < ir.size(); ++n) {
+            labelNode(n);
+        }
+        live_mask = 0;
+        const Label& best = labels[roots[i]].any[static_cast<size_t>(want)];
+        if (!best.valid()) {
+            throw std::runtime_error("Lỗi: ROM '" + gadget_db.model(rom).name + "' không đủ gadget để sinh mã cho " +
+                                     what + ".");
+        }
+        total = total + best.cost;
+
+        out = &sink;
+        spill_depth = temp_slots;
+        emit(roots[i], want, true);
+        out = nullptr;
+    }
+    return total;
+}
+
+SelectionCost InstructionSelector::gadgetCost(GF func) const {
+    const GadgetCandidate* candidate = gadget_db.isAvailable(rom, func)
+        ? gadget_db.selectCandidate(rom, func, byte_constraints)
+        : nullptr;
+    if (!candidate) return SelectionCost{UINT32_MAX, UINT32_MAX};
+    return SelectionCost{candidate->chainBytes(), estimateCycles(func)};
+}
+
+SelectionCost InstructionSelector::wideStoreCost() const {
+    SelectionCost cost;
+    for (GF func : kWideStoreSteps) {
+        SelectionCost step = gadgetCost(func);
+        if (step.bytes == UINT32_MAX) return step;
+        cost = cost + step;
+    }
+    return cost;
+}
+
+SelectionCost InstructionSelector::selectWideStore(uint32_t address, const std::array<uint16_t, 4>& words,
+                                                   std::vector<ChainStep>& sink) {
+    SelectionCost cost = wideStoreCost();
+    if (cost.bytes == UINT32_MAX) {
+        throw std::logic_error("Lỗi: ROM '" + gadget_db.model(rom).name + "' không có gadget ghi 8 byte.");
+    }
+    sink.push_back(ChainStep{GF::POP_EA, 0});
+    sink.push_back(ChainStep{GF::UNKNOWN_GADGET, address & 0xFFFF});
+    sink.push_back(ChainStep{GF::POP_QR0, 0});
+    for (uint16_t word : words) {
+        sink.push_back(ChainStep{GF::UNKNOWN_GADGET, word});
+    }
+    sink.push_back(ChainStep{GF::STORE_EA_QR0, 0});
+
+    for (GF func : kWideStoreSteps) {
+        registers.clobber(gadget_db.effect(func).writes);
+    }
+    registers.storeTo(address, 8);
+    // qr0 = er0:er2:er4:er6 vẫn giữ các hằng vừa ghi
+    for (unsigned int i = 0; i < words.size(); ++i) {
+        registers.set(2 * i, RegValue::constant(words[i]));
+    }
+    return cost;
+}
+
+SelectionCost InstructionSelector::bulkCallCost(GF call) const {
+    SelectionCost cost = gadgetCost(call);
+    if (cost.bytes == UINT32_MAX) return cost;
+    // Đối số thanh ghi: pop xr0 (er0, er2) hoặc pop er0 + pop er2
+    SelectionCost pair = gadgetCost(GF::POP_XR0);
+    if (pair.bytes == UINT32_MAX) {
+        SelectionCost er0 = gadgetCost(GF::POP_ER0);
+        SelectionCost er2 = gadgetCost(GF::POP_ER2);
+        if (er0.bytes == UINT32_MAX || er2.bytes == UINT32_MAX) return er0.bytes == UINT32_MAX ? er0 : er2;
+        pair = er0 + er2;
+    }
+    return cost + pair;
+}
+
+SelectionCost InstructionSelector::selectBulkCall(GF call, uint32_t dest, uint32_t source, bool source_is_block,
+                                                  uint32_t length, std::vector<ChainStep>& sink) {
+    SelectionCost cost = bulkCallCost(call);
+    if (cost.bytes == UINT32_MAX) {
+        throw std::logic_error("Lỗi: ROM '" + gadget_db.model(rom).name + "' không có gadget '" +
+                               std::string(gadgetSpelling(call)) + "'.");
+    }
+    ChainStep source_word{GF::UNKNOWN_GADGET, source_is_block ? source : source & 0xFFFF, false, source_is_block};
+    if (gadgetCost(GF::POP_XR0).bytes != UINT32_MAX) {
+        sink.push_back(ChainStep{GF::POP_XR0, 0});
+        sink.push_back(ChainStep{GF::UNKNOWN_GADGET, dest & 0xFFFF});
+        sink.push_back(source_word);
+        registers.clobber(gadget_db.effect(GF::POP_XR0).writes);
+    } else {
+        sink.push_back(ChainStep{GF::POP_ER2, 0});
+        sink.push_back(source_word);
+        sink.push_back(ChainStep{GF::POP_ER0, 0});
+        sink.push_back(ChainStep{GF::UNKNOWN_GADGET, dest & 0xFFFF});
+        registers.clobber(gadget_db.effect(GF::POP_ER2).writes | gadget_db.effect(GF::POP_ER0).writes);
+    }
+    sink.push_back(ChainStep{call, 0});
+    sink.push_back(ChainStep{GF::UNKNOWN_GADGET, length & 0xFFFF});
+
+    registers.clobber(gadget_db.effect(call).writes);
+    registers.storeTo(dest, length);
+    return cost;
+}
+
+SelectionCost InstructionSelector::branchCost() const {
+    SelectionCost cost;
+    for (GF func : kBooleanSteps) {
+        SelectionCost step = gadgetCost(func);
+        if (step.bytes == UINT32_MAX) return step;
+        cost = cost + step;
+    }
+    for (GF func : kBranchSteps) {
+        SelectionCost step = gadgetCost(func);
+        if (step.bytes == UINT32_MAX) return step;
+        cost = cost + step;
+    }
+    return cost;
+}
+
+SelectionCost InstructionSelector::selectBranch(uint32_t table, std::vector<ChainStep>& sink, bool boolean) {
+    SelectionCost cost = branchCost();
+    if (cost.bytes == UINT32_MAX) {
+        throw std::runtime_error("Lỗi: ROM '" + gadget_db.model(rom).name +
+                                 "' không đủ gadget để rẽ nhánh (cần so sánh er0 - er2 và sp=[er8]).");
+    }
+    if (boolean) {
+        for (GF func : kBooleanSteps) {
+            SelectionCost step = gadgetCost(func);
+            cost = SelectionCost{cost.bytes - step.bytes, cost.cycles - step.cycles};
+        }
+    } else {
+        // So sánh với er2 = 0; bỏ được pop nếu er2 đã giữ hằng 0
+        if (!(registers.get(2) == RegValue::constant(0))) {
+            SelectionCost pop = gadgetCost(GF::POP_ER2);
+            if (pop.bytes == UINT32_MAX) {
+                throw std::runtime_error("Lỗi: ROM '" + gadget_db.model(rom).name + "' không có gadget 'pop er2'.");
+            }
+            sink.push_back(ChainStep{GF::POP_ER2, 0});
+            sink.push_back(ChainStep{GF::UNKNOWN_GADGET, 0});
+            cost = cost + pop;
+        }
+        for (GF func : kBooleanSteps) {
+            sink.push_back(ChainStep{func, 0});
+        }
+    }
+    for (GF func : kBranchSteps) {
+        sink.push_back(ChainStep{func, 0});
+        for (unsigned int w = 0; w < gadgetPopWords(func); ++w) {
+            // Word duy nhất của "pop er8" giữa dãy là địa chỉ bảng nhảy; word sau sp=[er8] không
+            // bao giờ được đọc ở chỗ này (ROPGenerator đặt nhãn đích nhảy ngay trước nó)
+            bool table_word = func == GF::MOV_ER2_ER0_ER0_ER2_POP_ER8_RET;
+            sink.push_back(ChainStep{GF::UNKNOWN_GADGET, table_word ? table : 0, !table_word, table_word});
+        }
+    }
+    // Sau lệnh nhảy là một nhãn: không giá trị nào trong thanh ghi còn chắc chắn
+    registers.clear();
+    return cost;
+}
+
+SelectionCost InstructionSelector::selectJump(uint32_t table, std::vector<ChainStep>& sink) {
+    SelectionCost cost;
+    for (GF func : kJumpSteps) {
+        SelectionCost step = gadgetCost(func);
+        if (step.bytes == UINT32_MAX) {
+            throw std::runtime_error("Lỗi: ROM '" + gadget_db.model(rom).name + "' không có gadget '" +
+                                     std::string(gadgetSpelling(func)) + "' để nhảy.");
+        }
+        cost = cost + step;
+        sink.push_back(ChainStep{func, 0});
+        for (unsigned int w = 0; w < gadgetPopWords(func); ++w) {
+            bool table_word = func == GF::POP_ER8;
+            sink.push_back(ChainStep{GF::UNKNOWN_GADGET, table_word ? table : 0, !table_word, table_word});
+        }
+    }
+    registers.clear();
+    return cost;
+}
+
+SelectionCost InstructionSelector::selectCondition(const AstArena& ast, NodeId expr, std::vector<ChainStep>& sink,
+                                                   uint32_t position) {
+    beginTree();
+    bool negated = false;
+    uint32_t root = lowerCondition(ast, expr, negated);
+    return selectTree(root, NT::ER0, sink, position, "điều kiện tại dòng " + std::to_string(ast.lines[expr]));
+}
+
+SelectionCost InstructionSelector::selectPick(const AstArena& ast, NodeId cond, const std::vector<uint32_t>& dests,
+                                              uint32_t base, uint32_t index_slot, std::vector<ChainStep>& sink,
+                                              uint32_t position) {
+    std::string what = "điều kiện tại dòng " + std::to_string(ast.lines[cond]);
+    uint32_t stride = 2 * static_cast<uint32_t>(dests.size());
+    beginTree();
+    bool negated = false;
+    uint32_t flag = lowerCondition(ast, cond, negated);
+    if (!ensureConstantRules(IrOp::MulConst, stride)) {
+        throw std::runtime_error("Lỗi: Không tìm được dãy gadget cho phép nhân với " + std::to_string(stride) +
+                                 " (" + what + ").");
+    }
+    uint32_t pointer = addNode(IrOp::Add, addNode(IrOp::MulConst, flag, 0, stride), addNode(IrOp::Const, 0, 0, base));
+    if (dests.size() == 1) {
+        uint32_t root = addNode(IrOp::Store, addNode(IrOp::Const, 0, 0, dests[0] & 0xFFFF), addNode(IrOp::Load, pointer));
+        return selectTree(root, NT::Stmt, sink, position, what);
+    }
+    // Nhiều đích: cất con trỏ tới nhóm giá trị được chọn, rồi chép từng word của nhóm
+    uint32_t root = addNode(IrOp::Store, addNode(IrOp::Const, 0, 0, index_slot & 0xFFFF), pointer);
+    SelectionCost cost = selectTree(root, NT::Stmt, sink, position, what);
+    for (size_t j = 0; j < dests.size(); ++j) {
+        beginTree();
+        uint32_t address = addNode(IrOp::Load, addNode(IrOp::Const, 0, 0, index_slot & 0xFFFF));
+        if (j > 0) address = addNode(IrOp::Add, address, addNode(IrOp::Const, 0, 0, static_cast<uint32_t>(2 * j)));
+        root = addNode(IrOp::Store, addNode(IrOp::Const, 0, 0, dests[j] & 0xFFFF), addNode(IrOp::Load, address));
+        cost = cost + selectTree(root, NT::Stmt, sink, position, what);
+    }
+    return cost;
+}
+
+RegValue InstructionSelector::valueOf(uint32_t node) const {
+    const IrNode& n = ir[node];
+    if (n.op == IrOp::Const) return RegValue::constant(n.value);
+    if (n.op == IrOp::Load && ir[n.kids[0]].op == IrOp::Const) return RegValue::word(ir[n.kids[0]].value);
+    return RegValue{};
+}
+
+bool InstructionSelector::better(const Label& candidate, const Label& current) const {
+    if (candidate.cost.bytes != current.cost.bytes) return candidate.cost.bytes < current.cost.bytes;
+    int live_a = __builtin_popcount(candidate.clobbers & live_mask);
+    int live_b = __builtin_popcount(current.clobbers & live_mask);
+    if (live_a != live_b) return live_a < live_b;
+    return candidate.cost.cycles < current.cost.cycles;
+}
+
+bool InstructionSelector::consider(uint32_t node, Nonterminal nt, const Label& candidate, RegMask avoid) {
+    if (candidate.clobbers & avoid) return false;
+    bool changed = false;
+    Label& any = labels[node].any[static_cast<size_t>(nt)];
+    if (!any.valid() || better(candidate, any)) {
+        any = candidate;
+        changed = true;
+    }
+    if (candidate.uses == 0) {
+        Label& fresh = labels[node].fresh[static_cast<size_t>(nt)];
+        if (!fresh.valid() || better(candidate, fresh)) {
+            fresh = candidate;
+            changed = true;
+        }
+    }
+    return changed;
+}
+
+void InstructionSelector::labelNode(uint32_t node, RegMask avoid) {
+    labels[node] = NodeLabels{};
+    if (ir[node].op == IrOp::InER0) {
+        Label in_er0;
+        in_er0.cost = SelectionCost{};
+        consider(node, NT::ER0, in_er0, avoid);
+    } else {
+        // Giá trị đã nằm sẵn trong thanh ghi từ các câu lệnh trước: không tốn gadget nào,
+        // nhưng thanh ghi đó phải còn nguyên tới lúc được đọc (ghi vào `uses`)
+        RegMask resident = node >= kFirstTreeNode ? registers.find(valueOf(node)) : 0;
+        for (NT nt : kRegisterNts) {
+            if (!(resident & maskOf(nt))) continue;
+            Label label;
+            label.cost = SelectionCost{};
+            label.uses = maskOf(nt);
+            consider(node, nt, label, avoid);
+        }
+        for (size_t i = 0; i < active_rules.size(); ++i) {
+            if (rules[active_rules[i].rule].op != ir[node].op) continue;
+            tryRule(node, static_cast<uint16_t>(i), false, avoid);
+            if (isCommutative(ir[node].op)) {
+                tryRule(node, static_cast<uint16_t>(i), true, avoid);
+            }
+        }
+    }
+    closeChains(node, avoid);
+}
+
+void InstructionSelector::tryRule(uint32_t node, uint16_t active_index, bool swapped, RegMask avoid) {
+    const ActiveRule& active = active_rules[active_index];
+    const Rule& r = rules[active.rule];
+    const IrNode& n = ir[node];
+    uint32_t kid[2] = {swapped ? n.kids[1] : n.kids[0], swapped ? n.kids[0] : n.kids[1]};
+
+    if (hasConstantValue(n.op) && r.imm_value >= 0 && static_cast<int32_t>(n.value) != r.imm_value) {
+        return;
+    }
+
+    // Toán hạng hằng: con phải là Const (và đúng giá trị nếu luật yêu cầu)
+    for (size_t i = 0; i < arity(n.op); ++i) {
+        if (r.operands[i] != NT::Imm) continue;
+        const IrNode& k = ir[kid[i]];
+        if (k.op != IrOp::Const || (r.imm_value >= 0 && static_cast<int32_t>(k.value) != r.imm_value)) {
+            return;
+        }
+    }
+
+    Label base;
+    base.rule = active_index;
+    base.swapped = swapped;
+    base.cost = active.cost;
+    base.clobbers = active.clobbers;
+
+    bool reg0 = arity(n.op) > 0 && r.operands[0] != NT::Imm;
+    bool reg1 = arity(n.op) > 1 && r.operands[1] != NT::Imm;
+    if (!reg0 && !reg1) {
+        consider(node, r.result, base, avoid);
+        return;
+    }
+    if (!(reg0 && reg1)) {
+        size_t i = reg0 ? 0 : 1;
+        for (uint8_t variant = 0; variant < 2; ++variant) {
+            const Label& k = label(kid[i], r.operands[i], variant != 0);
+            if (!k.valid()) continue;
+            Label candidate = base;
+            candidate.cost = candidate.cost + k.cost;
+            candidate.clobbers |= k.clobbers;
+            candidate.uses = k.uses;
+            candidate.kid_any = static_cast<uint8_t>(variant << i);
+            consider(node, r.result, candidate, avoid);
+        }
+        return;
+    }
+
+    RegMask mask_a = maskOf(r.operands[0]);
+    RegMask mask_b = maskOf(r.operands[1]);
+    const Label& store = labels[kSlotStore].fresh[static_cast<size_t>(NT::Stmt)];
+    const Label& reload = labels[slotReload(r.operands[1])].fresh[static_cast<size_t>(r.operands[0])];
+    for (uint8_t variants = 0; variants < 4; ++variants) {
+        bool any_a = (variants & 1) != 0;
+        bool any_b = (variants & 2) != 0;
+        const Label& a = label(kid[0], r.operands[0], any_a);
+        const Label& b = label(kid[1], r.operands[1], any_b);
+        if (!b.valid()) continue;
+
+        Label candidate = base;
+        candidate.kid_any = variants;
+        candidate.uses = b.uses;
+        if (a.valid()) {
+            candidate.uses |= a.uses;
+            candidate.cost = base.cost + a.cost + b.cost;
+            candidate.clobbers = base.clobbers | a.clobbers | b.clobbers;
+            // Đánh giá lần lượt: con sau không được phá kết quả của con trước, con trước không
+            // được phá thanh ghi mà con sau còn đọc. InER0 luôn phải được "đánh giá" trước.
+            if (!(b.clobbers & mask_a) && !(a.clobbers & b.uses) && kid[1] != kValueInER0) {
+                candidate.order = Order::FirstOperandFirst;
+                consider(node, r.result, candidate, avoid);
+            }
+            if (!(a.clobbers & mask_b) && !(b.clobbers & a.uses) && kid[0] != kValueInER0) {
+                candidate.order = Order::SecondOperandFirst;
+                consider(node, r.result, candidate, avoid);
+            }
+        }
+
+        // Không có thứ tự nào an toàn: cất toán hạng đầu ra RAM tạm, nạp lại sau cùng
+        const Label& first = label(kid[0], NT::ER0, any_a);
+        if (first.valid() && store.valid() && reload.valid() && !((first.clobbers | store.clobbers) & b.uses)) {
+            candidate.order = Order::SpillFirst;
+            candidate.uses = first.uses | b.uses;
+            candidate.cost = base.cost + first.cost + store.cost + b.cost + reload.cost;
+            candidate.clobbers = base.clobbers | first.clobbers | store.clobbers | b.clobbers | reload.clobbers;
+            consider(node, r.result, candidate, avoid);
+        }
+    }
+}
+
+void InstructionSelector::closeChains(uint32_t node, RegMask avoid) {
+    // Chi phí tăng thực sự qua mỗi luật chuyển nên vòng lặp luôn dừng
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (size_t i = 0; i < active_rules.size(); ++i) {
+            const Rule& r = rules[active_rules[i].rule];
+            if (r.op != IrOp::Chain) continue;
+            for (uint8_t variant = 0; variant < 2; ++variant) {
+                const Label& from = label(node, r.operands[0], variant != 0);
+                if (!from.valid()) continue;
+                Label chained;
+                chained.cost = from.cost + active_rules[i].cost;
+                chained.clobbers = from.clobbers | active_rules[i].clobbers;
+                chained.uses = from.uses;
+                chained.rule = static_cast<uint16_t>(i);
+                chained.chain_from = r.operands[0];
+                chained.kid_any = variant;
+                changed |= consider(node, r.result, chained, avoid);
+            }
+        }
+    }
+}
+
+void InstructionSelector::emit(uint32_t node, Nonterminal nt, bool any) {
+    const Label& l = label(node, nt, any);
+    if (l.rule == kNoRule) {
+        return; // Giá trị đã nằm sẵn trong thanh ghi (InER0 hoặc từ câu lệnh trước)
+    }
+    const ActiveRule& active = active_rules[l.rule];
+    const Rule& r = rules[active.rule];
+    if (l.chain_from != NT::None) {
+        emit(node, l.chain_from, l.kid_any != 0);
+        emitTemplate(active, node, false);
+        registers.set(pairOf(nt), valueOf(node));
+        return;
+    }
+
+    const IrNode& n = ir[node];
+    uint32_t kid[2] = {l.swapped ? n.kids[1] : n.kids[0], l.swapped ? n.kids[0] : n.kids[1]};
+    bool any0 = (l.kid_any & 1) != 0;
+    bool any1 = (l.kid_any & 2) != 0;
+    bool reg0 = arity(n.op) > 0 && r.operands[0] != NT::Imm;
+    bool reg1 = arity(n.op) > 1 && r.operands[1] != NT::Imm;
+    if (reg0 && reg1) {
+        switch (l.order) {
+            case Order::FirstOperandFirst:
+                emit(kid[0], r.operands[0], any0);
+                emit(kid[1], r.operands[1], any1);
+                break;
+            case Order::SecondOperandFirst:
+                emit(kid[1], r.operands[1], any1);
+                emit(kid[0], r.operands[0], any0);
+                break;
+            case Order::SpillFirst: {
+                unsigned int depth = spill_depth;
+                emit(kid[0], NT::ER0, any0);
+                ir[kSlotStoreAddress].value = (scratch_base + depth * 2) & 0xFFFF;
+                emit(kSlotStore, NT::Stmt, false);
+                spill_depth++;
+                emit(kid[1], r.operands[1], any1);
+                spill_depth--;
+                ir[slotReloadAddress(r.operands[1])].value = (scratch_base + depth * 2) & 0xFFFF;
+                emit(slotReload(r.operands[1]), r.operands[0], false);
+                break;
+            }
+        }
+    } else if (reg0) {
+        emit(kid[0], r.operands[0], any0);
+    } else if (reg1) {
+        emit(kid[1], r.operands[1], any1);
+    }
+    emitTemplate(active, node, l.swapped);
+
+    // Cập nhật RegisterFile sau khi mẫu đã chạy
+    if (nt != NT::Stmt) {
+        registers.set(pairOf(nt), valueOf(node));
+    } else if (n.op == IrOp::Store || n.op == IrOp::StoreByte) {
+        const IrNode& address = ir[kid[0]];
+        unsigned int width = n.op == IrOp::Store ? 2 : 1;
+        if (address.op != IrOp::Const) {
+            registers.storeUnknown();
+            return;
+        }
+        registers.storeTo(address.value, width);
+        // Thanh ghi vừa được ghi ra RAM giờ cũng là bản sao của word đó (nếu gadget không phá nó)
+        if (n.op == IrOp::Store && reg1 && !(active.clobbers & maskOf(r.operands[1]))) {
+            registers.set(pairOf(r.operands[1]), RegValue::word(address.value));
+        }
+    }
+}
+
+void InstructionSelector::emitTemplate(const ActiveRule& active, uint32_t node, bool swapped) {
+    const Rule& r = rules[active.rule];
+    const IrNode& n = ir[node];
+    for (size_t s = 0; s < r.step_count; ++s) {
+        const RuleStep& step = r.steps[s];
+        out->push_back(ChainStep{step.func, 0});
+        const GadgetEffect& effect = gadget_db.effect(step.func);
+        registers.clobber(effect.writes);
+        if ((effect.stores > 0 || effect.calls) && r.op != IrOp::Store && r.op != IrOp::StoreByte) {
+            registers.storeUnknown(); // Ghi RAM ngoài ý muốn của luật: không còn tin bản sao nào
+        }
+        unsigned int pops = gadgetPopWords(step.func);
+        for (unsigned int w = 0; w < pops; ++w) {
+            unsigned int data = 0; // Đệm cho các pop không mang dữ liệu
+            bool filler = true;
+            bool carries = step.imm != kNoImm && ((step.imm_words >> w) & 1) != 0;
+            if (carries && step.imm == kSelfImm) {
+                data = n.value;
+                filler = false;
+            } else if (carries && step.imm == kFixedImm) {
+                data = step.fixed;
+                filler = false;
+            } else if (carries) {
+                size_t i = static_cast<size_t>(step.imm);
+                data = ir[swapped ? n.kids[1 - i] : n.kids[i]].value;
+                filler = false;
+            }
+            out->push_back(ChainStep{GadgetFunction::UNKNOWN_GADGET, data, filler});
+        }
+    }
+}
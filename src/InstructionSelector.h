@@ -0,0 +1,300 @@
+#ifndef INSTRUCTION_SELECTOR_H
+#define INSTRUCTION_SELECTOR_H
+
+#include "Parser.h"
+#include "GadgetFunction.h"
+#include "GadgetEffect.h"
+#include "RegisterAllocator.h"
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+class GadgetDB;
+class MultiplyPlanner;
+struct ByteConstraints;
+using RomHandle = uint32_t;
+
+// --- Chọn gadget theo chi phí (kiểu BURS) ---
+// Mỗi câu lệnh được hạ xuống một cây IR nhỏ (Const, Load, Add, Sub, Shl4, Mul,
+// Div, Greater, Store, StoreByte). Các luật (xem bảng kRules trong InstructionSelector.cpp)
+// khớp một node IR với một chuỗi gadget, cho kết quả nằm ở một "nonterminal"
+// (ER0, ER2, ...). Pha gán nhãn đi từ dưới lên và ghi lại, cho mỗi node và mỗi
+// nonterminal, cách phủ rẻ nhất; pha phát lại đi từ trên xuống theo các nhãn đó.
+//
+// Chi phí = (số byte trong chuỗi, số chu kỳ ước lượng từ mô hình tác động),
+// so sánh theo byte trước: payload phải gõ tay vào máy nên ngắn là quan trọng nhất.
+// Luật chỉ được bật khi mọi gadget của nó có trong ROM (và thỏa ràng buộc byte),
+// nên ROM thiếu gadget nào thì bộ chọn tự rơi về cách phủ khác.
+//
+// Giữa các câu lệnh, RegisterFile nhớ hằng/biến nào còn nằm trong thanh ghi;
+// node đọc lại giá trị đó được phủ với chi phí 0 (nhãn "any"), còn nhãn "fresh"
+// giữ cách phủ rẻ nhất không dựa vào thanh ghi có sẵn để dùng khi thứ tự đánh
+// giá làm mất giá trị đó. Khi hai cách phủ cùng số byte, cách không phá thanh
+// ghi đang giữ giá trị còn sống (LivenessInfo) được ưu tiên.
+//
+// Nhân/chia cho hằng (MulConst, DivConst) không dùng bảng viết tay: lần đầu gặp
+// một hằng, bộ chọn tự tổng hợp luật cho riêng hằng đó. Phép nhân ghép từ các
+// "bước" v -> alpha * v + beta (dãy ngắn gadget dịch/cộng/trừ/chép của ROM, tìm
+// trên mô hình tuyến tính, giữ số bị nhân trong một cặp cố định) bằng Dijkstra
+// trên hệ số v; phép chia dùng qr0 >> 4 cho phần lũy thừa của 16 và lệnh DIV
+// cho phần còn lại (< 256).
+//
+// Phép nhân/chia của ngôn ngữ là 16 bit không dấu ở mọi mức tối ưu (như khi gập hằng).
+// Lệnh MUL/DIV của máy chỉ nhân byte thấp và chia cho số chia 8 bit, nên với toán hạng
+// không phải hằng bộ chọn ghép tích 16 bit từ ba lệnh MUL, và chia bằng DIV khi số chia
+// < 256 hoặc trừ dần 8 bước khi số chia >= 256 (thương khi đó < 256). Số chia hằng mà
+// DivConst không phủ được thì ước lượng bằng dịch + DIV rồi hiệu chỉnh. Giá trị trung
+// gian nằm trong ô tạm: mỗi lần ghi ô tạm là một cây phụ, phát trước cây chính.
+
+// Nơi chứa kết quả của một cây con
+enum class Nonterminal : uint8_t {
+    ER0,
+    ER2,
+    ER4,
+    ER8,
+    ER12,
+    Stmt,  // Câu lệnh (không có giá trị)
+    Count,
+    Imm,   // Toán hạng phải là hằng, được đặt thẳng vào ô pop của gadget
+    None,
+};
+constexpr size_t kNonterminalCount = static_cast<size_t>(Nonterminal::Count);
+
+enum class IrOp : uint8_t {
+    Const,     // value
+    InER0,     // Giá trị đã có sẵn trong ER0 (dùng cho ô tạm)
+    Load,      // [kid0] (word)
+    Add,
+    Sub,
+    Shl4,      // kid0 << 4
+    Mul,       // kid0 * kid1 (lệnh MUL: byte thấp của hai toán hạng; chỉ dùng trong lowerMultiply/lowerDivide)
+    Div,       // kid0 / kid1 (lệnh DIV: số chia 8 bit; chỉ dùng trong lowerDivide)
+    MulConst,  // kid0 * value (dãy dịch/cộng/trừ, đúng trên 16 bit)
+    DivConst,  // kid0 / value
+    Greater,   // kid0 > kid1 ? 1 : 0 (không dấu, lệnh CMP)
+    Store,     // [kid0] = kid1 (word)
+    StoreByte, // [kid0] = kid1 (byte thấp)
+    Chain,     // Chỉ dùng trong bảng luật: chuyển giá trị giữa hai nonterminal
+};
+
+struct SelectionCost {
+    uint32_t bytes = 0;
+    uint32_t cycles = 0;
+
+    bool operator<(const SelectionCost& other) const {
+        return bytes != other.bytes ? bytes < other.bytes : cycles < other.cycles;
+    }
+    SelectionCost operator+(const SelectionCost& other) const {
+        return SelectionCost{bytes + other.bytes, cycles + other.cycles};
+    }
+};
+
+// Một word của chuỗi kết quả: gadget (func != UNKNOWN_GADGET) hoặc dữ liệu 16-bit
+struct ChainStep {
+    GadgetFunction func = GadgetFunction::UNKNOWN_GADGET;
+    unsigned int data = 0;
+    bool filler = false; // Ô pop không mang dữ liệu (đệm), có thể nhận giá trị tùy ý
+    bool block = false;  // data là chỉ số khối dữ liệu; word là địa chỉ của khối khi chạy
+};
+
+class InstructionSelector {
+public:
+    // scratch_base: đầu vùng RAM tạm cho các ô spill (mỗi mức lồng dùng 2 byte)
+    // Luật của ROM gồm bảng viết tay và các dãy superopt của model (xem SuperoptTable.h)
+    InstructionSelector(const GadgetDB& db, RomHandle rom, const ByteConstraints& constraints,
+                        const SymbolTable& symbols, unsigned int scratch_base);
+    ~InstructionSelector();
+
+    // Chọn và nối các gadget cho một câu lệnh (Assignment, MemWrite, PrintChar) vào `out`.
+    // position: thứ tự câu lệnh trong chương trình (cho LivenessInfo).
+    // Ném std::runtime_error nếu ROM không đủ gadget để phủ câu lệnh.
+    SelectionCost selectStatement(const AstArena& ast, NodeId stmt, std::vector<ChainStep>& out,
+                                  uint32_t position = 0);
+
+    // Ghi 4 word hằng liền nhau tại `address` bằng một lần ghi 8 byte (pop ea; pop qr0;
+    // [ea]=qr0). wideStoreCost().bytes == UINT32_MAX nếu ROM thiếu một trong các gadget đó.
+    SelectionCost wideStoreCost() const;
+    SelectionCost selectWideStore(uint32_t address, const std::array<uint16_t, 4>& words,
+                                  std::vector<ChainStep>& out);
+    // Gọi hàm ROM chép/điền khối (call: BL_MEMCPY_POP_ER0 hoặc BL_MEMSET_POP_ER2):
+    // er0 = đích, er2 = nguồn (memcpy) hoặc byte điền (memset, r2); số byte là đối số
+    // trên stack, tức chính word mà pop ngay sau BL đọc lại. source_is_block: `source`
+    // là chỉ số khối dữ liệu (xem ChainStep::block). bulkCallCost().bytes == UINT32_MAX
+    // nếu ROM thiếu gadget.
+    SelectionCost bulkCallCost(GadgetFunction call) const;
+    SelectionCost selectBulkCall(GadgetFunction call, uint32_t dest, uint32_t source, bool source_is_block,
+                                 uint32_t length, std::vector<ChainStep>& out);
+
+    // Tính giá trị của một biểu thức vào ER0
+    SelectionCost selectValue(const AstArena& ast, NodeId expr, std::vector<ChainStep>& out, uint32_t position = 0);
+    // Tính điều kiện (của WHILE/IF) vào ER0 dưới dạng 0/1 bằng gadget CMP. Với <=, >= và ==
+    // giá trị là phủ định của điều kiện (negatedCondition): người gọi đổi chỗ hai đích.
+    SelectionCost selectCondition(const AstArena& ast, NodeId expr, std::vector<ChainStep>& out,
+                                  uint32_t position = 0);
+    static bool negatedCondition(const AstArena& ast, NodeId expr);
+    // Biến đếm ẩn của REPEAT (word tại địa chỉ cố định trong vùng tạm): đọc vào ER0,
+    // gán giá trị một biểu thức, giảm đi 1
+    SelectionCost selectLoadWord(uint32_t address, std::vector<ChainStep>& out, uint32_t position = 0);
+    SelectionCost selectStoreWord(uint32_t address, const AstArena& ast, NodeId expr, std::vector<ChainStep>& out,
+                                  uint32_t position = 0);
+    SelectionCost selectDecrementWord(uint32_t address, std::vector<ChainStep>& out, uint32_t position = 0);
+    // Chép word tại `src` sang `dst` (giá trị của biến mà một nhánh IF không gán)
+    SelectionCost selectCopyWord(uint32_t dst, uint32_t src, std::vector<ChainStep>& out, uint32_t position = 0);
+    // Rẽ nhánh theo ER0: SP = word thứ (ER0 != 0 ? 1 : 0) của bảng nhảy `table` (chỉ số
+    // khối dữ liệu, xem ChainStep::block), qua sp=[er8]. boolean: ER0 đã là 0/1 (selectCondition),
+    // bỏ được bước so sánh. Word đệm cuối cùng (sau LOAD_SP_FROM_ER8_POP_ER8) chỉ được đọc
+    // khi nhảy tới đúng nó. Mọi thanh ghi bị quên.
+    // branchCost().bytes == UINT32_MAX nếu ROM thiếu gadget (tính cả bước so sánh, chưa tính pop er2 = 0).
+    SelectionCost branchCost() const;
+    SelectionCost selectBranch(uint32_t table, std::vector<ChainStep>& out, bool boolean = false);
+    // Nhảy không điều kiện tới word đầu của khối `table`: pop er8; sp=[er8]
+    SelectionCost selectJump(uint32_t table, std::vector<ChainStep>& out);
+    // Chọn không rẽ nhánh: c = giá trị 0/1 của `cond` (như selectCondition, chưa đảo), n = số đích;
+    // dests[j] = word tại base + 2 * (j + c * n). Với n > 1, base + 2 * c * n được cất vào
+    // index_slot trước rồi chép từng word.
+    SelectionCost selectPick(const AstArena& ast, NodeId cond, const std::vector<uint32_t>& dests, uint32_t base,
+                             uint32_t index_slot, std::vector<ChainStep>& out, uint32_t position = 0);
+
+    // Thông tin sống/chết của các biến (có thể null); phải sống lâu hơn bộ chọn
+    void setLiveness(const LivenessInfo* info) { liveness = info; }
+    // Quên mọi giá trị trong thanh ghi (ví dụ tại nhãn nhảy tới)
+    void forgetRegisters() { registers.clear(); }
+    const RegisterFile& registerFile() const { return registers; }
+
+    // Số luật được bật cho ROM này (cho log/DEBUG)
+    size_t activeRuleCount() const { return active_rules.size(); }
+
+    struct Rule; // Mẫu: node IR -> dãy gadget (xem InstructionSelector.cpp)
+
+private:
+    struct IrNode {
+        IrOp op;
+        std::array<uint32_t, 2> kids;
+        uint32_t value;
+    };
+
+    enum class Order : uint8_t { FirstOperandFirst, SecondOperandFirst, SpillFirst };
+
+    static constexpr uint16_t kNoRule = 0xFFFF;
+
+    struct Label {
+        SelectionCost cost{UINT32_MAX, UINT32_MAX};
+        RegMask clobbers = 0;
+        RegMask uses = 0;                 // Thanh ghi có sẵn từ trước mà cách phủ này đọc
+        uint16_t rule = kNoRule;          // Chỉ số trong active_rules; kNoRule = giá trị có sẵn
+        Nonterminal chain_from = Nonterminal::None;
+        Order order = Order::FirstOperandFirst;
+        bool swapped = false;             // Luật giao hoán khớp với hai con đổi chỗ
+        uint8_t kid_any = 0;              // Bit i: toán hạng i dùng nhãn "any" thay vì "fresh"
+
+        bool valid() const { return cost.bytes != UINT32_MAX; }
+    };
+
+    struct NodeLabels {
+        std::array<Label, kNonterminalCount> fresh; // Không dựa vào thanh ghi có sẵn (uses == 0)
+        std::array<Label, kNonterminalCount> any;   // Rẻ nhất, có thể dựa vào thanh ghi có sẵn
+    };
+
+    struct ActiveRule {
+        uint16_t rule;        // Chỉ số trong `rules`
+        SelectionCost cost;   // Chi phí riêng của các gadget trong luật
+        RegMask clobbers;     // Thanh ghi các gadget đó ghi đè
+    };
+
+    const GadgetDB& gadget_db;
+    RomHandle rom;
+    const ByteConstraints& byte_constraints;
+    const SymbolTable& symbol_table;
+    unsigned int scratch_base;
+    unsigned int spill_depth = 0;
+    unsigned int temp_slots = 0;     // Ô tạm của câu lệnh hiện tại (trước các ô spill)
+    std::vector<uint32_t> prelude;   // Các cây phụ ghi ô tạm, phát trước cây chính theo thứ tự
+
+    std::vector<Rule> rules;          // kRules rồi các luật suy từ bảng superopt của ROM
+    std::vector<ActiveRule> active_rules;
+    std::vector<IrNode> ir;
+    std::vector<NodeLabels> labels;
+    std::vector<ChainStep>* out = nullptr;
+
+    RegisterFile registers;                  // Giá trị trong thanh ghi tại điểm phát hiện tại
+    const LivenessInfo* liveness = nullptr;
+    RegMask live_mask = 0;                   // Thanh ghi giữ giá trị còn sống (câu lệnh đang chọn)
+
+    // Luật tổng hợp cho từng hằng: khóa = (IrOp << 16) | hằng -> có ít nhất một luật được bật
+    std::unordered_map<uint32_t, bool> constant_rules;
+    std::unique_ptr<MultiplyPlanner> multiply_planner; // Dựng lần đầu gặp phép nhân với hằng
+
+    // Các node ảo cố định ở đầu ir cho spill: ghi ER0 vào ô tạm, và với mỗi thanh
+    // ghi B một cặp (địa chỉ ô tạm, đọc ô tạm) được gán nhãn sao cho không phá B.
+    // Địa chỉ ô tạm (value của node Const) được điền lúc phát.
+    static constexpr uint32_t kValueInER0 = 0;
+    static constexpr uint32_t kSlotStoreAddress = 1;
+    static constexpr uint32_t kSlotStore = 2;
+    static constexpr uint32_t kSlotReloads = 3;
+    static constexpr uint32_t kFirstTreeNode = kSlotReloads + 2 * static_cast<uint32_t>(Nonterminal::Stmt);
+    static constexpr uint32_t slotReloadAddress(Nonterminal keep) { return kSlotReloads + 2 * static_cast<uint32_t>(keep); }
+    static constexpr uint32_t slotReload(Nonterminal keep) { return slotReloadAddress(keep) + 1; }
+
+    // Chi phí một gadget của ROM (ứng viên thỏa ràng buộc byte); bytes == UINT32_MAX nếu không có
+    SelectionCost gadgetCost(GadgetFunction func) const;
+    // Bật luật rules[index] nếu ROM có mọi gadget của nó; trả về true nếu được bật
+    bool activateRule(size_t index);
+    // Tổng hợp (một lần) các luật MulConst/DivConst cho một hằng; false nếu không phủ được
+    bool ensureConstantRules(IrOp op, uint32_t value);
+    bool planMultiply(uint32_t factor, Rule& out);
+
+    // Bắt đầu hạ một cây mới (xóa IR, cây phụ và ô tạm của cây trước)
+    void beginTree();
+    uint32_t addNode(IrOp op, uint32_t kid0 = 0, uint32_t kid1 = 0, uint32_t value = 0);
+    uint32_t cloneTree(uint32_t node);
+    // Ô tạm: cấp địa chỉ, ghi (thêm một cây phụ), đọc
+    uint32_t newTemp() { return (scratch_base + 2 * temp_slots++) & 0xFFFF; }
+    void storeTemp(uint32_t address, uint32_t value);
+    uint32_t loadTemp(uint32_t address);
+    // Toán hạng dùng nhiều lần: hằng / word tại địa chỉ cố định thì chép cây, còn lại cất ô tạm
+    uint32_t reusable(uint32_t node);
+    // Ném lỗi nếu không tổng hợp được luật MulConst/DivConst cho hằng này
+    void requireConstantRules(IrOp op, uint32_t value, int line);
+    uint32_t multiplyConst(uint32_t node, uint32_t factor, int line);
+    uint32_t shiftRight(uint32_t node, unsigned int bits, int line);
+    // Toán hạng cho MUL mang byte cao của node (hằng hoặc word tại địa chỉ cố định)
+    uint32_t highByteOperand(uint32_t node);
+    uint32_t shiftLeft8(uint32_t node);
+    // Word thứ flag (0/1) của bảng hai word tại địa chỉ table
+    uint32_t pick(uint32_t flag, uint32_t table, int line);
+    // Nhân/chia 16 bit không dấu (toán hạng bất kỳ; chia cho 0 cho 0xFFFF như lệnh DIV)
+    uint32_t lowerMultiply(uint32_t left, uint32_t right);
+    uint32_t lowerDivide(uint32_t dividend, uint32_t divisor, int line);
+    // Chia cho hằng mà DivConst không phủ được (ước lượng bằng dịch + DIV rồi hiệu chỉnh)
+    uint32_t divideByConstant(uint32_t dividend, uint32_t divisor, int line);
+    uint32_t lowerExpression(const AstArena& ast, NodeId node);
+    // So sánh -> node Greater cho 0/1; negated: kết quả là phủ định của phép so sánh
+    uint32_t lowerComparison(TokenType op, uint32_t left, uint32_t right, bool& negated);
+    // Điều kiện -> 0/1 (biểu thức không phải so sánh: so với 0)
+    uint32_t lowerCondition(const AstArena& ast, NodeId node, bool& negated);
+    uint32_t lowerStatement(const AstArena& ast, NodeId node);
+    // Gán nhãn rồi phát cây IR vừa hạ (gốc `root`, kết quả ở `nt`); what: mô tả cho thông báo lỗi
+    SelectionCost selectTree(uint32_t root, Nonterminal nt, std::vector<ChainStep>& out, uint32_t position,
+                             const std::string& what);
+
+    // avoid: bỏ qua mọi cách phủ phá một trong các thanh ghi này
+    void labelNode(uint32_t node, RegMask avoid = 0);
+    void tryRule(uint32_t node, uint16_t active_index, bool swapped, RegMask avoid);
+    void closeChains(uint32_t node, RegMask avoid);
+    // Cập nhật nhãn fresh/any của node nếu ứng viên tốt hơn; trả về true nếu có thay đổi
+    bool consider(uint32_t node, Nonterminal nt, const Label& candidate, RegMask avoid);
+    bool better(const Label& candidate, const Label& current) const;
+    const Label& label(uint32_t node, Nonterminal nt, bool any) const {
+        return any ? labels[node].any[static_cast<size_t>(nt)] : labels[node].fresh[static_cast<size_t>(nt)];
+    }
+    // Giá trị của node nếu mô tả được bằng RegValue (hằng, word tại địa chỉ cố định)
+    RegValue valueOf(uint32_t node) const;
+
+    void emit(uint32_t node, Nonterminal nt, bool any);
+    void emitTemplate(const ActiveRule& rule, uint32_t node, bool swapped);
+};
+
+#endif // INSTRUCTION_SELECTOR_H
@@ -1,11 +1,133 @@
 #include "Lexer.h"
+#include "PerfectHash.h"
 #include <cctype> // For isalpha, isdigit, isspace
 #include <iostream>
 
+// --- Bảng từ khóa ---
+// Thêm từ khóa mới: thêm vào cả hai mảng dưới đây (cùng thứ tự).
+// static_assert bảo đảm bảng perfect hash dựng được lúc biên dịch.
+namespace {
+
+constexpr std::array<std::string_view, 12> kKeywordSpellings = {
+    "VAR",
+    "MEM_WRITE",
+    "MEM_READ",
+    "PRINT_CHAR",
+    "WHILE",
+    "REPEAT",
+    "IF",
+    "ELSE",
+    "SUB",
+    "CALL",
+    "CONST",
+    "MACRO",
+};
+
+constexpr std::array<TokenType, 12> kKeywordTypes = {
+    TokenType::VAR,
+    TokenType::MEM_WRITE,
+    TokenType::MEM_READ,
+    TokenType::PRINT_CHAR,
+    TokenType::WHILE,
+    TokenType::REPEAT,
+    TokenType::IF,
+    TokenType::ELSE,
+    TokenType::SUB,
+    TokenType::CALL,
+    TokenType::CONST,
+    TokenType::MACRO,
+};
+
+constexpr auto kKeywordTable = perfect_hash::build(kKeywordSpellings);
+static_assert(kKeywordTable.ok, "Không dựng được perfect hash cho bảng từ khóa");
+
+} // namespace
+
+std::string tokenTypeToString(TokenType type) {
+    switch (type) {
+        case TokenType::VAR: return "VAR";
+        case TokenType::IDENTIFIER: return "IDENTIFIER";
+        case TokenType::INTEGER_LITERAL: return "INTEGER_LITERAL";
+        case TokenType::ASSIGN: return "=";
+        case TokenType::PLUS: return "+";
+        case TokenType::MINUS: return "-";
+        case TokenType::MULTIPLY: return "*";
+        case TokenType::DIVIDE: return "/";
+        case TokenType::SEMICOLON: return ";";
+        case TokenType::LPAREN: return "(";
+        case TokenType::RPAREN: return ")";
+        case TokenType::LBRACKET: return "[";
+        case TokenType::RBRACKET: return "]";
+        case TokenType::COMMA: return ",";
+        case TokenType::MEM_WRITE: return "MEM_WRITE";
+        case TokenType::MEM_READ: return "MEM_READ";
+        case TokenType::PRINT_CHAR: return "PRINT_CHAR";
+        case TokenType::WHILE: return "WHILE";
+        case TokenType::REPEAT: return "REPEAT";
+        case TokenType::LBRACE: return "{";
+        case TokenType::RBRACE: return "}";
+        case TokenType::IF: return "IF";
+        case TokenType::ELSE: return "ELSE";
+        case TokenType::LESS: return "<";
+        case TokenType::GREATER: return ">";
+        case TokenType::LESS_EQUAL: return "<=";
+        case TokenType::GREATER_EQUAL: return ">=";
+        case TokenType::EQUAL: return "==";
+        case TokenType::NOT_EQUAL: return "!=";
+        case TokenType::SUB: return "SUB";
+        case TokenType::CALL: return "CALL";
+        case TokenType::CONST: return "CONST";
+        case TokenType::MACRO: return "MACRO";
+        case TokenType::END_OF_FILE: return "END_OF_FILE";
+        case TokenType::UNKNOWN: return "UNKNOWN";
+    }
+    return "UNKNOWN";
+}
+
+// --- TokenBuffer Implementation ---
+void TokenBuffer::clear() {
+    types.clear();
+    offsets.clear();
+    lengths.clear();
+    lines.clear();
+    columns.clear();
+    symbols.clear();
+    interner = StringInterner();
+}
+
+void TokenBuffer::reserve(size_t count) {
+    types.reserve(count);
+    offsets.reserve(count);
+    lengths.reserve(count);
+    lines.reserve(count);
+    columns.reserve(count);
+    symbols.reserve(count);
+}
+
+void TokenBuffer::push(const TokenSlice& slice, uint32_t symbol) {
+    types.push_back(slice.type);
+    offsets.push_back(slice.offset);
+    lengths.push_back(slice.length);
+    lines.push_back(slice.line);
+    columns.push_back(slice.column);
+    symbols.push_back(symbol);
+}
+
+TokenType Lexer::classifyWord(std::string_view word) {
+    std::uint16_t idx = kKeywordTable.candidate(word);
+    if (idx != perfect_hash::kEmptySlot && kKeywordSpellings[idx] == word) {
+        return kKeywordTypes[idx];
+    }
+    return TokenType::IDENTIFIER;
+}
+
 Lexer::Lexer(const std::string& source)
+    : owned_source(source), source_code(owned_source), current_pos(0), current_line(1), current_column(1) {}
+
+Lexer::Lexer(std::string_view source)
     : source_code(source), current_pos(0), current_line(1), current_column(1) {}
 
-char Lexer::peek() {
+char Lexer::peek() const {
     if (current_pos >= source_code.length()) {
         return '\0'; // End of file
     }
@@ -27,67 +149,120 @@ char Lexer::consume() {
 }
 
 void Lexer::skipWhitespace() {
-    while (isspace(peek())) {
+    while (isspace(static_cast<unsigned char>(peek()))) {
         consume();
     }
 }
 
-Token Lexer::readIdentifier() {
-    std::string id_str;
+TokenSlice Lexer::readIdentifier() {
+    size_t start = current_pos;
     int start_col = current_column;
-    while (isalnum(peek()) || peek() == '_') {
-        id_str += consume();
+    // Định danh không chứa xuống dòng nên chỉ cần tăng cột
+    while (current_pos < source_code.length() &&
+           (isalnum(static_cast<unsigned char>(source_code[current_pos])) || source_code[current_pos] == '_')) {
+        current_pos++;
     }
+    uint32_t length = static_cast<uint32_t>(current_pos - start);
+    current_column += static_cast<int>(length);
 
     // Kiểm tra từ khóa
-    if (id_str == "VAR") return Token(TokenType::VAR, id_str, current_line, start_col);
-    if (id_str == "MEM_WRITE") return Token(TokenType::MEM_WRITE, id_str, current_line, start_col);
-    if (id_str == "MEM_READ") return Token(TokenType::MEM_READ, id_str, current_line, start_col);
-    if (id_str == "PRINT_CHAR") return Token(TokenType::PRINT_CHAR, id_str, current_line, start_col);
-    
-    return Token(TokenType::IDENTIFIER, id_str, current_line, start_col);
+    TokenType type = classifyWord(source_code.substr(start, length));
+    return TokenSlice{type, static_cast<uint32_t>(start), length, current_line, start_col};
 }
 
-Token Lexer::readNumber() {
-    std::string num_str;
+TokenSlice Lexer::readNumber() {
+    size_t start = current_pos;
     int start_col = current_column;
-    while (isdigit(peek())) {
-        num_str += consume();
+    while (current_pos < source_code.length() && isdigit(static_cast<unsigned char>(source_code[current_pos]))) {
+        current_pos++;
     }
-    return Token(TokenType::INTEGER_LITERAL, num_str, current_line, start_col);
+    uint32_t length = static_cast<uint32_t>(current_pos - start);
+    current_column += static_cast<int>(length);
+    return TokenSlice{TokenType::INTEGER_LITERAL, static_cast<uint32_t>(start), length, current_line, start_col};
 }
 
-Token Lexer::getNextToken() {
+TokenSlice Lexer::nextSlice() {
     skipWhitespace();
 
     if (peek() == '\0') {
-        return Token(TokenType::END_OF_FILE, "", current_line, current_column);
+        return TokenSlice{TokenType::END_OF_FILE, static_cast<uint32_t>(current_pos), 0, current_line, current_column};
     }
 
     char c = peek();
     int start_col = current_column;
+    uint32_t start = static_cast<uint32_t>(current_pos);
 
-    if (isalpha(c) || c == '_') {
+    if (isalpha(static_cast<unsigned char>(c)) || c == '_') {
         return readIdentifier();
     }
 
-    if (isdigit(c)) {
+    if (isdigit(static_cast<unsigned char>(c))) {
         return readNumber();
     }
 
+    // Toán tử so sánh hai ký tự: <=, >=, ==, !=
+    char next = current_pos + 1 < source_code.length() ? source_code[current_pos + 1] : '\0';
+    if (next == '=' && (c == '<' || c == '>' || c == '=' || c == '!')) {
+        TokenType type = c == '<' ? TokenType::LESS_EQUAL
+                       : c == '>' ? TokenType::GREATER_EQUAL
+                       : c == '=' ? TokenType::EQUAL
+                                  : TokenType::NOT_EQUAL;
+        consume();
+        consume();
+        return TokenSlice{type, start, 2, current_line, start_col};
+    }
+
+    TokenType type;
     switch (c) {
-        case '=': consume(); return Token(TokenType::ASSIGN, "=", current_line, start_col);
-        case '+': consume(); return Token(TokenType::PLUS, "+", current_line, start_col);
-        case '-': consume(); return Token(TokenType::MINUS, "-", current_line, start_col);
-        case ';': consume(); return Token(TokenType::SEMICOLON, ";", current_line, start_col);
-        case '(': consume(); return Token(TokenType::LPAREN, "(", current_line, start_col);
-        case ')': consume(); return Token(TokenType::RPAREN, ")", current_line, start_col);
-        case ',': consume(); return Token(TokenType::COMMA, ",", current_line, start_col);
+        case '=': type = TokenType::ASSIGN; break;
+        case '<': type = TokenType::LESS; break;
+        case '>': type = TokenType::GREATER; break;
+        case '+': type = TokenType::PLUS; break;
+        case '-': type = TokenType::MINUS; break;
+        case ';': type = TokenType::SEMICOLON; break;
+        case '(': type = TokenType::LPAREN; break;
+        case ')': type = TokenType::RPAREN; break;
+        case '[': type = TokenType::LBRACKET; break;
+        case ']': type = TokenType::RBRACKET; break;
+        case '{': type = TokenType::LBRACE; break;
+        case '}': type = TokenType::RBRACE; break;
+        case '*': type = TokenType::MULTIPLY; break;
+        case '/': type = TokenType::DIVIDE; break;
+        case ',': type = TokenType::COMMA; break;
         // ... thêm các toán tử và ký tự khác
         default:
             std::cerr << "Lỗi Lexer: Ký tự không hợp lệ '" << c << "' tại dòng "
                       << current_line << ", cột " << current_column << std::endl;
-            consume(); // Bỏ qua ký tự lỗi để tiếp tục
-            return Token(TokenType::UNKNOWN, std::string(1, c), current_line, start_col);
+            type = TokenType::UNKNOWN; // Bỏ qua ký tự lỗi để tiếp tục
+            break;
     }
+    consume();
+    return TokenSlice{type, start, 1, current_line, start_col};
+}
+
+Token Lexer::getNextToken() {
+    TokenSlice slice = nextSlice();
+    return Token(slice.type, std::string(text(slice)), slice.line, slice.column);
+}
+
+void Lexer::tokenize(TokenBuffer& out) {
+    out.source = source_code;
+    // Ước lượng thô: trung bình khoảng 4 ký tự mỗi token
+    out.reserve(out.size() + (source_code.length() - current_pos) / 4 + 1);
+    TokenSlice slice;
+    do {
+        slice = nextSlice();
+        if (slice.type == TokenType::IDENTIFIER) {
+            out.push(slice, out.interner.intern(text(slice)));
+        } else {
+            out.push(slice);
+        }
+    } while (slice.type != TokenType::END_OF_FILE);
+}
+
+TokenBuffer Lexer::tokenize(std::string_view source) {
+    TokenBuffer buffer;
+    Lexer lexer(source);
+    lexer.tokenize(buffer);
+    return buffer;
 }
@@ -1,9 +1,12 @@
 #ifndef LEXER_H
 #define LEXER_H
 
+#include <cstdint>
 #include <string>
+#include <string_view>
 #include <vector>
 #include <map>
+#include "StringInterner.h"
 
 // Định nghĩa các loại Token
 enum class TokenType {
@@ -13,13 +16,33 @@ enum class TokenType {
     ASSIGN,         // =
     PLUS,           // +
     MINUS,          // -
+    MULTIPLY,       // *
+    DIVIDE,         // /
     SEMICOLON,      // ;
     LPAREN,         // (
     RPAREN,         // )
+    LBRACKET,       // [
+    RBRACKET,       // ]
     COMMA,          // ,
     MEM_WRITE,      // MEM_WRITE (từ khóa)
     MEM_READ,       // MEM_READ (từ khóa)
     PRINT_CHAR,     // PRINT_CHAR (từ khóa màn hình Casio)
+    WHILE,          // WHILE (từ khóa vòng lặp)
+    REPEAT,         // REPEAT (từ khóa vòng lặp đếm)
+    LBRACE,         // {
+    RBRACE,         // }
+    IF,             // IF (từ khóa rẽ nhánh)
+    ELSE,           // ELSE
+    LESS,           // <
+    GREATER,        // >
+    LESS_EQUAL,     // <=
+    GREATER_EQUAL,  // >=
+    EQUAL,          // ==
+    NOT_EQUAL,      // !=
+    SUB,            // SUB (định nghĩa chương trình con)
+    CALL,           // CALL
+    CONST,          // CONST (hằng lúc biên dịch)
+    MACRO,          // MACRO (biểu thức có tham số, khai triển lúc biên dịch)
     END_OF_FILE,    // Kết thúc file
     UNKNOWN         // Token không xác định
 };
@@ -36,22 +59,84 @@ struct Token {
         : type(type), value(std::move(value)), line(line), column(column) {}
 };
 
+// Tên hiển thị của loại token (dùng trong thông báo lỗi)
+std::string tokenTypeToString(TokenType type);
+
+// Token dạng "lát cắt": chỉ lưu vị trí trong mã nguồn, không cấp phát heap.
+// Dùng text() của Lexer để lấy nội dung (string_view trỏ vào mã nguồn).
+struct TokenSlice {
+    TokenType type;
+    uint32_t offset;
+    uint32_t length;
+    int line;
+    int column;
+};
+
+// --- Bộ đệm token dạng struct-of-arrays ---
+// Lexer điền toàn bộ token trong một lượt; Parser duyệt theo chỉ số nên
+// nhìn trước bao xa cũng chỉ là một lần đọc mảng. Bộ đệm chỉ tham chiếu tới
+// mã nguồn (không tới Lexer), nên có thể lex file tiếp theo trên một thread
+// khác trong khi file hiện tại đang được parse.
+struct TokenBuffer {
+    std::string_view source;
+    std::vector<TokenType> types;
+    std::vector<uint32_t> offsets;
+    std::vector<uint32_t> lengths;
+    std::vector<int> lines;
+    std::vector<int> columns;
+    std::vector<uint32_t> symbols; // ID intern của IDENTIFIER (kNoId với token khác)
+    StringInterner interner;       // Bảng tên định danh của bộ đệm này
+
+    size_t size() const { return types.size(); }
+    std::string_view text(size_t index) const { return source.substr(offsets[index], lengths[index]); }
+
+    void clear();
+    void reserve(size_t count);
+    void push(const TokenSlice& slice, uint32_t symbol = StringInterner::kNoId);
+};
+
 class Lexer {
 public:
+    // Sao chép mã nguồn vào Lexer (chế độ cũ, an toàn với chuỗi tạm)
     explicit Lexer(const std::string& source);
+    // Mượn mã nguồn: người gọi phải giữ bộ nhớ sống lâu hơn Lexer
+    // (ví dụ: chuỗi hằng hoặc MappedFile).
+    explicit Lexer(std::string_view source);
+    explicit Lexer(const char* source) : Lexer(std::string_view(source)) {}
+
+    // Lexer có thể trỏ vào bộ đệm của chính nó, nên không cho sao chép/di chuyển
+    Lexer(const Lexer&) = delete;
+    Lexer& operator=(const Lexer&) = delete;
+
     Token getNextToken();
+    // Đường nhanh: không cấp phát, trả về vị trí token trong mã nguồn
+    TokenSlice nextSlice();
+    std::string_view text(const TokenSlice& slice) const {
+        return source_code.substr(slice.offset, slice.length);
+    }
+
+    // Lex toàn bộ phần còn lại vào bộ đệm (kết thúc bằng END_OF_FILE).
+    // Định danh được intern ngay khi lex, nên Parser chỉ làm việc với ID nguyên.
+    // Bộ đệm mượn mã nguồn của Lexer: với chế độ sao chép, Lexer phải sống lâu hơn bộ đệm.
+    void tokenize(TokenBuffer& out);
+    // Tiện ích cho việc lex song song: không giữ trạng thái chung nên gọi an toàn từ bất kỳ thread nào
+    static TokenBuffer tokenize(std::string_view source);
+
+    // Phân loại từ khóa bằng perfect hash dựng lúc biên dịch
+    static TokenType classifyWord(std::string_view word);
 
 private:
-    std::string source_code;
+    std::string owned_source; // Chỉ dùng ở chế độ sao chép
+    std::string_view source_code;
     size_t current_pos;
     int current_line;
     int current_column;
 
-    char peek();
+    char peek() const;
     char consume();
     void skipWhitespace();
-    Token readIdentifier();
-    Token readNumber();
+    TokenSlice readIdentifier();
+    TokenSlice readNumber();
     // Các hàm hỗ trợ khác
 };
 
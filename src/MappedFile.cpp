@@ -0,0 +1,56 @@
+#include "MappedFile.h"
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define MAPPED_FILE_HAS_MMAP 1
+#endif
+
+MappedFile::MappedFile(const std::string& filepath) {
+#ifdef MAPPED_FILE_HAS_MMAP
+    int fd = ::open(filepath.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error("Không thể mở file: " + filepath);
+    }
+    struct stat st;
+    if (::fstat(fd, &st) != 0) {
+        ::close(fd);
+        throw std::runtime_error("Không thể đọc thông tin file: " + filepath);
+    }
+    data_size = static_cast<std::size_t>(st.st_size);
+    if (data_size > 0) {
+        void* mem = ::mmap(nullptr, data_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mem != MAP_FAILED) {
+            data_ptr = static_cast<const char*>(mem);
+            is_mapped = true;
+        }
+    }
+    ::close(fd);
+    if (is_mapped || data_size == 0) {
+        return;
+    }
+#endif
+    // Fallback: đọc toàn bộ file vào bộ đệm
+    std::ifstream file(filepath, std::ios::binary);
+    if (!file.is_open()) {
+        throw std::runtime_error("Không thể mở file: " + filepath);
+    }
+    std::ostringstream ss;
+    ss << file.rdbuf();
+    fallback_buffer = ss.str();
+    data_ptr = fallback_buffer.data();
+    data_size = fallback_buffer.size();
+}
+
+MappedFile::~MappedFile() {
+#ifdef MAPPED_FILE_HAS_MMAP
+    if (is_mapped) {
+        ::munmap(const_cast<char*>(data_ptr), data_size);
+    }
+#endif
+}
@@ -0,0 +1,31 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+// --- File ánh xạ bộ nhớ (read-only) ---
+// Dùng mmap khi hệ điều hành hỗ trợ, nếu không thì đọc cả file vào bộ đệm.
+// Nội dung có hiệu lực cho tới khi đối tượng bị hủy, nên Lexer (chế độ mượn)
+// có thể trỏ thẳng vào đây mà không cần sao chép mã nguồn.
+class MappedFile {
+public:
+    explicit MappedFile(const std::string& filepath);
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const char* data() const { return data_ptr; }
+    std::size_t size() const { return data_size; }
+    std::string_view view() const { return std::string_view(data_ptr, data_size); }
+
+private:
+    const char* data_ptr = nullptr;
+    std::size_t data_size = 0;
+    bool is_mapped = false;
+    std::string fallback_buffer; // Chỉ dùng khi không có mmap
+};
+
+#endif // MAPPED_FILE_H
@@ -0,0 +1,1057 @@
+#include "Optimizer.h"
+#include <algorithm>
+#include <map>
+
+namespace {
+
+constexpr SymbolId kNoSymbol = 0xFFFFFFFF;
+
+bool isLiteral(const AstArena& ast, NodeId node, uint32_t* value = nullptr) {
+    if (ast.type(node) != NodeType::IntegerLiteral) return false;
+    if (value) *value = ast.at(node).a & 0xFFFF;
+    return true;
+}
+
+bool isComparison(TokenType op) {
+    return op == TokenType::LESS || op == TokenType::GREATER || op == TokenType::LESS_EQUAL ||
+           op == TokenType::GREATER_EQUAL || op == TokenType::EQUAL || op == TokenType::NOT_EQUAL;
+}
+
+// --- Đánh số giá trị (CSE) ---
+// Khóa của một giá trị: loại và hai toán hạng. Lần đọc bộ nhớ mang theo "phiên bản"
+// của các byte nó đọc (dấu thời gian của lần ghi gần nhất có thể chồng lấn), nên sau
+// một lần ghi, mọi biểu thức dựa trên lần đọc đó tự nhận số mới: không cần xóa gì
+// khỏi bảng, và MemWrite tới địa chỉ không biết trước làm mất mọi lần đọc.
+enum class ValueKind : uint8_t {
+    Opaque,    // Không so khớp với gì (biến chưa khai báo)
+    Literal,   // a = giá trị
+    LoadFixed, // a = địa chỉ cố định, b = phiên bản (biến hoặc MEM[hằng])
+    Load,      // a = số của địa chỉ, b = phiên bản của cả bộ nhớ
+    Operation, // + (TokenType << 8); a, b = số của hai vế
+};
+
+constexpr uint32_t kNoSlot = 0xFFFFFFFF;
+constexpr uint32_t kNoValue = 0xFFFFFFFF;
+
+// Chi phí ước lượng (byte trong chuỗi) để chọn biểu thức đáng đưa vào ô tạm:
+// pop địa chỉ + gadget đọc/ghi word, và phần thêm của từng loại phép tính.
+// Tính lại ở câu lệnh sau thì các biến lá thường còn trong thanh ghi (RegisterFile)
+// nên gần như không tốn gì; tính lại trong cùng câu lệnh thì phải nạp lại cả lá.
+constexpr uint32_t kReloadBytes = 10;
+constexpr uint32_t kStoreBytes = 14;
+constexpr uint32_t kResidentLeafBytes = 2;
+constexpr uint32_t kAddressedLoadBytes = 6; // Đọc word tại địa chỉ đã nằm trong thanh ghi
+constexpr uint32_t kAddSubBytes = 4;
+constexpr uint32_t kImmediateBytes = 6;     // Hằng được pop vào thanh ghi
+constexpr uint32_t kMulConstBytes = 24;     // Dãy dịch/cộng/trừ
+constexpr uint32_t kDivConstBytes = 10;     // pop số chia + DIV
+constexpr uint32_t kMulBytes = 240;        // Tích 16 bit: ba MUL, ghép byte cao, toán hạng đọc lại từ RAM
+constexpr uint32_t kDivBytes = 1200;       // Chia 16 bit: DIV hoặc 8 bước trừ dần qua ô tạm
+constexpr uint32_t kCompareBytes = 14;      // CMP + r1 = 0 (== và != thêm phép trừ, pop er2 = 0)
+constexpr uint32_t kSpillBytes = 12;        // Cả hai vế đều phải tính: thường phải cất một vế ra RAM
+
+struct ValueKey {
+    uint32_t kind;
+    uint32_t a;
+    uint32_t b;
+
+    bool operator==(const ValueKey& other) const { return kind == other.kind && a == other.a && b == other.b; }
+};
+
+uint32_t hashKey(const ValueKey& k) {
+    // Trộn kiểu murmur3 (fmix64): dò tuyến tính cần bit thấp phân tán đều
+    uint64_t h = ((static_cast<uint64_t>(k.a) << 32) | k.b) ^ (static_cast<uint64_t>(k.kind) * 0x9E3779B97F4A7C15ull);
+    h ^= h >> 33;
+    h *= 0xFF51AFD7ED558CCDull;
+    h ^= h >> 33;
+    h *= 0xC4CEB9FE1A85EC53ull;
+    h ^= h >> 33;
+    return static_cast<uint32_t>(h);
+}
+
+// Một giá trị; giữ gọn vì có gần một giá trị cho mỗi node của chương trình
+struct ValueInfo {
+    ValueKey key{};
+    uint32_t hash = 0;
+    uint32_t last_statement = 0; // Câu lệnh cuối cùng dùng giá trị
+    uint32_t slot = kNoSlot;     // Ô tạm đang giữ giá trị
+    uint32_t block = 0;          // Khối cơ bản nơi giá trị được đánh số
+    uint16_t weight = 0;         // Chi phí ước lượng để tính lại (byte), khi phải nạp lại mọi lá
+    uint16_t warm_weight = 0;    // Như trên, khi các lá còn trong thanh ghi
+    uint8_t cold_repeats = 0;    // Lần lặp lại trong cùng câu lệnh với lần dùng trước (bão hòa)
+    uint8_t warm_repeats = 0;    // Lần lặp lại ở câu lệnh sau (bão hòa)
+    ValueKind kind = ValueKind::Opaque;
+    bool used = false;           // Đã xuất hiện ngoài một lần lặp lại của biểu thức lớn hơn
+    bool computed = false;       // Đã được tính vào ô tạm (ô có thể đã được trả lại)
+};
+
+class ValueNumbering {
+public:
+    ValueNumbering(const AstArena& ast, const SymbolTable& symbols)
+        : ast(ast), symbols(symbols), numbers(ast.size(), 0), last_write(0x10000, 0) {
+        values.reserve(ast.size());
+    }
+
+    // Số giá trị của biểu thức (đệ quy, ghi lại cho mọi node con)
+    uint32_t number(NodeId node);
+    // Đếm lần xuất hiện từ trên xuống; lần lặp lại không đếm các biểu thức con của nó
+    void count(NodeId node, uint32_t statement);
+
+    void write(uint32_t address, unsigned int width);
+    void writeUnknown() { last_unknown = ++stamp; }
+    // Đầu khối cơ bản mới: không giá trị nào của khối trước còn dùng được
+    void endBlock() { block++; }
+
+    uint32_t valueOf(NodeId node) const { return numbers[node]; }
+    ValueInfo& info(uint32_t value) { return values[value]; }
+
+    // Đáng tính một lần vào ô tạm: ghi ô cộng đọc lại ở mỗi lần dùng sau phải rẻ hơn
+    // tính lại (lần đọc biến/MEM[hằng] đã rẻ như đọc ô tạm, bộ chọn còn giữ nó trong thanh ghi)
+    bool worthTemporary(uint32_t value) const {
+        const ValueInfo& v = values[value];
+        if (v.kind != ValueKind::Load && v.kind != ValueKind::Operation) return false;
+        auto saved = [](uint32_t weight) { return weight > kReloadBytes ? weight - kReloadBytes : 0; };
+        return v.cold_repeats * saved(v.weight) + v.warm_repeats * saved(v.warm_weight) > kStoreBytes;
+    }
+
+private:
+    const AstArena& ast;
+    const SymbolTable& symbols;
+    std::vector<uint32_t> numbers; // Chỉ số = NodeId (node có trước pass)
+    std::vector<ValueInfo> values;
+    // Bảng băm địa chỉ mở (dò tuyến tính, như StringInterner): ô chứa số giá trị, kNoValue = trống
+    std::vector<uint32_t> table;
+    size_t table_size = 0;
+    std::vector<uint32_t> last_write; // Địa chỉ byte -> dấu thời gian lần ghi cuối
+    uint32_t stamp = 0;
+    uint32_t last_unknown = 0; // Lần ghi gần nhất vào địa chỉ không biết trước
+    uint32_t block = 0;        // Giá trị của khối trước vẫn nằm trong bảng nhưng không còn khớp
+
+    void grow();
+
+    uint32_t intern(ValueKind kind, uint32_t extra, uint32_t a, uint32_t b, uint32_t weight, uint32_t warm_weight);
+    uint32_t versionOf(uint32_t address) const;
+};
+
+uint32_t ValueNumbering::intern(ValueKind kind, uint32_t extra, uint32_t a, uint32_t b, uint32_t weight,
+                                uint32_t warm_weight) {
+    ValueKey key{static_cast<uint32_t>(kind) | (extra << 8), a, b};
+    uint32_t h = hashKey(key);
+    size_t idx = 0;
+    if (kind != ValueKind::Opaque) {
+        // Giữ hệ số tải <= 1/2
+        if ((table_size + 1) * 2 > table.size()) grow();
+        size_t mask = table.size() - 1;
+        for (idx = h & mask; table[idx] != kNoValue; idx = (idx + 1) & mask) {
+            const ValueInfo& v = values[table[idx]];
+            if (v.hash == h && v.block == block && v.key == key) return table[idx];
+        }
+    }
+    uint32_t value = static_cast<uint32_t>(values.size());
+    ValueInfo info;
+    info.key = key;
+    info.hash = h;
+    info.kind = kind;
+    info.block = block;
+    info.weight = static_cast<uint16_t>(std::min<uint32_t>(weight, 0xFFFF));
+    info.warm_weight = static_cast<uint16_t>(std::min<uint32_t>(warm_weight, 0xFFFF));
+    values.push_back(info);
+    if (kind != ValueKind::Opaque) {
+        table[idx] = value;
+        table_size++;
+    }
+    return value;
+}
+
+void ValueNumbering::grow() {
+    std::vector<uint32_t> old;
+    old.swap(table);
+    table.assign(old.empty() ? 64 : old.size() * 2, kNoValue);
+    size_t mask = table.size() - 1;
+    for (uint32_t value : old) {
+        if (value == kNoValue) continue;
+        size_t idx = values[value].hash & mask;
+        while (table[idx] != kNoValue) idx = (idx + 1) & mask;
+        table[idx] = value;
+    }
+}
+
+uint32_t ValueNumbering::versionOf(uint32_t address) const {
+    uint32_t version = last_unknown;
+    for (uint32_t byte = address; byte < address + 2; ++byte) {
+        version = std::max(version, last_write[byte & 0xFFFF]);
+    }
+    return version;
+}
+
+void ValueNumbering::write(uint32_t address, unsigned int width) {
+    ++stamp;
+    for (uint32_t byte = address; byte < address + width; ++byte) {
+        last_write[byte & 0xFFFF] = stamp;
+    }
+    // Chương trình ghi thẳng vào vùng ô tạm (sau vùng biến): không giữ giá trị nào qua lần ghi
+    // này. Ghi vào địa chỉ không biết trước được coi là không chạm vùng đó (như ô spill).
+    if (address + width > symbols.next_available_address) endBlock();
+}
+
+uint32_t ValueNumbering::number(NodeId node) {
+    const NodeSlots& s = ast.at(node);
+    uint32_t value = 0;
+    switch (ast.type(node)) {
+        case NodeType::IntegerLiteral:
+            value = intern(ValueKind::Literal, 0, s.a & 0xFFFF, 0, 0, 0);
+            break;
+        case NodeType::Identifier: {
+            const SymbolInfo* sym = symbols.get_symbol(s.a);
+            value = sym ? intern(ValueKind::LoadFixed, 0, sym->address, versionOf(sym->address), kReloadBytes, kResidentLeafBytes)
+                        : intern(ValueKind::Opaque, 0, 0, 0, kReloadBytes, kReloadBytes);
+            break;
+        }
+        case NodeType::MemRead: {
+            uint32_t address = number(s.a);
+            uint32_t fixed;
+            // MEM[hằng] và biến tại cùng địa chỉ là một giá trị
+            value = isLiteral(ast, s.a, &fixed)
+                ? intern(ValueKind::LoadFixed, 0, fixed, versionOf(fixed), kReloadBytes, kResidentLeafBytes)
+                : intern(ValueKind::Load, 0, address, stamp, values[address].weight + kAddressedLoadBytes,
+                         values[address].warm_weight + kAddressedLoadBytes);
+            break;
+        }
+        case NodeType::BinaryOp: {
+            uint32_t left = number(s.a);
+            uint32_t right = number(s.b);
+            TokenType op = static_cast<TokenType>(s.c);
+            bool by_literal = values[left].kind == ValueKind::Literal || values[right].kind == ValueKind::Literal;
+            uint32_t cost = op == TokenType::MULTIPLY ? kMulBytes : kDivBytes;
+            if (op == TokenType::PLUS || op == TokenType::MINUS) {
+                cost = kAddSubBytes + (by_literal ? kImmediateBytes : 0);
+            } else if (isComparison(op)) {
+                cost = kCompareBytes;
+            } else if (by_literal) {
+                cost = op == TokenType::MULTIPLY ? kMulConstBytes : kDivConstBytes;
+            }
+            if (values[left].kind >= ValueKind::Load && values[right].kind >= ValueKind::Load) {
+                cost += kSpillBytes;
+            }
+            if ((op == TokenType::PLUS || op == TokenType::MULTIPLY || op == TokenType::EQUAL ||
+                 op == TokenType::NOT_EQUAL) && right < left) {
+                std::swap(left, right); // Giao hoán: a + b và b + a là một giá trị
+            }
+            value = intern(ValueKind::Operation, static_cast<uint32_t>(op), left, right,
+                           values[left].weight + values[right].weight + cost,
+                           values[left].warm_weight + values[right].warm_weight + cost);
+            break;
+        }
+        default:
+            value = intern(ValueKind::Opaque, 0, 0, 0, 0, 0);
+            break;
+    }
+    numbers[node] = value;
+    return value;
+}
+
+void ValueNumbering::count(NodeId node, uint32_t statement) {
+    ValueInfo& v = values[numbers[node]];
+    bool repeated = v.used;
+    if (repeated) {
+        uint8_t& repeats = v.last_statement == statement ? v.cold_repeats : v.warm_repeats;
+        if (repeats < 0xFF) repeats++;
+    }
+    v.used = true;
+    v.last_statement = statement;
+    if (repeated) return;
+    const NodeSlots& s = ast.at(node);
+    switch (ast.type(node)) {
+        case NodeType::MemRead:
+            count(s.a, statement);
+            break;
+        case NodeType::BinaryOp:
+            count(s.a, statement);
+            count(s.b, statement);
+            break;
+        default:
+            break;
+    }
+}
+
+// Đổi các lần dùng giá trị đáng giữ thành đọc ô tạm; lần đầu tiên được tính vào ô
+// bằng một câu lệnh chèn trước câu lệnh đang xét
+class TemporaryRewriter {
+public:
+    TemporaryRewriter(AstArena& ast, ValueNumbering& numbering, unsigned int base, OptimizerStats& counters)
+        : ast(ast), numbering(numbering), base(base), counters(counters) {}
+
+    void rewrite(NodeId node, int line);
+    // Trả lại ô của các giá trị không còn được dùng sau câu lệnh `statement`
+    void release(uint32_t statement);
+
+    std::vector<NodeId> definitions; // MEM[ô] = biểu thức, theo thứ tự phải chạy
+
+private:
+    AstArena& ast;
+    ValueNumbering& numbering;
+    unsigned int base;
+    OptimizerStats& counters;
+    std::vector<uint32_t> free_slots;
+    std::vector<uint32_t> holding; // Giá trị đang giữ ô
+    uint32_t slot_count = 0;
+
+    uint32_t allocate();
+    void readSlot(NodeId node, uint32_t slot, int line) {
+        ast.types[node] = NodeType::MemRead;
+        ast.at(node) = NodeSlots{ast.add(NodeType::IntegerLiteral, (base + 2 * slot) & 0xFFFF, 0, 0, line), 0, 0};
+    }
+};
+
+uint32_t TemporaryRewriter::allocate() {
+    if (!free_slots.empty()) {
+        uint32_t slot = free_slots.back();
+        free_slots.pop_back();
+        return slot;
+    }
+    counters.temporaries = std::max<size_t>(counters.temporaries, slot_count + 1);
+    return slot_count++;
+}
+
+void TemporaryRewriter::rewrite(NodeId node, int line) {
+    uint32_t value = numbering.valueOf(node);
+    ValueInfo& v = numbering.info(value);
+    bool temporary = numbering.worthTemporary(value);
+    if (temporary && v.slot != kNoSlot) {
+        readSlot(node, v.slot, line);
+        counters.reused_expressions++;
+        return;
+    }
+    const NodeSlots s = ast.at(node);
+    if (ast.type(node) == NodeType::MemRead) {
+        rewrite(s.a, line);
+    } else if (ast.type(node) == NodeType::BinaryOp) {
+        rewrite(s.a, line);
+        rewrite(s.b, line);
+    }
+    // Ô đã trả lại (giá trị còn xuất hiện ở chỗ pass đếm bỏ qua) thì tính lại tại chỗ
+    if (temporary && !v.computed) {
+        v.computed = true;
+        v.slot = allocate();
+        holding.push_back(value);
+        NodeId expr = ast.add(ast.type(node), s.a, s.b, s.c, ast.lines[node]);
+        NodeId address = ast.add(NodeType::IntegerLiteral, (base + 2 * v.slot) & 0xFFFF, 0, 0, line);
+        definitions.push_back(ast.add(NodeType::MemWrite, address, expr, 0, line));
+        readSlot(node, v.slot, line);
+    }
+}
+
+void TemporaryRewriter::release(uint32_t statement) {
+    for (size_t i = 0; i < holding.size();) {
+        ValueInfo& v = numbering.info(holding[i]);
+        if (v.last_statement > statement) {
+            ++i;
+            continue;
+        }
+        free_slots.push_back(v.slot);
+        v.slot = kNoSlot;
+        holding[i] = holding.back();
+        holding.pop_back();
+    }
+}
+
+// Các biểu thức của một câu lệnh theo thứ tự đánh giá; trả về số biểu thức
+size_t expressionsOf(const AstArena& ast, NodeId stmt, NodeId (&out)[3]) {
+    const NodeSlots& s = ast.at(stmt);
+    switch (ast.type(stmt)) {
+        case NodeType::Assignment: out[0] = s.b; return 1;
+        case NodeType::MemWrite: out[0] = s.a; out[1] = s.b; return 2;
+        case NodeType::PrintChar: out[0] = s.a; out[1] = s.b; out[2] = s.c; return 3;
+        default: return 0;
+    }
+}
+
+// Câu lệnh chạy nối tiếp câu lệnh sau (không phải nhãn/nhảy): không kết thúc khối cơ bản
+bool isStraightLine(NodeType type) {
+    return type == NodeType::VarDeclaration || type == NodeType::Assignment || type == NodeType::MemWrite ||
+           type == NodeType::PrintChar;
+}
+
+void recordWrites(const AstArena& ast, const SymbolTable& symbols, NodeId stmt, ValueNumbering& numbering) {
+    const NodeSlots& s = ast.at(stmt);
+    uint32_t address, line, column;
+    switch (ast.type(stmt)) {
+        case NodeType::Assignment:
+            if (const SymbolInfo* sym = symbols.get_symbol(s.a)) {
+                numbering.write(sym->address, 2);
+            } else {
+                numbering.writeUnknown();
+            }
+            break;
+        case NodeType::MemWrite:
+            if (isLiteral(ast, s.a, &address)) {
+                numbering.write(address, 2);
+            } else {
+                numbering.writeUnknown();
+            }
+            break;
+        case NodeType::PrintChar:
+            // Ghi một byte vào VRAM: (line - 1) * 0x10 + column
+            if (isLiteral(ast, s.a, &line) && isLiteral(ast, s.b, &column)) {
+                numbering.write(((line - 1) * 0x10 + column) & 0xFFFF, 1);
+            } else {
+                numbering.writeUnknown();
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+// --- Biến còn sống (DSE) ---
+// Duyệt ngược các câu lệnh. Dấu thời gian thay cho tập biến sống: biến sống nếu lần
+// đọc gần nhất (theo chiều duyệt) đến sau lần bị ghi đè, nên MEM[biểu thức] "đọc mọi
+// biến" chỉ là một phép gán. Đồng thời ghi lại biến nào còn được tham chiếu, và vùng
+// biến có bị truy cập qua địa chỉ (hằng chồng lấn hoặc biểu thức) hay không.
+class StoreLiveness {
+public:
+    explicit StoreLiveness(const SymbolTable& symbols);
+
+    bool declared(SymbolId id) const { return id < needed.size() && symbols.symbols[id].declared; }
+    bool live(SymbolId id) const { return std::max(read_at[id], unknown_read_at) > killed_at[id]; }
+    void kill(SymbolId id) { killed_at[id] = ++stamp; }
+    // Đọc không biết địa chỉ (hoặc câu lệnh không phân tích được): mọi biến đều sống
+    void readUnknown() {
+        unknown_read_at = ++stamp;
+        relocatable = false;
+    }
+    void readExpression(const AstArena& ast, NodeId expr);
+    // Một khối có thể không chạy (thân vòng lặp, nhánh IF): mọi lần đọc trong khối; lần
+    // ghi trong đó không làm chết biến nào, chỉ đánh dấu biến còn được tham chiếu
+    void readBlock(const AstArena& ast, const NodeId* begin, const NodeId* end);
+    // Truy cập `width` byte tại địa chỉ cố định; trả về biến nằm đúng tại đó (nếu có)
+    SymbolId access(uint32_t address, unsigned int width, bool is_read);
+
+    std::vector<bool> needed; // Chỉ số = SymbolId: còn được câu lệnh nào đó tham chiếu
+    bool relocatable = true;  // Không câu lệnh nào truy cập vùng biến qua địa chỉ
+
+private:
+    const SymbolTable& symbols;
+    std::vector<uint32_t> read_at;
+    std::vector<uint32_t> killed_at;
+    uint32_t unknown_read_at = 0;
+    uint32_t stamp = 0;
+    // Byte của vùng biến -> biến chiếm byte đó
+    uint32_t region_begin = 0;
+    std::vector<SymbolId> owner;
+};
+
+StoreLiveness::StoreLiveness(const SymbolTable& symbols)
+    : needed(symbols.symbols.size(), false), symbols(symbols), read_at(symbols.symbols.size(), 0),
+      killed_at(symbols.symbols.size(), 0), region_begin(symbols.next_available_address) {
+    for (const SymbolInfo& sym : symbols.symbols) {
+        if (sym.declared) region_begin = std::min(region_begin, sym.address);
+    }
+    owner.assign(symbols.next_available_address - region_begin, kNoSymbol);
+    for (SymbolId id = 0; id < symbols.symbols.size(); ++id) {
+        const SymbolInfo& sym = symbols.symbols[id];
+        if (!sym.declared) continue;
+        for (uint32_t byte = sym.address; byte < sym.address + 2; ++byte) {
+            owner[byte - region_begin] = id;
+        }
+    }
+}
+
+SymbolId StoreLiveness::access(uint32_t address, unsigned int width, bool is_read) {
+    SymbolId exact = kNoSymbol;
+    for (uint32_t byte = address; byte < address + width; ++byte) {
+        uint32_t b = byte & 0xFFFF;
+        if (b < region_begin || b - region_begin >= owner.size()) continue;
+        relocatable = false;
+        SymbolId id = owner[b - region_begin];
+        if (id == kNoSymbol) continue;
+        needed[id] = true;
+        if (is_read) read_at[id] = ++stamp;
+        if (byte == address && symbols.symbols[id].address == address) exact = id;
+    }
+    return exact;
+}
+
+void StoreLiveness::readExpression(const AstArena& ast, NodeId expr) {
+    const NodeSlots& s = ast.at(expr);
+    uint32_t address;
+    switch (ast.type(expr)) {
+        case NodeType::Identifier:
+            if (declared(s.a)) {
+                needed[s.a] = true;
+                read_at[s.a] = ++stamp;
+            }
+            break;
+        case NodeType::MemRead:
+            if (isLiteral(ast, s.a, &address)) {
+                access(address, 2, true);
+            } else {
+                readExpression(ast, s.a);
+                readUnknown();
+            }
+            break;
+        case NodeType::BinaryOp:
+            readExpression(ast, s.a);
+            readExpression(ast, s.b);
+            break;
+        default:
+            break;
+    }
+}
+
+void StoreLiveness::readBlock(const AstArena& ast, const NodeId* begin, const NodeId* end) {
+    uint32_t address, line, column;
+    for (const NodeId* it = begin; it != end; ++it) {
+        const NodeSlots& s = ast.at(*it);
+        switch (ast.type(*it)) {
+            case NodeType::Assignment:
+                if (declared(s.a)) needed[s.a] = true;
+                readExpression(ast, s.b);
+                break;
+            case NodeType::MemWrite:
+                if (isLiteral(ast, s.a, &address)) {
+                    access(address, 2, false);
+                } else {
+                    relocatable = false;
+                    readExpression(ast, s.a);
+                }
+                readExpression(ast, s.b);
+                break;
+            case NodeType::PrintChar:
+                if (isLiteral(ast, s.a, &line) && isLiteral(ast, s.b, &column)) {
+                    access(((line - 1) * 0x10 + column) & 0xFFFF, 1, false);
+                } else {
+                    relocatable = false;
+                }
+                readExpression(ast, s.a);
+                readExpression(ast, s.b);
+                readExpression(ast, s.c);
+                break;
+            case NodeType::While:
+            case NodeType::Repeat:
+                readBlock(ast, ast.bodyBegin(*it), ast.bodyEnd(*it));
+                readExpression(ast, s.a);
+                break;
+            case NodeType::If:
+                readBlock(ast, ast.statementsBegin(s.b), ast.statementsEnd(s.b));
+                readBlock(ast, ast.statementsBegin(s.c), ast.statementsEnd(s.c));
+                readExpression(ast, s.a);
+                break;
+            case NodeType::Call:
+                readBlock(ast, ast.bodyBegin(s.a), ast.bodyEnd(s.a));
+                break;
+            default:
+                readUnknown();
+                break;
+        }
+    }
+}
+
+} // namespace
+
+AstOptimizer::AstOptimizer(const SymbolTable& symbols) : symbol_table(symbols) {}
+
+void AstOptimizer::replaceWithLiteral(AstArena& ast, NodeId node, uint32_t value) {
+    ast.types[node] = NodeType::IntegerLiteral;
+    ast.at(node) = NodeSlots{value & 0xFFFF, 0, 0};
+}
+
+void AstOptimizer::replaceWithCopy(AstArena& ast, NodeId node, NodeId source) {
+    ast.types[node] = ast.type(source);
+    ast.at(node) = ast.at(source);
+}
+
+void AstOptimizer::forgetAll() {
+    std::fill(known.begin(), known.end(), false);
+}
+
+void AstOptimizer::forgetOverlapping(uint32_t address, unsigned int width) {
+    for (SymbolId id = 0; id < symbol_table.symbols.size() && id < known.size(); ++id) {
+        const SymbolInfo& sym = symbol_table.symbols[id];
+        if (sym.declared && sym.address < address + width && address < sym.address + 2) {
+            known[id] = false;
+        }
+    }
+}
+
+SymbolId AstOptimizer::symbolAt(uint32_t address) const {
+    for (SymbolId id = 0; id < symbol_table.symbols.size(); ++id) {
+        const SymbolInfo& sym = symbol_table.symbols[id];
+        if (sym.declared && sym.address == address) return id;
+    }
+    return kNoSymbol;
+}
+
+bool AstOptimizer::foldExpression(AstArena& ast, NodeId node) {
+    NodeSlots s = ast.at(node);
+    switch (ast.type(node)) {
+        case NodeType::IntegerLiteral:
+            return true;
+        case NodeType::Identifier:
+            if (s.a < known.size() && known[s.a]) {
+                replaceWithLiteral(ast, node, known_value[s.a]);
+                counters.propagated_reads++;
+                return true;
+            }
+            return false;
+        case NodeType::MemRead: {
+            uint32_t address;
+            if (!foldExpression(ast, s.a) || !isLiteral(ast, s.a, &address)) return false;
+            // MEM[địa chỉ của một biến đã biết giá trị]
+            SymbolId id = symbolAt(address);
+            if (id != kNoSymbol && id < known.size() && known[id]) {
+                replaceWithLiteral(ast, node, known_value[id]);
+                counters.propagated_reads++;
+                return true;
+            }
+            return false;
+        }
+        case NodeType::BinaryOp: {
+            bool left_const = foldExpression(ast, s.a);
+            bool right_const = foldExpression(ast, s.b);
+            TokenType op = static_cast<TokenType>(s.c);
+            uint32_t l = 0, r = 0;
+            isLiteral(ast, s.a, &l);
+            isLiteral(ast, s.b, &r);
+            if (left_const && right_const) {
+                uint32_t result;
+                switch (op) {
+                    case TokenType::PLUS: result = l + r; break;
+                    case TokenType::MINUS: result = l - r; break;
+                    case TokenType::MULTIPLY: result = l * r; break;
+                    case TokenType::DIVIDE:
+                        if (r == 0) return false; // Để lỗi chia cho 0 xảy ra lúc chạy như viết
+                        result = l / r;
+                        break;
+                    case TokenType::LESS: result = l < r; break;
+                    case TokenType::GREATER: result = l > r; break;
+                    case TokenType::LESS_EQUAL: result = l <= r; break;
+                    case TokenType::GREATER_EQUAL: result = l >= r; break;
+                    case TokenType::EQUAL: result = l == r; break;
+                    case TokenType::NOT_EQUAL: result = l != r; break;
+                    default: return false;
+                }
+                replaceWithLiteral(ast, node, result);
+                counters.folded_nodes++;
+                return true;
+            }
+            // Đồng nhất thức: biểu thức không có tác dụng phụ nên bỏ vế còn lại là an toàn
+            if ((right_const && r == 0 && (op == TokenType::PLUS || op == TokenType::MINUS)) ||
+                (right_const && r == 1 && (op == TokenType::MULTIPLY || op == TokenType::DIVIDE))) {
+                replaceWithCopy(ast, node, s.a);
+                counters.folded_nodes++;
+                return false;
+            }
+            if ((left_const && l == 0 && op == TokenType::PLUS) || (left_const && l == 1 && op == TokenType::MULTIPLY)) {
+                replaceWithCopy(ast, node, s.b);
+                counters.folded_nodes++;
+                return false;
+            }
+            if (op == TokenType::MULTIPLY && ((left_const && l == 0) || (right_const && r == 0))) {
+                replaceWithLiteral(ast, node, 0);
+                counters.folded_nodes++;
+                return true;
+            }
+            return false;
+        }
+        default:
+            return false;
+    }
+}
+
+void AstOptimizer::foldConstants(AstArena& ast) {
+    known.assign(symbol_table.symbols.size(), false);
+    known_value.assign(symbol_table.symbols.size(), 0);
+
+    for (const NodeId* it = ast.statementsBegin(ast.root); it != ast.statementsEnd(ast.root); ++it) {
+        foldStatement(ast, *it);
+    }
+}
+
+void AstOptimizer::forgetWrites(const AstArena& ast, const NodeId* begin, const NodeId* end) {
+    for (const NodeId* it = begin; it != end; ++it) {
+        const NodeSlots& s = ast.at(*it);
+        uint32_t address, line, column;
+        switch (ast.type(*it)) {
+            case NodeType::Assignment:
+                if (s.a < known.size()) known[s.a] = false;
+                break;
+            case NodeType::MemWrite:
+                if (isLiteral(ast, s.a, &address)) {
+                    forgetOverlapping(address, 2);
+                } else {
+                    forgetAll();
+                }
+                break;
+            case NodeType::PrintChar:
+                if (isLiteral(ast, s.a, &line) && isLiteral(ast, s.b, &column)) {
+                    forgetOverlapping(((line - 1) * 0x10 + column) & 0xFFFF, 1);
+                } else {
+                    forgetAll();
+                }
+                break;
+            case NodeType::While:
+            case NodeType::Repeat:
+                forgetWrites(ast, ast.bodyBegin(*it), ast.bodyEnd(*it));
+                break;
+            case NodeType::If:
+                forgetWrites(ast, ast.statementsBegin(s.b), ast.statementsEnd(s.b));
+                forgetWrites(ast, ast.statementsBegin(s.c), ast.statementsEnd(s.c));
+                break;
+            case NodeType::Call:
+                forgetWrites(ast, ast.bodyBegin(s.a), ast.bodyEnd(s.a));
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+void AstOptimizer::foldStatement(AstArena& ast, NodeId stmt) {
+    const NodeSlots s = ast.at(stmt);
+    switch (ast.type(stmt)) {
+        case NodeType::Assignment: {
+            uint32_t value;
+            if (foldExpression(ast, s.b) && isLiteral(ast, s.b, &value) && s.a < known.size()) {
+                known[s.a] = true;
+                known_value[s.a] = static_cast<uint16_t>(value);
+            } else if (s.a < known.size()) {
+                known[s.a] = false;
+            }
+            break;
+        }
+        case NodeType::MemWrite: {
+            uint32_t address = 0, value = 0;
+            bool address_const = foldExpression(ast, s.a) && isLiteral(ast, s.a, &address);
+            bool value_const = foldExpression(ast, s.b) && isLiteral(ast, s.b, &value);
+            if (!address_const) {
+                forgetAll(); // Có thể ghi vào bất kỳ biến nào
+                break;
+            }
+            forgetOverlapping(address, 2);
+            SymbolId id = symbolAt(address);
+            if (value_const && id != kNoSymbol && id < known.size()) {
+                known[id] = true;
+                known_value[id] = static_cast<uint16_t>(value);
+            }
+            break;
+        }
+        case NodeType::PrintChar: {
+            uint32_t line, column;
+            bool line_const = foldExpression(ast, s.a) && isLiteral(ast, s.a, &line);
+            bool column_const = foldExpression(ast, s.b) && isLiteral(ast, s.b, &column);
+            foldExpression(ast, s.c);
+            // Ghi một byte vào VRAM: (line - 1) * 0x10 + column
+            if (line_const && column_const) {
+                forgetOverlapping(((line - 1) * 0x10 + column) & 0xFFFF, 1);
+            } else {
+                forgetAll();
+            }
+            break;
+        }
+        case NodeType::While:
+        case NodeType::Repeat: {
+            // Số lần lặp được tính một lần trước vòng lặp; điều kiện thì ở mỗi vòng
+            if (ast.type(stmt) == NodeType::Repeat) foldExpression(ast, s.a);
+            // Đầu mỗi vòng: chỉ còn biết các biến mà thân vòng lặp không ghi. Đó cũng là
+            // những gì còn biết sau vòng lặp (thân có thể chạy 0 hay nhiều lần).
+            forgetWrites(ast, ast.bodyBegin(stmt), ast.bodyEnd(stmt));
+            if (ast.type(stmt) == NodeType::While) foldExpression(ast, s.a);
+            std::vector<bool> saved = known;
+            for (const NodeId* it = ast.bodyBegin(stmt); it != ast.bodyEnd(stmt); ++it) {
+                foldStatement(ast, *it);
+            }
+            known = std::move(saved);
+            break;
+        }
+        case NodeType::If: {
+            uint32_t condition;
+            if (foldExpression(ast, s.a) && isLiteral(ast, s.a, &condition)) {
+                // Nhánh được chọn lúc biên dịch chạy như các câu lệnh tuần tự; nhánh kia bị bỏ khi sinh mã
+                NodeId taken = condition != 0 ? s.b : s.c;
+                for (const NodeId* it = ast.statementsBegin(taken); it != ast.statementsEnd(taken); ++it) {
+                    foldStatement(ast, *it);
+                }
+                break;
+            }
+            // Gấp từng nhánh từ cùng trạng thái; sau IF chỉ còn biết biến có cùng giá trị ở cả hai nhánh
+            std::vector<bool> entry_known = known;
+            std::vector<uint16_t> entry_value = known_value;
+            for (const NodeId* it = ast.statementsBegin(s.b); it != ast.statementsEnd(s.b); ++it) {
+                foldStatement(ast, *it);
+            }
+            std::vector<bool> then_known = std::move(known);
+            std::vector<uint16_t> then_value = std::move(known_value);
+            known = std::move(entry_known);
+            known_value = std::move(entry_value);
+            for (const NodeId* it = ast.statementsBegin(s.c); it != ast.statementsEnd(s.c); ++it) {
+                foldStatement(ast, *it);
+            }
+            for (size_t id = 0; id < known.size(); ++id) {
+                known[id] = known[id] && then_known[id] && known_value[id] == then_value[id];
+            }
+            break;
+        }
+        case NodeType::Sub: {
+            // Thân chạy ở mọi lệnh CALL: gấp từ trạng thái không biết gì; định nghĩa không đổi trạng thái
+            std::vector<bool> saved = known;
+            std::vector<uint16_t> saved_value = known_value;
+            forgetAll();
+            for (const NodeId* it = ast.bodyBegin(stmt); it != ast.bodyEnd(stmt); ++it) {
+                foldStatement(ast, *it);
+            }
+            known = std::move(saved);
+            known_value = std::move(saved_value);
+            break;
+        }
+        case NodeType::Call:
+            forgetWrites(ast, ast.bodyBegin(s.a), ast.bodyEnd(s.a));
+            break;
+        default:
+            break;
+    }
+}
+
+void AstOptimizer::eliminateDeadStores(AstArena& ast) {
+    std::vector<NodeId> statements(ast.statementsBegin(ast.root), ast.statementsEnd(ast.root));
+    std::vector<bool> keep(statements.size(), true);
+    StoreLiveness liveness(symbol_table);
+    uint32_t address, line, column;
+
+    for (size_t i = statements.size(); i-- > 0;) {
+        NodeId stmt = statements[i];
+        const NodeSlots& s = ast.at(stmt);
+        switch (ast.type(stmt)) {
+            case NodeType::VarDeclaration:
+                break; // Quyết định sau khi biết biến có còn được tham chiếu không
+            case NodeType::Assignment:
+                if (!liveness.declared(s.a)) {
+                    liveness.readExpression(ast, s.b);
+                } else if (!liveness.live(s.a)) {
+                    // Biểu thức không có tác dụng phụ: bỏ cả câu lệnh
+                    keep[i] = false;
+                    counters.dead_stores++;
+                } else {
+                    liveness.kill(s.a);
+                    liveness.needed[s.a] = true;
+                    liveness.readExpression(ast, s.b);
+                }
+                break;
+            case NodeType::MemWrite: {
+                // Lần ghi do chương trình viết ra luôn được giữ; chỉ làm chết biến bị ghi đè cả word
+                if (isLiteral(ast, s.a, &address)) {
+                    SymbolId id = liveness.access(address, 2, false);
+                    if (id != kNoSymbol) liveness.kill(id);
+                } else {
+                    liveness.relocatable = false;
+                    liveness.readExpression(ast, s.a);
+                }
+                liveness.readExpression(ast, s.b);
+                break;
+            }
+            case NodeType::PrintChar:
+                // Ghi một byte vào VRAM: (line - 1) * 0x10 + column
+                if (isLiteral(ast, s.a, &line) && isLiteral(ast, s.b, &column)) {
+                    liveness.access(((line - 1) * 0x10 + column) & 0xFFFF, 1, false);
+                } else {
+                    liveness.relocatable = false;
+                }
+                liveness.readExpression(ast, s.a);
+                liveness.readExpression(ast, s.b);
+                liveness.readExpression(ast, s.c);
+                break;
+            case NodeType::While:
+            case NodeType::Repeat:
+                // Điều kiện là hằng 0 (hay lặp 0 lần): thân không bao giờ chạy
+                if (isLiteral(ast, s.a, &address) && address == 0) {
+                    keep[i] = false;
+                } else {
+                    liveness.readBlock(ast, ast.bodyBegin(stmt), ast.bodyEnd(stmt));
+                    liveness.readExpression(ast, s.a);
+                }
+                break;
+            case NodeType::If:
+                if (isLiteral(ast, s.a, &address)) {
+                    // Điều kiện là hằng: chỉ nhánh được chọn còn ý nghĩa
+                    NodeId taken = address != 0 ? s.b : s.c;
+                    if (ast.at(taken).b == 0) {
+                        keep[i] = false;
+                    } else {
+                        liveness.readBlock(ast, ast.statementsBegin(taken), ast.statementsEnd(taken));
+                    }
+                } else {
+                    liveness.readBlock(ast, ast.statementsBegin(s.b), ast.statementsEnd(s.b));
+                    liveness.readBlock(ast, ast.statementsBegin(s.c), ast.statementsEnd(s.c));
+                    liveness.readExpression(ast, s.a);
+                }
+                break;
+            case NodeType::Sub:
+                // Định nghĩa không chạy gì ở đây; chỉ đánh dấu các biến thân SUB tham chiếu
+                // (lần đọc thật được tính tại từng lệnh CALL)
+                liveness.readBlock(ast, ast.bodyBegin(stmt), ast.bodyEnd(stmt));
+                break;
+            case NodeType::Call:
+                liveness.readBlock(ast, ast.bodyBegin(s.a), ast.bodyEnd(s.a));
+                break;
+            default:
+                liveness.readUnknown(); // Không phân tích được: coi như đọc mọi biến
+                break;
+        }
+    }
+
+    std::vector<NodeId> kept;
+    kept.reserve(statements.size());
+    for (size_t i = 0; i < statements.size(); ++i) {
+        NodeId stmt = statements[i];
+        if (ast.type(stmt) == NodeType::VarDeclaration && liveness.declared(ast.at(stmt).a) &&
+            !liveness.needed[ast.at(stmt).a]) {
+            keep[i] = false;
+        }
+        if (keep[i]) kept.push_back(stmt);
+    }
+    if (kept.size() != statements.size()) {
+        ast.at(ast.root).a = ast.addList(kept);
+        ast.at(ast.root).b = static_cast<uint32_t>(kept.size());
+    }
+    compactVariables(ast, liveness.needed, liveness.relocatable);
+}
+
+std::vector<std::array<SymbolId, 4>> AstOptimizer::groupCoassignedVariables(const AstArena& ast,
+                                                                          const std::vector<bool>& needed) const {
+    // Mỗi dãy lệnh gán hằng liền nhau (VAR và MEM[hằng] = hằng không cắt dãy) cho các
+    // nhóm 4 biến của nó (theo thứ tự khai báo); nhóm xuất hiện nhiều lần được ưu tiên.
+    struct Candidate {
+        uint32_t count = 0;
+        uint32_t first = 0; // Thứ tự xuất hiện đầu tiên (để kết quả ổn định)
+    };
+    std::map<std::array<SymbolId, 4>, Candidate> candidates;
+    std::vector<SymbolId> run;
+    auto flush = [&]() {
+        std::sort(run.begin(), run.end(), [this](SymbolId a, SymbolId b) {
+            return symbol_table.symbols[a].address < symbol_table.symbols[b].address;
+        });
+        run.erase(std::unique(run.begin(), run.end()), run.end());
+        for (size_t i = 0; i + 4 <= run.size(); i += 4) {
+            std::array<SymbolId, 4> group{run[i], run[i + 1], run[i + 2], run[i + 3]};
+            Candidate& c = candidates[group];
+            if (c.count++ == 0) c.first = static_cast<uint32_t>(candidates.size());
+        }
+        run.clear();
+    };
+    for (const NodeId* it = ast.statementsBegin(ast.root); it != ast.statementsEnd(ast.root); ++it) {
+        const NodeSlots& s = ast.at(*it);
+        switch (ast.type(*it)) {
+            case NodeType::VarDeclaration:
+                break;
+            case NodeType::Assignment:
+                if (isLiteral(ast, s.b) && s.a < needed.size() && needed[s.a]) {
+                    run.push_back(s.a);
+                } else {
+                    flush();
+                }
+                break;
+            case NodeType::MemWrite:
+                if (!isLiteral(ast, s.a) || !isLiteral(ast, s.b)) flush();
+                break;
+            default:
+                flush();
+                break;
+        }
+    }
+    flush();
+
+    std::vector<std::pair<std::array<SymbolId, 4>, Candidate>> ranked(candidates.begin(), candidates.end());
+    std::sort(ranked.begin(), ranked.end(), [](const auto& a, const auto& b) {
+        return a.second.count != b.second.count ? a.second.count > b.second.count : a.second.first < b.second.first;
+    });
+    std::vector<bool> grouped(needed.size(), false);
+    std::vector<std::array<SymbolId, 4>> groups;
+    for (const auto& [group, candidate] : ranked) {
+        if (std::any_of(group.begin(), group.end(), [&](SymbolId id) { return grouped[id]; })) continue;
+        for (SymbolId id : group) grouped[id] = true;
+        groups.push_back(group);
+    }
+    return groups;
+}
+
+void AstOptimizer::compactVariables(const AstArena& ast, const std::vector<bool>& needed, bool relocatable) {
+    std::vector<SymbolId> order;
+    for (SymbolId id = 0; id < symbol_table.symbols.size(); ++id) {
+        if (symbol_table.symbols[id].declared) order.push_back(id);
+    }
+    if (order.empty()) return;
+    std::sort(order.begin(), order.end(), [this](SymbolId a, SymbolId b) {
+        return symbol_table.symbols[a].address < symbol_table.symbols[b].address;
+    });
+
+    // Không có truy cập nào qua địa chỉ: xếp liền các biến còn dùng, các nhóm ghi 8 byte
+    // trước (căn 8 byte), rồi các biến còn lại theo thứ tự khai báo.
+    // Ngược lại địa chỉ là một phần ý nghĩa của chương trình: chỉ cắt các biến không dùng ở cuối.
+    // Biến bị bỏ giữ địa chỉ cũ nhưng không còn câu lệnh nào tham chiếu tới nó.
+    unsigned int end = symbol_table.symbols[order.front()].address;
+    if (relocatable) {
+        std::vector<std::array<SymbolId, 4>> groups = groupCoassignedVariables(ast, needed);
+        std::vector<bool> placed(needed.size(), false);
+        if (!groups.empty()) end = (end + 7) & ~7u;
+        for (const std::array<SymbolId, 4>& group : groups) {
+            for (SymbolId id : group) {
+                symbol_table.symbols[id].address = end;
+                placed[id] = true;
+                end += 2;
+            }
+        }
+        counters.wide_groups = groups.size();
+        for (SymbolId id : order) {
+            if (!needed[id] || placed[id]) continue;
+            symbol_table.symbols[id].address = end;
+            end += 2;
+        }
+    } else {
+        for (SymbolId id : order) {
+            if (needed[id]) end = std::max(end, symbol_table.symbols[id].address + 2);
+        }
+    }
+    for (SymbolId id : order) {
+        if (!needed[id] && (relocatable || symbol_table.symbols[id].address >= end)) counters.freed_variables++;
+    }
+    symbol_table.next_available_address = end;
+}
+
+void AstOptimizer::eliminateCommonSubexpressions(AstArena& ast) {
+    std::vector<NodeId> statements(ast.statementsBegin(ast.root), ast.statementsEnd(ast.root));
+    ValueNumbering numbering(ast, symbol_table);
+    NodeId expressions[3];
+
+    // Lượt 1: đánh số và đếm số lần dùng của mọi giá trị
+    for (uint32_t i = 0; i < statements.size(); ++i) {
+        NodeId stmt = statements[i];
+        if (!isStraightLine(ast.type(stmt))) {
+            numbering.endBlock();
+            continue;
+        }
+        size_t count = expressionsOf(ast, stmt, expressions);
+        for (size_t k = 0; k < count; ++k) numbering.number(expressions[k]);
+        for (size_t k = 0; k < count; ++k) numbering.count(expressions[k], i);
+        recordWrites(ast, symbol_table, stmt, numbering);
+    }
+
+    // Lượt 2: thay các lần dùng bằng ô tạm, chèn câu lệnh tính ô trước lần dùng đầu
+    TemporaryRewriter rewriter(ast, numbering, symbol_table.next_available_address, counters);
+    std::vector<NodeId> rewritten;
+    rewritten.reserve(statements.size());
+    bool inserted = false;
+    for (uint32_t i = 0; i < statements.size(); ++i) {
+        NodeId stmt = statements[i];
+        size_t count = isStraightLine(ast.type(stmt)) ? expressionsOf(ast, stmt, expressions) : 0;
+        for (size_t k = 0; k < count; ++k) rewriter.rewrite(expressions[k], ast.lines[stmt]);
+        inserted |= !rewriter.definitions.empty();
+        rewritten.insert(rewritten.end(), rewriter.definitions.begin(), rewriter.definitions.end());
+        rewriter.definitions.clear();
+        rewritten.push_back(stmt);
+        rewriter.release(i);
+    }
+    if (inserted) {
+        ast.at(ast.root).a = ast.addList(rewritten);
+        ast.at(ast.root).b = static_cast<uint32_t>(rewritten.size());
+    }
+}
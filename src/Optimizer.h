@@ -0,0 +1,100 @@
+#ifndef OPTIMIZER_H
+#define OPTIMIZER_H
+
+#include "Parser.h"
+#include <array>
+#include <cstdint>
+#include <vector>
+
+// --- Tối ưu trên AST trước khi sinh mã ROP ---
+// Các pass sửa trực tiếp AstArena (đổi loại/ô dữ liệu của node tại chỗ; node con
+// không còn được tham chiếu chỉ đơn giản bị bỏ lại trong arena).
+// Chương trình là một dãy câu lệnh tuần tự, có thể xen các vòng lặp WHILE/REPEAT
+// và lệnh IF. Các khối này được xử lý thận trọng: gấp hằng quên mọi biến mà thân
+// vòng lặp ghi (sau IF chỉ giữ biến có cùng giá trị ở hai nhánh, IF có điều kiện
+// hằng chỉ còn nhánh được chọn), DSE không bỏ câu lệnh nào trong khối và không coi
+// lần ghi trong đó là ghi đè, còn CSE chỉ làm việc trên các khối cơ bản giữa chúng.
+// Thân SUB được gấp hằng riêng, từ trạng thái không biết gì; mỗi lệnh CALL được coi
+// như đọc mọi biến thân SUB đọc và làm mất giá trị đã biết của mọi biến thân SUB ghi.
+//
+// CSE (eliminateCommonSubexpressions) đánh số giá trị các biểu thức trong từng
+// khối cơ bản. Biểu thức thuần lặp lại và đủ đắt được tính một lần vào một ô tạm
+// (word ngay sau vùng biến của SymbolTable): câu lệnh MEM[ô] = biểu thức được
+// chèn trước lần dùng đầu tiên, các lần dùng thành MEM[ô]. Bộ chọn gadget theo
+// dõi word đó trong thanh ghi nên lần đọc lại thường không tốn gì.
+//
+// DSE (eliminateDeadStores) duyệt ngược để bỏ các lệnh gán mà biến bị ghi đè
+// (hoặc không bao giờ được đọc) trước lần đọc tiếp theo, rồi dời lại vùng biến:
+// biến không còn được tham chiếu không chiếm RAM. Vì vậy optimizer giữ bản sao
+// SymbolTable của riêng nó; các bước sau (ROPGenerator) phải dùng symbols().
+// Khi được dời, các biến hay được gán hằng cùng nhau (trong một dãy câu lệnh liền
+// nhau) được xếp thành nhóm 4 word liền nhau, căn 8 byte: ROPGenerator ghi cả nhóm
+// bằng một lệnh [ea]=qr0.
+
+struct OptimizerStats {
+    size_t folded_nodes = 0;      // BinaryOp được thay bằng hằng (hoặc rút gọn x + 0, x * 1, ...)
+    size_t propagated_reads = 0;  // Lần đọc biến/MEM được thay bằng giá trị đã biết
+    size_t reused_expressions = 0; // Lần tính lại được thay bằng đọc ô tạm (CSE)
+    size_t temporaries = 0;       // Số ô tạm (word) CSE dùng cùng lúc nhiều nhất
+    size_t dead_stores = 0;       // Lệnh gán bị bỏ vì giá trị không bao giờ được đọc
+    size_t freed_variables = 0;   // Biến không còn được cấp RAM
+    size_t wide_groups = 0;       // Nhóm 4 biến được xếp liền nhau cho lệnh ghi 8 byte
+};
+
+class AstOptimizer {
+public:
+    explicit AstOptimizer(const SymbolTable& symbols);
+
+    // Gấp hằng số và lan truyền giá trị của các biến được gán hằng
+    void foldConstants(AstArena& ast);
+
+    // Bỏ lệnh gán chết và không cấp RAM cho biến không dùng (có thể dời địa chỉ biến)
+    void eliminateDeadStores(AstArena& ast);
+
+    // Tính một lần các biểu thức thuần lặp lại trong mỗi khối cơ bản (ô tạm trong RAM)
+    void eliminateCommonSubexpressions(AstArena& ast);
+
+    // Chạy mọi pass theo thứ tự
+    void run(AstArena& ast) {
+        foldConstants(ast);
+        eliminateDeadStores(ast);
+        eliminateCommonSubexpressions(ast);
+    }
+
+    const OptimizerStats& stats() const { return counters; }
+    // Bảng ký hiệu sau khi tối ưu (địa chỉ biến có thể đã được dời)
+    const SymbolTable& symbols() const { return symbol_table; }
+    // Byte đầu tiên sau các ô tạm của CSE: vùng spill của ROPGenerator phải bắt đầu từ đây
+    unsigned int scratchEnd() const { return symbol_table.next_available_address + 2 * static_cast<unsigned int>(counters.temporaries); }
+
+private:
+    SymbolTable symbol_table;
+    OptimizerStats counters;
+
+    // Giá trị đã biết của từng biến (chỉ số = SymbolId) tại điểm đang duyệt
+    std::vector<bool> known;
+    std::vector<uint16_t> known_value;
+
+    // Gấp một biểu thức (đệ quy, tại chỗ); trả về true nếu kết quả là IntegerLiteral
+    bool foldExpression(AstArena& ast, NodeId node);
+    void replaceWithLiteral(AstArena& ast, NodeId node, uint32_t value);
+    void replaceWithCopy(AstArena& ast, NodeId node, NodeId source);
+
+    // Một lần ghi vào RAM: quên các biến có thể bị ghi đè
+    void forgetOverlapping(uint32_t address, unsigned int width);
+    void forgetAll();
+    // Gấp hằng trong một câu lệnh và cập nhật giá trị đã biết sau nó
+    void foldStatement(AstArena& ast, NodeId stmt);
+    // Quên mọi biến mà một dãy câu lệnh (kể cả khối lồng nhau) có thể ghi
+    void forgetWrites(const AstArena& ast, const NodeId* begin, const NodeId* end);
+    // Biến nằm đúng tại địa chỉ này (nếu có)
+    SymbolId symbolAt(uint32_t address) const;
+
+    // Dời địa chỉ biến sau DSE: chỉ biến trong `needed` được giữ RAM
+    void compactVariables(const AstArena& ast, const std::vector<bool>& needed, bool relocatable);
+    // Các nhóm 4 biến nên nằm liền nhau (theo các dãy lệnh gán hằng của chương trình)
+    std::vector<std::array<SymbolId, 4>> groupCoassignedVariables(const AstArena& ast,
+                                                                  const std::vector<bool>& needed) const;
+};
+
+#endif // OPTIMIZER_H
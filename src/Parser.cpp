@@ -1,4 +1,5 @@
 #include "Parser.h"
+#include <algorithm>
 #include <iostream>
 #include <stdexcept>
 
@@ -9,187 +10,607 @@ unsigned int SymbolTable::get_next_address(unsigned int size_bytes) {
     return current_addr;
 }
 
-void SymbolTable::add_symbol(const std::string& name) {
-    if (symbols.count(name)) {
-        std::cerr << "Lỗi ngữ nghĩa: Biến '" << name << "' đã được khai báo." << std::endl;
+std::string_view SymbolTable::name_of(SymbolId id) const {
+    if (names && id < names->size()) {
+        return names->name(id);
+    }
+    return "?";
+}
+
+void SymbolTable::add_symbol(SymbolId id) {
+    if (id >= symbols.size()) {
+        symbols.resize(id + 1);
+    }
+    SymbolInfo& info = symbols[id];
+    if (info.declared) {
+        std::cerr << "Lỗi ngữ nghĩa: Biến '" << name_of(id) << "' đã được khai báo." << std::endl;
         return;
     }
-    SymbolInfo info;
+    info.declared = true;
+    info.name = name_of(id);
     info.address = get_next_address(); // Assign an address to the new variable
-    symbols[name] = info;
-    std::cout << "DEBUG: Biến '" << name << "' được gán địa chỉ: 0x" << std::hex << info.address << std::dec << std::endl;
+    std::cout << "DEBUG: Biến '" << info.name << "' được gán địa chỉ: 0x" << std::hex << info.address << std::dec << std::endl;
 }
 
-// Sửa chữa: Thêm 'const' vào kiểu trả về và cuối hàm
-const SymbolInfo* SymbolTable::get_symbol(const std::string& name) const {
-    auto it = symbols.find(name);
-    if (it != symbols.end()) {
-        return &it->second; // Trả về con trỏ const
+const SymbolInfo* SymbolTable::get_symbol(SymbolId id) const {
+    if (id < symbols.size() && symbols[id].declared) {
+        return &symbols[id];
     }
-    std::cerr << "Lỗi ngữ nghĩa: Biến '" << name << "' chưa được khai báo." << std::endl;
+    std::cerr << "Lỗi ngữ nghĩa: Biến '" << name_of(id) << "' chưa được khai báo." << std::endl;
     return nullptr;
 }
 
 
+// --- AstArena Implementation ---
+NodeId AstArena::add(NodeType type, uint32_t a, uint32_t b, uint32_t c, int line) {
+    NodeId id = static_cast<NodeId>(types.size());
+    types.push_back(type);
+    slots.push_back(NodeSlots{a, b, c});
+    lines.push_back(line);
+    return id;
+}
+
+uint32_t AstArena::addList(const std::vector<NodeId>& items) {
+    uint32_t start = static_cast<uint32_t>(lists.size());
+    lists.insert(lists.end(), items.begin(), items.end());
+    return start;
+}
+
+void AstArena::reserve(size_t node_count) {
+    types.reserve(node_count);
+    slots.reserve(node_count);
+    lines.reserve(node_count);
+}
+
+void AstArena::clear() {
+    types.clear();
+    slots.clear();
+    lines.clear();
+    lists.clear();
+    root = kNullNode;
+}
+
+
 // --- Parser Implementation ---
 
-// Sửa chữa: Khởi tạo current_token ngay tại danh sách khởi tạo
-Parser::Parser(Lexer& lexer) : lexer(lexer), current_token(lexer.getNextToken()) {
-    // Không cần gọi advance() ở đây nữa vì current_token đã được khởi tạo
+namespace {
+// Chuyển chuỗi chữ số thập phân thành số, không cấp phát chuỗi tạm
+unsigned int parseUnsigned(std::string_view digits) {
+    unsigned int value = 0;
+    for (char c : digits) {
+        value = value * 10 + static_cast<unsigned int>(c - '0');
+    }
+    return value;
+}
+
+// Một phép toán trên hai hằng, cùng quy tắc với bước gập hằng của AstOptimizer:
+// 16 bit không dấu, so sánh cho 0/1. Chia cho 0 không tính (để lỗi xảy ra lúc chạy như viết).
+bool applyOperator(TokenType op, uint32_t l, uint32_t r, uint32_t& value) {
+    switch (op) {
+        case TokenType::PLUS: value = l + r; break;
+        case TokenType::MINUS: value = l - r; break;
+        case TokenType::MULTIPLY: value = l * r; break;
+        case TokenType::DIVIDE:
+            if (r == 0) return false;
+            value = l / r;
+            break;
+        case TokenType::LESS: value = l < r; break;
+        case TokenType::GREATER: value = l > r; break;
+        case TokenType::LESS_EQUAL: value = l <= r; break;
+        case TokenType::GREATER_EQUAL: value = l >= r; break;
+        case TokenType::EQUAL: value = l == r; break;
+        case TokenType::NOT_EQUAL: value = l != r; break;
+        default: return false;
+    }
+    value &= 0xFFFF;
+    return true;
+}
+
+// Thông dịch thân MACRO khi mọi đối số đã biết, không chép cây: thân chỉ gồm
+// IntegerLiteral, BinaryOp và Identifier (= tham số, giá trị lấy từ args)
+bool evaluateTemplate(const AstArena& ast, NodeId node, const uint32_t* args, uint32_t& value) {
+    const NodeSlots& s = ast.at(node);
+    switch (ast.type(node)) {
+        case NodeType::IntegerLiteral:
+            value = s.a & 0xFFFF;
+            return true;
+        case NodeType::Identifier:
+            value = args[s.a];
+            return true;
+        case NodeType::BinaryOp: {
+            uint32_t l = 0, r = 0;
+            return evaluateTemplate(ast, s.a, args, l) && evaluateTemplate(ast, s.b, args, r) &&
+                   applyOperator(static_cast<TokenType>(s.c), l, r, value);
+        }
+        default:
+            return false;
+    }
+}
+} // namespace
+
+Parser::Parser(Lexer& lexer) {
+    lexer.tokenize(tokens);
+    symbol_table.names = &tokens.interner;
+}
+
+Parser::Parser(TokenBuffer token_buffer) : tokens(std::move(token_buffer)) {
+    if (tokens.size() == 0 || tokens.types.back() != TokenType::END_OF_FILE) {
+        throw std::runtime_error("Lỗi: Bộ đệm token phải kết thúc bằng END_OF_FILE.");
+    }
+    symbol_table.names = &tokens.interner;
+}
+
+TokenType Parser::peekType(size_t ahead) const {
+    size_t index = pos + ahead;
+    if (index >= tokens.size()) {
+        return TokenType::END_OF_FILE;
+    }
+    return tokens.types[index];
 }
 
 void Parser::advance() {
-    current_token = lexer.getNextToken();
-    // std::cout << "DEBUG: Advanced to token: " << tokenTypeToString(current_token.type)
-    //           << " ('" << current_token.value << "')" << std::endl;
+    if (pos + 1 < tokens.size()) {
+        pos++;
+    }
+    // std::cout << "DEBUG: Advanced to token: " << tokenTypeToString(peekType())
+    //           << " ('" << currentText() << "')" << std::endl;
 }
 
 void Parser::expect(TokenType type) {
-    if (current_token.type == type) {
+    if (peekType() == type) {
         advance();
     } else {
         std::string error_msg = "Lỗi cú pháp tại dòng ";
-        error_msg += std::to_string(current_token.line) + ", cột ";
-        error_msg += std::to_string(current_token.column) + ": ";
-        error_msg += "Mong đợi '" + tokenTypeToString(type) + "' nhưng nhận được '" + current_token.value + "' ('" + tokenTypeToString(current_token.type) + "').";
+        error_msg += std::to_string(currentLine()) + ", cột ";
+        error_msg += std::to_string(currentColumn()) + ": ";
+        error_msg += "Mong đợi '" + tokenTypeToString(type) + "' nhưng nhận được '" + std::string(currentText()) + "' ('" + tokenTypeToString(peekType()) + "').";
         throw std::runtime_error(error_msg);
     }
 }
 
-std::unique_ptr<ProgramNode> Parser::parse() {
-    auto program_node = std::make_unique<ProgramNode>();
-    while (current_token.type != TokenType::EOF_TOKEN) {
-        program_node->statements.push_back(parse_statement());
+NodeId Parser::parse(AstArena& out) {
+    arena = &out;
+    arena->clear();
+    // Ước lượng thô: khoảng một node cho mỗi token
+    arena->reserve(tokens.size());
+    subroutines.clear();
+    constants.clear();
+    macros.clear();
+    macro_templates.clear();
+    macro_results.clear();
+    macro_params = nullptr;
+
+    std::vector<NodeId> statements;
+    while (peekType() != TokenType::END_OF_FILE) {
+        // CONST/MACRO chỉ ghi vào bảng của parser, không sinh node nào
+        if (peekType() == TokenType::CONST) {
+            parse_const();
+        } else if (peekType() == TokenType::MACRO) {
+            parse_macro();
+        } else {
+            statements.push_back(parse_statement());
+        }
     }
-    return program_node;
+    uint32_t first = arena->addList(statements);
+    arena->root = arena->add(NodeType::Program, first, static_cast<uint32_t>(statements.size()));
+    return arena->root;
 }
 
-std::unique_ptr<ASTNode> Parser::parse_statement() {
-    if (current_token.type == TokenType::VAR) {
+NodeId Parser::parse_statement() {
+    if (peekType() == TokenType::VAR) {
         return parse_var_declaration();
-    } else if (current_token.type == TokenType::IDENTIFIER) {
+    } else if (peekType() == TokenType::IDENTIFIER) {
         // Có thể là lệnh gán hoặc lệnh gọi hàm sau này
         // Tạm thời coi là lệnh gán nếu tiếp theo là ASSIGN
         // Hoặc là MemWrite nếu là '['
-        Token peek_token = lexer.peekNextToken(); // Xem trước token tiếp theo
-        if (peek_token.type == TokenType::ASSIGN) {
+        TokenType next = peekType(1); // Xem trước token tiếp theo
+        if (next == TokenType::ASSIGN) {
             return parse_assignment();
-        } else if (peek_token.type == TokenType::OPEN_BRACKET) {
+        } else if (next == TokenType::LBRACKET) {
             return parse_mem_write();
         }
         else {
-            throw std::runtime_error("Lỗi cú pháp không xác định sau định danh tại dòng " + std::to_string(current_token.line));
+            throw std::runtime_error("Lỗi cú pháp không xác định sau định danh tại dòng " + std::to_string(currentLine()));
         }
-    } else if (current_token.type == TokenType::PRINT_CHAR_KW) {
+    } else if (peekType() == TokenType::PRINT_CHAR) {
         return parse_print_char();
+    } else if (peekType() == TokenType::WHILE || peekType() == TokenType::REPEAT) {
+        return parse_loop();
+    } else if (peekType() == TokenType::IF) {
+        return parse_if();
+    } else if (peekType() == TokenType::SUB) {
+        return parse_sub();
+    } else if (peekType() == TokenType::CALL) {
+        return parse_call();
     }
     else {
-        throw std::runtime_error("Lỗi cú pháp: Mong đợi khai báo biến, gán, hoặc lệnh tại dòng " + std::to_string(current_token.line));
+        throw std::runtime_error("Lỗi cú pháp: Mong đợi khai báo biến, gán, hoặc lệnh tại dòng " + std::to_string(currentLine()));
     }
 }
 
-std::unique_ptr<ASTNode> Parser::parse_var_declaration() {
+NodeId Parser::parse_var_declaration() {
+    int line = currentLine();
     expect(TokenType::VAR);
-    std::string var_name = current_token.value;
+    SymbolId var_id = currentSymbol();
     expect(TokenType::IDENTIFIER);
     expect(TokenType::SEMICOLON);
+    if (subroutines.count(var_id) || constants.count(var_id) || macros.count(var_id)) {
+        throw std::runtime_error("Lỗi ngữ nghĩa: '" + std::string(tokens.interner.name(var_id)) + "' đã là tên một " + nameKind(var_id) + " (dòng " + std::to_string(line) + ").");
+    }
 
-    symbol_table.add_symbol(var_name); // Add variable to symbol table
-    return std::make_unique<VarDeclarationNode>(var_name);
+    symbol_table.add_symbol(var_id); // Add variable to symbol table
+    return arena->add(NodeType::VarDeclaration, var_id, 0, 0, line);
 }
 
-std::unique_ptr<ASTNode> Parser::parse_assignment() {
-    std::string var_name = current_token.value;
+NodeId Parser::parse_assignment() {
+    int line = currentLine();
+    SymbolId var_id = currentSymbol();
+    if (constants.count(var_id) || macros.count(var_id)) {
+        throw std::runtime_error("Lỗi ngữ nghĩa: Không gán được cho " + std::string(nameKind(var_id)) + " '" + std::string(currentText()) + "' tại dòng " + std::to_string(line));
+    }
+    // Semantic check: the assignment target must be declared
+    if (!symbol_table.get_symbol(var_id)) {
+        throw std::runtime_error("Lỗi ngữ nghĩa: Biến '" + std::string(currentText()) + "' chưa được khai báo tại dòng " + std::to_string(line));
+    }
     expect(TokenType::IDENTIFIER);
     expect(TokenType::ASSIGN);
-    auto expr = parse_expression();
+    NodeId expr = parse_expression();
     expect(TokenType::SEMICOLON);
-    return std::make_unique<AssignmentNode>(var_name, std::move(expr));
+    return arena->add(NodeType::Assignment, var_id, expr, 0, line);
 }
 
-std::unique_ptr<ASTNode> Parser::parse_mem_write() {
-    std::string var_name_or_base_addr_id = current_token.value; // Có thể là tên biến chứa base addr
+NodeId Parser::parse_mem_write() {
+    int line = currentLine();
     expect(TokenType::IDENTIFIER); // Consume the identifier (e.g., 'MEM')
 
-    expect(TokenType::OPEN_BRACKET); // Consume '['
-    auto address_expr = parse_expression(); // Parse the address expression
-    expect(TokenType::CLOSE_BRACKET); // Consume ']'
+    expect(TokenType::LBRACKET); // Consume '['
+    NodeId address_expr = parse_expression(); // Parse the address expression
+    expect(TokenType::RBRACKET); // Consume ']'
 
     expect(TokenType::ASSIGN); // Consume '='
-    auto value_expr = parse_expression(); // Parse the value expression
+    NodeId value_expr = parse_expression(); // Parse the value expression
     expect(TokenType::SEMICOLON); // Consume ';'
 
-    return std::make_unique<MemWriteNode>(std::move(address_expr), std::move(value_expr));
+    return arena->add(NodeType::MemWrite, address_expr, value_expr, 0, line);
 }
 
-std::unique_ptr<ASTNode> Parser::parse_print_char() {
-    expect(TokenType::PRINT_CHAR_KW);
-    expect(TokenType::OPEN_PAREN);
-    auto line_expr = parse_expression();
+NodeId Parser::parse_print_char() {
+    int line = currentLine();
+    expect(TokenType::PRINT_CHAR);
+    expect(TokenType::LPAREN);
+    NodeId line_expr = parse_expression();
     expect(TokenType::COMMA);
-    auto column_expr = parse_expression();
+    NodeId column_expr = parse_expression();
     expect(TokenType::COMMA);
-    auto char_code_expr = parse_expression();
-    expect(TokenType::CLOSE_PAREN);
+    NodeId char_code_expr = parse_expression();
+    expect(TokenType::RPAREN);
+    expect(TokenType::SEMICOLON);
+    return arena->add(NodeType::PrintChar, line_expr, column_expr, char_code_expr, line);
+}
+
+NodeId Parser::parse_loop() {
+    int line = currentLine();
+    NodeType type = peekType() == TokenType::WHILE ? NodeType::While : NodeType::Repeat;
+    advance(); // WHILE / REPEAT
+    NodeId head = parse_expression();
+    std::vector<NodeId> body = parse_body(line, "vòng lặp", "thân vòng lặp");
+    uint32_t first = arena->addList(body);
+    return arena->add(type, head, first, static_cast<uint32_t>(body.size()), line);
+}
+
+NodeId Parser::parse_if() {
+    int line = currentLine();
+    expect(TokenType::IF);
+    NodeId condition = parse_expression();
+    std::vector<NodeId> then_body = parse_body(line, "lệnh IF", "nhánh IF");
+    std::vector<NodeId> else_body;
+    if (peekType() == TokenType::ELSE) {
+        advance();
+        if (peekType() == TokenType::IF) {
+            else_body.push_back(parse_if()); // ELSE IF: nhánh ELSE chỉ gồm một lệnh IF
+        } else {
+            else_body = parse_body(line, "lệnh IF", "nhánh IF");
+        }
+    }
+    NodeId then_block = arena->add(NodeType::Block, arena->addList(then_body), static_cast<uint32_t>(then_body.size()), 0, line);
+    NodeId else_block = arena->add(NodeType::Block, arena->addList(else_body), static_cast<uint32_t>(else_body.size()), 0, line);
+    return arena->add(NodeType::If, condition, then_block, else_block, line);
+}
+
+NodeId Parser::parse_sub() {
+    int line = currentLine();
+    expect(TokenType::SUB);
+    SymbolId name = currentSymbol();
+    std::string text(currentText());
+    expect(TokenType::IDENTIFIER);
+    if (subroutines.count(name)) {
+        throw std::runtime_error("Lỗi ngữ nghĩa: SUB '" + text + "' được định nghĩa lại tại dòng " + std::to_string(line));
+    }
+    if (const char* kind = nameKind(name)) {
+        throw std::runtime_error("Lỗi ngữ nghĩa: '" + text + "' đã là tên một " + kind + " (dòng " + std::to_string(line) + ").");
+    }
+    // Tên chỉ có hiệu lực sau thân: SUB không tự gọi mình được
+    std::vector<NodeId> body = parse_body(line, "SUB", "SUB");
+    uint32_t first = arena->addList(body);
+    NodeId sub = arena->add(NodeType::Sub, name, first, static_cast<uint32_t>(body.size()), line);
+    subroutines[name] = sub;
+    return sub;
+}
+
+NodeId Parser::parse_call() {
+    int line = currentLine();
+    expect(TokenType::CALL);
+    SymbolId name = currentSymbol();
+    std::string text(currentText());
+    expect(TokenType::IDENTIFIER);
+    expect(TokenType::SEMICOLON);
+    auto it = subroutines.find(name);
+    if (it == subroutines.end()) {
+        throw std::runtime_error("Lỗi ngữ nghĩa: SUB '" + text + "' chưa được định nghĩa trước lệnh CALL tại dòng " + std::to_string(line));
+    }
+    return arena->add(NodeType::Call, it->second, 0, 0, line);
+}
+
+void Parser::parse_const() {
+    int line = currentLine();
+    expect(TokenType::CONST);
+    SymbolId name = currentSymbol();
+    std::string text(currentText());
+    expect(TokenType::IDENTIFIER);
+    if (const char* kind = nameKind(name)) {
+        throw std::runtime_error("Lỗi ngữ nghĩa: '" + text + "' đã là tên một " + kind + " (dòng " + std::to_string(line) + ").");
+    }
+    expect(TokenType::ASSIGN);
+    NodeId value = parse_expression(); // Gập ngay khi parse (xem binary)
     expect(TokenType::SEMICOLON);
-    return std::make_unique<PrintCharNode>(std::move(line_expr), std::move(column_expr), std::move(char_code_expr));
+    if (arena->type(value) != NodeType::IntegerLiteral) {
+        throw std::runtime_error("Lỗi ngữ nghĩa: Giá trị của CONST '" + text + "' phải tính được lúc biên dịch (dòng " + std::to_string(line) + ").");
+    }
+    constants[name] = arena->at(value).a & 0xFFFF;
+    std::cout << "DEBUG: CONST '" << text << "' = " << constants[name] << std::endl;
+}
+
+void Parser::parse_macro() {
+    int line = currentLine();
+    expect(TokenType::MACRO);
+    SymbolId name = currentSymbol();
+    std::string text(currentText());
+    expect(TokenType::IDENTIFIER);
+    if (const char* kind = nameKind(name)) {
+        throw std::runtime_error("Lỗi ngữ nghĩa: '" + text + "' đã là tên một " + kind + " (dòng " + std::to_string(line) + ").");
+    }
+    Macro macro;
+    expect(TokenType::LPAREN);
+    while (peekType() != TokenType::RPAREN) {
+        if (!macro.params.empty()) {
+            expect(TokenType::COMMA);
+        }
+        SymbolId param = currentSymbol();
+        std::string param_text(currentText());
+        expect(TokenType::IDENTIFIER);
+        if (std::find(macro.params.begin(), macro.params.end(), param) != macro.params.end()) {
+            throw std::runtime_error("Lỗi ngữ nghĩa: Tham số '" + param_text + "' của MACRO '" + text + "' bị lặp (dòng " + std::to_string(line) + ").");
+        }
+        macro.params.push_back(param);
+    }
+    expect(TokenType::RPAREN);
+    expect(TokenType::ASSIGN);
+
+    // Thân parse vào macro_templates. Tên chỉ có hiệu lực sau thân: MACRO không tự gọi mình được
+    AstArena* caller = arena;
+    arena = &macro_templates;
+    macro_params = &macro.params;
+    macro.body = parse_expression();
+    macro_params = nullptr;
+    arena = caller;
+    expect(TokenType::SEMICOLON);
+    std::cout << "DEBUG: MACRO '" << text << "' (" << macro.params.size() << " tham số)" << std::endl;
+    macros[name] = std::move(macro);
+}
+
+NodeId Parser::parse_macro_call(SymbolId name, const Macro& macro) {
+    int line = currentLine();
+    std::string text(currentText());
+    expect(TokenType::IDENTIFIER);
+    expect(TokenType::LPAREN);
+    std::vector<NodeId> args;
+    while (peekType() != TokenType::RPAREN) {
+        if (!args.empty()) {
+            expect(TokenType::COMMA);
+        }
+        args.push_back(parse_expression()); // Trong phạm vi của nơi gọi
+    }
+    expect(TokenType::RPAREN);
+    if (args.size() != macro.params.size()) {
+        throw std::runtime_error("Lỗi ngữ nghĩa: MACRO '" + text + "' cần " + std::to_string(macro.params.size()) + " đối số nhưng nhận " + std::to_string(args.size()) + " tại dòng " + std::to_string(line));
+    }
+
+    // Mọi đối số đã biết: tính thẳng trên thân mẫu, nhớ kết quả theo (tên, đối số)
+    std::vector<uint32_t> key{name};
+    for (NodeId arg : args) {
+        if (arena->type(arg) != NodeType::IntegerLiteral) break;
+        key.push_back(arena->at(arg).a & 0xFFFF);
+    }
+    if (key.size() == args.size() + 1) {
+        auto memo = macro_results.find(key);
+        if (memo != macro_results.end()) {
+            return arena->add(NodeType::IntegerLiteral, memo->second, 0, 0, line);
+        }
+        uint32_t value = 0;
+        if (evaluateTemplate(macro_templates, macro.body, key.data() + 1, value)) {
+            macro_results.emplace(std::move(key), value);
+            return arena->add(NodeType::IntegerLiteral, value, 0, 0, line);
+        }
+        // Chia cho 0: chép thân như viết
+    }
+    std::vector<bool> used(args.size(), false);
+    return instantiate(macro.body, args, used, line);
+}
+
+NodeId Parser::instantiate(NodeId node, const std::vector<NodeId>& args, std::vector<bool>& used, int line) {
+    // Chép slots: arena có thể chính là macro_templates (MACRO gọi MACRO) và bị cấp phát lại
+    NodeType type = macro_templates.type(node);
+    NodeSlots s = macro_templates.at(node);
+    switch (type) {
+        case NodeType::Identifier:
+            // Lần dùng đầu lấy luôn cây đối số, các lần sau chép lại: node không dùng chung
+            if (!used[s.a]) {
+                used[s.a] = true;
+                return args[s.a];
+            }
+            return copyExpression(args[s.a]);
+        case NodeType::BinaryOp: {
+            NodeId left = instantiate(s.a, args, used, line);
+            NodeId right = instantiate(s.b, args, used, line);
+            return binary(left, right, static_cast<TokenType>(s.c), line);
+        }
+        default:
+            return arena->add(type, s.a, s.b, s.c, line);
+    }
+}
+
+NodeId Parser::copyExpression(NodeId node) {
+    NodeType type = arena->type(node);
+    NodeSlots s = arena->at(node);
+    int line = arena->lines[node];
+    switch (type) {
+        case NodeType::MemRead:
+            return arena->add(type, copyExpression(s.a), 0, 0, line);
+        case NodeType::BinaryOp: {
+            NodeId left = copyExpression(s.a);
+            NodeId right = copyExpression(s.b);
+            return arena->add(type, left, right, s.c, line);
+        }
+        default:
+            return arena->add(type, s.a, s.b, s.c, line);
+    }
 }
 
+const char* Parser::nameKind(SymbolId id) const {
+    if (id < symbol_table.symbols.size() && symbol_table.symbols[id].declared) return "biến";
+    if (subroutines.count(id)) return "SUB";
+    if (constants.count(id)) return "CONST";
+    if (macros.count(id)) return "MACRO";
+    return nullptr;
+}
 
-std::unique_ptr<ASTNode> Parser::parse_expression() {
-    auto node = parse_term(); // Start with term (multiplication/division)
+NodeId Parser::binary(NodeId left, NodeId right, TokenType op, int line) {
+    // Gập ngay khi parse, nên số, CONST và MACRO với đối số đã biết
+    // không sinh gadget nào kể cả khi không chạy AstOptimizer
+    uint32_t value = 0;
+    if (arena->type(left) == NodeType::IntegerLiteral && arena->type(right) == NodeType::IntegerLiteral &&
+        applyOperator(op, arena->at(left).a & 0xFFFF, arena->at(right).a & 0xFFFF, value)) {
+        // Node mới: node trái có thể là đối số MACRO mà các lần dùng sau của tham số còn chép lại
+        return arena->add(NodeType::IntegerLiteral, value, 0, 0, line);
+    }
+    return arena->add(NodeType::BinaryOp, left, right, static_cast<uint32_t>(op), line);
+}
 
-    while (current_token.type == TokenType::PLUS || current_token.type == TokenType::MINUS) {
-        TokenType op_type = current_token.type;
+std::vector<NodeId> Parser::parse_body(int line, const char* owner, const char* part) {
+    expect(TokenType::LBRACE);
+    std::vector<NodeId> body;
+    while (peekType() != TokenType::RBRACE) {
+        if (peekType() == TokenType::END_OF_FILE) {
+            throw std::runtime_error(std::string("Lỗi cú pháp: Thiếu '}' cho ") + owner + " bắt đầu tại dòng " + std::to_string(line));
+        }
+        // Biến được cấp địa chỉ tĩnh khi parse: khai báo trong một khối không có ý nghĩa riêng
+        if (peekType() == TokenType::VAR) {
+            throw std::runtime_error(std::string("Lỗi cú pháp: Không được khai báo biến trong ") + part + " tại dòng " + std::to_string(currentLine()));
+        }
+        if (peekType() == TokenType::SUB || peekType() == TokenType::CONST || peekType() == TokenType::MACRO) {
+            throw std::runtime_error("Lỗi cú pháp: " + std::string(currentText()) + " chỉ được định nghĩa ở cấp cao nhất, không trong " + part + " tại dòng " + std::to_string(currentLine()));
+        }
+        body.push_back(parse_statement());
+    }
+    expect(TokenType::RBRACE);
+    return body;
+}
+
+NodeId Parser::parse_expression() {
+    NodeId node = parse_sum();
+    TokenType op_type = peekType();
+    if (op_type == TokenType::LESS || op_type == TokenType::GREATER || op_type == TokenType::LESS_EQUAL ||
+        op_type == TokenType::GREATER_EQUAL || op_type == TokenType::EQUAL || op_type == TokenType::NOT_EQUAL) {
+        // Không kết hợp: a < b < c phải viết (a < b) < c
+        int line = currentLine();
         advance();
-        auto right = parse_term();
-        node = std::make_unique<BinaryOpNode>(op_type, std::move(node), std::move(right));
+        NodeId right = parse_sum();
+        node = binary(node, right, op_type, line);
     }
     return node;
 }
 
-std::unique_ptr<ASTNode> Parser::parse_term() {
-    auto node = parse_factor(); // Start with factor (numbers, identifiers, parentheses, memory reads)
+NodeId Parser::parse_sum() {
+    NodeId node = parse_term(); // Start with term (multiplication/division)
 
-    while (current_token.type == TokenType::MULTIPLY || current_token.type == TokenType::DIVIDE) {
-        TokenType op_type = current_token.type;
+    while (peekType() == TokenType::PLUS || peekType() == TokenType::MINUS) {
+        TokenType op_type = peekType();
+        int line = currentLine();
         advance();
-        auto right = parse_factor();
-        node = std::make_unique<BinaryOpNode>(op_type, std::move(node), std::move(right));
+        NodeId right = parse_term();
+        node = binary(node, right, op_type, line);
     }
     return node;
 }
 
-std::unique_ptr<ASTNode> Parser::parse_factor() {
-    std::unique_ptr<ASTNode> node;
-    if (current_token.type == TokenType::INTEGER) {
-        node = std::make_unique<IntegerLiteralNode>(std::stoul(current_token.value));
+NodeId Parser::parse_term() {
+    NodeId node = parse_factor(); // Start with factor (numbers, identifiers, parentheses, memory reads)
+
+    while (peekType() == TokenType::MULTIPLY || peekType() == TokenType::DIVIDE) {
+        TokenType op_type = peekType();
+        int line = currentLine();
         advance();
-    } else if (current_token.type == TokenType::IDENTIFIER) {
-        Token peek_token = lexer.peekNextToken(); // Peek to check for array/memory access
-        if (peek_token.type == TokenType::OPEN_BRACKET) { // If it's like VAR[EXPR]
-            std::string base_id = current_token.value;
+        NodeId right = parse_factor();
+        node = binary(node, right, op_type, line);
+    }
+    return node;
+}
+
+NodeId Parser::parse_factor() {
+    NodeId node;
+    int line = currentLine();
+    if (peekType() == TokenType::INTEGER_LITERAL) {
+        node = arena->add(NodeType::IntegerLiteral, parseUnsigned(currentText()), 0, 0, line);
+        advance();
+    } else if (peekType() == TokenType::IDENTIFIER) {
+        if (peekType(1) == TokenType::LBRACKET) { // If it's like VAR[EXPR]
+            if (macro_params) {
+                throw std::runtime_error("Lỗi ngữ nghĩa: Thân MACRO phải thuần, không được đọc bộ nhớ (dòng " + std::to_string(line) + ").");
+            }
             expect(TokenType::IDENTIFIER); // Consume the identifier (e.g., 'MEM')
-            expect(TokenType::OPEN_BRACKET); // Consume '['
-            auto address_expr = parse_expression(); // Parse the address expression
-            expect(TokenType::CLOSE_BRACKET); // Consume ']'
-            node = std::make_unique<MemReadNode>(std::move(address_expr));
+            expect(TokenType::LBRACKET); // Consume '['
+            NodeId address_expr = parse_expression(); // Parse the address expression
+            expect(TokenType::RBRACKET); // Consume ']'
+            node = arena->add(NodeType::MemRead, address_expr, 0, 0, line);
+        } else if (macro_params && std::find(macro_params->begin(), macro_params->end(), currentSymbol()) != macro_params->end()) {
+            // Tham số trong thân MACRO: a = chỉ số tham số
+            uint32_t index = static_cast<uint32_t>(std::find(macro_params->begin(), macro_params->end(), currentSymbol()) - macro_params->begin());
+            node = arena->add(NodeType::Identifier, index, 0, 0, line);
+            advance();
+        } else if (auto constant = constants.find(currentSymbol()); constant != constants.end()) {
+            node = arena->add(NodeType::IntegerLiteral, constant->second, 0, 0, line);
+            advance();
+        } else if (auto macro = macros.find(currentSymbol()); macro != macros.end()) {
+            node = parse_macro_call(macro->first, macro->second);
+        } else if (macro_params) {
+            throw std::runtime_error("Lỗi ngữ nghĩa: Thân MACRO phải thuần, '" + std::string(currentText()) + "' không phải tham số, CONST hay MACRO (dòng " + std::to_string(line) + ").");
         } else { // Just an identifier (variable)
-            node = std::make_unique<IdentifierNode>(current_token.value);
+            SymbolId var_id = currentSymbol();
             // Semantic check: ensure identifier is declared
-            if (!symbol_table.get_symbol(current_token.value)) {
-                 throw std::runtime_error("Lỗi ngữ nghĩa: Biến '" + current_token.value + "' chưa được khai báo tại dòng " + std::to_string(current_token.line));
+            if (!symbol_table.get_symbol(var_id)) {
+                 throw std::runtime_error("Lỗi ngữ nghĩa: Biến '" + std::string(currentText()) + "' chưa được khai báo tại dòng " + std::to_string(currentLine()));
             }
+            node = arena->add(NodeType::Identifier, var_id, 0, 0, line);
             advance();
         }
-    } else if (current_token.type == TokenType::OPEN_PAREN) {
+    } else if (peekType() == TokenType::LPAREN) {
         advance();
         node = parse_expression();
-        expect(TokenType::CLOSE_PAREN);
+        expect(TokenType::RPAREN);
     } else {
         std::string error_msg = "Lỗi cú pháp: Mong đợi số nguyên, định danh, hoặc '(' tại dòng ";
-        error_msg += std::to_string(current_token.line) + ", cột ";
-        error_msg += std::to_string(current_token.column) + ". Nhận được '" + current_token.value + "'.";
+        error_msg += std::to_string(currentLine()) + ", cột ";
+        error_msg += std::to_string(currentColumn()) + ". Nhận được '" + std::string(currentText()) + "'.";
         throw std::runtime_error(error_msg);
     }
     return node;
@@ -5,136 +5,191 @@
 #include <vector>
 #include <string>
 #include <map>
-#include <memory> // For std::unique_ptr
-
-// --- AST Node Definitions ---
-// Base class for all Abstract Syntax Tree nodes
-struct ASTNode {
-    enum class NodeType {
-        Program,
-        VarDeclaration,
-        Assignment,
-        IntegerLiteral,
-        BinaryOp,
-        Identifier,
-        MemWrite, // New node type for memory write
-        MemRead,  // New node type for memory read
-        PrintChar // New node type for print_char
-    };
-    NodeType type;
-    virtual ~ASTNode() = default;
-};
-
-// Program node (root of the AST)
-struct ProgramNode : public ASTNode {
-    std::vector<std::unique_ptr<ASTNode>> statements;
-    ProgramNode() { type = NodeType::Program; }
-};
-
-// Variable Declaration node
-struct VarDeclarationNode : public ASTNode {
-    std::string var_name;
-    VarDeclarationNode(std::string name) : var_name(std::move(name)) { type = NodeType::VarDeclaration; }
-};
-
-// Assignment node: var_name = expression
-struct AssignmentNode : public ASTNode {
-    std::string var_name;
-    std::unique_ptr<ASTNode> expression;
-    AssignmentNode(std::string name, std::unique_ptr<ASTNode> expr)
-        : var_name(std::move(name)), expression(std::move(expr)) { type = NodeType::Assignment; }
-};
-
-// Integer Literal node (e.g., 10, 255)
-struct IntegerLiteralNode : public ASTNode {
-    unsigned int value;
-    IntegerLiteralNode(unsigned int val) : value(val) { type = NodeType::IntegerLiteral; }
-};
-
-// Binary Operation node (e.g., a + b, x - y)
-struct BinaryOpNode : public ASTNode {
-    TokenType op; // PLUS, MINUS, MULT, DIV
-    std::unique_ptr<ASTNode> left;
-    std::unique_ptr<ASTNode> right;
-    BinaryOpNode(TokenType op_type, std::unique_ptr<ASTNode> l, std::unique_ptr<ASTNode> r)
-        : op(op_type), left(std::move(l)), right(std::move(r)) { type = NodeType::BinaryOp; }
-};
-
-// Identifier node (variable name)
-struct IdentifierNode : public ASTNode {
-    std::string name;
-    IdentifierNode(std::string var_name) : name(std::move(var_name)) { type = NodeType::Identifier; }
+#include <cstdint>
+#include <string_view>
+
+// --- AST (arena) ---
+// Toàn bộ cây của một lần biên dịch nằm trong một AstArena: các node là các
+// mảng phẳng (loại node + 3 ô dữ liệu 32-bit), con được liên kết bằng chỉ số
+// NodeId. Không có vtable, không có cấp phát riêng cho từng node, và cả cây
+// được giải phóng một lần khi arena bị hủy (hoặc clear() để dùng lại).
+using NodeId = uint32_t;
+constexpr NodeId kNullNode = 0xFFFFFFFF;
+
+enum class NodeType : uint8_t {
+    Program,
+    VarDeclaration,
+    Assignment,
+    IntegerLiteral,
+    BinaryOp,
+    Identifier,
+    MemWrite, // New node type for memory write
+    MemRead,  // New node type for memory read
+    PrintChar, // New node type for print_char
+    While,     // WHILE cond { ... }
+    Repeat,    // REPEAT count { ... }
+    If,        // IF cond { ... } ELSE { ... }
+    Block,     // Một nhánh của If
+    Sub,       // SUB name { ... } (chỉ ở cấp cao nhất)
+    Call       // CALL name;
 };
 
-// Memory Write node: [address_expr] = value_expr
-struct MemWriteNode : public ASTNode {
-    std::unique_ptr<ASTNode> address_expr;
-    std::unique_ptr<ASTNode> value_expr;
-    MemWriteNode(std::unique_ptr<ASTNode> addr_expr, std::unique_ptr<ASTNode> val_expr)
-        : address_expr(std::move(addr_expr)), value_expr(std::move(val_expr)) { type = NodeType::MemWrite; }
+// Ý nghĩa các ô a/b/c theo loại node:
+//   Program:        a = vị trí đầu danh sách câu lệnh (trong lists), b = số câu lệnh
+//   VarDeclaration: a = SymbolId của biến
+//   Assignment:     a = SymbolId, b = biểu thức
+//   IntegerLiteral: a = giá trị
+//   BinaryOp:       a = trái, b = phải, c = toán tử (TokenType: PLUS, MINUS, MULTIPLY, DIVIDE,
+//                   hoặc so sánh LESS .. NOT_EQUAL cho kết quả 0/1, không dấu 16 bit)
+//   Identifier:     a = SymbolId
+//   MemWrite:       a = biểu thức địa chỉ, b = biểu thức giá trị
+//   MemRead:        a = biểu thức địa chỉ
+//   PrintChar:      a = dòng, b = cột, c = mã ký tự
+//   While:          a = điều kiện (lặp khi khác 0), b = vị trí đầu thân (trong lists), c = số câu lệnh
+//   Repeat:         a = số lần lặp (tính một lần trước vòng lặp), b/c như While
+//   If:             a = điều kiện (nhánh đúng khi khác 0), b = Block nhánh đúng, c = Block nhánh ELSE
+//   Block:          a = vị trí đầu danh sách câu lệnh, b = số câu lệnh (như Program; có thể rỗng)
+//   Sub:            a = SymbolId của tên, b/c = thân như While (chỉ chạy qua CALL)
+//   Call:           a = node Sub được gọi (luôn định nghĩa trước nên không có đệ quy)
+struct NodeSlots {
+    uint32_t a;
+    uint32_t b;
+    uint32_t c;
 };
 
-// Memory Read node: [address_expr] (used in expressions)
-struct MemReadNode : public ASTNode {
-    std::unique_ptr<ASTNode> address_expr;
-    MemReadNode(std::unique_ptr<ASTNode> addr_expr)
-        : address_expr(std::move(addr_expr)) { type = NodeType::MemRead; }
-};
-
-// PRINT_CHAR node: PRINT_CHAR(line, column, char_code)
-struct PrintCharNode : public ASTNode {
-    std::unique_ptr<ASTNode> line_expr;
-    std::unique_ptr<ASTNode> column_expr;
-    std::unique_ptr<ASTNode> char_code_expr;
-    PrintCharNode(std::unique_ptr<ASTNode> line, std::unique_ptr<ASTNode> col, std::unique_ptr<ASTNode> code)
-        : line_expr(std::move(line)), column_expr(std::move(col)), char_code_expr(std::move(code)) {
-        type = NodeType::PrintChar;
-    }
+class AstArena {
+public:
+    std::vector<NodeType> types;
+    std::vector<NodeSlots> slots;
+    std::vector<int> lines;              // Dòng nguồn của từng node (cho thông báo lỗi)
+    std::vector<NodeId> lists;           // Danh sách con liên tiếp (câu lệnh của Program / thân vòng lặp)
+    NodeId root = kNullNode;
+
+    NodeId add(NodeType type, uint32_t a = 0, uint32_t b = 0, uint32_t c = 0, int line = 0);
+    // Chép một danh sách NodeId vào lists, trả về vị trí bắt đầu
+    uint32_t addList(const std::vector<NodeId>& items);
+
+    NodeType type(NodeId id) const { return types[id]; }
+    const NodeSlots& at(NodeId id) const { return slots[id]; }
+    NodeSlots& at(NodeId id) { return slots[id]; }
+
+    // Danh sách câu lệnh của một node Program hoặc Block
+    const NodeId* statementsBegin(NodeId program) const { return lists.data() + slots[program].a; }
+    const NodeId* statementsEnd(NodeId program) const { return statementsBegin(program) + slots[program].b; }
+    // Thân của một node While/Repeat/Sub
+    const NodeId* bodyBegin(NodeId loop) const { return lists.data() + slots[loop].b; }
+    const NodeId* bodyEnd(NodeId loop) const { return bodyBegin(loop) + slots[loop].c; }
+
+    size_t size() const { return types.size(); }
+    void reserve(size_t node_count);
+    void clear();
 };
 
 // --- Symbol Table ---
+// Định danh được intern thành ID liên tiếp khi lex (xem StringInterner),
+// nên bảng ký hiệu chỉ là một vector đánh chỉ số theo ID: tra cứu là một lần đọc mảng.
+using SymbolId = uint32_t;
+
 struct SymbolInfo {
-    unsigned int address;
+    unsigned int address = 0;
+    bool declared = false;
+    std::string_view name; // Tên gốc (cho thông báo lỗi/DEBUG)
     // Thêm các thông tin khác nếu cần (ví dụ: kích thước, kiểu dữ liệu)
 };
 
 class SymbolTable {
 public:
-    std::map<std::string, SymbolInfo> symbols;
+    std::vector<SymbolInfo> symbols; // Chỉ số = SymbolId
     unsigned int next_available_address = 0x2000; // Start variable addresses from 0x2000
+    const StringInterner* names = nullptr; // Để in tên của biến chưa khai báo
 
     unsigned int get_next_address(unsigned int size_bytes = 2); // Giả định 2 byte cho các biến
 
-    void add_symbol(const std::string& name);
-    // Sửa chữa: Thêm 'const' vào kiểu trả về và cuối hàm
-    const SymbolInfo* get_symbol(const std::string& name) const;
+    void add_symbol(SymbolId id);
+    const SymbolInfo* get_symbol(SymbolId id) const;
+
+private:
+    std::string_view name_of(SymbolId id) const;
 };
 
 
 // --- Parser Class ---
 class Parser {
 public:
+    // Lex toàn bộ đầu vào của lexer vào bộ đệm rồi parse trên bộ đệm đó
     explicit Parser(Lexer& lexer);
-    std::unique_ptr<ProgramNode> parse();
+    // Parse một bộ đệm token đã lex sẵn (ví dụ: lex trên thread khác)
+    explicit Parser(TokenBuffer tokens);
+
+    // SymbolTable trỏ vào bảng intern của chính Parser
+    Parser(const Parser&) = delete;
+    Parser& operator=(const Parser&) = delete;
+    // Parse toàn bộ chương trình vào arena (arena được clear trước), trả về node Program.
+    // Node định danh mang SymbolId; tên tra qua getSymbolTable() hoặc getNames().
+    NodeId parse(AstArena& arena);
+
+    const SymbolTable& getSymbolTable() const { return symbol_table; }
+    const StringInterner& getNames() const { return tokens.interner; }
 
 private:
-    Lexer& lexer;
-    Token current_token; // Sửa chữa: Khởi tạo trong constructor
+    TokenBuffer tokens;
+    size_t pos = 0; // Chỉ số token hiện tại trong bộ đệm
+
+    // Nhìn trước: O(1), không lex lại. Vượt quá cuối bộ đệm trả về END_OF_FILE.
+    TokenType peekType(size_t ahead = 0) const;
+    std::string_view currentText() const { return tokens.text(pos); }
+    SymbolId currentSymbol() const { return tokens.symbols[pos]; }
+    int currentLine() const { return tokens.lines[pos]; }
+    int currentColumn() const { return tokens.columns[pos]; }
 
     void advance(); // Move to the next token
     void expect(TokenType type); // Consume current token and expect next token to be of a certain type
 
     // Parsing functions for different grammar rules
-    std::unique_ptr<ASTNode> parse_statement();
-    std::unique_ptr<ASTNode> parse_var_declaration();
-    std::unique_ptr<ASTNode> parse_assignment();
-    std::unique_ptr<ASTNode> parse_mem_write();
-    std::unique_ptr<ASTNode> parse_print_char();
-
-    std::unique_ptr<ASTNode> parse_expression();
-    std::unique_ptr<ASTNode> parse_term();     // Handles multiplication and division
-    std::unique_ptr<ASTNode> parse_factor();   // Handles numbers, identifiers, and parentheses, memory reads
-
+    NodeId parse_statement();
+    NodeId parse_var_declaration();
+    NodeId parse_assignment();
+    NodeId parse_mem_write();
+    NodeId parse_print_char();
+    NodeId parse_loop(); // WHILE/REPEAT expr { ... }
+    NodeId parse_if();   // IF expr { ... } [ELSE { ... } | ELSE IF ...]
+    NodeId parse_sub();  // SUB name { ... }
+    NodeId parse_call(); // CALL name;
+    void parse_const();  // CONST name = expr; (không sinh node)
+    void parse_macro();  // MACRO name(a, b) = expr; (không sinh node)
+    // { câu lệnh ... } của vòng lặp/nhánh IF; owner/part: tên trong thông báo lỗi
+    std::vector<NodeId> parse_body(int line, const char* owner, const char* part);
+
+    NodeId parse_expression(); // Handles one comparison (<, >, <=, >=, ==, !=) between sums
+    NodeId parse_sum();      // Handles addition and subtraction
+    NodeId parse_term();     // Handles multiplication and division
+    NodeId parse_factor();   // Handles numbers, identifiers, and parentheses, memory reads
+
+    // --- CONST / MACRO ---
+    // Thân MACRO nằm trong macro_templates; Identifier trong thân là tham số
+    // (a = chỉ số tham số), CONST và MACRO lồng đã được thay ngay khi định nghĩa,
+    // nên thân không có tên tự do: khai triển là vệ sinh (hygienic) và chỉ cần
+    // chép cây, thay tham số bằng bản sao biểu thức đối số.
+    struct Macro {
+        std::vector<SymbolId> params;
+        NodeId body = kNullNode; // Trong macro_templates
+    };
+    NodeId parse_macro_call(SymbolId name, const Macro& macro);
+    NodeId instantiate(NodeId node, const std::vector<NodeId>& args, std::vector<bool>& used, int line);
+    NodeId copyExpression(NodeId node);
+    // BinaryOp mới; hai vế đều là hằng thì gập luôn thành IntegerLiteral
+    NodeId binary(NodeId left, NodeId right, TokenType op, int line);
+    // Loại của một tên đã dùng ("biến", "SUB", "CONST", "MACRO"), nullptr nếu chưa dùng
+    const char* nameKind(SymbolId id) const;
+
+    AstArena* arena = nullptr; // Arena của lần parse hiện tại
+    std::map<SymbolId, NodeId> subroutines; // Tên -> node Sub đã định nghĩa
+    std::map<SymbolId, uint32_t> constants;  // Tên CONST -> giá trị (16 bit)
+    std::map<SymbolId, Macro> macros;        // Tên MACRO -> tham số và thân
+    AstArena macro_templates;                // Thân của các MACRO
+    const std::vector<SymbolId>* macro_params = nullptr; // Tham số của MACRO đang parse thân
+    // Kết quả đã tính: (tên MACRO, giá trị các đối số) -> giá trị
+    std::map<std::vector<uint32_t>, uint32_t> macro_results;
     SymbolTable symbol_table; // Symbol table instance
 };
 
@@ -0,0 +1,133 @@
+#ifndef PERFECT_HASH_H
+#define PERFECT_HASH_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+// --- Perfect hash tại thời điểm biên dịch ---
+// Dùng cho các bảng từ khóa/tên cố định: toàn bộ bảng được dựng bằng constexpr,
+// nên tra cứu lúc chạy chỉ tốn hai lần hash + một lần so sánh chuỗi.
+//
+// Lược đồ hai tầng "hash and displace": khóa được chia vào các bucket theo
+// hash(key, 0); mỗi bucket có một seed riêng sao cho hash(key, seed) của mọi
+// khóa trong bucket rơi vào ô trống. Nhờ vậy bảng chỉ cần ~2 ô cho mỗi khóa
+// kể cả với hàng trăm khóa. Nếu không dựng được (có khóa trùng), `ok` là false
+// và static_assert ở nơi dựng bảng sẽ báo lỗi ngay khi biên dịch.
+namespace perfect_hash {
+
+constexpr std::uint16_t kEmptySlot = 0xFFFF;
+
+// FNV-1a 32-bit, trộn thêm seed để có họ hàm băm khác nhau.
+constexpr std::uint32_t hash(std::string_view key, std::uint32_t seed) {
+    std::uint32_t h = 2166136261u ^ (seed * 0x9E3779B9u);
+    for (char c : key) {
+        h ^= static_cast<unsigned char>(c);
+        h *= 16777619u;
+    }
+    h ^= h >> 15;
+    h *= 0x2C1B3C6Du;
+    h ^= h >> 12;
+    return h;
+}
+
+// Kích thước bảng: lũy thừa của 2, ít nhất gấp đôi số khóa.
+constexpr std::size_t tableSizeFor(std::size_t key_count) {
+    std::size_t size = 1;
+    while (size < key_count * 2) size <<= 1;
+    return size;
+}
+
+// Số bucket tầng một: khoảng 2 khóa mỗi bucket.
+constexpr std::size_t bucketCountFor(std::size_t key_count) {
+    return key_count / 2 + 1;
+}
+
+template <std::size_t TableSize, std::size_t BucketCount>
+struct Table {
+    std::array<std::uint16_t, BucketCount> seeds{};
+    std::array<std::uint16_t, TableSize> slots{};
+    bool ok = false; // false nếu không dựng được (khóa trùng hoặc hết seed)
+
+    // Trả về chỉ số khóa ứng viên; người gọi phải so sánh lại với khóa thật.
+    constexpr std::uint16_t candidate(std::string_view key) const {
+        std::uint16_t seed = seeds[hash(key, 0) % BucketCount];
+        return slots[hash(key, seed) & (TableSize - 1)];
+    }
+};
+
+template <std::size_t N>
+constexpr Table<tableSizeFor(N), bucketCountFor(N)> build(const std::array<std::string_view, N>& keys) {
+    constexpr std::size_t kTableSize = tableSizeFor(N);
+    constexpr std::size_t kBuckets = bucketCountFor(N);
+    static_assert(N < kEmptySlot, "Quá nhiều khóa cho perfect hash 16-bit");
+    Table<kTableSize, kBuckets> table;
+
+    for (std::size_t i = 0; i < N; ++i) {
+        for (std::size_t j = i + 1; j < N; ++j) {
+            if (keys[i] == keys[j]) return table; // khóa trùng: không thể có perfect hash
+        }
+    }
+
+    // Gom khóa theo bucket
+    std::array<std::size_t, N> bucket_of{};
+    std::array<std::size_t, kBuckets> bucket_size{};
+    for (std::size_t i = 0; i < N; ++i) {
+        bucket_of[i] = hash(keys[i], 0) % kBuckets;
+        bucket_size[bucket_of[i]]++;
+    }
+
+    // Thứ tự xử lý: bucket lớn trước (sắp xếp chọn, đủ nhanh ở compile time)
+    std::array<std::size_t, kBuckets> order{};
+    for (std::size_t b = 0; b < kBuckets; ++b) order[b] = b;
+    for (std::size_t i = 0; i < kBuckets; ++i) {
+        std::size_t best = i;
+        for (std::size_t j = i + 1; j < kBuckets; ++j) {
+            if (bucket_size[order[j]] > bucket_size[order[best]]) best = j;
+        }
+        std::size_t tmp = order[i];
+        order[i] = order[best];
+        order[best] = tmp;
+    }
+
+    for (auto& s : table.slots) s = kEmptySlot;
+
+    for (std::size_t oi = 0; oi < kBuckets; ++oi) {
+        std::size_t bucket = order[oi];
+        if (bucket_size[bucket] == 0) break;
+
+        bool placed = false;
+        for (std::uint32_t seed = 1; seed < 0xFFFF && !placed; ++seed) {
+            std::array<std::size_t, N> positions{};
+            std::size_t count = 0;
+            bool fits = true;
+            for (std::size_t i = 0; i < N && fits; ++i) {
+                if (bucket_of[i] != bucket) continue;
+                std::size_t pos = hash(keys[i], seed) & (kTableSize - 1);
+                if (table.slots[pos] != kEmptySlot) fits = false;
+                for (std::size_t k = 0; k < count && fits; ++k) {
+                    if (positions[k] == pos) fits = false;
+                }
+                positions[count++] = pos;
+            }
+            if (!fits) continue;
+
+            count = 0;
+            for (std::size_t i = 0; i < N; ++i) {
+                if (bucket_of[i] != bucket) continue;
+                table.slots[positions[count++]] = static_cast<std::uint16_t>(i);
+            }
+            table.seeds[bucket] = static_cast<std::uint16_t>(seed);
+            placed = true;
+        }
+        if (!placed) return table;
+    }
+
+    table.ok = true;
+    return table;
+}
+
+} // namespace perfect_hash
+
+#endif // PERFECT_HASH_H
@@ -4,367 +4,1193 @@
 #include <sstream>   // For std::stringstream
 #include <stdexcept> // For std::runtime_error
 #include <iomanip>   // For std::hex, std::dec
+#include <algorithm> // For std::min
+#include <cctype>    // For isxdigit, tolower
+#include <iterator>  // For std::prev
 
 // --- GadgetDB Implementation ---
 
-// Constructor để khởi tạo name_to_enum_map
-GadgetDB::GadgetDB() {
-    // Ánh xạ chuỗi tên gadget trong file nx_u8_gadgets.txt sang enum GadgetFunction
-    // Đảm bảo rằng mỗi chuỗi ở đây khớp chính xác với chuỗi sau địa chỉ trong file txt của bạn.
-
-    // Basic stack/register manipulation
-    name_to_enum_map["setlr"] = GadgetFunction::SETLR;
-    name_to_enum_map["DI,RT"] = GadgetFunction::DI_RT;
-    name_to_enum_map["sp = er14,pop er14,rt"] = GadgetFunction::SP_ER14_POP_ER14_RT;
-    name_to_enum_map["sp = er14,pop qr8"] = GadgetFunction::SP_ER14_POP_QR8;
-    name_to_enum_map["sp = er14,pop qr8,pop qr0"] = GadgetFunction::SP_ER14_POP_QR8_POP_QR0;
-    name_to_enum_map["sp = er14,pop er14"] = GadgetFunction::SP_ER14_POP_ER14;
-    name_to_enum_map["sp = er6,pop er8"] = GadgetFunction::SP_ER6_POP_ER8;
-    name_to_enum_map["sp = er14,pop xr12"] = GadgetFunction::SP_ER14_POP_XR12;
-    name_to_enum_map["sp = er14,pop qr8,pop er6"] = GadgetFunction::SP_ER14_POP_QR8_POP_ER6;
-    name_to_enum_map["er14 = sp,rt"] = GadgetFunction::ER14_SP_RT;
-    name_to_enum_map["nop"] = GadgetFunction::NOP;
-
-    // POP gadgets
-    name_to_enum_map["pop ea"] = GadgetFunction::POP_EA;
-    name_to_enum_map["pop er14,rt"] = GadgetFunction::POP_ER14_RT;
-    name_to_enum_map["pop er0,rt"] = GadgetFunction::POP_ER0_RT;
-    name_to_enum_map["pop er2"] = GadgetFunction::POP_ER2;
-    name_to_enum_map["pop er4"] = GadgetFunction::POP_ER4;
-    name_to_enum_map["pop er8"] = GadgetFunction::POP_ER8;
-    name_to_enum_map["pop er12,rt"] = GadgetFunction::POP_ER12_RT;
-    name_to_enum_map["pop qr0"] = GadgetFunction::POP_QR0;
-    name_to_enum_map["pop qr8"] = GadgetFunction::POP_QR8;
-    name_to_enum_map["pop r0"] = GadgetFunction::POP_R0;
-    name_to_enum_map["pop r8"] = GadgetFunction::POP_R8;
-    name_to_enum_map["pop xr0"] = GadgetFunction::POP_XR0;
-    name_to_enum_map["pop xr4"] = GadgetFunction::POP_XR4;
-    name_to_enum_map["pop xr8"] = GadgetFunction::POP_XR8;
-    name_to_enum_map["pop er10"] = GadgetFunction::POP_ER10;
-    name_to_enum_map["pop r12"] = GadgetFunction::POP_R12;
-    name_to_enum_map["pop er0"] = GadgetFunction::POP_ER0;
-    name_to_enum_map["pop er12"] = GadgetFunction::POP_ER12;
-    name_to_enum_map["pop er14"] = GadgetFunction::POP_ER14;
-    name_to_enum_map["pop er6"] = GadgetFunction::POP_ER6;
-    name_to_enum_map["pop er6,rt"] = GadgetFunction::POP_ER6_RT;
-    name_to_enum_map["pop xr12"] = GadgetFunction::POP_XR12;
-    name_to_enum_map["pop er4,rt"] = GadgetFunction::POP_ER4_RT;
-    name_to_enum_map["pop er8,rt"] = GadgetFunction::POP_ER8_RT;
-    name_to_enum_map["pop qr0,rt"] = GadgetFunction::POP_QR0_RT;
-    name_to_enum_map["pop qr8,rt"] = GadgetFunction::POP_QR8_RT;
-    name_to_enum_map["pop r4"] = GadgetFunction::POP_R4;
-    name_to_enum_map["pop r4,rt"] = GadgetFunction::POP_R4_RT;
-    name_to_enum_map["pop r9"] = GadgetFunction::POP_R9;
-    name_to_enum_map["pop xr12,rt"] = GadgetFunction::POP_XR12_RT;
-    name_to_enum_map["pop xr4,rt"] = GadgetFunction::POP_XR4_RT;
-    name_to_enum_map["pop xr8,rt"] = GadgetFunction::POP_XR8_RT;
-
-    // ADD gadgets
-    name_to_enum_map["er0+=er4,rt"] = GadgetFunction::ADD_ER0_ER4_RET;
-    name_to_enum_map["er4+=er0,r8 = r8,rt"] = GadgetFunction::ADD_ER4_ER0_R8_RET;
-    name_to_enum_map["er0+=er8,rt"] = GadgetFunction::ADD_ER0_ER8_RET;
-    name_to_enum_map["er2+=er8,rt"] = GadgetFunction::ADD_ER2_ER8_RET;
-    name_to_enum_map["er0+=er2,rt"] = GadgetFunction::ADD_ER0_ER2_RET;
-    name_to_enum_map["er0+=1,rt"] = GadgetFunction::ADD_ER0_ONE_RET;
-    name_to_enum_map["r0+=1,rt"] = GadgetFunction::ADD_R0_ONE_RET;
-
-    // Move/Copy registers
-    name_to_enum_map["er6 = er0,er0 = er8,pop qr8"] = GadgetFunction::MOV_ER6_ER0_ER0_ER8_POP_QR8;
-    name_to_enum_map["er8 = er0"] = GadgetFunction::MOV_ER8_ER0_RET;
-    name_to_enum_map["er2 = er0,er0 = er2,pop er8,rt"] = GadgetFunction::MOV_ER2_ER0_ER0_ER2_POP_ER8_RET;
-    name_to_enum_map["er2 = er0,er0+=er4,rt"] = GadgetFunction::MOV_ER2_ER0_ADD_ER0_ER4_RET;
-    name_to_enum_map["er0 = er2,rt"] = GadgetFunction::MOV_ER0_ER2_RET;
-    name_to_enum_map["er0 = er4,pop er4"] = GadgetFunction::MOV_ER0_ER4_POP_ER4;
-    name_to_enum_map["er0 = er8,pop er8,rt"] = GadgetFunction::MOV_ER0_ER8_POP_ER8_RET;
-    name_to_enum_map["er0 = er8"] = GadgetFunction::MOV_ER0_ER8_RET; // No ,rt implies it's not a return gadget
-    name_to_enum_map["er0 = er6,pop er8,pop xr4"] = GadgetFunction::MOV_ER0_ER6_POP_ER8_POP_XR4;
-    name_to_enum_map["er2 = er0,r0 = r4,r1 = 0,pop xr4,rt"] = GadgetFunction::MOV_ER2_ER0_R0_R4_R1_ZERO_POP_XR4_RET;
-    name_to_enum_map["r0 = r5,pop er4"] = GadgetFunction::MOV_R0_R5_POP_ER4;
-    name_to_enum_map["r0 = r2 = 0"] = GadgetFunction::MOV_R0_R2_ZERO;
-    name_to_enum_map["r0 = r2"] = GadgetFunction::MOV_R0_R2;
-    name_to_enum_map["r2 = r0,pop er0"] = GadgetFunction::MOV_R2_R0_POP_ER0;
-    name_to_enum_map["r2 = r0,pop r6,pop er12"] = GadgetFunction::MOV_R2_R0_POP_R6_POP_ER12;
-    name_to_enum_map["r2 = 0,r7 = 4"] = GadgetFunction::MOV_R2_ZERO_R7_FOUR;
-    name_to_enum_map["r0 = 0"] = GadgetFunction::MOV_R0_ZERO;
-    name_to_enum_map["r0 = 0,rt"] = GadgetFunction::MOV_R0_ZERO_RET;
-    name_to_enum_map["r0 = 1,rt"] = GadgetFunction::MOV_R0_ONE_RET;
-    name_to_enum_map["r0 = 0,pop er2"] = GadgetFunction::MOV_R0_ZERO_POP_ER2;
-    name_to_enum_map["r1 = 0,rt"] = GadgetFunction::MOV_R1_ZERO_RET;
-    name_to_enum_map["r5 = 0,rt"] = GadgetFunction::MOV_R5_ZERO_RET;
-    name_to_enum_map["er14 = er0,pop xr0"] = GadgetFunction::MOV_ER14_ER0_POP_XR0;
-    name_to_enum_map["er0 = er12,pop er12,rt"] = GadgetFunction::MOV_ER0_ER12_POP_ER12_RET;
-    name_to_enum_map["er10 = er2,rt"] = GadgetFunction::MOV_ER10_ER2_RET;
-    name_to_enum_map["er0 = er10,pop xr8"] = GadgetFunction::MOV_ER0_ER10_POP_XR8;
-    name_to_enum_map["er0 = 1,rt"] = GadgetFunction::MOV_ER0_ONE_RET;
-    name_to_enum_map["er2 = 0,er4 = 0,er6 = 0,er8 = 1,rt"] = GadgetFunction::MOV_ER2_ZERO_ER4_ZERO_ER6_ZERO_ER8_ONE_RET;
-    name_to_enum_map["er2 = 0,r0 = 2,[er8]=er2,pop xr8"] = GadgetFunction::MOV_ER2_ZERO_R0_TWO_STORE_ER8_ER2_POP_XR8;
-    name_to_enum_map["er2 = 1,r0 = r2,rt"] = GadgetFunction::MOV_ER2_ONE_R0_ER2_RET;
-    name_to_enum_map["r0 = 0,[er8]+=er2,pop xr8"] = GadgetFunction::MOV_R0_ZERO_STORE_ER8_ER2_POP_XR8;
-    name_to_enum_map["r2 = 1,r0 = r2,pop er4,pop er8,rt"] = GadgetFunction::MOV_R2_ONE_R0_R2_POP_ER4_POP_ER8_RET;
-    name_to_enum_map["r0 = r1,rt"] = GadgetFunction::MOV_R0_R1_RET;
-
-
-    // Store (ST) gadgets
-    name_to_enum_map["[er2]=er0,r2 = 0,pop er4,rt"] = GadgetFunction::STORE_ER2_ER0_R2_ZERO_POP_ER4_RET;
-    name_to_enum_map["[er0]=er2,rt"] = GadgetFunction::STORE_ER0_ER2_RET;
-    name_to_enum_map["[er0]=r2,rt"] = GadgetFunction::STORE_ER0_R2_RET;
-    name_to_enum_map["[er0]=r2"] = GadgetFunction::STORE_ER0_R2;
-    name_to_enum_map["[er2]=r0,r2 = 0"] = GadgetFunction::STORE_ER2_R0_R2_ZERO;
-    name_to_enum_map["[er8]=er2,pop xr8"] = GadgetFunction::STORE_ER8_ER2_POP_XR8;
-    name_to_enum_map["[er4]=er0,pop er0,rt"] = GadgetFunction::STORE_ER4_ER0_POP_ER0_RET;
-    name_to_enum_map["[ea]=qr0"] = GadgetFunction::STORE_EA_QR0;
-    name_to_enum_map["[er12]=er14,pop xr4,pop qr8"] = GadgetFunction::STORE_ER12_ER14_POP_XR4_POP_QR8;
-
-    // Load (L) gadgets
-    name_to_enum_map["er4=[er8],pop er8,rt"] = GadgetFunction::LOAD_ER4_FROM_ER8_POP_ER8_RET;
-    name_to_enum_map["er0=[er2],r2 = 9,rt"] = GadgetFunction::LOAD_ER0_FROM_ER2_R2_NINE_RET;
-    name_to_enum_map["er8=[er0],rt"] = GadgetFunction::LOAD_ER8_FROM_ER0_RET;
-    name_to_enum_map["r0=[er2]"] = GadgetFunction::LOAD_R0_FROM_ER2;
-    name_to_enum_map["r0=[er0]"] = GadgetFunction::LOAD_R0_FROM_ER0;
-    name_to_enum_map["er0=[er0],pop xr8,rt"] = GadgetFunction::LOAD_ER0_FROM_ER0_POP_XR8_RET;
-    name_to_enum_map["r0=[ea],rt"] = GadgetFunction::LOAD_R0_FROM_EA_RET;
-    name_to_enum_map["sp=[er8],pop er8"] = GadgetFunction::LOAD_SP_FROM_ER8_POP_ER8;
-    name_to_enum_map["qr0=[ea],lea D002H,[ea]=qr0"] = GadgetFunction::LOAD_QR0_FROM_EA_LEA_D002H_EA_QR0;
-
-    // Subtract (SUB) gadgets
-    name_to_enum_map["er0-=er2,rt"] = GadgetFunction::SUB_ER0_ER2_RET;
-    name_to_enum_map["er0-=er12,pop er8,pop er12,rt"] = GadgetFunction::SUB_ER0_ER12_POP_ER8_POP_ER12_RET;
-    name_to_enum_map["r0-=1,rt"] = GadgetFunction::SUB_R0_ONE_RET;
-    name_to_enum_map["r0-=r8,pop er8,rt"] = GadgetFunction::SUB_R0_R8_POP_ER8_RET;
-
-    // OR gadgets
-    name_to_enum_map["or r0,r1"] = GadgetFunction::OR_R0_R1;
-    name_to_enum_map["or qr0,qr8"] = GadgetFunction::OR_QR0_QR8;
-
-    // Shift gadgets
-    name_to_enum_map["r0 >> 4,rt"] = GadgetFunction::SRL_R0_4_RET;
-    name_to_enum_map["qr0 >> 4,rt"] = GadgetFunction::SRL_QR0_4_RET;
-    name_to_enum_map["r0 << 4,rt"] = GadgetFunction::SLL_R0_4_RET;
-    name_to_enum_map["r1 << 4,rt"] = GadgetFunction::SLL_R1_4_RET;
-    name_to_enum_map["er0 << 4,rt"] = GadgetFunction::SLL_ER0_4_RET;
-    name_to_enum_map["xr0 << 4,rt"] = GadgetFunction::SLL_XR0_4_RET;
-    name_to_enum_map["qr0 << 4,rt"] = GadgetFunction::SLL_QR0_4_RET;
-
-    // Compare (CMP) gadgets
-    name_to_enum_map["er0 - er2_gt,r0 = 0 |r0 = 1,rt"] = GadgetFunction::CMP_ER0_ER2_GT_R0_ZERO_OR_ONE_RET;
-    name_to_enum_map["er0 - er2_eq,r0 = 1,rt"] = GadgetFunction::CMP_ER0_ER2_EQ_R0_ONE_RET;
-    name_to_enum_map["er2 - er0_gt,r0 = 0 |r0 = 1,rt"] = GadgetFunction::CMP_ER2_ER0_GT_R0_ZERO_OR_ONE_RET;
-    name_to_enum_map["er0 - er2_le,er0 = er2,rt"] = GadgetFunction::CMP_ER0_ER2_LE_ER0_ER2_RET;
-    name_to_enum_map["er8 - er0_lt,pop xr8"] = GadgetFunction::CMP_ER8_ER0_LT_POP_XR8;
-    name_to_enum_map["r0 - 0_lt,rt"] = GadgetFunction::CMP_R0_ZERO_LT_RET;
-    name_to_enum_map["r1 - 0_lt,rt"] = GadgetFunction::CMP_R1_ZERO_LT_RET;
-
-    // Multiply (MUL) gadgets
-    name_to_enum_map["er0*=r2,er2 = er0,er0+=er4,rt"] = GadgetFunction::MUL_ER0_R2_ER2_ER0_ADD_ER0_ER4_RET;
-    name_to_enum_map["er0*=r2,er0+=er6,er10 = er0,rt"] = GadgetFunction::MUL_ER0_R2_ADD_ER0_ER6_ER10_ER0_RET;
-
-    // Divide (DIV) gadgets
-    name_to_enum_map["er0/=r2,rt"] = GadgetFunction::DIV_ER0_R2_RET;
-
-    // BRK gadget
-    name_to_enum_map["break"] = GadgetFunction::BRK;
-
-    // Other gadgets
-    name_to_enum_map["[ea]+=1,r0=3"] = GadgetFunction::INC_EA_R0_THREE;
-    name_to_enum_map["[ea]-=1,pop xr4"] = GadgetFunction::DEC_EA_POP_XR4;
-    name_to_enum_map["B LEAVE"] = GadgetFunction::B_LEAVE;
-    name_to_enum_map["calc_checksum_set_f004"] = GadgetFunction::CALC_CHECKSUM_SET_F004;
-    name_to_enum_map["calc_checksum_no_set_f004"] = GadgetFunction::CALC_CHECKSUM_NO_SET_F004;
-    name_to_enum_map["calc_checksum_0"] = GadgetFunction::CALC_CHECKSUM_0;
-    name_to_enum_map["calc_checksum_1"] = GadgetFunction::CALC_CHECKSUM_1;
-    name_to_enum_map["calc_checksum_2"] = GadgetFunction::CALC_CHECKSUM_2;
-    name_to_enum_map["calc_checksum_3"] = GadgetFunction::CALC_CHECKSUM_3;
-    name_to_enum_map["pr_checksum"] = GadgetFunction::PR_CHECKSUM;
-    name_to_enum_map["[er8]+=er2,pop xr8"] = GadgetFunction::ADD_ER8_ER2_POP_XR8;
-
-
-    // BL gadgets (Function calls)
-    name_to_enum_map["BL memcpy,pop er0"] = GadgetFunction::BL_MEMCPY_POP_ER0;
-    name_to_enum_map["BL strcpy"] = GadgetFunction::BL_STRCPY;
-    name_to_enum_map["BL strcat"] = GadgetFunction::BL_STRCAT;
-    name_to_enum_map["BL memset,pop er2"] = GadgetFunction::BL_MEMSET_POP_ER2;
-    name_to_enum_map["BL delay,pop xr0"] = GadgetFunction::BL_DELAY_POP_XR0;
-    name_to_enum_map["BL line_print"] = GadgetFunction::BL_LINE_PRINT;
-    name_to_enum_map["BL printline"] = GadgetFunction::BL_PRINTLINE;
-    name_to_enum_map["BL hex_byte,er6 = er0,er0 = er8,pop qr8"] = GadgetFunction::BL_HEX_BYTE_ER6_ER0_ER0_ER8_POP_QR8;
-    name_to_enum_map["BL smart_strcpy,pop er8"] = GadgetFunction::BL_SMART_STRCPY_POP_ER8;
-    name_to_enum_map["BL zero_KO"] = GadgetFunction::BL_ZERO_KO;
-    name_to_enum_map["BL line_draw"] = GadgetFunction::BL_LINE_DRAW;
-    name_to_enum_map["BL render.ddd4"] = GadgetFunction::BL_RENDER_DDD4;
-}
-
-
-void GadgetDB::loadFromFile(const std::string& filepath) {
+RomHandle GadgetDB::loadFromFile(const std::string& filepath, const std::string& model_name) {
     std::ifstream file(filepath);
     if (!file.is_open()) {
         throw std::runtime_error("Không thể mở file gadget: " + filepath);
     }
 
+    std::vector<std::pair<GadgetFunction, unsigned int>> entries;
+
     std::string line;
     while (std::getline(file, line)) {
-        // Skip empty lines
-        if (line.empty()) continue;
-
-        std::stringstream ss(line);
-        std::string addr_str;
-        std::string func_str_raw;
+        std::string_view rest(line);
+        // Skip empty lines and '#' comment lines
+        size_t first_non_space = rest.find_first_not_of(" \t\r");
+        if (first_non_space == std::string_view::npos || rest[first_non_space] == '#') continue;
+        rest.remove_prefix(first_non_space);
+        while (!rest.empty() && (rest.back() == '\r' || rest.back() == ' ' || rest.back() == '\t')) {
+            rest.remove_suffix(1); // CRLF files, trailing spaces
+        }
 
         // Read address (hex string)
-        ss >> addr_str;
-        if (addr_str.empty()) continue; // Should not happen after empty line check, but good for robustness
-
-        // Read the rest of the line as the function string
-        std::getline(ss, func_str_raw);
-        // Remove leading whitespace from func_str_raw
-        size_t first_char = func_str_raw.find_first_not_of(" \t");
-        if (std::string::npos != first_char) {
-            func_str_raw = func_str_raw.substr(first_char);
+        size_t addr_end = rest.find_first_of(" \t");
+        std::string_view addr_str = rest.substr(0, addr_end);
+        unsigned int addr = 0;
+        for (char c : addr_str) {
+            int digit = isxdigit(static_cast<unsigned char>(c))
+                ? (isdigit(static_cast<unsigned char>(c)) ? c - '0' : (tolower(static_cast<unsigned char>(c)) - 'a' + 10))
+                : -1;
+            if (digit < 0) {
+                throw std::runtime_error("Lỗi: Địa chỉ gadget không hợp lệ '" + std::string(addr_str) + "' trong " + filepath);
+            }
+            addr = addr * 16 + static_cast<unsigned int>(digit);
         }
 
-        unsigned int addr = std::stoul(addr_str, nullptr, 16);
+        // The rest of the line is the function string
+        std::string_view func_str;
+        if (addr_end != std::string_view::npos) {
+            func_str = rest.substr(addr_end);
+            func_str.remove_prefix(std::min(func_str.size(), func_str.find_first_not_of(" \t")));
+        }
 
-        // Find in the map that converts string names to enum
-        auto it = name_to_enum_map.find(func_str_raw);
-        if (it != name_to_enum_map.end()) {
-            gadget_address_map[it->second] = addr; // Assign the address to the corresponding enum
+        // One perfect-hash probe + one compare (see GadgetFunction.h)
+        GadgetFunction func = lookupGadget(func_str);
+        if (func != GadgetFunction::UNKNOWN_GADGET) {
+            entries.emplace_back(func, addr); // Keep every candidate address for this function
         } else {
             // It's good to keep this warning during development to catch unmapped gadgets.
-            // You can comment it out once all gadgets are mapped.
-            std::cerr << "Cảnh báo: Chức năng gadget không xác định trong file hoặc chưa được ánh xạ trong GadgetDB constructor: '"
-                      << func_str_raw << "' (Địa chỉ: 0x" << std::hex << addr << std::dec << ")" << std::endl;
+            std::cerr << "Cảnh báo: Chức năng gadget không xác định trong file hoặc chưa có trong GadgetTable.def: '"
+                      << func_str << "' (Địa chỉ: 0x" << std::hex << addr << std::dec << ")" << std::endl;
+        }
+    }
+    RomModel model = buildModel(model_name.empty() ? filepath : model_name, std::move(entries));
+    std::cout << "Đã tải " << model.candidates.size() << " gadget (" << model.available.count()
+              << " chức năng) cho ROM '" << model.name << "'." << std::endl;
+    models.push_back(std::move(model));
+    return static_cast<RomHandle>(models.size() - 1);
+}
+
+RomHandle GadgetDB::loadFromImage(const std::string& filepath, const std::string& model_name) {
+    GadgetImage image(filepath);
+    std::vector<std::pair<GadgetFunction, unsigned int>> entries;
+    entries.reserve(image.size());
+    // Ảnh lưu số thứ tự enum: nếu GadgetTable.def đã đổi kể từ khi chạy gadgetc thì từ chối
+    for (size_t i = 0; i < image.size(); ++i) {
+        GadgetFunction func = static_cast<GadgetFunction>(image.entry(i).function);
+        if (gadgetSpelling(func) != image.name(i)) {
+            throw std::runtime_error("Lỗi: Ảnh gadget '" + filepath + "' không khớp GadgetTable.def ('" +
+                                     std::string(image.name(i)) + "'), hãy chạy lại gadgetc.");
+        }
+        entries.emplace_back(func, image.entry(i).address);
+    }
+    RomModel model = buildModel(model_name.empty() ? filepath : model_name, std::move(entries));
+    std::cout << "Đã nạp ảnh gadget: " << model.candidates.size() << " gadget cho ROM '" << model.name << "'." << std::endl;
+    models.push_back(std::move(model));
+    return static_cast<RomHandle>(models.size() - 1);
+}
+
+void GadgetDB::loadSuperoptTable(RomHandle rom, const std::string& filepath) {
+    RomModel& m = models.at(rom);
+    std::ifstream file(filepath);
+    if (!file.is_open()) {
+        throw std::runtime_error("Không thể mở bảng superopt: " + filepath);
+    }
+    std::vector<SuperoptEntry> entries = parseSuperoptTable(file, filepath);
+    size_t skipped = 0;
+    m.superopt.clear();
+    for (SuperoptEntry& entry : entries) {
+        bool available = std::all_of(entry.gadgets.begin(), entry.gadgets.end(),
+                                     [&m](GadgetFunction f) { return m.available.test(static_cast<size_t>(f)); });
+        if (available) {
+            m.superopt.push_back(std::move(entry));
+        } else {
+            skipped++;
+        }
+    }
+    if (skipped > 0) {
+        std::cerr << "Cảnh báo: " << skipped << " dãy trong bảng superopt '" << filepath
+                  << "' dùng gadget mà ROM '" << m.name << "' không có, đã bỏ qua." << std::endl;
+    }
+    std::cout << "Đã tải " << m.superopt.size() << " dãy superopt cho ROM '" << m.name << "'." << std::endl;
+}
+
+std::vector<GadgetImage::Record> GadgetDB::toImageRecords(RomHandle rom) const {
+    const RomModel& m = models.at(rom);
+    std::vector<GadgetImage::Record> records;
+    for (size_t i = 1; i < kGadgetFunctionCount; ++i) {
+        GadgetFunction func = static_cast<GadgetFunction>(i);
+        for (const GadgetCandidate* c = m.candidatesBegin(func); c != m.candidatesEnd(func); ++c) {
+            records.push_back(GadgetImage::Record{static_cast<uint16_t>(i), c->address, std::string(gadgetSpelling(func))});
+        }
+    }
+    return records;
+}
+
+RomModel GadgetDB::buildModel(std::string name, std::vector<std::pair<GadgetFunction, unsigned int>> entries) {
+    RomModel model;
+    model.name = std::move(name);
+    GadgetEffectTable::instance(); // Dựng bảng tác động ngay lúc nạp để lỗi mô tả lộ ra sớm
+    // Stable: giữ thứ tự xuất hiện trong file, ứng viên đầu tiên là ứng viên được dùng
+    std::stable_sort(entries.begin(), entries.end(),
+                     [](const auto& a, const auto& b) { return a.first < b.first; });
+
+    model.candidates.reserve(entries.size());
+    size_t next = 0;
+    for (size_t f = 0; f < kGadgetFunctionCount; ++f) {
+        model.first[f] = static_cast<uint32_t>(model.candidates.size());
+        GadgetFunction func = static_cast<GadgetFunction>(f);
+        for (; next < entries.size() && entries[next].first == func; ++next) {
+            unsigned int address = entries[next].second;
+            model.candidates.push_back(GadgetCandidate{address, static_cast<uint8_t>(address >> 16), gadgetPopWords(func)});
+        }
+        if (model.candidates.size() > model.first[f]) {
+            model.addresses[f] = model.candidates[model.first[f]].address;
+            model.available.set(f);
         }
     }
-    std::cout << "Đã tải " << gadget_address_map.size() << " gadget." << std::endl;
+    model.first[kGadgetFunctionCount] = static_cast<uint32_t>(model.candidates.size());
+    return model;
 }
 
-unsigned int GadgetDB::getAddress(GadgetFunction func) const {
-    auto it = gadget_address_map.find(func);
-    if (it != gadget_address_map.end()) {
-        return it->second;
+const GadgetCandidate* GadgetDB::selectCandidate(RomHandle rom, GadgetFunction func, const ByteConstraints& constraints) const {
+    const RomModel& m = models[rom];
+    for (const GadgetCandidate* c = m.candidatesBegin(func); c != m.candidatesEnd(func); ++c) {
+        if (constraints.allows(*c)) return c;
     }
-    // Convert enum to string for better error message if possible, or just print int value
-    throw std::runtime_error("Lỗi: Không tìm thấy địa chỉ cho gadget chức năng: " + std::to_string(static_cast<int>(func)));
+    return nullptr;
+}
+
+RomHandle GadgetDB::findModel(std::string_view name) const {
+    for (size_t i = 0; i < models.size(); ++i) {
+        if (models[i].name == name) {
+            return static_cast<RomHandle>(i);
+        }
+    }
+    return kNoRom;
+}
+
+void GadgetDB::throwMissing(const RomModel& model, GadgetFunction func) {
+    throw std::runtime_error("Lỗi: ROM '" + model.name + "' không có gadget '" + std::string(gadgetSpelling(func)) +
+                             "' (" + std::to_string(static_cast<int>(func)) + ").");
 }
 
 // --- ROPGenerator Implementation ---
-ROPGenerator::ROPGenerator(const GadgetDB& db, const SymbolTable& sym_table)
-    : gadget_db(db), symbol_table(sym_table) {}
+ROPGenerator::ROPGenerator(const GadgetDB& db, const SymbolTable& sym_table, RomHandle rom)
+    : gadget_db(db), symbol_table(sym_table), rom(rom) {
+    if (rom >= db.modelCount()) {
+        throw std::runtime_error("Lỗi: RomHandle không hợp lệ: " + std::to_string(rom));
+    }
+}
 
-std::vector<unsigned int> ROPGenerator::generateROPChain(const ProgramNode& program_node) {
-    rop_chain.clear(); // Clear previous chain
+const std::vector<unsigned int>& ROPGenerator::generateROPChain(const AstArena& arena) {
+    buildChain(arena);
+    resolveChain();
+    return rop_chain;
+}
+
+size_t ROPGenerator::emitPayload(const AstArena& arena, std::vector<uint8_t>& out) {
+    buildChain(arena);
+    size_t start = out.size();
+    size_t bytes = chainBytes(symbolic_chain);
+    out.resize(start + bytes);
+    writePayload(out.data() + start);
+    return bytes;
+}
+
+size_t ROPGenerator::emitPayload(const AstArena& arena, uint8_t* buffer, size_t capacity) {
+    buildChain(arena);
+    size_t bytes = chainBytes(symbolic_chain);
+    if (bytes > capacity) {
+        throw std::runtime_error("Lỗi: Payload cần " + std::to_string(bytes) + " byte nhưng bộ đệm chỉ có " +
+                                 std::to_string(capacity) + " byte.");
+    }
+    writePayload(buffer);
+    return bytes;
+}
+
+namespace {
+
+// Nhánh IF được chạy khi điều kiện là hằng; kNullNode nếu điều kiện không phải hằng
+NodeId constantArm(const AstArena& ast, NodeId node) {
+    const NodeSlots& s = ast.at(node);
+    if (ast.type(s.a) != NodeType::IntegerLiteral) return kNullNode;
+    return (ast.at(s.a).a & 0xFFFF) != 0 ? s.b : s.c;
+}
+
+// Số REPEAT lồng nhau sâu nhất trong một danh sách câu lệnh (mỗi mức cần một ô đếm)
+uint32_t repeatNesting(const AstArena& ast, const NodeId* begin, const NodeId* end) {
+    uint32_t depth = 0;
+    for (const NodeId* it = begin; it != end; ++it) {
+        NodeType type = ast.type(*it);
+        if (type == NodeType::While || type == NodeType::Repeat) {
+            uint32_t inner = repeatNesting(ast, ast.bodyBegin(*it), ast.bodyEnd(*it));
+            depth = std::max(depth, inner + (type == NodeType::Repeat ? 1 : 0));
+        } else if (type == NodeType::If) {
+            for (NodeId arm : {ast.at(*it).b, ast.at(*it).c}) {
+                NodeId taken = constantArm(ast, *it);
+                if (taken != kNullNode && taken != arm) continue;
+                depth = std::max(depth, repeatNesting(ast, ast.statementsBegin(arm), ast.statementsEnd(arm)));
+            }
+        }
+    }
+    return depth;
+}
+
+// Biểu thức chỉ đọc hằng và các biến chưa được gán trong `assigned`
+bool readsOnly(const AstArena& ast, NodeId expr, const std::vector<uint32_t>& assigned) {
+    const NodeSlots& s = ast.at(expr);
+    switch (ast.type(expr)) {
+        case NodeType::IntegerLiteral:
+            return true;
+        case NodeType::Identifier:
+            return std::find(assigned.begin(), assigned.end(), s.a) == assigned.end();
+        case NodeType::BinaryOp:
+            return readsOnly(ast, s.a, assigned) && readsOnly(ast, s.b, assigned);
+        default:
+            return false; // Đọc RAM theo địa chỉ tính được: để nguyên lối rẽ nhánh
+    }
+}
+
+// Phép gán cho biến `var` trong một nhánh IF, kNullNode nếu nhánh không gán nó
+NodeId armAssignment(const AstArena& ast, NodeId arm, uint32_t var) {
+    for (const NodeId* it = ast.statementsBegin(arm); it != ast.statementsEnd(arm); ++it) {
+        if (ast.at(*it).a == var) return *it;
+    }
+    return kNullNode;
+}
 
-    for (const auto& statement : program_node.statements) {
-        generateForNode(*statement);
+// Số biến tối đa của một IF chọn không rẽ nhánh: mỗi biến cần 2 ô và một lần chép qua con trỏ
+constexpr size_t kMaxPickedVariables = 2;
+
+uint32_t pickSlotCount(size_t vars) {
+    return static_cast<uint32_t>(2 * vars + (vars > 1 ? 1 : 0));
+}
+
+} // namespace
+
+void ROPGenerator::buildChain(const AstArena& arena) {
+    ast = &arena;
+    rop_chain.clear(); // Clear previous chain
+    symbolic_chain.clear();
+    label_count = 0;
+    repeat_depth = 0;
+    counter_slots = repeatNesting(arena, arena.statementsBegin(arena.root), arena.statementsEnd(arena.root));
+    subroutines.clear();
+    called_subroutines.clear();
+    uint32_t save_slots = 0;
+    for (const NodeId* it = arena.statementsBegin(arena.root); it != arena.statementsEnd(arena.root); ++it) {
+        if (arena.type(*it) != NodeType::Sub) continue;
+        Subroutine& sub = subroutines[*it];
+        sub.counter_base = counter_slots;
+        sub.save_slot = save_slots++;
+        counter_slots += repeatNesting(arena, arena.bodyBegin(*it), arena.bodyEnd(*it));
     }
+    pick_slots = pickSlotsNeeded(arena.statementsBegin(arena.root), arena.statementsEnd(arena.root));
+    for (auto& [node, sub] : subroutines) sub.save_slot += counter_slots + pick_slots;
+    // Bộ chọn gadget dựng theo ROM + ràng buộc byte hiện tại (luật thiếu gadget bị tắt).
+    // Ô spill của nó nằm sau các ô đếm của REPEAT, các ô của IF chọn không rẽ nhánh và các ô cất er14.
+    selector = std::make_unique<InstructionSelector>(gadget_db, rom, byte_constraints, symbol_table,
+                                                     spillSlotAddress(counter_slots + pick_slots + save_slots));
+    // Biến nào còn được đọc về sau: bộ chọn tránh phá các thanh ghi đang giữ chúng
+    liveness.build(arena, symbol_table);
+    selector->setLiveness(&liveness);
+
+    planBulkStores(arena);
+
+    statement_position = 0;
+    generateStatements(arena.statementsBegin(arena.root), arena.statementsEnd(arena.root), true);
+    current_statement = kNullNode;
 
     // End the ROP chain with a breakpoint (BRK) for easier debugging
     pushGadget(GadgetFunction::BRK);
+    generateSubroutines();
+    current_statement = kNullNode;
 
-    return rop_chain;
+    peephole_stats = PeepholeStats{};
+    filler_stats = FillerStats{};
+    if (optimize_chain) {
+        ChainOptimizer peephole(gadget_db, rom, byte_constraints);
+        uint32_t before = chainBytes(symbolic_chain);
+        peephole.run(symbolic_chain);
+        // Ô pop đệm mang được hằng cho các pop phía sau; gadget bị bỏ có thể mở thêm cửa sổ peephole
+        reuseFillerSlots(symbolic_chain, filler_stats);
+        if (filler_stats.gadgets_removed > 0) {
+            peephole.run(symbolic_chain);
+        }
+        peephole_stats = peephole.stats();
+        for (const PeepholeRuleStats& r : peephole_stats.rules) {
+            if (r.hits > 0) {
+                std::cout << "DEBUG: Peephole '" << r.name << "': " << r.hits << " lần, -" << r.bytes_saved << " byte" << std::endl;
+            }
+        }
+        std::cout << "DEBUG: Peephole: " << before << " -> " << chainBytes(symbolic_chain) << " byte sau "
+                  << peephole_stats.passes << " lượt (" << peephole.activeRuleCount() << " luật)" << std::endl;
+        std::cout << "DEBUG: Ô đệm: " << filler_stats.slots_reused << " ô mang dữ liệu, bỏ "
+                  << filler_stats.gadgets_removed << " gadget pop, -" << filler_stats.bytes_reclaimed << " byte" << std::endl;
+    }
+    outline_stats = OutlineStats{};
+    if (optimize_chain && payload_address != 0) {
+        // Chạy sau cùng: các pass trên không dời được gì qua nhãn của lệnh gọi
+        outlineRepeatedFragments(symbolic_chain, gadget_db, rom, byte_constraints, label_count, outline_stats);
+        std::cout << "DEBUG: Tách chương trình con: " << outline_stats.subroutines << " thân, "
+                  << outline_stats.call_sites << " lệnh gọi, -" << outline_stats.bytes_saved << " byte" << std::endl;
+    }
+
+    appendDataBlocks();
+    resolveLabels();
+    buildSourceMap();
+}
+
+void ROPGenerator::generateStatements(const NodeId* begin, const NodeId* end, bool top_level) {
+    previous_statement = kNullNode;
+    for (const NodeId* it = begin; it != end; ++it) {
+        current_statement = *it;
+        auto bulk = std::lower_bound(bulk_stores.begin(), bulk_stores.end(), *it,
+                                     [](const BulkStore& b, NodeId id) { return b.statement < id; });
+        for (; bulk != bulk_stores.end() && bulk->statement == *it; ++bulk) {
+            emitBulkStore(*bulk);
+        }
+        if (!covered[*it]) {
+            generateForNode(*it);
+        }
+        previous_statement = *it;
+        if (top_level) statement_position++;
+    }
+}
+
+void ROPGenerator::buildSourceMap() {
+    source_map.clear();
+    uint32_t offset = 0;
+    for (const ChainEntry& e : symbolic_chain) {
+        if (e.kind == ChainEntry::Kind::Label) continue;
+        uint32_t size = e.kind == ChainEntry::Kind::Gadget ? 4 : 2;
+        if (!source_map.empty() && source_map.back().statement == e.statement) {
+            source_map.back().size += size;
+        } else {
+            int line = e.statement != ChainEntry::kNoStatement ? ast->lines[e.statement] : 0;
+            source_map.push_back(SourceMapEntry{offset, size, e.statement, line});
+        }
+        offset += size;
+    }
 }
 
-void ROPGenerator::generateForNode(const ASTNode& node) {
-    switch (node.type) {
-        case ASTNode::NodeType::VarDeclaration:
-            generateForVarDeclaration(static_cast<const VarDeclarationNode&>(node));
+void ROPGenerator::generateForNode(NodeId node) {
+    switch (ast->type(node)) {
+        case NodeType::VarDeclaration:
+            generateForVarDeclaration(node);
+            break;
+        case NodeType::Assignment:
+            generateForAssignment(node);
+            break;
+        case NodeType::MemWrite:
+            generateForMemWrite(node);
+            break;
+        case NodeType::PrintChar:
+            generateForPrintChar(node);
             break;
-        case ASTNode::NodeType::Assignment:
-            generateForAssignment(static_cast<const AssignmentNode&>(node));
+        case NodeType::While:
+        case NodeType::Repeat:
+            generateForLoop(node);
             break;
-        case ASTNode::NodeType::MemWrite:
-            generateForMemWrite(static_cast<const MemWriteNode&>(node));
+        case NodeType::If:
+            generateForIf(node);
             break;
-        case ASTNode::NodeType::PrintChar:
-            generateForPrintChar(static_cast<const PrintCharNode&>(node));
+        case NodeType::Sub:
+            // Thân được sinh sau BRK, ở lần gọi đầu tiên (xem generateSubroutines)
+            std::cout << "DEBUG: Định nghĩa SUB tại dòng " << ast->lines[node] << std::endl;
+            break;
+        case NodeType::Call:
+            generateForCall(node);
             break;
         // Add more cases for other statement types as you implement them
         default:
-            throw std::runtime_error("Lỗi: Loại ASTNode không được hỗ trợ trong ROP generation.");
+            throw std::runtime_error("Lỗi: Loại node không được hỗ trợ trong ROP generation.");
     }
 }
 
-void ROPGenerator::generateForVarDeclaration(const VarDeclarationNode& node) {
+void ROPGenerator::generateForVarDeclaration(NodeId node) {
     // Variable declarations in FxLaux primarily update the symbol table.
     // No direct ROP gadgets are generated for declaration itself.
-    std::cout << "DEBUG: Xử lý khai báo biến: " << node.var_name << std::endl;
+    const SymbolInfo* sym = symbol_table.get_symbol(ast->at(node).a);
+    std::cout << "DEBUG: Xử lý khai báo biến: " << (sym ? sym->name : "?") << std::endl;
 }
 
-void ROPGenerator::generateForAssignment(const AssignmentNode& node) {
-    const SymbolInfo* sym = symbol_table.get_symbol(node.var_name);
+void ROPGenerator::generateForAssignment(NodeId node) {
+    const SymbolInfo* sym = symbol_table.get_symbol(ast->at(node).a);
     if (!sym) {
         // This check should ideally be done in semantic analysis phase (Parser),
         // but keeping it here for robustness during ROP generation.
-        throw std::runtime_error("Lỗi: Biến '" + node.var_name + "' chưa khai báo.");
+        throw std::runtime_error("Lỗi: Biến #" + std::to_string(ast->at(node).a) + " chưa khai báo.");
+    }
+    SelectionCost cost = selectStatement(node);
+    std::cout << "DEBUG: Sinh mã gán: " << sym->name << " = expr (địa chỉ 0x"
+              << std::hex << sym->address << std::dec << ", " << cost.bytes << " byte)" << std::endl;
+}
+
+void ROPGenerator::generateForMemWrite(NodeId node) {
+    SelectionCost cost = selectStatement(node);
+    std::cout << "DEBUG: Sinh mã ghi bộ nhớ: [expr_addr] = expr_val (" << cost.bytes << " byte)" << std::endl;
+}
+
+void ROPGenerator::generateForPrintChar(NodeId node) {
+    // VRAM: mỗi dòng 0x10 byte, mỗi ký tự 1 byte
+    // VRAM_Addr = (line - 1) * 0x10 + column; xem InstructionSelector::lowerStatement
+    SelectionCost cost = selectStatement(node);
+    std::cout << "DEBUG: Sinh mã PRINT_CHAR (" << cost.bytes << " byte)" << std::endl;
+}
+
+namespace {
+
+// Số byte ngay dưới SP mà một hàm ROM gọi qua gadget BL ghi đè (đẩy LR và thanh ghi
+// vào stack). Giả định 8 byte: 4 byte của chính gadget BL và 4 byte trước nó trong chuỗi.
+// Khôi phục bằng [ea]=qr0 nên phải là bội của 8.
+constexpr int kCallStackBytes = 8;
+static_assert(kCallStackBytes % 8 == 0, "Vùng khôi phục được ghi theo từng 8 byte");
+
+} // namespace
+
+void ROPGenerator::generateForLoop(NodeId node) {
+    const NodeSlots s = ast->at(node);
+    bool repeat = ast->type(node) == NodeType::Repeat;
+    if (payload_address == 0) {
+        throw std::runtime_error("Lỗi: Vòng lặp tại dòng " + std::to_string(ast->lines[node]) +
+                                 " cần địa chỉ payload khi chạy (setPayloadAddress) để tính đích nhảy.");
+    }
+    NodeId previous = previous_statement;
+    uint32_t start = chainBytes(symbolic_chain);
+    uint32_t counter = repeat ? spillSlotAddress(repeat_depth) : 0;
+
+    // Bảng nhảy {thoát, thân}: lệnh nhảy chọn word theo (giá trị != 0)
+    uint32_t body_label = newLabel();
+    uint32_t exit_label = newLabel();
+    // WHILE tính điều kiện thành 0/1; với <=, >=, == giá trị là phủ định nên đổi chỗ hai đích
+    bool negated = !repeat && InstructionSelector::negatedCondition(*ast, s.a);
+    uint32_t table = static_cast<uint32_t>(data_blocks.size());
+    data_blocks.push_back(negated ? DataBlock{{}, {body_label, exit_label}} : DataBlock{{}, {exit_label, body_label}});
+
+    // Lần đầu chắc chắn vào thân: số lần lặp là hằng khác 0, điều kiện là hằng khác 0, hoặc
+    // câu lệnh ngay trước vừa gán hằng khác 0 cho biến điều kiện
+    bool enters = ast->type(s.a) == NodeType::IntegerLiteral && (ast->at(s.a).a & 0xFFFF) != 0;
+    if (!repeat && !enters && ast->type(s.a) == NodeType::Identifier && previous != kNullNode &&
+        ast->type(previous) == NodeType::Assignment && ast->at(previous).a == ast->at(s.a).a &&
+        ast->type(ast->at(previous).b) == NodeType::IntegerLiteral) {
+        enters = (ast->at(ast->at(previous).b).a & 0xFFFF) != 0;
     }
 
-    // 1. Evaluate the right-hand side expression into ER0.
-    // After this call, ER0 will contain the value to be assigned.
-    evaluateExpressionIntoR0(*node.expression);
+    selected.clear();
+    if (repeat) {
+        selector->selectStoreWord(counter, *ast, s.a, selected, statement_position);
+    }
+    if (enters) {
+        // Chỉ cần chỗ đáp cho lần nhảy về: "pop er8" đọc word đệm ngay sau nhãn
+        pushSelected();
+        pushGadget(GadgetFunction::POP_ER8);
+        pushPad();
+    } else {
+        if (repeat) {
+            selector->selectLoadWord(counter, selected, statement_position);
+        } else {
+            selector->selectCondition(*ast, s.a, selected, statement_position);
+        }
+        selector->selectBranch(table, selected, !repeat);
+        pushSelected();
+    }
+    labelLastWord(body_label);
+    selector->forgetRegisters();
 
-    // 2. Prepare the destination address for the variable.
-    // We need to load the variable's address into a register, say ER1.
-    pushGadget(GadgetFunction::POP_ER1); // Pop the address into ER1
-    pushData(sym->address);
+    size_t body_start = symbolic_chain.size();
+    if (repeat) repeat_depth++;
+    generateStatements(ast->bodyBegin(node), ast->bodyEnd(node), false);
+    if (repeat) repeat_depth--;
+    current_statement = node;
 
-    // 3. Store the value from ER0 into the address in ER1.
-    // We need a gadget that effectively does `[ER1] = ER0`.
-    // Looking at your gadgets: `STORE_ER0_ER2_RET` is `[er0]=er2,rt`.
-    // This means we need ER0 to hold the destination address and ER2 to hold the value.
-    // Current state: ER0 (value), ER1 (address).
-    // So, we need to swap/move them.
-    pushGadget(GadgetFunction::MOV_ER2_ER0_RET); // ER2 = ER0 (Move value to ER2)
-    pushGadget(GadgetFunction::MOV_ER0_ER1_RET); // ER0 = ER1 (Move address to ER0)
-    pushGadget(GadgetFunction::STORE_ER0_ER2_RET); // Now: [ER0 (address)] = ER2 (value)
+    uint32_t calls = restoreCallWindows(body_start);
+    selected.clear();
+    if (repeat) {
+        selector->selectDecrementWord(counter, selected, statement_position);
+        selector->selectLoadWord(counter, selected, statement_position);
+    } else {
+        selector->selectCondition(*ast, s.a, selected, statement_position);
+    }
+    selector->selectBranch(table, selected, !repeat);
+    pushSelected();
+    labelLastWord(exit_label);
+    selector->forgetRegisters();
 
-    std::cout << "DEBUG: Sinh mã gán: " << node.var_name << " = expr (địa chỉ 0x"
-              << std::hex << sym->address << std::dec << ")" << std::endl;
+    std::cout << "DEBUG: Sinh mã " << (repeat ? "REPEAT" : "WHILE") << " (" << chainBytes(symbolic_chain) - start
+              << " byte kể cả thân" << (enters ? ", bỏ kiểm tra lần đầu" : "") << ", khôi phục sau " << calls
+              << " lời gọi hàm ROM)" << std::endl;
 }
 
-void ROPGenerator::generateForMemWrite(const MemWriteNode& node) {
-    // 1. Evaluate the value to be written into ER0.
-    evaluateExpressionIntoR0(*node.value_expr); // Value will be in ER0
-    pushGadget(GadgetFunction::MOV_ER2_ER0_RET); // Move value to ER2 (temporary storage)
+void ROPGenerator::generateForIf(NodeId node) {
+    const NodeSlots s = ast->at(node);
+    uint32_t start = chainBytes(symbolic_chain);
+    NodeId taken = constantArm(*ast, node);
+    if (taken != kNullNode) {
+        // Điều kiện hằng (khi không chạy AstOptimizer): chỉ sinh nhánh được chạy
+        generateStatements(ast->statementsBegin(taken), ast->statementsEnd(taken), false);
+        current_statement = node;
+        std::cout << "DEBUG: Sinh mã IF hằng (" << chainBytes(symbolic_chain) - start << " byte)" << std::endl;
+        return;
+    }
+    bool negated = InstructionSelector::negatedCondition(*ast, s.a);
+
+    std::vector<uint32_t> vars;
+    if (picksIf(node, vars)) {
+        // Ô base + 2 * (j + c * n): nhóm c = 0 giữ giá trị khi điều kiện (chưa đảo) bằng 0
+        uint32_t base = spillSlotAddress(counter_slots);
+        uint32_t n = static_cast<uint32_t>(vars.size());
+        std::vector<uint32_t> dests;
+        for (uint32_t var : vars) dests.push_back(symbol_table.get_symbol(var)->address);
+        for (uint32_t group = 0; group < 2; ++group) {
+            NodeId arm = (group == 1) != negated ? s.b : s.c;
+            for (uint32_t j = 0; j < n; ++j) {
+                uint32_t slot = base + 2 * (j + group * n);
+                NodeId assignment = armAssignment(*ast, arm, vars[j]);
+                selected.clear();
+                if (assignment != kNullNode) {
+                    current_statement = assignment;
+                    selector->selectStoreWord(slot, *ast, ast->at(assignment).b, selected, statement_position);
+                } else {
+                    current_statement = node;
+                    selector->selectCopyWord(slot, dests[j], selected, statement_position);
+                }
+                pushSelected();
+            }
+        }
+        current_statement = node;
+        selected.clear();
+        selector->selectPick(*ast, s.a, dests, base, base + 4 * n, selected, statement_position);
+        pushSelected();
+        selector->forgetRegisters();
+        std::cout << "DEBUG: Sinh mã IF không rẽ nhánh (" << n << " biến, " << chainBytes(symbolic_chain) - start
+                  << " byte)" << std::endl;
+        return;
+    }
 
-    // 2. Evaluate the destination address into ER0.
-    evaluateExpressionIntoR0(*node.address_expr); // Address will be in ER0
+    if (payload_address == 0) {
+        throw std::runtime_error("Lỗi: Lệnh IF tại dòng " + std::to_string(ast->lines[node]) +
+                                 " cần địa chỉ payload khi chạy (setPayloadAddress) để tính đích nhảy.");
+    }
+    // Nhánh đúng rỗng: đảo điều kiện để khỏi cần lệnh nhảy qua nhánh sai
+    NodeId then_arm = s.b, else_arm = s.c;
+    if (ast->at(then_arm).b == 0) {
+        std::swap(then_arm, else_arm);
+        negated = !negated;
+    }
+    bool has_else = ast->at(else_arm).b != 0;
+    uint32_t then_label = newLabel();
+    uint32_t else_label = newLabel();
+    uint32_t end_label = has_else ? newLabel() : else_label;
 
-    // Current state: ER0 (address), ER2 (value to write).
-    // Our target gadget `STORE_ER0_ER2_RET` (`[er0]=er2,rt`) directly supports this.
-    pushGadget(GadgetFunction::STORE_ER0_ER2_RET); // Store ER2 (value) at [ER0 (address)]
+    // Bảng nhảy {sai, đúng}; nhãn đặt ở cuối chuỗi nên đích lùi 2 byte về word mà "pop er8" đọc
+    uint32_t table = static_cast<uint32_t>(data_blocks.size());
+    data_blocks.push_back(DataBlock{{}, {else_label, then_label}, -2});
+    if (negated) std::swap(data_blocks.back().labels[0], data_blocks.back().labels[1]);
+    selected.clear();
+    selector->selectCondition(*ast, s.a, selected, statement_position);
+    selector->selectBranch(table, selected, true);
+    pushSelected();
+    placeLabel(then_label);
 
-    std::cout << "DEBUG: Sinh mã ghi bộ nhớ: [expr_addr] = expr_val" << std::endl;
+    generateStatements(ast->statementsBegin(then_arm), ast->statementsEnd(then_arm), false);
+    current_statement = node;
+    if (has_else) {
+        uint32_t exit = static_cast<uint32_t>(data_blocks.size());
+        data_blocks.push_back(DataBlock{{}, {end_label}, -2});
+        selected.clear();
+        selector->selectJump(exit, selected);
+        pushSelected();
+        placeLabel(else_label);
+        generateStatements(ast->statementsBegin(else_arm), ast->statementsEnd(else_arm), false);
+        current_statement = node;
+    }
+    placeLabel(end_label);
+
+    std::cout << "DEBUG: Sinh mã IF (" << chainBytes(symbolic_chain) - start << " byte kể cả các nhánh"
+              << (has_else ? "" : ", không có nhánh sai") << ")" << std::endl;
 }
 
-void ROPGenerator::generateForPrintChar(const PrintCharNode& node) {
-    // Casio fx-9860G VRAM mapping (example assumptions):
-    // Display starts at 0xD0000.
-    // Each character is 1 byte.
-    // Each line is 0x10 bytes long (16 characters wide).
-    // VRAM_Addr = BASE_VRAM_ADDR + (line - 1) * 0x10 + column_offset
+void ROPGenerator::generateForCall(NodeId node) {
+    if (payload_address == 0) {
+        throw std::runtime_error("Lỗi: Lệnh CALL tại dòng " + std::to_string(ast->lines[node]) +
+                                 " cần địa chỉ payload khi chạy (setPayloadAddress) để tính đích nhảy.");
+    }
+    GadgetFunction missing = GadgetFunction::UNKNOWN_GADGET;
+    if (!subroutinesAvailable(gadget_db, rom, byte_constraints, &missing)) {
+        throw std::runtime_error("Lỗi: ROM '" + gadget_db.model(rom).name + "' không có gadget '" +
+                                 std::string(gadgetSpelling(missing)) + "' cho lệnh CALL.");
+    }
+    Subroutine& sub = subroutines.at(ast->at(node).a);
+    if (!sub.called) {
+        sub.called = true;
+        sub.entry = newLabel();
+        called_subroutines.push_back(ast->at(node).a);
+    }
+    appendCall(symbolic_chain, sub.entry, label_count, current_statement);
+    selector->forgetRegisters(); // Thân SUB có thể phá mọi thanh ghi
+    std::cout << "DEBUG: Sinh mã CALL (" << kCallSequenceBytes << " byte)" << std::endl;
+}
+
+void ROPGenerator::generateSubroutines() {
+    // Thân SUB có thể gọi SUB khác (định nghĩa trước nó): danh sách lớn dần trong lúc duyệt
+    for (size_t i = 0; i < called_subroutines.size(); ++i) {
+        NodeId node = called_subroutines[i];
+        const Subroutine sub = subroutines.at(node);
+        uint32_t start = chainBytes(symbolic_chain);
+        current_statement = node;
+        placeLabel(sub.entry);
+
+        size_t body_start = symbolic_chain.size();
+        repeat_depth = sub.counter_base;
+        generateStatements(ast->bodyBegin(node), ast->bodyEnd(node), false);
+        repeat_depth = 0;
+        current_statement = node;
+        // Thân chạy lại ở mỗi lần gọi: khôi phục chỗ mà lời gọi hàm ROM ghi đè
+        uint32_t calls = restoreCallWindows(body_start);
+
+        // Thân phá er14 (lệnh CALL lồng, hay gadget dùng er14): cất địa chỉ trở về lúc vào,
+        // nạp lại trước khi trở về
+        bool saves = false;
+        for (size_t k = body_start; k < symbolic_chain.size() && !saves; ++k) {
+            const ChainEntry& e = symbolic_chain[k];
+            saves = e.kind == ChainEntry::Kind::Gadget && (gadget_db.effect(e.func).writes & reg::er(14)) != 0;
+        }
+        if (saves) {
+            for (GadgetFunction func : {GadgetFunction::POP_ER12, GadgetFunction::STORE_ER12_ER14_POP_XR4_POP_QR8,
+                                        GadgetFunction::MOV_ER14_ER0_POP_XR0}) {
+                if (!gadget_db.selectCandidate(rom, func, byte_constraints)) {
+                    throw std::runtime_error("Lỗi: ROM '" + gadget_db.model(rom).name + "' không có gadget '" +
+                                             std::string(gadgetSpelling(func)) + "' để cất er14 trong thân SUB tại dòng " +
+                                             std::to_string(ast->lines[node]) + ".");
+                }
+            }
+            std::vector<ChainEntry> prologue{
+                ChainEntry::gadget(GadgetFunction::POP_ER12, node),
+                ChainEntry::data(spillSlotAddress(sub.save_slot), node),
+                ChainEntry::gadget(GadgetFunction::STORE_ER12_ER14_POP_XR4_POP_QR8, node)};
+            prologue.resize(prologue.size() + gadgetPopWords(GadgetFunction::STORE_ER12_ER14_POP_XR4_POP_QR8),
+                            ChainEntry::pad(node));
+            symbolic_chain.insert(symbolic_chain.begin() + static_cast<std::ptrdiff_t>(body_start), prologue.begin(),
+                                  prologue.end());
+            selected.clear();
+            selector->selectLoadWord(spillSlotAddress(sub.save_slot), selected, statement_position);
+            pushSelected();
+            pushGadget(GadgetFunction::MOV_ER14_ER0_POP_XR0);
+            for (unsigned int w = 0; w < gadgetPopWords(GadgetFunction::MOV_ER14_ER0_POP_XR0); ++w) pushPad();
+        }
+        appendReturn(symbolic_chain, current_statement);
+        selector->forgetRegisters();
+
+        std::cout << "DEBUG: Sinh mã thân SUB dòng " << ast->lines[node] << " (" << chainBytes(symbolic_chain) - start
+                  << " byte" << (saves ? ", cất er14" : "") << ", khôi phục sau " << calls << " lời gọi hàm ROM)"
+                  << std::endl;
+    }
+}
+
+bool ROPGenerator::picksIf(NodeId node, std::vector<uint32_t>& vars) const {
+    vars.clear();
+    if (constantArm(*ast, node) != kNullNode) return false;
+    // Hai nhánh chỉ gồm phép gán, mỗi biến tối đa một lần mỗi nhánh, không biểu thức nào đọc
+    // biến đã gán trước nó trong cùng nhánh: tính trước mọi giá trị rồi mới chọn là đúng nghĩa
+    for (NodeId arm : {ast->at(node).b, ast->at(node).c}) {
+        std::vector<uint32_t> assigned;
+        for (const NodeId* it = ast->statementsBegin(arm); it != ast->statementsEnd(arm); ++it) {
+            const NodeSlots& a = ast->at(*it);
+            if (ast->type(*it) != NodeType::Assignment || !symbol_table.get_symbol(a.a)) return false;
+            if (std::find(assigned.begin(), assigned.end(), a.a) != assigned.end()) return false;
+            if (!readsOnly(*ast, a.b, assigned)) return false;
+            assigned.push_back(a.a);
+            if (std::find(vars.begin(), vars.end(), a.a) == vars.end()) vars.push_back(a.a);
+        }
+    }
+    // Rẽ nhánh rẻ hơn khi nhiều biến; không có địa chỉ payload thì chỉ chọn được
+    return !vars.empty() && vars.size() <= kMaxPickedVariables && (payload_address == 0 || vars.size() == 1);
+}
+
+uint32_t ROPGenerator::pickSlotsNeeded(const NodeId* begin, const NodeId* end) const {
+    uint32_t slots = 0;
+    std::vector<uint32_t> vars;
+    for (const NodeId* it = begin; it != end; ++it) {
+        NodeType type = ast->type(*it);
+        if (type == NodeType::While || type == NodeType::Repeat) {
+            slots = std::max(slots, pickSlotsNeeded(ast->bodyBegin(*it), ast->bodyEnd(*it)));
+        } else if (type == NodeType::Sub) {
+            slots = std::max(slots, pickSlotsNeeded(ast->bodyBegin(*it), ast->bodyEnd(*it)));
+        } else if (type == NodeType::If) {
+            if (picksIf(*it, vars)) {
+                slots = std::max(slots, pickSlotCount(vars.size()));
+                continue;
+            }
+            NodeId taken = constantArm(*ast, *it);
+            for (NodeId arm : {ast->at(*it).b, ast->at(*it).c}) {
+                if (taken != kNullNode && taken != arm) continue;
+                slots = std::max(slots, pickSlotsNeeded(ast->statementsBegin(arm), ast->statementsEnd(arm)));
+            }
+        }
+    }
+    return slots;
+}
+
+void ROPGenerator::labelLastWord(uint32_t label) {
+    symbolic_chain.insert(symbolic_chain.end() - 1, ChainEntry::label(label, current_statement));
+}
+
+void ROPGenerator::placeLabel(uint32_t label) {
+    symbolic_chain.push_back(ChainEntry::label(label, current_statement));
+    selector->forgetRegisters();
+}
+
+uint32_t ROPGenerator::restoreCallWindows(size_t from) {
+    std::vector<uint32_t> windows;
+    for (size_t i = from; i < symbolic_chain.size(); ++i) {
+        const ChainEntry& e = symbolic_chain[i];
+        if (e.kind != ChainEntry::Kind::Gadget || !gadget_db.effect(e.func).calls) continue;
+        // Đã có nhãn: lời gọi thuộc một vòng lặp con, vòng đó tự khôi phục trước mỗi lần nhảy
+        if (i > 0 && symbolic_chain[i - 1].kind == ChainEntry::Kind::Label) continue;
+        uint32_t label = newLabel();
+        symbolic_chain.insert(symbolic_chain.begin() + static_cast<std::ptrdiff_t>(i),
+                              ChainEntry::label(label, e.statement));
+        ++i;
+        windows.push_back(label);
+    }
+    if (windows.empty()) return 0;
+    if (selector->wideStoreCost().bytes == UINT32_MAX) {
+        throw std::runtime_error("Lỗi: ROM '" + gadget_db.model(rom).name +
+                                 "' không có gadget ghi 8 byte để khôi phục chuỗi sau lời gọi hàm ROM trong vòng lặp.");
+    }
+    // Nhãn đứng ngay trước gadget BL: vùng bị ghi đè là [nhãn + 4 - kCallStackBytes, nhãn + 4)
+    for (uint32_t label : windows) {
+        for (int base = 4 - kCallStackBytes; base < 4; base += 8) {
+            pushGadget(GadgetFunction::POP_EA);
+            symbolic_chain.push_back(ChainEntry::labelAddress(label, base, current_statement));
+            pushGadget(GadgetFunction::POP_QR0);
+            for (int w = 0; w < 4; ++w) {
+                symbolic_chain.push_back(ChainEntry::chainWord(label, base + 2 * w, current_statement));
+            }
+            pushGadget(GadgetFunction::STORE_EA_QR0);
+        }
+    }
+    selector->forgetRegisters();
+    return static_cast<uint32_t>(windows.size());
+}
+
+SelectionCost ROPGenerator::selectStatement(NodeId node) {
+    selected.clear();
+    SelectionCost cost = selector->selectStatement(*ast, node, selected, statement_position);
+    pushSelected();
+    return cost;
+}
+
+bool ROPGenerator::constantStore(NodeId node, uint32_t& address, uint32_t& width, uint32_t& value) const {
+    const NodeSlots& s = ast->at(node);
+    auto literal = [this](NodeId n) { return ast->type(n) == NodeType::IntegerLiteral; };
+    switch (ast->type(node)) {
+        case NodeType::Assignment: {
+            if (!literal(s.b)) return false;
+            const SymbolInfo* sym = symbol_table.get_symbol(s.a);
+            if (!sym) return false;
+            address = sym->address;
+            width = 2;
+            value = ast->at(s.b).a;
+            break;
+        }
+        case NodeType::MemWrite:
+            if (!literal(s.a) || !literal(s.b)) return false;
+            address = ast->at(s.a).a;
+            width = 2;
+            value = ast->at(s.b).a;
+            break;
+        case NodeType::PrintChar:
+            // Ghi một byte vào VRAM: (line - 1) * 0x10 + column
+            if (!literal(s.a) || !literal(s.b) || !literal(s.c)) return false;
+            address = ((ast->at(s.a).a - 1) * 0x10 + ast->at(s.b).a) & 0xFFFF;
+            width = 1;
+            value = ast->at(s.c).a & 0xFF;
+            break;
+        default:
+            return false;
+    }
+    address &= 0xFFFF;
+    return address + width <= 0x10000;
+}
+
+namespace {
+
+// Ước lượng chi phí (byte) của một câu lệnh ghi hằng khi sinh mã bình thường:
+// pop địa chỉ, pop giá trị, gadget ghi
+constexpr uint32_t kStoreStatementBytes = 16;
+constexpr uint32_t kMinFillBytes = 4; // memset phá er0..er6: không dùng cho một word lẻ
+
+struct StoreAtom {
+    uint32_t address;
+    uint32_t width;
+    NodeId statement;
+};
 
-    // 1. Calculate the character code into ER0.
-    evaluateExpressionIntoR0(*node.char_code_expr); // char_code into ER0
-    pushGadget(GadgetFunction::MOV_ER2_ER0_RET); // Move char_code to ER2 (temporary)
+} // namespace
 
-    // 2. Calculate VRAM address into ER0.
-    // Part a: Calculate `(line - 1)` into ER0.
-    evaluateExpressionIntoR0(*node.line_expr); // 'line' value into ER0
-    pushGadget(GadgetFunction::POP_ER4);      // Pop 1 into ER4
-    pushData(1);
-    pushGadget(GadgetFunction::SUB_ER0_ER4_RET); // ER0 = ER0 - ER4 (line - 1)
+void ROPGenerator::planBulkStores(const AstArena& arena) {
+    bulk_stores.clear();
+    data_blocks.clear();
+    bulk_stats = BulkStoreStats{};
+    covered.assign(arena.size(), false);
 
-    // Part b: Multiply `(line - 1)` by 0x10 (i.e., left shift by 4 bits) into ER0.
-    pushGadget(GadgetFunction::SLL_ER0_4_RET); // ER0 = ER0 << 4
+    SelectionCost wide_cost = selector->wideStoreCost();
+    SelectionCost fill_cost = selector->bulkCallCost(GadgetFunction::BL_MEMSET_POP_ER2);
+    SelectionCost copy_cost = payload_address != 0 ? selector->bulkCallCost(GadgetFunction::BL_MEMCPY_POP_ER0)
+                                                   : SelectionCost{UINT32_MAX, UINT32_MAX};
+    if (wide_cost.bytes == UINT32_MAX && fill_cost.bytes == UINT32_MAX && copy_cost.bytes == UINT32_MAX) return;
 
-    // Part c: Add 'column' value to ER0.
-    // Need to save current ER0 (line_offset) temporarily, calculate column, then add.
-    pushGadget(GadgetFunction::MOV_ER8_ER0_RET); // Save (line_offset) to ER8
+    // Dãy hiện tại: giá trị cuối cùng của từng byte, và các câu lệnh ghi
+    std::map<uint32_t, uint8_t> bytes;
+    std::vector<StoreAtom> atoms;
+    // Chi phí sinh mã bình thường cho các câu lệnh nằm trọn trong [begin, end)
+    auto normalCost = [&](uint32_t begin, uint32_t end) {
+        uint32_t words = 0, singles = 0;
+        for (const StoreAtom& a : atoms) {
+            if (a.address >= begin && a.address + a.width <= end) (a.width == 2 ? words : singles)++;
+        }
+        uint32_t quads = wide_cost.bytes != UINT32_MAX && wide_cost.bytes < 4 * kStoreStatementBytes ? words / 4 : 0;
+        return quads * wide_cost.bytes + (words - 4 * quads + singles) * kStoreStatementBytes;
+    };
+    auto add = [&](BulkStore store) {
+        // atoms theo thứ tự câu lệnh: câu lệnh đầu tiên chồng lấn là nơi phát
+        for (const StoreAtom& a : atoms) {
+            if (a.address < store.address + store.length && store.address < a.address + a.width) {
+                covered[a.statement] = true;
+                if (store.statement == kNullNode) store.statement = a.statement;
+                bulk_stats.statements++;
+            }
+        }
+        switch (store.kind) {
+            case BulkStore::Kind::Wide: bulk_stats.wide_stores++; break;
+            case BulkStore::Kind::Fill: bulk_stats.fills++; break;
+            case BulkStore::Kind::Copy: bulk_stats.copies++; break;
+        }
+        bulk_stores.push_back(store);
+    };
+    auto flush = [&]() {
+        // Không được cắt giữa hai byte của một lần ghi word: mọi câu lệnh nằm trọn trong một lần
+        // ghi gộp hoặc nằm ngoài hẳn (câu lệnh còn lại có thể chạy sau lần ghi gộp)
+        std::vector<uint32_t> no_cut;
+        for (const StoreAtom& a : atoms) {
+            if (a.width == 2) no_cut.push_back(a.address + 1);
+        }
+        std::sort(no_cut.begin(), no_cut.end());
+        auto cuttable = [&](uint32_t at) { return !std::binary_search(no_cut.begin(), no_cut.end(), at); };
 
-    evaluateExpressionIntoR0(*node.column_expr); // 'column' value into ER0
+        for (auto it = bytes.begin(); it != bytes.end();) {
+            // Một đoạn byte liên tiếp [begin, end)
+            uint32_t begin = it->first, end = begin;
+            while (it != bytes.end() && it->first == end) {
+                ++it;
+                ++end;
+            }
+            // memset cho các đoạn con cùng giá trị; memcpy cho phần còn lại giữa chúng
+            uint32_t rest = begin;
+            auto copy = [&](uint32_t from, uint32_t to) {
+                uint32_t length = to - from;
+                if (copy_cost.bytes == UINT32_MAX || length == 0) return;
+                if (copy_cost.bytes + ((length + 1) & ~1u) >= normalCost(from, to)) return;
+                std::vector<uint8_t> block;
+                for (uint32_t a = from; a < to; ++a) block.push_back(bytes[a]);
+                if (!std::all_of(block.begin(), block.end(), [this](uint8_t b) { return byte_constraints.allows(b); })) {
+                    return; // Byte không gõ được vào payload
+                }
+                BulkStore store;
+                store.kind = BulkStore::Kind::Copy;
+                store.address = from;
+                store.length = length;
+                store.block = static_cast<uint32_t>(data_blocks.size());
+                bulk_stats.data_bytes += length;
+                data_blocks.push_back(DataBlock{std::move(block), {}});
+                add(store);
+            };
+            for (uint32_t a = begin; a < end;) {
+                uint32_t b = a + 1;
+                while (b < end && bytes[b] == bytes[a]) ++b;
+                uint32_t from = cuttable(a) ? a : a + 1;
+                uint32_t to = cuttable(b) ? b : b - 1;
+                if (fill_cost.bytes != UINT32_MAX && to >= from + kMinFillBytes && fill_cost.bytes < normalCost(from, to)) {
+                    copy(rest, from);
+                    BulkStore store;
+                    store.kind = BulkStore::Kind::Fill;
+                    store.address = from;
+                    store.length = to - from;
+                    store.fill = bytes[from];
+                    add(store);
+                    rest = to;
+                }
+                a = b;
+            }
+            copy(rest, end);
+        }
+
+        // 4 word liền nhau trong phần chưa gộp: một lần ghi qr0
+        if (wide_cost.bytes != UINT32_MAX && wide_cost.bytes < 4 * kStoreStatementBytes) {
+            std::vector<uint32_t> words;
+            for (const StoreAtom& a : atoms) {
+                if (!covered[a.statement] && a.width == 2) words.push_back(a.address);
+            }
+            std::sort(words.begin(), words.end());
+            words.erase(std::unique(words.begin(), words.end()), words.end());
+            for (size_t i = 0; i + 4 <= words.size();) {
+                uint32_t base = words[i];
+                bool window = words[i + 3] == base + 6 && base + 8 <= 0x10000;
+                // Word lẻ/chồng nhau vẫn qua được kiểm tra trên: cả 8 byte phải do chương trình ghi
+                for (uint32_t a = base; window && a < base + 8; ++a) {
+                    window = bytes.count(a) != 0;
+                }
+                for (const StoreAtom& a : atoms) {
+                    bool overlaps = a.address < base + 8 && base < a.address + a.width;
+                    if (window && overlaps && !covered[a.statement] && (a.address < base || a.address + a.width > base + 8)) {
+                        window = false;
+                    }
+                }
+                if (!window) {
+                    ++i;
+                    continue;
+                }
+                BulkStore store;
+                store.kind = BulkStore::Kind::Wide;
+                store.address = base;
+                store.length = 8;
+                for (unsigned int w = 0; w < 4; ++w) {
+                    store.words[w] = static_cast<uint16_t>(bytes[base + 2 * w] | (bytes[base + 2 * w + 1] << 8));
+                }
+                add(store);
+                i += 4;
+            }
+        }
+        bytes.clear();
+        atoms.clear();
+    };
 
-    // Add saved line_offset (in ER8) to current ER0 (column)
-    pushGadget(GadgetFunction::MOV_ER4_ER0_RET); // Move column to ER4
-    pushGadget(GadgetFunction::MOV_ER0_ER8_RET); // Move line_offset from ER8 to ER0
-    pushGadget(GadgetFunction::ADD_ER0_ER4_RET); // ER0 = ER0 + ER4 (now ER0 has line_offset + column)
+    // Chương trình rồi thân của từng vòng lặp, nhánh IF và SUB (dãy không kéo qua đầu/cuối của chúng)
+    std::vector<uint32_t> vars;
+    std::vector<std::pair<const NodeId*, const NodeId*>> lists{{arena.statementsBegin(arena.root),
+                                                                arena.statementsEnd(arena.root)}};
+    while (!lists.empty()) {
+        auto [begin, end] = lists.back();
+        lists.pop_back();
+        for (const NodeId* it = begin; it != end; ++it) {
+            uint32_t address, width, value;
+            NodeType type = arena.type(*it);
+            if (constantStore(*it, address, width, value)) {
+                for (uint32_t b = 0; b < width; ++b) {
+                    bytes[address + b] = static_cast<uint8_t>(value >> (8 * b));
+                }
+                atoms.push_back(StoreAtom{address, width, *it});
+            } else if (type != NodeType::VarDeclaration) {
+                if (type == NodeType::While || type == NodeType::Repeat || type == NodeType::Sub) {
+                    lists.emplace_back(arena.bodyBegin(*it), arena.bodyEnd(*it));
+                } else if (type == NodeType::If && !picksIf(*it, vars)) {
+                    // Nhánh IF chọn không rẽ nhánh không đi qua generateStatements
+                    NodeId taken = constantArm(arena, *it);
+                    for (NodeId arm : {arena.at(*it).b, arena.at(*it).c}) {
+                        if (taken != kNullNode && taken != arm) continue;
+                        lists.emplace_back(arena.statementsBegin(arm), arena.statementsEnd(arm));
+                    }
+                }
+                flush();
+            }
+        }
+        flush();
+    }
+    // Cùng câu lệnh: giữ thứ tự lập kế hoạch
+    std::stable_sort(bulk_stores.begin(), bulk_stores.end(),
+                     [](const BulkStore& a, const BulkStore& b) { return a.statement < b.statement; });
+}
 
-    // 
+void ROPGenerator::emitBulkStore(const BulkStore& store) {
+    selected.clear();
+    SelectionCost cost;
+    const char* what = "";
+    switch (store.kind) {
+        case BulkStore::Kind::Wide:
+            cost = selector->selectWideStore(store.address, store.words, selected);
+            what = "ghi 8 byte";
+            break;
+        case BulkStore::Kind::Fill:
+            cost = selector->selectBulkCall(GadgetFunction::BL_MEMSET_POP_ER2, store.address, store.fill, false,
+                                            store.length, selected);
+            what = "memset";
+            break;
+        case BulkStore::Kind::Copy:
+            cost = selector->selectBulkCall(GadgetFunction::BL_MEMCPY_POP_ER0, store.address, store.block, true,
+                                            store.length, selected);
+            what = "memcpy";
+            break;
+    }
+    pushSelected();
+    std::cout << "DEBUG: Sinh mã " << what << " tại 0x" << std::hex << store.address << std::dec << " ("
+              << store.length << " byte dữ liệu, " << cost.bytes << " byte)" << std::endl;
+}
+
+void ROPGenerator::appendDataBlocks() {
+    if (data_blocks.empty()) return;
+    // Sau BRK nên không bao giờ được chạy; memcpy và lệnh nhảy đọc chúng qua địa chỉ payload_address + offset
+    uint8_t filler = byte_constraints.fillerByte();
+    std::vector<uint32_t> offsets;
+    offsets.reserve(data_blocks.size());
+    for (const DataBlock& block : data_blocks) {
+        offsets.push_back(chainBytes(symbolic_chain));
+        for (size_t i = 0; i < block.bytes.size(); i += 2) {
+            uint8_t high = i + 1 < block.bytes.size() ? block.bytes[i + 1] : filler;
+            symbolic_chain.push_back(ChainEntry::data(block.bytes[i] | (high << 8)));
+        }
+        for (uint32_t label : block.labels) {
+            symbolic_chain.push_back(ChainEntry::labelAddress(label, block.label_offset));
+        }
+    }
+    for (ChainEntry& e : symbolic_chain) {
+        if (e.kind == ChainEntry::Kind::BlockAddress) {
+            e = ChainEntry::data((payload_address + offsets[e.value]) & 0xFFFF, e.statement);
+        }
+    }
+}
+
+void ROPGenerator::pushSelected() {
+    for (const ChainStep& step : selected) {
+        if (step.func != GadgetFunction::UNKNOWN_GADGET) {
+            pushGadget(step.func);
+        } else if (step.block) {
+            symbolic_chain.push_back(ChainEntry::blockAddress(step.data, current_statement));
+        } else if (step.filler) {
+            pushPad();
+        } else {
+            pushData(step.data);
+        }
+    }
+}
+
+unsigned int ROPGenerator::spillSlotAddress(unsigned int depth) const {
+    return (scratch_base != 0 ? scratch_base : symbol_table.next_available_address) + depth * 2;
+}
+
+void ROPGenerator::pushGadget(GadgetFunction func) {
+    symbolic_chain.push_back(ChainEntry::gadget(func, current_statement));
+}
+
+void ROPGenerator::pushData(unsigned int data) {
+    symbolic_chain.push_back(ChainEntry::data(data, current_statement)); // Data words are 16-bit
+}
+
+void ROPGenerator::pushPad() {
+    symbolic_chain.push_back(ChainEntry::pad(current_statement));
+}
+
+void ROPGenerator::resolveChain() {
+    rop_chain.reserve(symbolic_chain.size());
+    for (const ChainEntry& e : symbolic_chain) {
+        switch (e.kind) {
+            case ChainEntry::Kind::Gadget: rop_chain.push_back(resolveAddress(e.func)); break;
+            case ChainEntry::Kind::Data: rop_chain.push_back(e.value); break;
+            case ChainEntry::Kind::Pad: rop_chain.push_back(fillerWord()); break;
+            case ChainEntry::Kind::Label: break; // Không chiếm word nào
+            case ChainEntry::Kind::BlockAddress:
+            case ChainEntry::Kind::LabelAddress:
+            case ChainEntry::Kind::ChainWord:
+                throw std::logic_error("Lỗi: địa chỉ khối dữ liệu/nhãn chưa được điền.");
+        }
+    }
+}
+
+uint16_t ROPGenerator::fillerWord() const {
+    uint8_t filler = byte_constraints.fillerByte();
+    return static_cast<uint16_t>(filler | (filler << 8));
+}
+
+void ROPGenerator::writePayload(uint8_t* out) const {
+    for (const ChainEntry& e : symbolic_chain) {
+        out = writeEntry(e, out);
+    }
+}
+
+uint8_t* ROPGenerator::writeEntry(const ChainEntry& e, uint8_t* out) const {
+    uint8_t filler = byte_constraints.fillerByte();
+    switch (e.kind) {
+        case ChainEntry::Kind::Gadget: {
+            unsigned int address = resolveAddress(e.func);
+            *out++ = static_cast<uint8_t>(address);
+            *out++ = static_cast<uint8_t>(address >> 8);
+            *out++ = static_cast<uint8_t>(address >> 16); // Segment (CSR)
+            *out++ = filler;
+            break;
+        }
+        case ChainEntry::Kind::Data:
+            *out++ = static_cast<uint8_t>(e.value);
+            *out++ = static_cast<uint8_t>(e.value >> 8);
+            break;
+        case ChainEntry::Kind::Pad:
+            *out++ = filler;
+            *out++ = filler;
+            break;
+        case ChainEntry::Kind::Label:
+            break;
+        case ChainEntry::Kind::BlockAddress:
+        case ChainEntry::Kind::LabelAddress:
+        case ChainEntry::Kind::ChainWord:
+            throw std::logic_error("Lỗi: địa chỉ khối dữ liệu/nhãn chưa được điền.");
+    }
+    return out;
+}
+
+void ROPGenerator::resolveLabels() {
+    if (label_count == 0) return;
+    constexpr uint32_t kUnplaced = 0xFFFFFFFF;
+    std::vector<uint32_t> offsets(label_count, kUnplaced);
+    uint32_t offset = 0;
+    for (const ChainEntry& e : symbolic_chain) {
+        if (e.kind == ChainEntry::Kind::Label) offsets[e.value] = offset;
+        offset += e.kind == ChainEntry::Kind::Gadget ? 4 : e.kind == ChainEntry::Kind::Label ? 0 : 2;
+    }
+    auto target = [&](const ChainEntry& e) {
+        if (e.value >= label_count || offsets[e.value] == kUnplaced) {
+            throw std::logic_error("Lỗi: nhãn " + std::to_string(e.value) + " không có trong chuỗi.");
+        }
+        int64_t at = static_cast<int64_t>(offsets[e.value]) + e.offset;
+        if (at < 0 || at + 2 > static_cast<int64_t>(offset)) {
+            throw std::logic_error("Lỗi: word tại nhãn " + std::to_string(e.value) + " nằm ngoài payload.");
+        }
+        return static_cast<uint32_t>(at);
+    };
+    for (ChainEntry& e : symbolic_chain) {
+        if (e.kind == ChainEntry::Kind::LabelAddress) {
+            e = ChainEntry::data((payload_address + target(e)) & 0xFFFF, e.statement);
+        }
+    }
+
+    // ChainWord: bản sao của payload cuối cùng, nên điền sau mọi thứ khác; word của
+    // chính một ChainWord không dùng làm nguồn được
+    std::vector<uint8_t> image(offset);
+    std::vector<bool> known(offset, true);
+    uint8_t* out = image.data();
+    for (const ChainEntry& e : symbolic_chain) {
+        if (e.kind == ChainEntry::Kind::ChainWord) {
+            size_t at = static_cast<size_t>(out - image.data());
+            known[at] = known[at + 1] = false;
+            out += 2;
+        } else {
+            out = writeEntry(e, out);
+        }
+    }
+    for (ChainEntry& e : symbolic_chain) {
+        if (e.kind != ChainEntry::Kind::ChainWord) continue;
+        uint32_t at = target(e);
+        if (!known[at] || !known[at + 1]) {
+            throw std::logic_error("Lỗi: word cần khôi phục tại nhãn " + std::to_string(e.value) + " chưa được điền.");
+        }
+        e = ChainEntry::data(image[at] | (image[at + 1] << 8), e.statement);
+    }
+}
+
+unsigned int ROPGenerator::resolveAddress(GadgetFunction func) const {
+    if (byte_constraints.empty()) {
+        return gadget_db.getAddress(rom, func); // Ứng viên đầu tiên, O(1)
+    }
+    const GadgetCandidate* candidate = gadget_db.selectCandidate(rom, func, byte_constraints);
+    if (!candidate) {
+        throw std::runtime_error("Lỗi: Không có địa chỉ nào của gadget '" + std::string(gadgetSpelling(func)) +
+                                 "' thỏa ràng buộc byte của payload.");
+    }
+    return candidate->address;
+}
@@ -2,244 +2,332 @@
 #define ROP_GENERATOR_H
 
 #include "Parser.h" // Cần các định nghĩa AST và SymbolTable
+#include "GadgetFunction.h"
+#include "GadgetEffect.h"
+#include "GadgetImage.h"
+#include "SuperoptTable.h"
+#include "InstructionSelector.h"
+#include "ChainOptimizer.h"
+#include <array>
+#include <bitset>
+#include <cstdint>
 #include <string>
 #include <vector>
 #include <map>
+#include <memory>
 #include <fstream>
 #include <sstream>
 #include <stdexcept> // For std::runtime_error
 
-// --- Định nghĩa các loại Gadget ---
-// Liệt kê chi tiết tất cả các chức năng của gadget mà bạn đã cung cấp
-enum class GadgetFunction {
-    UNKNOWN_GADGET,
-
-    // Stack/Register manipulation (pop)
-    SETLR,
-    DI_RT,
-    SP_ER14_POP_ER14_RT,
-    SP_ER14_POP_QR8,
-    SP_ER14_POP_QR8_POP_QR0,
-    SP_ER14_POP_ER14,
-    SP_ER6_POP_ER8,
-    SP_ER14_POP_XR12,
-    SP_ER14_POP_QR8_POP_ER6,
-    ER14_SP_RT,
-    NOP,
-    POP_EA,
-    POP_ER14_RT,
-    POP_ER0_RT,
-    POP_ER2,
-    POP_ER4,
-    POP_ER8,
-    POP_ER12_RT,
-    POP_QR0,
-    POP_QR8,
-    POP_R0,
-    POP_R8,
-    POP_XR0,
-    POP_XR4,
-    POP_XR8,
-    POP_ER10,
-    POP_R12,
-    POP_ER0,
-    POP_ER12,
-    POP_ER14,
-    POP_ER6,
-    POP_ER6_RT,
-    POP_XR12,
-    POP_ER4_RT,
-    POP_ER8_RT,
-    POP_QR0_RT,
-    POP_QR8_RT,
-    POP_R4,
-    POP_R4_RT,
-    POP_R9,
-    POP_XR12_RT,
-    POP_XR4_RT,
-    POP_XR8_RT,
-
-    // ADD gadgets
-    ADD_ER0_ER4_RET,
-    ADD_ER4_ER0_R8_RET,
-    ADD_ER0_ER8_RET,
-    ADD_ER2_ER8_RET,
-    ADD_ER0_ER2_RET,
-    ADD_ER0_ONE_RET,
-    ADD_R0_ONE_RET,
-
-    // Move/Copy registers
-    MOV_ER6_ER0_ER0_ER8_POP_QR8,
-    MOV_ER8_ER0_RET,
-    MOV_ER2_ER0_ER0_ER2_POP_ER8_RET,
-    MOV_ER2_ER0_ADD_ER0_ER4_RET,
-    MOV_ER0_ER2_RET,
-    MOV_ER0_ER4_POP_ER4,
-    MOV_ER0_ER8_POP_ER8_RET,
-    MOV_ER0_ER8_RET,
-    MOV_ER0_ER6_POP_ER8_POP_XR4,
-    MOV_ER2_ER0_R0_R4_R1_ZERO_POP_XR4_RET,
-    MOV_R0_R5_POP_ER4,
-    MOV_R0_R2_ZERO,
-    MOV_R0_R2,
-    MOV_R2_R0_POP_ER0,
-    MOV_R2_R0_POP_R6_POP_ER12,
-    MOV_R2_ZERO_R7_FOUR,
-    MOV_R0_ZERO,
-    MOV_R0_ZERO_RET,
-    MOV_R0_ONE_RET,
-    MOV_R0_ZERO_POP_ER2,
-    MOV_R1_ZERO_RET,
-    MOV_R5_ZERO_RET,
-    MOV_ER14_ER0_POP_XR0,
-    MOV_ER0_ER12_POP_ER12_RET,
-    MOV_ER10_ER2_RET,
-    MOV_ER0_ER10_POP_XR8,
-    MOV_ER0_ONE_RET,
-    MOV_ER2_ZERO_ER4_ZERO_ER6_ZERO_ER8_ONE_RET,
-    MOV_ER2_ZERO_R0_TWO_STORE_ER8_ER2_POP_XR8,
-    MOV_ER2_ONE_R0_ER2_RET,
-    MOV_R0_ZERO_STORE_ER8_ER2_POP_XR8,
-    MOV_R2_ONE_R0_R2_POP_ER4_POP_ER8_RET,
-    MOV_R0_R1_RET,
-
-    // Store (ST) gadgets
-    STORE_ER2_ER0_R2_ZERO_POP_ER4_RET,
-    STORE_ER0_ER2_RET,
-    STORE_ER0_R2_RET,
-    STORE_ER0_R2,
-    STORE_ER2_R0_R2_ZERO,
-    STORE_ER8_ER2_POP_XR8,
-    STORE_ER4_ER0_POP_ER0_RET,
-    STORE_EA_QR0,
-    STORE_ER12_ER14_POP_XR4_POP_QR8,
-
-    // Load (L) gadgets
-    LOAD_ER4_FROM_ER8_POP_ER8_RET,
-    LOAD_ER0_FROM_ER2_R2_NINE_RET,
-    LOAD_ER8_FROM_ER0_RET,
-    LOAD_R0_FROM_ER2,
-    LOAD_R0_FROM_ER0,
-    LOAD_ER0_FROM_ER0_POP_XR8_RET,
-    LOAD_R0_FROM_EA_RET,
-    LOAD_SP_FROM_ER8_POP_ER8,
-    LOAD_QR0_FROM_EA_LEA_D002H_EA_QR0,
-
-    // Subtract (SUB) gadgets
-    SUB_ER0_ER2_RET,
-    SUB_ER0_ER12_POP_ER8_POP_ER12_RET,
-    SUB_R0_ONE_RET,
-    SUB_R0_R8_POP_ER8_RET,
-
-    // OR gadgets
-    OR_R0_R1,
-    OR_QR0_QR8,
-
-    // Shift gadgets
-    SRL_R0_4_RET,
-    SRL_QR0_4_RET,
-    SLL_R0_4_RET,
-    SLL_R1_4_RET,
-    SLL_ER0_4_RET,
-    SLL_XR0_4_RET,
-    SLL_QR0_4_RET,
-
-    // Compare (CMP) gadgets
-    CMP_ER0_ER2_GT_R0_ZERO_OR_ONE_RET,
-    CMP_ER0_ER2_EQ_R0_ONE_RET,
-    CMP_ER2_ER0_GT_R0_ZERO_OR_ONE_RET,
-    CMP_ER0_ER2_LE_ER0_ER2_RET,
-    CMP_ER8_ER0_LT_POP_XR8,
-    CMP_R0_ZERO_LT_RET,
-    CMP_R1_ZERO_LT_RET,
-
-    // Multiply (MUL) gadgets
-    MUL_ER0_R2_ER2_ER0_ADD_ER0_ER4_RET,
-    MUL_ER0_R2_ADD_ER0_ER6_ER10_ER0_RET,
-
-    // Divide (DIV) gadgets
-    DIV_ER0_R2_RET,
-
-    // Control Flow (Jumps/Calls)
-    BRK,
-    BL_MEMCPY_POP_ER0,
-    BL_STRCPY,
-    BL_STRCAT,
-    BL_MEMSET_POP_ER2,
-    BL_DELAY_POP_XR0,
-    BL_LINE_PRINT,
-    BL_PRINTLINE,
-    BL_HEX_BYTE_ER6_ER0_ER0_ER8_POP_QR8,
-    BL_SMART_STRCPY_POP_ER8,
-    BL_ZERO_KO,
-    BL_LINE_DRAW,
-    BL_RENDER_DDD4,
-
-    // Other gadgets
-    INC_EA_R0_THREE,
-    DEC_EA_POP_XR4,
-    B_LEAVE,
-
-    // Special Casio VRAM-related internal gadget (if any exist in your DB or need to be faked)
-    // For now, we'll implement PRINT_CHAR using basic store operations to VRAM addresses.
+// --- Cấu trúc thông tin về một gadget ---
+// Một ứng viên cụ thể cho một GadgetFunction. Cùng một chức năng có thể xuất
+// hiện ở nhiều địa chỉ trong ROM; DB giữ tất cả để bộ sinh mã chọn lúc phát.
+// Các ứng viên của một chức năng có cùng cách viết nên cùng tác động và cùng số
+// word pop: chúng chỉ khác nhau ở byte địa chỉ (xem ByteConstraints).
+struct GadgetCandidate {
+    unsigned int address;    // Địa chỉ đầy đủ (segment:offset)
+    uint8_t segment;         // address >> 16
+    uint8_t extra_pop_words; // Số word stack mà các pop phía sau tiêu thụ
+
+    uint8_t lowByte() const { return static_cast<uint8_t>(address & 0xFF); }
+    uint8_t highByte() const { return static_cast<uint8_t>((address >> 8) & 0xFF); }
+    // Số byte ứng viên chiếm trong chuỗi: địa chỉ (2) + segment/đệm (2) + các word bị pop
+    unsigned int chainBytes() const { return 4 + 2u * extra_pop_words; }
 };
 
-// --- Cấu trúc thông tin về một gadget ---
-// Chúng ta sẽ chỉ lưu địa chỉ, vì chức năng đã được mã hóa trong enum.
-struct Gadget {
-    unsigned int address; // Địa chỉ của gadget
+// Ràng buộc byte cho payload (ví dụ: các byte không gõ được trên máy tính)
+struct ByteConstraints {
+    std::bitset<256> forbidden;
+
+    bool empty() const { return forbidden.none(); }
+    bool allows(uint8_t byte) const { return !forbidden.test(byte); }
+    // Byte dùng cho các ô đệm (giá trị tùy ý): byte nhỏ nhất được phép, 0 nếu cấm hết
+    uint8_t fillerByte() const {
+        for (unsigned int b = 0; b < 256; ++b) {
+            if (allows(static_cast<uint8_t>(b))) return static_cast<uint8_t>(b);
+        }
+        return 0;
+    }
+    bool allows(const GadgetCandidate& c) const {
+        return allows(c.lowByte()) && allows(c.highByte()) && allows(c.segment);
+    }
+};
+
+// --- Một model ROM ---
+// Bảng địa chỉ dày đánh chỉ số trực tiếp bằng GadgetFunction; bitset cho biết
+// gadget nào có mặt trong ROM này. Tra cứu là O(1), không cần map.
+// Mọi ứng viên nằm liên tiếp trong `candidates` (sắp theo chức năng), ứng viên
+// của f là [first[f], first[f + 1]) theo thứ tự trong file; addresses[f] là ứng viên đầu tiên.
+using RomHandle = uint32_t;
+constexpr RomHandle kNoRom = 0xFFFFFFFF;
+
+struct RomModel {
+    std::string name;
+    std::array<unsigned int, kGadgetFunctionCount> addresses{};
+    std::bitset<kGadgetFunctionCount> available;
+    std::vector<GadgetCandidate> candidates;
+    std::array<uint32_t, kGadgetFunctionCount + 1> first{};
+    std::vector<SuperoptEntry> superopt; // Dãy gadget tối ưu cho các tác động nhỏ (tools/superopt)
+
+    const GadgetCandidate* candidatesBegin(GadgetFunction func) const {
+        return candidates.data() + first[static_cast<size_t>(func)];
+    }
+    const GadgetCandidate* candidatesEnd(GadgetFunction func) const {
+        return candidates.data() + first[static_cast<size_t>(func) + 1];
+    }
 };
 
 // --- Database chứa các gadget ---
+// Chứa N model ROM song song. Nạp tất cả model lúc khởi động, sau đó chia sẻ
+// GadgetDB dưới dạng const cho mọi lần biên dịch (an toàn giữa các thread);
+// mỗi lần biên dịch chọn model qua RomHandle.
 class GadgetDB {
 public:
-    // Ánh xạ chuỗi tên gadget (như trong file) đến enum GadgetFunction
-    std::map<std::string, GadgetFunction> name_to_enum_map;
-    // Ánh xạ enum GadgetFunction đến địa chỉ thực
-    std::map<GadgetFunction, unsigned int> gadget_address_map;
+    // Hàm load gadget từ file (ví dụ: nx_u8_gadgets.txt) thành một model mới.
+    // model_name rỗng thì dùng đường dẫn file làm tên.
+    RomHandle loadFromFile(const std::string& filepath, const std::string& model_name = "");
+
+    // Nạp ảnh nhị phân do gadgetc tạo ra (mmap, không parse) thành một model mới.
+    RomHandle loadFromImage(const std::string& filepath, const std::string& model_name = "");
+
+    // Nạp bảng superopt (do tools/superopt tạo) cho một model đã nạp; bộ chọn gadget
+    // dùng mỗi dòng như một luật. Dòng dùng gadget mà ROM không có bị bỏ qua.
+    void loadSuperoptTable(RomHandle rom, const std::string& filepath);
+
+    // Xuất các gadget của một model thành bản ghi để gadgetc ghi ra ảnh nhị phân
+    std::vector<GadgetImage::Record> toImageRecords(RomHandle rom = 0) const;
+
+    size_t modelCount() const { return models.size(); }
+    const RomModel& model(RomHandle rom) const { return models.at(rom); }
+    // Trả về kNoRom nếu không có model tên này
+    RomHandle findModel(std::string_view name) const;
+
+    bool isAvailable(RomHandle rom, GadgetFunction func) const {
+        return models[rom].available.test(static_cast<size_t>(func));
+    }
+
+    // Tác động của gadget (thanh ghi đọc/ghi, bộ nhớ, pop), parse từ cách viết.
+    // Không phụ thuộc ROM nên mọi model dùng chung một bảng.
+    const GadgetEffect& effect(GadgetFunction func) const { return gadgetEffect(func); }
+
+    // Ứng viên đầu tiên (theo thứ tự trong file) có địa chỉ thỏa ràng buộc byte; không xếp
+    // hạng theo chi phí vì mọi ứng viên của một chức năng như nhau. nullptr nếu không có.
+    const GadgetCandidate* selectCandidate(RomHandle rom, GadgetFunction func, const ByteConstraints& constraints) const;
 
-    GadgetDB(); // Constructor để khởi tạo name_to_enum_map
+    // Lấy địa chỉ ứng viên đầu tiên của một gadget (ném lỗi nếu ROM không có gadget này)
+    unsigned int getAddress(RomHandle rom, GadgetFunction func) const {
+        const RomModel& m = models[rom];
+        if (!m.available.test(static_cast<size_t>(func))) {
+            throwMissing(m, func);
+        }
+        return m.addresses[static_cast<size_t>(func)];
+    }
+    // Tương thích: tra trên model đầu tiên
+    unsigned int getAddress(GadgetFunction func) const { return getAddress(0, func); }
 
-    // Hàm load gadget từ file (ví dụ: nx_u8_gadgets.txt)
-    void loadFromFile(const std::string& filepath);
+private:
+    std::vector<RomModel> models; // Chỉ số = RomHandle
+
+    // Gom các cặp (chức năng, địa chỉ) thành model: sắp xếp, lập chỉ mục, lấy ứng viên đầu tiên
+    static RomModel buildModel(std::string name, std::vector<std::pair<GadgetFunction, unsigned int>> entries);
+
+    [[noreturn]] static void throwMissing(const RomModel& model, GadgetFunction func);
+};
 
-    // Lấy địa chỉ của một gadget theo chức năng
-    unsigned int getAddress(GadgetFunction func) const;
+// Một đoạn liên tiếp của payload sinh ra từ cùng một câu lệnh. Các đoạn phủ kín payload:
+// phần không thuộc câu lệnh nào (BRK, khối dữ liệu sau nó) có statement = kNullNode, line = 0.
+struct SourceMapEntry {
+    uint32_t offset; // Byte đầu tiên trong payload
+    uint32_t size;   // Số byte
+    NodeId statement;
+    int line;        // Dòng nguồn của câu lệnh
+};
+
+// Thống kê các lần ghi gộp từ dãy câu lệnh ghi hằng (xem ROPGenerator::planBulkStores)
+struct BulkStoreStats {
+    uint32_t wide_stores = 0; // [ea]=qr0
+    uint32_t fills = 0;       // memset
+    uint32_t copies = 0;      // memcpy
+    uint32_t data_bytes = 0;  // Byte của các khối dữ liệu cho memcpy
+    uint32_t statements = 0;  // Câu lệnh được gộp
 };
 
 // --- Lớp ROP Generator ---
 class ROPGenerator {
 public:
-    explicit ROPGenerator(const GadgetDB& db, const SymbolTable& sym_table);
-    std::vector<unsigned int> generateROPChain(const ProgramNode& program_node);
+    // Khi chạy AstOptimizer trước, truyền AstOptimizer::symbols() (DSE có thể đã dời địa chỉ biến)
+    explicit ROPGenerator(const GadgetDB& db, const SymbolTable& sym_table, RomHandle rom = 0);
+    // Chuỗi dạng địa chỉ/word (mỗi phần tử một unsigned int); tham chiếu tới bộ đệm
+    // của generator, còn hợp lệ tới lần sinh mã sau
+    const std::vector<unsigned int>& generateROPChain(const AstArena& ast);
+
+    // Sinh payload đúng như gõ vào máy: mỗi gadget 4 byte (offset 16 bit little-endian,
+    // segment, byte đệm — pop pc của nX-U8 đọc PC rồi một word có byte thấp là CSR),
+    // mỗi word pop 2 byte little-endian. Nối vào `out` (giữ vector giữa các lần biên
+    // dịch để khỏi cấp phát lại); trả về số byte đã ghi.
+    size_t emitPayload(const AstArena& ast, std::vector<uint8_t>& out);
+    // Như trên nhưng ghi vào vùng nhớ do người gọi cấp; ném lỗi nếu `capacity` không đủ
+    size_t emitPayload(const AstArena& ast, uint8_t* buffer, size_t capacity);
+    // Offset byte trong payload -> câu lệnh nguồn, của lần sinh mã gần nhất
+    const std::vector<SourceMapEntry>& sourceMap() const { return source_map; }
+    // Chuỗi ký hiệu (đã điền nhãn và khối) mà payload của lần sinh mã gần nhất được ghi ra từ đó
+    const std::vector<ChainEntry>& symbolicChain() const { return symbolic_chain; }
+
+    // Các byte không được xuất hiện trong địa chỉ gadget (mặc định: không ràng buộc)
+    void setByteConstraints(const ByteConstraints& constraints) { byte_constraints = constraints; }
+
+    // Đầu vùng RAM tạm cho spill (mặc định: ngay sau vùng biến của SymbolTable).
+    // Khi chạy AstOptimizer trước, đặt bằng AstOptimizer::scratchEnd() để không đè ô tạm của CSE.
+    void setScratchBase(unsigned int address) { scratch_base = address; }
+
+    // Bật/tắt các pass tối ưu trên chuỗi ký hiệu: peephole, tận dụng ô đệm (mặc định: bật)
+    void setChainOptimization(bool enabled) { optimize_chain = enabled; }
+    // Thống kê peephole của lần generateROPChain gần nhất
+    const PeepholeStats& peepholeStats() const { return peephole_stats; }
+    // Số ô pop đệm được tận dụng (và byte thu hồi) của lần generateROPChain gần nhất
+    const FillerStats& fillerStats() const { return filler_stats; }
+    // Các lần ghi gộp (qr0, memset, memcpy) của lần generateROPChain gần nhất
+    const BulkStoreStats& bulkStoreStats() const { return bulk_stats; }
+    // Các đoạn lặp lại được tách thành chương trình con của lần generateROPChain gần nhất
+    const OutlineStats& outlineStats() const { return outline_stats; }
+
+    // Địa chỉ RAM của byte đầu payload khi chạy. Khi biết (khác 0), các dãy ghi hằng dài
+    // được chép bằng memcpy từ khối dữ liệu đặt ngay sau BRK ở cuối payload.
+    // Bắt buộc cho WHILE/REPEAT/IF/CALL: lệnh nhảy đặt SP thành địa chỉ tuyệt đối trong payload.
+    // Khi biết (và bật tối ưu chuỗi), các đoạn chuỗi lặp lại còn được tách thành chương trình con.
+    void setPayloadAddress(unsigned int address) { payload_address = address; }
 
 private:
     const GadgetDB& gadget_db;
     const SymbolTable& symbol_table;
+    RomHandle rom; // Model ROM đích của lần biên dịch này
+    ByteConstraints byte_constraints;
+    unsigned int scratch_base = 0; // 0: ngay sau vùng biến
+    unsigned int payload_address = 0; // 0: không biết (không dùng memcpy)
+    const AstArena* ast = nullptr; // Arena của lần sinh mã hiện tại
     std::vector<unsigned int> rop_chain; // Chuỗi ROP (các địa chỉ và dữ liệu)
+    std::vector<ChainEntry> symbolic_chain; // Chuỗi trước khi tra địa chỉ (cho các pass tối ưu)
+    std::vector<SourceMapEntry> source_map;
+    bool optimize_chain = true;
+    PeepholeStats peephole_stats;
+    FillerStats filler_stats;
+    OutlineStats outline_stats;
+    std::unique_ptr<InstructionSelector> selector; // Dựng lại mỗi lần generateROPChain
+    std::vector<ChainStep> selected; // Bộ đệm kết quả chọn gadget cho một câu lệnh
+    LivenessInfo liveness;
+    uint32_t statement_position = 0; // Thứ tự câu lệnh cấp cao nhất đang sinh mã (cả thân vòng lặp của nó)
+
+    // Một dãy câu lệnh liền nhau (trong cùng một danh sách: chương trình hoặc thân vòng lặp)
+    // chỉ ghi hằng vào địa chỉ cố định (không đọc gì) có thể ghi theo thứ tự bất kỳ: gộp lại
+    // thành memset/memcpy (đoạn byte dài) và lần ghi qr0 (4 word liền nhau), phát ngay trước
+    // câu lệnh đầu tiên được gộp.
+    struct BulkStore {
+        enum class Kind : uint8_t {
+            Wide, // pop ea; pop qr0; [ea]=qr0
+            Fill, // memset(address, fill, length)
+            Copy, // memcpy(address, khối dữ liệu `block`, length)
+        };
+        Kind kind = Kind::Wide;
+        NodeId statement = kNullNode; // Câu lệnh đầu tiên được gộp
+        uint32_t address = 0;
+        uint32_t length = 0;   // Byte
+        std::array<uint16_t, 4> words{};
+        uint8_t fill = 0;
+        uint32_t block = 0;    // Chỉ số trong data_blocks
+    };
+    // Khối dữ liệu đặt sau BRK, cuối payload: byte nguồn của memcpy, hoặc bảng nhảy của
+    // vòng lặp/IF (mỗi word là địa chỉ khi chạy của một nhãn, cộng label_offset)
+    struct DataBlock {
+        std::vector<uint8_t> bytes;
+        std::vector<uint32_t> labels;
+        int16_t label_offset = 0; // -2: nhãn đứng sau word mà "pop er8" của lệnh nhảy đọc
+    };
+    std::vector<BulkStore> bulk_stores; // Theo statement tăng dần
+    std::vector<DataBlock> data_blocks;
+    BulkStoreStats bulk_stats;
+    std::vector<bool> covered;          // Chỉ số = NodeId: câu lệnh đã được gộp vào một BulkStore
+    NodeId current_statement = kNullNode;
+    NodeId previous_statement = kNullNode; // Câu lệnh ngay trước trong cùng danh sách
+
+    // Vòng lặp: nhãn (ChainEntry::Label) được đánh số theo thứ tự tạo
+    uint32_t label_count = 0;
+    uint32_t repeat_depth = 0;  // Số REPEAT bao quanh câu lệnh đang sinh mã
+    uint32_t counter_slots = 0; // Ô đếm của REPEAT: spillSlotAddress(0 .. counter_slots - 1)
+    uint32_t pick_slots = 0;    // Ô của IF chọn không rẽ nhánh, ngay sau các ô đếm
+
+    // SUB: thân được sinh một lần sau BRK (chỉ các SUB được gọi), theo thứ tự lần gọi đầu tiên.
+    // Mỗi SUB có dải ô đếm REPEAT riêng (SUB này gọi SUB kia khi đang giữa vòng lặp) và một ô
+    // cất er14 (địa chỉ trở về) ngay sau các ô của IF, dùng khi thân phá er14.
+    struct Subroutine {
+        uint32_t entry = 0;        // Nhãn đầu thân, hợp lệ khi called
+        uint32_t counter_base = 0; // Ô đếm REPEAT đầu tiên của thân
+        uint32_t save_slot = 0;    // Chỉ số ô (spillSlotAddress) cất er14
+        bool called = false;
+    };
+    std::map<NodeId, Subroutine> subroutines;
+    std::vector<NodeId> called_subroutines; // Theo thứ tự lần gọi đầu tiên
+
+    // Sinh chuỗi ký hiệu cho cả chương trình, chạy các pass tối ưu và lập bảng nguồn
+    void buildChain(const AstArena& ast);
+    // Tìm các lần ghi gộp (bulk_stores, data_blocks, covered) cho chương trình
+    void planBulkStores(const AstArena& ast);
+    // Câu lệnh ghi hằng (width = 1 hoặc 2 byte) vào địa chỉ cố định?
+    bool constantStore(NodeId node, uint32_t& address, uint32_t& width, uint32_t& value) const;
+    // Đặt các khối dữ liệu sau cuối chuỗi và điền địa chỉ của chúng
+    void appendDataBlocks();
+    // Điền LabelAddress/ChainWord khi chuỗi đã cố định (sau mọi pass và appendDataBlocks)
+    void resolveLabels();
+    void buildSourceMap();
+    // Ghi payload byte của symbolic_chain vào `out` (đủ chỗ cho chainBytes byte)
+    void writePayload(uint8_t* out) const;
+    // Byte của một entry đã điền (Gadget, Data, Pad); trả về con trỏ sau byte cuối
+    uint8_t* writeEntry(const ChainEntry& e, uint8_t* out) const;
 
-    // --- Các hàm hỗ trợ sinh mã cho từng loại ASTNode ---
-    void generateForNode(const ASTNode& node);
-    void generateForVarDeclaration(const VarDeclarationNode& node);
-    void generateForAssignment(const AssignmentNode& node);
-    void generateForBinaryOp(const BinaryOpNode& node);
-    void generateForMemWrite(const MemWriteNode& node);
-    void generateForPrintChar(const PrintCharNode& node);
+    // --- Các hàm hỗ trợ sinh mã cho từng loại node ---
+    void generateForNode(NodeId node);
+    void generateForVarDeclaration(NodeId node);
+    void generateForAssignment(NodeId node);
+    void generateForMemWrite(NodeId node);
+    void generateForPrintChar(NodeId node);
+    void generateForLoop(NodeId node); // WHILE, REPEAT
+    void generateForIf(NodeId node);
+    void generateForCall(NodeId node);
+    // Thân của các SUB được gọi (cả SUB chỉ được gọi từ thân SUB khác), sau BRK
+    void generateSubroutines();
+    // IF có điều kiện không phải hằng sinh bằng selectPick (không nhảy) thay vì rẽ nhánh?
+    // vars: các biến mà hai nhánh gán
+    bool picksIf(NodeId node, std::vector<uint32_t>& vars) const;
+    // Số ô mà các IF chọn không rẽ nhánh trong một danh sách câu lệnh cần (lấy max, không lồng nhau;
+    // kể cả thân SUB)
+    uint32_t pickSlotsNeeded(const NodeId* begin, const NodeId* end) const;
+    // Sinh mã cho một danh sách câu lệnh (chương trình hoặc thân vòng lặp) kèm các lần ghi gộp
+    void generateStatements(const NodeId* begin, const NodeId* end, bool top_level);
+    // Thân vòng lặp: khôi phục phần chuỗi mà các lời gọi hàm ROM từ symbolic_chain[from] trở đi
+    // đã ghi đè (stack của hàm được gọi nằm ngay dưới SP); trả về số lời gọi
+    uint32_t restoreCallWindows(size_t from);
+    uint32_t newLabel() { return label_count++; }
+    // Đặt nhãn ngay trước entry cuối cùng của chuỗi (word đệm của gadget vừa phát)
+    void labelLastWord(uint32_t label);
+    // Đặt nhãn ở cuối chuỗi (đích của bảng nhảy có label_offset = -2); quên mọi thanh ghi
+    void placeLabel(uint32_t label);
 
-    // --- Hàm trợ giúp cho biểu thức ---
-    // Hàm này sẽ sinh ra các gadget để đánh giá một biểu thức và đưa kết quả vào thanh ghi R0.
-    // Trả về giá trị của biểu thức, nhưng quan trọng là ROP chain sẽ đặt nó vào R0.
-    void evaluateExpressionIntoR0(const ASTNode& expr_node);
+    // Chọn gadget cho một câu lệnh (xem InstructionSelector) rồi đẩy vào chuỗi ký hiệu
+    SelectionCost selectStatement(NodeId node);
+    void emitBulkStore(const BulkStore& store);
+    // Đẩy các bước trong `selected` vào chuỗi ký hiệu
+    void pushSelected();
 
-    // --- Hàm tiện ích để push địa chỉ gadget và dữ liệu vào ROP chain ---
+    // --- Hàm tiện ích để push gadget và dữ liệu vào chuỗi ký hiệu ---
     void pushGadget(GadgetFunction func);
     void pushData(unsigned int data);
+    void pushPad();
+    // Tra địa chỉ ROM cho chuỗi ký hiệu, ghi kết quả vào rop_chain
+    void resolveChain();
+    uint16_t fillerWord() const;
+    unsigned int resolveAddress(GadgetFunction func) const;
 
-    // --- Chiến lược quản lý thanh ghi đơn giản ---
-    // Với nhiều thanh ghi, chúng ta có thể cần một chiến lược tốt hơn.
-    // Tạm thời, giả định các gadget Pop/Move có sẵn để di chuyển giá trị.
-    // Ví dụ: pushValueIntoR0(value), pushValueIntoR1(value)
-    // Để làm phức tạp hơn nữa, chúng ta có thể thêm một "trình phân bổ thanh ghi" (register allocator) đơn giản.
+    // Ô nhớ tạm (ngay sau vùng biến của SymbolTable) để giữ kết quả trung gian
+    unsigned int spillSlotAddress(unsigned int depth) const;
 };
 
 #endif // ROP_GENERATOR_H
@@ -0,0 +1,163 @@
+#include "RegisterAllocator.h"
+#include <algorithm>
+
+// --- RegisterFile Implementation ---
+void RegisterFile::clobber(RegMask mask) {
+    for (size_t i = 0; i < kPairCount; ++i) {
+        if (mask & reg::er(static_cast<unsigned int>(i * 2))) {
+            pairs[i] = RegValue{};
+        }
+    }
+}
+
+void RegisterFile::set(unsigned int er, const RegValue& v) {
+    pairs[er / 2] = v;
+}
+
+void RegisterFile::storeTo(uint32_t address, unsigned int width) {
+    for (RegValue& v : pairs) {
+        // Word [v.value, v.value + 2) chồng lên [address, address + width)?
+        if (v.kind == RegValue::Kind::Word && v.value < address + width && address < v.value + 2u) {
+            v = RegValue{};
+        }
+    }
+}
+
+void RegisterFile::storeUnknown() {
+    for (RegValue& v : pairs) {
+        if (v.kind == RegValue::Kind::Word) {
+            v = RegValue{};
+        }
+    }
+}
+
+RegMask RegisterFile::find(const RegValue& v) const {
+    RegMask mask = 0;
+    if (!v.known()) return mask;
+    for (size_t i = 0; i < kPairCount; ++i) {
+        if (pairs[i] == v) {
+            mask |= reg::er(static_cast<unsigned int>(i * 2));
+        }
+    }
+    return mask;
+}
+
+// --- LivenessInfo Implementation ---
+void LivenessInfo::addEvent(uint32_t address, uint32_t position, bool is_write) {
+    events[address & 0xFFFF].push_back(position * 2 + (is_write ? 1 : 0));
+}
+
+void LivenessInfo::collectReads(const AstArena& ast, const SymbolTable& symbols, NodeId expr, uint32_t position) {
+    const NodeSlots& s = ast.at(expr);
+    switch (ast.type(expr)) {
+        case NodeType::Identifier:
+            if (const SymbolInfo* sym = symbols.get_symbol(s.a)) {
+                addEvent(sym->address, position, false);
+            }
+            break;
+        case NodeType::MemRead:
+            if (ast.type(s.a) == NodeType::IntegerLiteral) {
+                addEvent(ast.at(s.a).a, position, false);
+            } else {
+                collectReads(ast, symbols, s.a, position);
+            }
+            break;
+        case NodeType::BinaryOp:
+            collectReads(ast, symbols, s.a, position);
+            collectReads(ast, symbols, s.b, position);
+            break;
+        default:
+            break;
+    }
+}
+
+void LivenessInfo::build(const AstArena& ast, const SymbolTable& symbols) {
+    events.clear();
+    uint32_t position = 0;
+    for (const NodeId* it = ast.statementsBegin(ast.root); it != ast.statementsEnd(ast.root); ++it, ++position) {
+        const NodeSlots& s = ast.at(*it);
+        switch (ast.type(*it)) {
+            case NodeType::Assignment:
+                collectReads(ast, symbols, s.b, position);
+                if (const SymbolInfo* sym = symbols.get_symbol(s.a)) {
+                    addEvent(sym->address, position, true);
+                }
+                break;
+            case NodeType::MemWrite:
+                collectReads(ast, symbols, s.a, position);
+                collectReads(ast, symbols, s.b, position);
+                if (ast.type(s.a) == NodeType::IntegerLiteral) {
+                    addEvent(ast.at(s.a).a, position, true);
+                }
+                break;
+            case NodeType::PrintChar:
+                collectReads(ast, symbols, s.a, position);
+                collectReads(ast, symbols, s.b, position);
+                collectReads(ast, symbols, s.c, position);
+                break;
+            case NodeType::While:
+            case NodeType::Repeat:
+            case NodeType::If:
+            case NodeType::Call:
+                collectBlockReads(ast, symbols, it, it + 1, position);
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+void LivenessInfo::collectBlockReads(const AstArena& ast, const SymbolTable& symbols, const NodeId* begin,
+                                     const NodeId* end, uint32_t position) {
+    for (const NodeId* it = begin; it != end; ++it) {
+        const NodeSlots& s = ast.at(*it);
+        switch (ast.type(*it)) {
+            case NodeType::Assignment:
+                collectReads(ast, symbols, s.b, position);
+                break;
+            case NodeType::MemWrite:
+                collectReads(ast, symbols, s.a, position);
+                collectReads(ast, symbols, s.b, position);
+                break;
+            case NodeType::PrintChar:
+                collectReads(ast, symbols, s.a, position);
+                collectReads(ast, symbols, s.b, position);
+                collectReads(ast, symbols, s.c, position);
+                break;
+            case NodeType::While:
+            case NodeType::Repeat:
+                collectReads(ast, symbols, s.a, position);
+                collectBlockReads(ast, symbols, ast.bodyBegin(*it), ast.bodyEnd(*it), position);
+                break;
+            case NodeType::If:
+                collectReads(ast, symbols, s.a, position);
+                collectBlockReads(ast, symbols, ast.statementsBegin(s.b), ast.statementsEnd(s.b), position);
+                collectBlockReads(ast, symbols, ast.statementsBegin(s.c), ast.statementsEnd(s.c), position);
+                break;
+            case NodeType::Call:
+                collectBlockReads(ast, symbols, ast.bodyBegin(s.a), ast.bodyEnd(s.a), position);
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+bool LivenessInfo::liveAfter(uint32_t position, uint32_t address) const {
+    auto it = events.find(address & 0xFFFF);
+    if (it == events.end()) return false;
+    // Sự kiện đầu tiên thuộc câu lệnh sau `position`; đọc trong câu lệnh đó đứng trước ghi
+    auto next = std::lower_bound(it->second.begin(), it->second.end(), (position + 1) * 2);
+    return next != it->second.end() && (*next & 1) == 0;
+}
+
+RegMask LivenessInfo::liveRegisters(const RegisterFile& file, uint32_t position) const {
+    RegMask mask = 0;
+    for (size_t i = 0; i < RegisterFile::kPairCount; ++i) {
+        const RegValue& v = file.get(static_cast<unsigned int>(i * 2));
+        if (v.kind == RegValue::Kind::Word && liveAfter(position, v.value)) {
+            mask |= reg::er(static_cast<unsigned int>(i * 2));
+        }
+    }
+    return mask;
+}
@@ -0,0 +1,79 @@
+#ifndef REGISTER_ALLOCATOR_H
+#define REGISTER_ALLOCATOR_H
+
+#include "Parser.h"
+#include "GadgetEffect.h"
+#include <array>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+// --- Theo dõi thanh ghi giữa các câu lệnh ---
+// RegisterFile ghi lại giá trị đã biết trong từng cặp ER0..ER14 sau mỗi gadget
+// được phát (dựa trên GadgetEffect::writes, nên cả các pop phụ như "pop qr8"
+// hay "pop xr4" cũng làm mất giá trị). Bộ chọn gadget dùng nó để lấy lại một
+// hằng hoặc một biến đã nằm sẵn trong thanh ghi thay vì nạp lại từ RAM.
+// LivenessInfo cho biết giá trị trong RAM nào còn được đọc ở các câu lệnh sau,
+// để bộ chọn ưu tiên cách phủ không phá các thanh ghi đang giữ giá trị còn sống.
+
+struct RegValue {
+    enum class Kind : uint8_t { Unknown, Const, Word }; // Word = word tại địa chỉ cố định (biến, MEM[hằng])
+    Kind kind = Kind::Unknown;
+    uint16_t value = 0; // Hằng số hoặc địa chỉ
+
+    bool known() const { return kind != Kind::Unknown; }
+    bool operator==(const RegValue& other) const { return kind == other.kind && value == other.value; }
+
+    static RegValue constant(uint32_t v) { return RegValue{Kind::Const, static_cast<uint16_t>(v)}; }
+    static RegValue word(uint32_t address) { return RegValue{Kind::Word, static_cast<uint16_t>(address)}; }
+};
+
+class RegisterFile {
+public:
+    static constexpr size_t kPairCount = 8; // ER0, ER2, ..., ER14
+
+    // Quên mọi giá trị (đầu chương trình, nhãn nhảy tới, lời gọi không rõ tác động)
+    void clear() { pairs.fill(RegValue{}); }
+
+    // Gadget vừa ghi các thanh ghi trong mask: cặp nào bị chạm (dù chỉ một byte) thì mất giá trị
+    void clobber(RegMask mask);
+    // Cặp ERn (n chẵn) giờ chứa giá trị v
+    void set(unsigned int er, const RegValue& v);
+    const RegValue& get(unsigned int er) const { return pairs[er / 2]; }
+
+    // Ghi `width` byte vào địa chỉ cố định: mọi Word chồng lấn mất hiệu lực
+    void storeTo(uint32_t address, unsigned int width);
+    // Ghi vào địa chỉ không biết trước: mọi Word mất hiệu lực (hằng vẫn giữ)
+    void storeUnknown();
+
+    // Các cặp đang giữ v (mask theo byte, như reg::er(n))
+    RegMask find(const RegValue& v) const;
+
+private:
+    std::array<RegValue, kPairCount> pairs{};
+};
+
+// Thời điểm đọc/ghi từng địa chỉ cố định theo thứ tự câu lệnh cấp cao nhất
+class LivenessInfo {
+public:
+    void build(const AstArena& ast, const SymbolTable& symbols);
+
+    // Word tại `address` còn được đọc sau câu lệnh thứ `position` (trước khi bị ghi đè)?
+    bool liveAfter(uint32_t position, uint32_t address) const;
+
+    // Các thanh ghi trong `file` đang giữ giá trị còn sống sau câu lệnh `position`
+    RegMask liveRegisters(const RegisterFile& file, uint32_t position) const;
+
+private:
+    // Mỗi sự kiện: vị trí * 2 + (1 nếu là ghi), tăng dần
+    std::unordered_map<uint32_t, std::vector<uint32_t>> events;
+
+    void collectReads(const AstArena& ast, const SymbolTable& symbols, NodeId expr, uint32_t position);
+    // Mọi lần đọc trong một khối (thân vòng lặp, nhánh IF, kể cả lồng nhau) được tính tại
+    // vị trí của câu lệnh cấp cao nhất chứa nó
+    void collectBlockReads(const AstArena& ast, const SymbolTable& symbols, const NodeId* begin, const NodeId* end,
+                           uint32_t position);
+    void addEvent(uint32_t address, uint32_t position, bool is_write);
+};
+
+#endif // REGISTER_ALLOCATOR_H
@@ -0,0 +1,56 @@
+#include "StringInterner.h"
+#include "PerfectHash.h"
+
+uint32_t StringInterner::find(std::string_view str) const {
+    if (table.empty()) {
+        return kNoId;
+    }
+    uint32_t h = perfect_hash::hash(str, 0);
+    size_t mask = table.size() - 1;
+    for (size_t idx = h & mask;; idx = (idx + 1) & mask) {
+        uint32_t id = table[idx];
+        if (id == kNoId) {
+            return kNoId;
+        }
+        if (hashes[id] == h && strings[id] == str) {
+            return id;
+        }
+    }
+}
+
+uint32_t StringInterner::intern(std::string_view str) {
+    // Giữ hệ số tải <= 1/2
+    if ((strings.size() + 1) * 2 > table.size()) {
+        grow();
+    }
+    uint32_t h = perfect_hash::hash(str, 0);
+    size_t mask = table.size() - 1;
+    size_t idx = h & mask;
+    for (;; idx = (idx + 1) & mask) {
+        uint32_t id = table[idx];
+        if (id == kNoId) {
+            break;
+        }
+        if (hashes[id] == h && strings[id] == str) {
+            return id;
+        }
+    }
+    uint32_t new_id = static_cast<uint32_t>(strings.size());
+    strings.push_back(str);
+    hashes.push_back(h);
+    table[idx] = new_id;
+    return new_id;
+}
+
+void StringInterner::grow() {
+    size_t new_size = table.empty() ? 64 : table.size() * 2;
+    table.assign(new_size, kNoId);
+    size_t mask = new_size - 1;
+    for (uint32_t id = 0; id < strings.size(); ++id) {
+        size_t idx = hashes[id] & mask;
+        while (table[idx] != kNoId) {
+            idx = (idx + 1) & mask;
+        }
+        table[idx] = id;
+    }
+}
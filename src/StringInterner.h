@@ -0,0 +1,32 @@
+#ifndef STRING_INTERNER_H
+#define STRING_INTERNER_H
+
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+// --- Bảng intern chuỗi ---
+// Gán cho mỗi chuỗi phân biệt một ID nguyên liên tiếp (0, 1, 2, ...).
+// Bảng băm địa chỉ mở (dò tuyến tính); chuỗi được lưu dưới dạng string_view
+// trỏ vào mã nguồn, nên mã nguồn phải sống lâu hơn bảng intern.
+class StringInterner {
+public:
+    static constexpr uint32_t kNoId = 0xFFFFFFFF;
+
+    // Trả về ID có sẵn hoặc cấp ID mới
+    uint32_t intern(std::string_view str);
+    // Trả về kNoId nếu chuỗi chưa được intern
+    uint32_t find(std::string_view str) const;
+
+    std::string_view name(uint32_t id) const { return strings[id]; }
+    size_t size() const { return strings.size(); }
+
+private:
+    std::vector<std::string_view> strings; // chỉ số = ID
+    std::vector<uint32_t> hashes;          // hash của từng chuỗi, dùng lại khi mở rộng bảng
+    std::vector<uint32_t> table;           // ô bảng băm chứa ID, kNoId = trống
+
+    void grow();
+};
+
+#endif // STRING_INTERNER_H
@@ -0,0 +1,120 @@
+#include "SuperoptTable.h"
+#include <array>
+#include <stdexcept>
+
+namespace {
+
+constexpr std::array<std::string_view, 4> kGoalNames = {"load_const", "copy", "add_const", "store_abs"};
+
+std::string_view trim(std::string_view s) {
+    while (!s.empty() && (s.front() == ' ' || s.front() == '\t')) s.remove_prefix(1);
+    while (!s.empty() && (s.back() == ' ' || s.back() == '\t' || s.back() == '\r')) s.remove_suffix(1);
+    return s;
+}
+
+// Tách theo dấu phân cách, cắt khoảng trắng từng phần
+std::vector<std::string_view> split(std::string_view s, std::string_view separator) {
+    std::vector<std::string_view> parts;
+    while (true) {
+        size_t at = s.find(separator);
+        parts.push_back(trim(s.substr(0, at)));
+        if (at == std::string_view::npos) break;
+        s.remove_prefix(at + separator.size());
+    }
+    return parts;
+}
+
+// "er6" -> 6; -1 nếu không phải cặp ERn
+int parsePair(std::string_view s) {
+    if (s.size() < 3 || s.size() > 4 || s.substr(0, 2) != "er") return -1;
+    int n = 0;
+    for (char c : s.substr(2)) {
+        if (c < '0' || c > '9') return -1;
+        n = n * 10 + (c - '0');
+    }
+    return n <= 14 && n % 2 == 0 ? n : -1;
+}
+
+bool usesSource(SuperoptGoal goal) { return goal == SuperoptGoal::Copy || goal == SuperoptGoal::StoreAbs; }
+bool usesDestination(SuperoptGoal goal) { return goal != SuperoptGoal::StoreAbs; }
+
+} // namespace
+
+std::string_view superoptGoalName(SuperoptGoal goal) {
+    return kGoalNames[static_cast<size_t>(goal)];
+}
+
+std::string formatSuperoptEntry(const SuperoptEntry& entry) {
+    std::string line(superoptGoalName(entry.goal));
+    if (usesSource(entry.goal)) line += " er" + std::to_string(entry.src);
+    if (usesDestination(entry.goal)) line += " er" + std::to_string(entry.dst);
+    line += " | ";
+    unsigned int words = 0;
+    for (size_t i = 0; i < entry.gadgets.size(); ++i) {
+        if (i > 0) line += " ; ";
+        line += gadgetSpelling(entry.gadgets[i]);
+        words += gadgetPopWords(entry.gadgets[i]);
+    }
+    line += " |";
+    if (words == 0) line += " -";
+    for (unsigned int w = 0; w < words; ++w) {
+        line += (entry.param_words >> w) & 1 ? " K" : " _";
+    }
+    return line;
+}
+
+std::vector<SuperoptEntry> parseSuperoptTable(std::istream& in, const std::string& source) {
+    std::vector<SuperoptEntry> entries;
+    std::string line;
+    size_t line_number = 0;
+    while (std::getline(in, line)) {
+        ++line_number;
+        std::string_view rest(line);
+        rest = trim(rest.substr(0, rest.find('#')));
+        if (rest.empty()) continue;
+        auto bad = [&](const std::string& what) {
+            return std::runtime_error("Lỗi: Bảng superopt " + source + ":" + std::to_string(line_number) + ": " + what);
+        };
+
+        // " | " (có khoảng trắng hai bên): cách viết "r0 = 0 |r0 = 1" cũng chứa '|'
+        std::vector<std::string_view> columns = split(rest, " | ");
+        if (columns.size() != 3) throw bad("cần 3 cột cách nhau bởi ' | '");
+
+        SuperoptEntry entry;
+        std::vector<std::string_view> head = split(columns[0], " ");
+        size_t goal = 0;
+        while (goal < kGoalNames.size() && kGoalNames[goal] != head[0]) ++goal;
+        if (goal == kGoalNames.size()) throw bad("mục tiêu không biết '" + std::string(head[0]) + "'");
+        entry.goal = static_cast<SuperoptGoal>(goal);
+        size_t expected = 1 + (usesSource(entry.goal) ? 1 : 0) + (usesDestination(entry.goal) ? 1 : 0);
+        if (head.size() != expected) throw bad("sai số toán hạng của '" + std::string(head[0]) + "'");
+        size_t next = 1;
+        int pair = 0;
+        if (usesSource(entry.goal)) {
+            if ((pair = parsePair(head[next++])) < 0) throw bad("thanh ghi nguồn không hợp lệ");
+            entry.src = static_cast<uint8_t>(pair);
+        }
+        if (usesDestination(entry.goal)) {
+            if ((pair = parsePair(head[next++])) < 0) throw bad("thanh ghi đích không hợp lệ");
+            entry.dst = static_cast<uint8_t>(pair);
+        }
+
+        unsigned int words = 0;
+        for (std::string_view spelling : split(columns[1], " ; ")) {
+            GadgetFunction func = lookupGadget(spelling);
+            if (func == GadgetFunction::UNKNOWN_GADGET) throw bad("gadget không biết '" + std::string(spelling) + "'");
+            entry.gadgets.push_back(func);
+            words += gadgetPopWords(func);
+        }
+
+        std::vector<std::string_view> holes = split(columns[2], " ");
+        if (holes.size() == 1 && holes[0] == "-") holes.clear();
+        if (holes.size() != words || words > 32) throw bad("số ô pop không khớp dãy gadget");
+        for (unsigned int w = 0; w < words; ++w) {
+            if (holes[w] == "K") entry.param_words |= 1u << w;
+            else if (holes[w] != "_") throw bad("ô pop phải là K hoặc _");
+        }
+        entries.push_back(std::move(entry));
+    }
+    return entries;
+}
@@ -0,0 +1,49 @@
+#ifndef SUPEROPT_TABLE_H
+#define SUPEROPT_TABLE_H
+
+#include "GadgetFunction.h"
+#include <cstdint>
+#include <istream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// --- Bảng dãy gadget tối ưu (do tools/superopt tạo ra cho từng ROM) ---
+// Mỗi dòng là dãy gadget ngắn nhất (theo byte trong chuỗi) tìm được cho một
+// tác động nhỏ, đã được kiểm chứng bằng giả lập trên trạng thái ngẫu nhiên:
+//
+//   load_const er2 | pop er2 | K                  # er2 = K
+//   copy er0 er4 | er4 = ... ; ... | _ _          # er4 = er0
+//   add_const er0 | pop er2 ; er0+=er2,rt | K     # er0 += K
+//   store_abs er0 | pop er2 ; [er2]=er0,... | K _ # [K] = er0 (word)
+//
+// Các cột cách nhau bởi " | ". Cột thứ hai là các cách viết gadget (như trong
+// GadgetTable.def) cách nhau bởi " ; ". Cột thứ ba cho từng word pop của cả
+// dãy: K = nhận toán hạng, _ = đệm ("-" nếu dãy không pop gì). Phần sau '#'
+// là chú thích.
+// InstructionSelector biến mỗi dòng thành một luật chọn lệnh.
+
+enum class SuperoptGoal : uint8_t {
+    LoadConst, // ER[dst] = K
+    Copy,      // ER[dst] = ER[src]
+    AddConst,  // ER[dst] += K
+    StoreAbs,  // word [K] = ER[src]
+};
+
+struct SuperoptEntry {
+    SuperoptGoal goal = SuperoptGoal::LoadConst;
+    uint8_t dst = 0; // n của ERn
+    uint8_t src = 0;
+    std::vector<GadgetFunction> gadgets;
+    uint32_t param_words = 0; // Bit w: word pop thứ w (đếm qua cả dãy) nhận K
+};
+
+std::string_view superoptGoalName(SuperoptGoal goal);
+
+// Một dòng của bảng (không có chú thích, không có '\n')
+std::string formatSuperoptEntry(const SuperoptEntry& entry);
+
+// Đọc bảng; `source` chỉ dùng cho thông báo lỗi. Ném std::runtime_error nếu có dòng sai.
+std::vector<SuperoptEntry> parseSuperoptTable(std::istream& in, const std::string& source);
+
+#endif // SUPEROPT_TABLE_H
@@ -0,0 +1,32 @@
+// gadgetc: biên dịch database gadget dạng văn bản thành ảnh nhị phân (xem GadgetImage.h).
+//
+// Build (từ thư mục gốc repo):
+//   g++ -std=c++17 -O2 -Isrc tools/gadgetc.cpp src/ROPGenerator.cpp src/GadgetImage.cpp src/GadgetEffect.cpp
+//       src/InstructionSelector.cpp src/RegisterAllocator.cpp src/ChainOptimizer.cpp src/SuperoptTable.cpp
+//       src/MappedFile.cpp src/Parser.cpp src/Lexer.cpp src/StringInterner.cpp -o gadgetc
+// Dùng:  ./gadgetc data/nx_u8_gadget.txt data/nx_u8_gadget.bin
+#include "GadgetImage.h"
+#include "ROPGenerator.h"
+#include <exception>
+#include <iostream>
+
+int main(int argc, char** argv) {
+    if (argc != 3) {
+        std::cerr << "Cách dùng: " << argv[0] << " <gadget.txt> <gadget.bin>" << std::endl;
+        return 2;
+    }
+    try {
+        GadgetDB db;
+        db.loadFromFile(argv[1]);
+        std::vector<GadgetImage::Record> records = db.toImageRecords();
+        GadgetImage::write(argv[2], records);
+
+        // Đọc lại để chắc chắn ảnh hợp lệ (magic, checksum, kích thước)
+        GadgetImage verify(argv[2]);
+        std::cout << "Đã ghi " << verify.size() << " gadget vào " << argv[2] << std::endl;
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,475 @@
+// regress: biên dịch các chương trình hồi quy nhỏ (có và không có AstOptimizer, có và không có
+// địa chỉ payload), chạy payload (emitPayload) trong RAM giả lập với stack là chính payload
+// (xem GadgetEmulator.h) và so bộ nhớ với kết quả mong đợi: mọi byte khác đi phải là kết quả
+// mong đợi, vùng biến/ô tạm, hoặc nằm trong 8 byte dưới SP mà một lời gọi BL được phép ghi đè.
+// Payload cũng được giải mã ngược để kiểm tra bố cục byte và bảng nguồn.
+//
+// Build (từ thư mục gốc repo):
+//   g++ -std=c++17 -O2 -Isrc tools/regress.cpp src/ROPGenerator.cpp src/GadgetImage.cpp src/GadgetEffect.cpp
+//       src/GadgetEmulator.cpp src/InstructionSelector.cpp src/RegisterAllocator.cpp src/ChainOptimizer.cpp
+//       src/SuperoptTable.cpp src/MappedFile.cpp src/Optimizer.cpp src/Parser.cpp src/Lexer.cpp
+//       src/StringInterner.cpp -o regress
+// Dùng:  ./regress [file_gadget] > /dev/null   (mã thoát khác 0 nếu có ca sai)
+#include "GadgetEmulator.h"
+#include "Lexer.h"
+#include "Optimizer.h"
+#include "Parser.h"
+#include "ROPGenerator.h"
+#include <algorithm>
+#include <exception>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace {
+
+uint16_t loadWord(const MachineState& s, uint16_t address) {
+    return static_cast<uint16_t>(s.load(address) | (s.load(static_cast<uint16_t>(address + 1)) << 8));
+}
+
+// Các word mong đợi (địa chỉ, giá trị), tính từ trạng thái ban đầu của máy
+using Expectation = std::function<std::vector<std::pair<uint16_t, uint16_t>>(const MachineState&)>;
+
+// [12544] = f([12288])
+std::vector<std::pair<uint16_t, uint16_t>> resultOf(const MachineState& s, const std::function<uint32_t(uint32_t)>& f) {
+    return {{12544, static_cast<uint16_t>(f(loadWord(s, 12288)))}};
+}
+
+// Các word liên tiếp từ `first`
+std::vector<std::pair<uint16_t, uint16_t>> wordsAt(uint16_t first, const std::vector<uint16_t>& values) {
+    std::vector<std::pair<uint16_t, uint16_t>> result;
+    for (uint16_t value : values) {
+        result.emplace_back(first, value);
+        first = static_cast<uint16_t>(first + 2);
+    }
+    return result;
+}
+
+// Kiểm tra chuỗi có dùng `func` (ví dụ lệnh nhảy: vòng lặp không bị gập hay trải ra hết)
+std::function<std::string(const ROPGenerator&)> usesGadget(GadgetFunction func) {
+    return [func](const ROPGenerator& g) {
+        const std::vector<ChainEntry>& chain = g.symbolicChain();
+        bool found = std::any_of(chain.begin(), chain.end(), [func](const ChainEntry& e) {
+            return e.kind == ChainEntry::Kind::Gadget && e.func == func;
+        });
+        return found ? std::string() : "không dùng " + std::string(gadgetSpelling(func));
+    };
+}
+
+struct Case {
+    std::string name;
+    std::string source;
+    Expectation expect;
+    bool needs_address = false; // Có nhảy/gọi: chỉ chạy khi biết địa chỉ payload
+    // Thông báo lỗi nếu tính năng mà ca nhắm tới không được dùng khi biết địa chỉ payload (và bật
+    // tối ưu chuỗi), hoặc ""
+    std::function<std::string(const ROPGenerator&)> uses = nullptr;
+};
+
+// PRINT_CHAR(dòng, cột, c) ghi byte c vào [(dòng - 1) * 16 + cột]: word chứa byte đó sau khi ghi
+std::pair<uint16_t, uint16_t> printedChar(const MachineState& s, uint16_t address, uint8_t c) {
+    uint16_t word = static_cast<uint16_t>(address & ~1u);
+    uint16_t value = loadWord(s, word);
+    value = static_cast<uint16_t>(address & 1 ? (value & 0x00FF) | (c << 8) : (value & 0xFF00) | c);
+    return {word, value};
+}
+
+// Địa chỉ RAM đặt payload khi chạy (cũng là địa chỉ truyền cho setPayloadAddress)
+constexpr uint16_t kPayloadAddress = 0x8000;
+constexpr size_t kMaxSteps = 100000;
+
+const std::vector<Case>& fixedCases() {
+    static const std::vector<Case> all = {
+        // Hằng gán trong thân SUB (không được gọi) không được lan ra chương trình chính
+        {"sub-known-value", "VAR v; v = 66; SUB s { v = 322; } MEM[12402] = v;",
+         [](const MachineState&) { return std::vector<std::pair<uint16_t, uint16_t>>{{12402, 66}}; }},
+        // Ghi qr0 chỉ khi cả 8 byte đều được ghi: word lẻ không được kéo theo byte 0 vào [260]
+        {"wide-store-odd-words", "MEM[256] = 1; MEM[257] = 2; MEM[258] = 3; MEM[262] = 4;",
+         [](const MachineState&) { return std::vector<std::pair<uint16_t, uint16_t>>{{256, 0x0201}, {258, 3}, {262, 4}}; }},
+        // Nhân/chia 16 bit với toán hạng không phải hằng, như khi gập hằng
+        {"multiply-16bit", "VAR x; VAR y; x = MEM[12288]; y = 300; MEM[12544] = x * y;",
+         [](const MachineState& s) { return resultOf(s, [](uint32_t x) { return x * 300; }); }},
+        {"divide-16bit", "MEM[12544] = MEM[12288] / MEM[12290];",
+         [](const MachineState& s) {
+             uint16_t y = loadWord(s, 12290);
+             return resultOf(s, [y](uint32_t x) { return y ? x / y : 0xFFFF; });
+         }},
+        {"divide-8bit-divisor", "MEM[12544] = MEM[12288] / (MEM[12290] / 512);",
+         [](const MachineState& s) {
+             uint16_t y = loadWord(s, 12290) / 512;
+             return resultOf(s, [y](uint32_t x) { return y ? x / y : 0xFFFF; });
+         }},
+        // Tham số MACRO vừa nằm trong biểu thức con được gập vừa đứng riêng: lần gập không được sửa đối số
+        {"macro-folded-parameter", "MACRO f(x, y) = (x + 1) * y + x; MEM[12544] = f(5, MEM[12288]);",
+         [](const MachineState& s) { return resultOf(s, [](uint32_t y) { return 6 * y + 5; }); }},
+        // Số chia hằng ngoài dạng 16^k * m (m < 256)
+        {"divide-257", "MEM[12544] = MEM[12288] / 257;",
+         [](const MachineState& s) { return resultOf(s, [](uint32_t x) { return x / 257; }); }},
+        {"divide-300", "MEM[12544] = MEM[12288] / 300;",
+         [](const MachineState& s) { return resultOf(s, [](uint32_t x) { return x / 300; }); }},
+        {"divide-1000", "MEM[12544] = MEM[12288] / 1000;",
+         [](const MachineState& s) { return resultOf(s, [](uint32_t x) { return x / 1000; }); }},
+        // Dãy ghi hằng thành memset / memcpy: chỉ đúng 24 byte đích được ghi (BL còn đè 8 byte dưới SP)
+        {"fill-run",
+         "MEM[12544] = 16705; MEM[12546] = 16705; MEM[12548] = 16705; MEM[12550] = 16705; "
+         "MEM[12552] = 16705; MEM[12554] = 16705; MEM[12556] = 16705; MEM[12558] = 16705; "
+         "MEM[12560] = 16705; MEM[12562] = 16705; MEM[12564] = 16705; MEM[12566] = 16705;",
+         [](const MachineState&) { return wordsAt(12544, std::vector<uint16_t>(12, 16705)); }, false,
+         [](const ROPGenerator& g) { return g.bulkStoreStats().fills > 0 ? "" : "không có memset"; }},
+        {"copy-run",
+         "MEM[12544] = 4097; MEM[12546] = 8195; MEM[12548] = 12293; MEM[12550] = 16391; "
+         "MEM[12552] = 20489; MEM[12554] = 24587; MEM[12556] = 28685; MEM[12558] = 32783; "
+         "MEM[12560] = 36881; MEM[12562] = 40979; MEM[12564] = 45077; MEM[12566] = 49175;",
+         [](const MachineState&) {
+             return wordsAt(12544, {4097, 8195, 12293, 16391, 20489, 24587, 28685, 32783, 36881, 40979, 45077, 49175});
+         },
+         false,
+         [](const ROPGenerator& g) { return g.bulkStoreStats().copies > 0 ? "" : "không có memcpy"; }},
+        // Vòng lặp (nhảy bằng sp=[er8]): REPEAT đếm, WHILE theo ô nhớ, và BL trong thân vòng lặp
+        // (vùng 8 byte dưới SP bị đè phải được khôi phục trước lần lặp sau)
+        {"repeat-counted", "VAR i; VAR s; i = MEM[12288]; s = 0; REPEAT 5 { s = s + i; i = i + 3; } MEM[12544] = s;",
+         [](const MachineState& s) { return resultOf(s, [](uint32_t x) { return 5 * x + 30; }); }, true,
+         usesGadget(GadgetFunction::LOAD_SP_FROM_ER8_POP_ER8)},
+        {"repeat-nested", "VAR s; s = MEM[12288]; REPEAT 3 { REPEAT 4 { s = s + 1; } s = s + 100; } MEM[12544] = s;",
+         [](const MachineState& s) { return resultOf(s, [](uint32_t x) { return x + 312; }); }, true,
+         usesGadget(GadgetFunction::LOAD_SP_FROM_ER8_POP_ER8)},
+        {"while-memory",
+         "VAR s; s = 0; MEM[12546] = MEM[12288] / 4096; WHILE MEM[12546] { MEM[12546] = MEM[12546] - 1; s = s + 3; } "
+         "MEM[12544] = s;",
+         [](const MachineState& s) {
+             uint16_t x = loadWord(s, 12288);
+             return std::vector<std::pair<uint16_t, uint16_t>>{{12544, static_cast<uint16_t>(x / 4096 * 3)}, {12546, 0}};
+         },
+         true, usesGadget(GadgetFunction::LOAD_SP_FROM_ER8_POP_ER8)},
+        {"repeat-fill-run",
+         "VAR i; i = 0; REPEAT 3 { "
+         "MEM[12548] = 16705; MEM[12550] = 16705; MEM[12552] = 16705; MEM[12554] = 16705; "
+         "MEM[12556] = 16705; MEM[12558] = 16705; MEM[12560] = 16705; MEM[12562] = 16705; "
+         "MEM[12564] = 16705; MEM[12566] = 16705; MEM[12568] = 16705; MEM[12570] = 16705;"
+         " i = i + 1; MEM[12544] = i; }",
+         [](const MachineState&) {
+             std::vector<std::pair<uint16_t, uint16_t>> expected = wordsAt(12548, std::vector<uint16_t>(12, 16705));
+             expected.emplace_back(12544, 3);
+             return expected;
+         },
+         true, [](const ROPGenerator& g) { return g.bulkStoreStats().fills > 0 ? "" : "không có memset"; }},
+        {"while-copy-run",
+         "MEM[12544] = MEM[12288] / 16384 + 2; WHILE MEM[12544] { "
+         "MEM[12548] = 4097; MEM[12550] = 8195; MEM[12552] = 12293; MEM[12554] = 16391; "
+         "MEM[12556] = 20489; MEM[12558] = 24587; MEM[12560] = 28685; MEM[12562] = 32783; "
+         "MEM[12564] = 36881; MEM[12566] = 40979; MEM[12568] = 45077; MEM[12570] = 49175;"
+         " MEM[12544] = MEM[12544] - 1; }",
+         [](const MachineState&) {
+             std::vector<std::pair<uint16_t, uint16_t>> expected =
+                 wordsAt(12548, {4097, 8195, 12293, 16391, 20489, 24587, 28685, 32783, 36881, 40979, 45077, 49175});
+             expected.emplace_back(12544, 0);
+             return expected;
+         },
+         true, [](const ROPGenerator& g) { return g.bulkStoreStats().copies > 0 ? "" : "không có memcpy"; }},
+        // Chương trình con: CALL hai lần (quay về đúng chỗ gọi), SUB có BL (vùng dưới SP được khôi phục
+        // trước lần gọi sau), và tách đoạn chuỗi lặp lại thành chương trình con (outlining)
+        {"sub-called-twice", "VAR v; SUB s { v = v + 3; } v = MEM[12288]; CALL s; MEM[12546] = v; CALL s; MEM[12544] = v;",
+         [](const MachineState& s) {
+             uint16_t x = loadWord(s, 12288);
+             return wordsAt(12544, {static_cast<uint16_t>(x + 6), static_cast<uint16_t>(x + 3)});
+         },
+         true, usesGadget(GadgetFunction::SP_ER14_POP_ER14_RT)},
+        {"sub-fill-run-called-twice",
+         "VAR i; i = MEM[12288]; SUB s { "
+         "MEM[12548] = 16705; MEM[12550] = 16705; MEM[12552] = 16705; MEM[12554] = 16705; "
+         "MEM[12556] = 16705; MEM[12558] = 16705; MEM[12560] = 16705; MEM[12562] = 16705; "
+         "MEM[12564] = 16705; MEM[12566] = 16705; MEM[12568] = 16705; MEM[12570] = 16705; "
+         "i = i + 1; } CALL s; CALL s; MEM[12544] = i;",
+         [](const MachineState& s) {
+             std::vector<std::pair<uint16_t, uint16_t>> expected = wordsAt(12548, std::vector<uint16_t>(12, 16705));
+             expected.emplace_back(12544, static_cast<uint16_t>(loadWord(s, 12288) + 2));
+             return expected;
+         },
+         true, [](const ROPGenerator& g) { return g.bulkStoreStats().fills > 0 ? "" : "không có memset"; }},
+        {"outlined-fragments",
+         "VAR v; v = MEM[12288]; v = v * 3 + 1; MEM[12544] = v; v = v * 3 + 1; MEM[12546] = v; "
+         "v = v * 3 + 1; MEM[12548] = v; v = v * 3 + 1; MEM[12550] = v;",
+         [](const MachineState& s) {
+             uint16_t v = loadWord(s, 12288);
+             std::vector<uint16_t> values;
+             for (int i = 0; i < 4; ++i) values.push_back(v = static_cast<uint16_t>(v * 3 + 1));
+             return wordsAt(12544, values);
+         },
+         false, [](const ROPGenerator& g) { return g.outlineStats().subroutines > 0 ? "" : "không tách đoạn nào"; }},
+        // Tận dụng ô đệm: word của "pop er0" được đưa vào ô đệm của "[er4]=er0,pop er0" phía trước.
+        // Nhãn cuối IF nằm giữa ô đệm (cuối nhánh) và pop: khi nhánh bị bỏ qua, pop vẫn phải chạy
+        {"filler-reuse",
+         "VAR a; VAR b; a = MEM[12288] / 4096; b = MEM[12290] / 4096; PRINT_CHAR(2, a, 65); PRINT_CHAR(3, b, 66);",
+         [](const MachineState& s) {
+             return std::vector<std::pair<uint16_t, uint16_t>>{
+                 printedChar(s, static_cast<uint16_t>(16 + loadWord(s, 12288) / 4096), 65),
+                 printedChar(s, static_cast<uint16_t>(32 + loadWord(s, 12290) / 4096), 66)};
+         },
+         false, [](const ROPGenerator& g) { return g.fillerStats().gadgets_removed > 0 ? "" : "không bỏ gadget pop nào"; }},
+        {"filler-label-between",
+         "VAR a; a = MEM[12288] / 4096; IF a > 7 { MEM[12546] = a; } PRINT_CHAR(2, a, 65);",
+         [](const MachineState& s) {
+             uint16_t a = loadWord(s, 12288) / 4096;
+             std::vector<std::pair<uint16_t, uint16_t>> expected = {printedChar(s, static_cast<uint16_t>(16 + a), 65)};
+             if (a > 7) expected.emplace_back(12546, a);
+             return expected;
+         },
+         true, usesGadget(GadgetFunction::LOAD_SP_FROM_ER8_POP_ER8)},
+    };
+    return all;
+}
+
+// Mỗi phép so sánh, đúng và sai (b = a - 1, a, a + 1): làm giá trị 0/1, và làm điều kiện IF có và
+// không có ELSE, với nhánh chỉ gán một biến (chọn không rẽ nhánh) hoặc ghi MEM (buộc rẽ nhánh);
+// thêm một ca gán nhiều hơn kMaxPickedVariables biến (rẽ nhánh)
+std::vector<Case> comparisonCases() {
+    const std::vector<std::pair<std::string, std::function<bool(uint16_t, uint16_t)>>> operators = {
+        {"<", [](uint16_t a, uint16_t b) { return a < b; }},   {"<=", [](uint16_t a, uint16_t b) { return a <= b; }},
+        {">", [](uint16_t a, uint16_t b) { return a > b; }},   {">=", [](uint16_t a, uint16_t b) { return a >= b; }},
+        {"==", [](uint16_t a, uint16_t b) { return a == b; }}, {"!=", [](uint16_t a, uint16_t b) { return a != b; }},
+    };
+    const std::pair<std::string, int> offsets[] = {{"a - 1", -1}, {"a", 0}, {"a + 1", 1}};
+    // a trong [1, 32768]: a - 1 và a + 1 không tràn
+    auto operand = [](const MachineState& s) { return static_cast<uint16_t>(loadWord(s, 12288) / 2 + 1); };
+    std::vector<Case> list;
+    for (const auto& [spelling, compare] : operators) {
+        for (const auto& [b_source, offset] : offsets) {
+            list.push_back({"a " + spelling + " " + b_source,
+                            "VAR a; VAR b; a = MEM[12288] / 2 + 1; b = " + b_source + "; MEM[12544] = a " + spelling + " b;",
+                            [compare = compare, offset = offset, operand](const MachineState& s) {
+                                uint16_t a = operand(s);
+                                uint16_t result = compare(a, static_cast<uint16_t>(a + offset)) ? 1 : 0;
+                                return std::vector<std::pair<uint16_t, uint16_t>>{{12544, result}};
+                            }});
+            for (bool with_else : {false, true}) {
+                for (bool branch : {false, true}) {
+                    std::string arm = branch ? "MEM[12544] = " : "y = ";
+                    std::string name = "if a " + spelling + " " + b_source + (with_else ? " else" : "") +
+                                       (branch ? " (rẽ nhánh)" : "");
+                    std::string source = "VAR a; VAR b; VAR y; a = MEM[12288] / 2 + 1; b = " + b_source +
+                                         "; y = 5; MEM[12544] = 5; IF a " + spelling + " b { " + arm + "1; }" +
+                                         (with_else ? " ELSE { " + arm + "2; }" : "") +
+                                         (branch ? "" : " MEM[12544] = y;");
+                    Expectation expect = [compare = compare, offset = offset, with_else, operand](const MachineState& s) {
+                        uint16_t a = operand(s);
+                        uint16_t result = compare(a, static_cast<uint16_t>(a + offset)) ? 1 : with_else ? 2 : 5;
+                        return std::vector<std::pair<uint16_t, uint16_t>>{{12544, result}};
+                    };
+                    std::function<std::string(const ROPGenerator&)> uses = nullptr;
+                    if (branch) uses = usesGadget(GadgetFunction::LOAD_SP_FROM_ER8_POP_ER8);
+                    list.push_back({name, source, expect, branch, uses});
+                }
+            }
+        }
+    }
+    list.push_back({"if ba biến (rẽ nhánh)",
+                    "VAR a; VAR x; VAR y; VAR z; a = MEM[12288]; x = 0; y = 0; z = 0; "
+                    "IF a > 32767 { x = a; y = 2; z = 3; } ELSE { x = 4; y = a + 1; z = a; } "
+                    "MEM[12544] = x; MEM[12546] = y; MEM[12548] = z;",
+                    [](const MachineState& s) {
+                        uint16_t a = loadWord(s, 12288);
+                        bool high = a > 32767;
+                        return wordsAt(12544, {high ? a : uint16_t{4}, high ? uint16_t{2} : static_cast<uint16_t>(a + 1),
+                                               high ? uint16_t{3} : a});
+                    },
+                    true, usesGadget(GadgetFunction::LOAD_SP_FROM_ER8_POP_ER8)});
+    return list;
+}
+
+const std::vector<Case>& cases() {
+    static const std::vector<Case> all = [] {
+        std::vector<Case> list = fixedCases();
+        for (Case& c : comparisonCases()) list.push_back(std::move(c));
+        return list;
+    }();
+    return all;
+}
+
+// Chạy payload đã đặt tại kPayloadAddress trong s.ram đến BRK: pop pc đọc 4 byte (offset,
+// segment, đệm) tại SP. Ghi lại các vùng [SP-8, SP) của lời gọi BL vào `call_windows`.
+// Trả về thông báo lỗi hoặc ""
+std::string runPayload(const GadgetDB& db, RomHandle rom, MachineState& s,
+                       std::vector<std::pair<uint16_t, uint16_t>>& call_windows) {
+    std::map<unsigned int, GadgetFunction> by_address;
+    const RomModel& model = db.model(rom);
+    for (size_t f = 1; f < kGadgetFunctionCount; ++f) {
+        if (model.available.test(f)) by_address[model.addresses[f]] = static_cast<GadgetFunction>(f);
+    }
+    s.sp = kPayloadAddress;
+    for (size_t step = 0; step < kMaxSteps; ++step) {
+        uint16_t entry = s.sp;
+        unsigned int address = loadWord(s, entry) | (s.load(static_cast<uint16_t>(entry + 2)) << 16);
+        s.sp = static_cast<uint16_t>(entry + 4);
+        auto it = by_address.find(address);
+        if (it == by_address.end()) {
+            return "byte " + std::to_string(static_cast<uint16_t>(entry - kPayloadAddress)) + " không phải gadget";
+        }
+        if (it->second == GadgetFunction::BRK) return "";
+        if (gadgetEffect(it->second).calls) call_windows.emplace_back(static_cast<uint16_t>(s.sp - 8), s.sp);
+        if (!emulateGadget(it->second, s, nullptr)) {
+            return "không giả lập được " + std::string(gadgetSpelling(it->second));
+        }
+    }
+    return "quá " + std::to_string(kMaxSteps) + " gadget";
+}
+
+// Giải mã payload ngược về chuỗi ký hiệu: gadget 4 byte (offset, segment, đệm), word 2 byte
+// little-endian, nhãn 0 byte; phải khớp chuỗi word của generateROPChain, và các đoạn của
+// bảng nguồn phải nối tiếp nhau phủ kín payload. Trả về thông báo lỗi hoặc ""
+std::string checkPayload(const GadgetDB& db, RomHandle rom, const ROPGenerator& generator,
+                         const std::vector<uint8_t>& payload, const std::vector<unsigned int>& chain) {
+    size_t at = 0, word = 0;
+    auto fail = [&](const std::string& what) { return "payload byte " + std::to_string(at) + ": " + what; };
+    for (const ChainEntry& e : generator.symbolicChain()) {
+        if (e.kind == ChainEntry::Kind::Label) continue;
+        bool gadget = e.kind == ChainEntry::Kind::Gadget;
+        if (at + (gadget ? 4 : 2) > payload.size()) return fail("hết payload");
+        unsigned int value = payload[at] | (payload[at + 1] << 8);
+        unsigned int expected = 0;
+        switch (e.kind) {
+            case ChainEntry::Kind::Gadget:
+                value |= payload[at + 2] << 16;
+                expected = db.getAddress(rom, e.func);
+                if (payload[at + 3] != 0) return fail("byte đệm của gadget khác 0");
+                break;
+            case ChainEntry::Kind::Data: expected = e.value; break;
+            case ChainEntry::Kind::Pad: expected = 0; break;
+            default: return fail("entry chưa được điền");
+        }
+        if (value != expected) return fail(std::to_string(value) + ", mong đợi " + std::to_string(expected));
+        if (word >= chain.size() || chain[word] != value) return fail("khác word " + std::to_string(word) + " của chuỗi");
+        at += gadget ? 4 : 2;
+        word++;
+    }
+    if (at != payload.size() || word != chain.size()) return fail("thừa byte sau chuỗi");
+    uint32_t covered = 0;
+    for (const SourceMapEntry& m : generator.sourceMap()) {
+        if (m.offset != covered) return "bảng nguồn hở tại byte " + std::to_string(covered);
+        covered += m.size;
+    }
+    if (covered != payload.size()) return "bảng nguồn phủ " + std::to_string(covered) + " byte";
+    return "";
+}
+
+// RAM sau khi chạy (một bản cho mỗi seed) và độ dài payload, để so hai lần biên dịch
+struct RunResult {
+    std::vector<std::vector<uint8_t>> rams;
+    size_t payload_size = 0;
+};
+
+std::string check(const GadgetDB& db, RomHandle rom, const Case& c, bool optimize, uint16_t payload_address,
+                  bool chain_optimization, RunResult& result) {
+    Lexer lexer(std::string_view{c.source});
+    Parser parser(lexer);
+    AstArena arena;
+    parser.parse(arena);
+    AstOptimizer optimizer(parser.getSymbolTable());
+    if (optimize) optimizer.run(arena);
+    ROPGenerator generator(db, optimize ? optimizer.symbols() : parser.getSymbolTable());
+    if (optimize) generator.setScratchBase(optimizer.scratchEnd());
+    generator.setPayloadAddress(payload_address);
+    generator.setChainOptimization(chain_optimization);
+    std::vector<unsigned int> chain = generator.generateROPChain(arena);
+    std::vector<uint8_t> payload;
+    generator.emitPayload(arena, payload);
+    std::string layout = checkPayload(db, rom, generator, payload, chain);
+    if (!layout.empty()) return layout;
+    if (payload_address != 0 && chain_optimization && c.uses) {
+        std::string unused = c.uses(generator);
+        if (!unused.empty()) return unused;
+    }
+    if (kPayloadAddress + payload.size() > 0x10000) return "payload quá dài";
+    result.payload_size = payload.size();
+
+    // Vùng biến / ô tạm: nội dung tùy ý
+    unsigned int variables_end = std::max(parser.getSymbolTable().next_available_address, optimizer.scratchEnd()) + 64;
+    for (uint32_t seed = 1; seed <= 3; ++seed) {
+        MachineState seeded;
+        seeded.memory_seed = seed * 7919;
+        std::vector<uint8_t> before(0x10000);
+        for (size_t a = 0; a < before.size(); ++a) before[a] = seeded.load(static_cast<uint16_t>(a));
+        std::copy(payload.begin(), payload.end(), before.begin() + kPayloadAddress);
+        std::vector<uint8_t> ram = before;
+
+        MachineState s;
+        s.ram = ram.data();
+        for (uint8_t& r : s.r) r = static_cast<uint8_t>(seed * 31);
+        MachineState initial = s;
+        initial.ram = before.data();
+        std::vector<std::pair<uint16_t, uint16_t>> call_windows;
+        std::string error = runPayload(db, rom, s, call_windows);
+        if (!error.empty()) return error;
+
+        std::vector<std::pair<uint16_t, uint16_t>> expected = c.expect(initial);
+        for (const auto& [address, value] : expected) {
+            if (loadWord(s, address) != value) {
+                return "[" + std::to_string(address) + "] = " + std::to_string(loadWord(s, address)) +
+                       ", mong đợi " + std::to_string(value);
+            }
+        }
+        for (size_t a = 0; a < ram.size(); ++a) {
+            if (ram[a] == before[a] || (a >= 0x2000 && a < variables_end)) continue;
+            auto covers = [a](uint16_t first, uint16_t end) { return a >= first && a < end; };
+            bool wanted = std::any_of(expected.begin(), expected.end(), [&](const auto& e) {
+                return covers(e.first, static_cast<uint16_t>(e.first + 2));
+            }) || std::any_of(call_windows.begin(), call_windows.end(), [&](const auto& w) {
+                return covers(w.first, w.second);
+            });
+            if (!wanted) return "ghi lạc vào [" + std::to_string(a) + "]";
+        }
+        result.rams.push_back(std::move(ram));
+    }
+    return "";
+}
+
+// Tối ưu chuỗi (peephole, ô đệm, tách chương trình con) không được đổi tác động của chương trình:
+// RAM ngoài payload (và 8 byte dưới nó) phải giống hệt khi tắt
+std::string compareRuns(const RunResult& optimized, const RunResult& plain) {
+    size_t payload_end = kPayloadAddress + std::max(optimized.payload_size, plain.payload_size);
+    for (size_t seed = 0; seed < optimized.rams.size(); ++seed) {
+        for (size_t a = 0; a < 0x10000; ++a) {
+            if (a >= kPayloadAddress - 8u && a < payload_end) continue;
+            if (optimized.rams[seed][a] != plain.rams[seed][a]) {
+                return "RAM khác khi tắt tối ưu chuỗi tại [" + std::to_string(a) + "]";
+            }
+        }
+    }
+    return "";
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    try {
+        GadgetDB db;
+        RomHandle rom = db.loadFromFile(argc > 1 ? argv[1] : "data/nx_u8_gadget.txt");
+        int failures = 0;
+        for (const Case& c : cases()) {
+            for (bool optimize : {false, true}) {
+                for (uint16_t payload_address : {uint16_t{0}, kPayloadAddress}) {
+                    if (c.needs_address && payload_address == 0) continue;
+                    RunResult optimized, plain;
+                    std::string error = check(db, rom, c, optimize, payload_address, true, optimized);
+                    if (error.empty()) {
+                        error = check(db, rom, c, optimize, payload_address, false, plain);
+                        if (!error.empty()) error = "(không tối ưu chuỗi) " + error;
+                    }
+                    if (error.empty()) error = compareRuns(optimized, plain);
+                    if (!error.empty()) {
+                        std::cerr << "SAI: " << c.name << (optimize ? " (tối ưu)" : "")
+                                  << (payload_address ? " (có địa chỉ payload)" : "") << ": " << error << "\n";
+                        failures++;
+                    }
+                }
+            }
+        }
+        std::cerr << cases().size() << " ca, " << failures << " lần sai\n";
+        return failures == 0 ? 0 : 1;
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << "\n";
+        return 1;
+    }
+}
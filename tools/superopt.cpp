@@ -0,0 +1,328 @@
+// superopt: tìm dãy gadget ngắn nhất cho các tác động nhỏ và ghi ra bảng cho một ROM
+// (xem SuperoptTable.h). InstructionSelector đọc bảng này và dùng mỗi dòng như một luật.
+//
+// Build (từ thư mục gốc repo):
+//   g++ -std=c++17 -O2 -pthread -Isrc tools/superopt.cpp src/ROPGenerator.cpp src/GadgetImage.cpp
+//       src/GadgetEffect.cpp src/GadgetEmulator.cpp src/SuperoptTable.cpp src/InstructionSelector.cpp
+//       src/RegisterAllocator.cpp src/ChainOptimizer.cpp src/MappedFile.cpp src/Parser.cpp src/Lexer.cpp
+//       src/StringInterner.cpp -o superopt
+// Dùng:  ./superopt data/nx_u8_gadget.txt data/nx_u8_gadget.superopt [độ_dài_tối_đa=3] [số_thread]
+//
+// Duyệt mọi dãy gadget (giả lập được) có độ dài <= k, thử mọi cách gán toán hạng
+// vào các ô pop, và kiểm chứng từng ứng viên trên nhiều trạng thái máy ngẫu nhiên
+// bằng GadgetEmulator. Giữ ứng viên ít byte nhất; hòa thì ít thanh ghi bị phá nhất,
+// rồi ít gadget nhất, rồi theo thứ tự enum (nên kết quả không phụ thuộc số thread).
+#include "GadgetEmulator.h"
+#include "ROPGenerator.h"
+#include "SuperoptTable.h"
+#include <algorithm>
+#include <atomic>
+#include <bitset>
+#include <chrono>
+#include <exception>
+#include <fstream>
+#include <iostream>
+#include <thread>
+
+namespace {
+
+constexpr unsigned int kTrials = 64;
+constexpr unsigned int kMaxLength = 4;
+constexpr unsigned int kMaxWords = 16;
+
+struct Goal {
+    SuperoptGoal kind;
+    uint8_t dst;
+    uint8_t src;
+};
+
+struct Candidate {
+    uint32_t bytes = UINT32_MAX;
+    uint32_t clobber_count = 0;
+    std::vector<GadgetFunction> gadgets;
+    uint32_t param_words = 0;
+    RegMask clobbers = 0;
+
+    bool found() const { return bytes != UINT32_MAX; }
+    bool operator<(const Candidate& other) const {
+        if (bytes != other.bytes) return bytes < other.bytes;
+        if (clobber_count != other.clobber_count) return clobber_count < other.clobber_count;
+        if (gadgets.size() != other.gadgets.size()) return gadgets.size() < other.gadgets.size();
+        if (gadgets != other.gadgets) return gadgets < other.gadgets;
+        return param_words < other.param_words;
+    }
+};
+
+uint64_t splitmix(uint64_t& state) {
+    uint64_t z = (state += 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+RegOperand pair(uint8_t n) { return RegOperand{n, 2}; }
+
+RegMask targetMask(const Goal& goal) {
+    return goal.kind == SuperoptGoal::StoreAbs ? 0 : reg::er(goal.dst);
+}
+
+bool needsParam(const Goal& goal) { return goal.kind != SuperoptGoal::Copy; }
+
+// Dãy gadget đang xét (cùng các đại lượng cộng dồn)
+struct Sequence {
+    std::array<GadgetFunction, kMaxLength> gadgets{};
+    unsigned int length = 0;
+    unsigned int words = 0;
+    uint32_t bytes = 0;
+    RegMask writes = 0;
+    unsigned int stores = 0;
+};
+
+class Searcher {
+public:
+    Searcher(const GadgetDB& db, RomHandle rom, std::vector<GadgetFunction> usable, std::vector<Goal> goals,
+             unsigned int max_length)
+        : db(db), rom(rom), usable(std::move(usable)), goals(std::move(goals)), max_length(max_length),
+          best_bytes(this->goals.size()) {
+        for (std::atomic<uint32_t>& b : best_bytes) b.store(UINT32_MAX);
+    }
+
+    std::vector<Candidate> run(unsigned int threads) {
+        std::vector<std::vector<Candidate>> partial(threads, std::vector<Candidate>(goals.size()));
+        std::vector<std::thread> workers;
+        for (unsigned int t = 0; t < threads; ++t) {
+            workers.emplace_back([this, &partial, t] { work(partial[t]); });
+        }
+        for (std::thread& w : workers) w.join();
+
+        std::vector<Candidate> best(goals.size());
+        for (const std::vector<Candidate>& p : partial) {
+            for (size_t g = 0; g < goals.size(); ++g) {
+                if (p[g].found() && p[g] < best[g]) best[g] = p[g];
+            }
+        }
+        return best;
+    }
+
+    uint64_t testedCount() const { return tested.load(); }
+
+private:
+    const GadgetDB& db;
+    RomHandle rom;
+    std::vector<GadgetFunction> usable;
+    std::vector<Goal> goals;
+    unsigned int max_length;
+    std::vector<std::atomic<uint32_t>> best_bytes; // Cận trên chung để cắt tỉa giữa các thread
+    std::atomic<size_t> next_first{0};
+    std::atomic<uint64_t> tested{0};
+
+    void work(std::vector<Candidate>& best) {
+        Sequence seq;
+        for (size_t first = next_first++; first < usable.size(); first = next_first++) {
+            extend(seq, usable[first], best);
+        }
+    }
+
+    void extend(Sequence& seq, GadgetFunction func, std::vector<Candidate>& best) {
+        const GadgetCandidate* c = db.selectCandidate(rom, func, ByteConstraints{});
+        Sequence next = seq;
+        next.gadgets[next.length++] = func;
+        next.words += gadgetPopWords(func);
+        next.bytes += c->chainBytes();
+        next.writes |= gadgetEffect(func).writes;
+        next.stores += gadgetEffect(func).stores;
+        if (next.words > kMaxWords) return;
+
+        for (size_t g = 0; g < goals.size(); ++g) {
+            evaluate(next, g, best[g]);
+        }
+        if (next.length < max_length) {
+            for (GadgetFunction f : usable) extend(next, f, best);
+        }
+    }
+
+    void evaluate(const Sequence& seq, size_t g, Candidate& best) {
+        const Goal& goal = goals[g];
+        if (seq.bytes > best_bytes[g].load(std::memory_order_relaxed)) return;
+        if (goal.kind == SuperoptGoal::StoreAbs ? seq.stores == 0 : (seq.writes & targetMask(goal)) != targetMask(goal)) {
+            return;
+        }
+
+        // Cách gán toán hạng: dãy ngắn thì thử mọi tập ô pop, dài thì chỉ 1-2 ô
+        std::vector<uint32_t> masks;
+        if (!needsParam(goal)) {
+            masks.push_back(0);
+        } else if (seq.words <= 4) {
+            for (uint32_t m = 1; m < (1u << seq.words); ++m) masks.push_back(m);
+        } else {
+            for (unsigned int a = 0; a < seq.words; ++a) {
+                masks.push_back(1u << a);
+                for (unsigned int b = a + 1; b < seq.words; ++b) masks.push_back((1u << a) | (1u << b));
+            }
+        }
+
+        Candidate candidate;
+        candidate.bytes = seq.bytes;
+        candidate.clobbers = seq.writes & ~targetMask(goal);
+        candidate.clobber_count = static_cast<uint32_t>(std::bitset<32>(candidate.clobbers & 0xFFFF).count());
+        candidate.gadgets.assign(seq.gadgets.begin(), seq.gadgets.begin() + seq.length);
+        for (uint32_t mask : masks) {
+            candidate.param_words = mask;
+            if (best.found() && !(candidate < best)) continue;
+            tested++;
+            if (!verify(seq, goal, mask)) continue;
+            best = candidate;
+            uint32_t current = best_bytes[g].load();
+            while (candidate.bytes < current && !best_bytes[g].compare_exchange_weak(current, candidate.bytes)) {
+            }
+        }
+    }
+
+    static bool verify(const Sequence& seq, const Goal& goal, uint32_t param_words) {
+        uint64_t rng = 0x5EED0000ull + seq.words;
+        for (unsigned int trial = 0; trial < kTrials; ++trial) {
+            MachineState initial;
+            for (uint8_t& r : initial.r) r = static_cast<uint8_t>(splitmix(rng));
+            initial.ea = static_cast<uint16_t>(splitmix(rng));
+            initial.flag = (splitmix(rng) & 1) != 0;
+            initial.memory_seed = static_cast<uint32_t>(splitmix(rng));
+            static constexpr uint16_t kEdges[] = {0, 1, 0xFFFF, 0x8000};
+            uint16_t k = trial < 4 ? kEdges[trial] : static_cast<uint16_t>(splitmix(rng));
+
+            std::array<uint16_t, kMaxWords> words{};
+            for (unsigned int w = 0; w < seq.words; ++w) {
+                words[w] = (param_words >> w) & 1 ? k : static_cast<uint16_t>(splitmix(rng)); // Đệm: giá trị bất kỳ
+            }
+
+            MachineState s = initial;
+            unsigned int word = 0;
+            for (unsigned int i = 0; i < seq.length; ++i) {
+                if (!emulateGadget(seq.gadgets[i], s, words.data() + word)) return false;
+                word += gadgetPopWords(seq.gadgets[i]);
+            }
+            if (!matches(goal, initial, s, k)) return false;
+        }
+        return true;
+    }
+
+    static bool matches(const Goal& goal, const MachineState& initial, const MachineState& s, uint16_t k) {
+        // Bộ nhớ: chỉ store_abs được thay đổi, và chỉ đúng hai byte tại K
+        uint16_t value = static_cast<uint16_t>(initial.get(pair(goal.src)));
+        auto expected = [&](uint16_t address) -> uint8_t {
+            if (goal.kind == SuperoptGoal::StoreAbs) {
+                if (address == k) return static_cast<uint8_t>(value);
+                if (address == static_cast<uint16_t>(k + 1)) return static_cast<uint8_t>(value >> 8);
+            }
+            return initial.load(address);
+        };
+        for (size_t i = 0; i < s.write_count; ++i) {
+            if (s.writes[i].value != expected(s.writes[i].address)) return false;
+        }
+        switch (goal.kind) {
+            case SuperoptGoal::LoadConst:
+                return s.get(pair(goal.dst)) == k;
+            case SuperoptGoal::Copy:
+                return s.get(pair(goal.dst)) == initial.get(pair(goal.src));
+            case SuperoptGoal::AddConst:
+                return s.get(pair(goal.dst)) == static_cast<uint16_t>(initial.get(pair(goal.dst)) + k);
+            case SuperoptGoal::StoreAbs:
+                return s.load(k) == expected(k) && s.load(static_cast<uint16_t>(k + 1)) == expected(static_cast<uint16_t>(k + 1));
+        }
+        return false;
+    }
+};
+
+// Gadget dùng được trong dãy: có trong ROM, giả lập được, không đụng LR/ngắt
+bool usableGadget(const GadgetDB& db, RomHandle rom, GadgetFunction func) {
+    if (!db.isAvailable(rom, func) || !isEmulatable(func)) return false;
+    const GadgetEffectTable& table = GadgetEffectTable::instance();
+    if (table.effect(func).op_count == 0 || (table.effect(func).writes & reg::LR)) return false;
+    for (const EffectOp* op = table.opsBegin(func); op != table.opsEnd(func); ++op) {
+        if (op->kind == EffectOpKind::DisableInt) return false;
+    }
+    return true;
+}
+
+std::vector<Goal> allGoals() {
+    std::vector<Goal> goals;
+    for (uint8_t n = 0; n < 16; n += 2) goals.push_back(Goal{SuperoptGoal::LoadConst, n, 0});
+    for (uint8_t from = 0; from < 16; from += 2) {
+        for (uint8_t to = 0; to < 16; to += 2) {
+            if (from != to) goals.push_back(Goal{SuperoptGoal::Copy, to, from});
+        }
+    }
+    for (uint8_t n : {0, 2, 4, 8}) goals.push_back(Goal{SuperoptGoal::AddConst, n, 0});
+    for (uint8_t n : {0, 2, 4, 8}) goals.push_back(Goal{SuperoptGoal::StoreAbs, 0, n});
+    return goals;
+}
+
+std::string describeGoal(const Goal& goal) {
+    SuperoptEntry e;
+    e.goal = goal.kind;
+    e.dst = goal.dst;
+    e.src = goal.src;
+    std::string line = formatSuperoptEntry(e);
+    return line.substr(0, line.find(" |"));
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    if (argc < 3 || argc > 5) {
+        std::cerr << "Cách dùng: " << argv[0] << " <gadget.txt> <bảng.superopt> [độ_dài_tối_đa=3] [số_thread]" << std::endl;
+        return 2;
+    }
+    try {
+        unsigned int max_length = argc > 3 ? static_cast<unsigned int>(std::stoul(argv[3])) : 3;
+        if (max_length == 0 || max_length > kMaxLength) {
+            throw std::runtime_error("Lỗi: Độ dài tối đa phải trong khoảng 1.." + std::to_string(kMaxLength));
+        }
+        unsigned int threads = argc > 4 ? static_cast<unsigned int>(std::stoul(argv[4])) : std::thread::hardware_concurrency();
+        threads = std::max(1u, threads);
+
+        GadgetDB db;
+        RomHandle rom = db.loadFromFile(argv[1]);
+        std::vector<GadgetFunction> usable;
+        for (size_t f = 1; f < kGadgetFunctionCount; ++f) {
+            if (usableGadget(db, rom, static_cast<GadgetFunction>(f))) usable.push_back(static_cast<GadgetFunction>(f));
+        }
+        std::vector<Goal> goals = allGoals();
+        std::cout << "Tìm trên " << usable.size() << " gadget, " << goals.size() << " mục tiêu, độ dài <= " << max_length
+                  << ", " << threads << " thread..." << std::endl;
+
+        auto start = std::chrono::steady_clock::now();
+        Searcher searcher(db, rom, usable, goals, max_length);
+        std::vector<Candidate> best = searcher.run(threads);
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        std::ofstream out(argv[2]);
+        if (!out.is_open()) {
+            throw std::runtime_error("Không thể ghi file: " + std::string(argv[2]));
+        }
+        out << "# Bảng superopt cho ROM '" << db.model(rom).name << "' (độ dài <= " << max_length << ", "
+            << kTrials << " phép thử ngẫu nhiên mỗi ứng viên). Tạo bởi tools/superopt, đừng sửa tay.\n";
+        size_t found = 0;
+        for (size_t g = 0; g < goals.size(); ++g) {
+            if (!best[g].found()) {
+                out << "# " << describeGoal(goals[g]) << ": không tìm thấy\n";
+                continue;
+            }
+            SuperoptEntry entry;
+            entry.goal = goals[g].kind;
+            entry.dst = goals[g].dst;
+            entry.src = goals[g].src;
+            entry.gadgets = best[g].gadgets;
+            entry.param_words = best[g].param_words;
+            out << formatSuperoptEntry(entry) << "  # " << best[g].bytes << " byte";
+            if (best[g].clobbers) out << ", phá: " << describeRegs(best[g].clobbers);
+            out << "\n";
+            found++;
+        }
+        std::cout << "Tìm được " << found << "/" << goals.size() << " mục tiêu sau " << searcher.testedCount()
+                  << " lần kiểm chứng (" << seconds << " s), ghi vào " << argv[2] << std::endl;
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}